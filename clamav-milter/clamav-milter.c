@@ -421,6 +421,7 @@ int main(int argc, char **argv) {
 	maxfilesize = CLI_DEFAULT_MAXFILESIZE;
     }
     readtimeout = optget(opts, "ReadTimeout")->numarg;
+    muxscan = optget(opts, "ClamdMultiplex")->enabled;
 
     cpool_init(opts);
     if (!cp) {
@@ -27,6 +27,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/types.h>
+#include <sys/time.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <ctype.h>
@@ -82,6 +83,9 @@ struct CLAMFI {
     int local;
     int main;
     int alt;
+    struct NC_STREAM *mux;
+    struct CP_ENTRY *cpe;
+    struct timeval sent;
     unsigned int totsz;
     unsigned int bufsz;
     unsigned int all_whitelisted;
@@ -134,11 +138,24 @@ static const char *makesanehdr(char *hdr) {
     return ret;
 }
 
+/* Reports the outcome of the scan to the connection pool */
+static void release(struct CLAMFI *cf, int how) {
+    if(cf->cpe) {
+	cpool_done(cf->cpe, -1, 0, how);
+	cf->cpe = NULL;
+    }
+}
+
 static void nullify(SMFICTX *ctx, struct CLAMFI *cf, enum CFWHAT closewhat) {
-    if(closewhat & CF_MAIN || ((closewhat & CF_ANY) && cf->main >= 0))
+    release(cf, CP_DONE_ABORT);
+    if((closewhat & (CF_MAIN | CF_ANY)) && cf->main >= 0)
 	close(cf->main);
     if(closewhat & CF_ALT || ((closewhat & CF_ANY) && cf->alt >= 0))
 	close(cf->alt);
+    if(cf->mux) {
+	nc_mux_close(cf->mux);
+	cf->mux = NULL;
+    }
     if(cf->msg_subj) free(cf->msg_subj);
     if(cf->msg_date) free(cf->msg_date);
     if(cf->msg_id) free(cf->msg_id);
@@ -153,13 +170,34 @@ static void nullify(SMFICTX *ctx, struct CLAMFI *cf, enum CFWHAT closewhat) {
 }
 
 
+/* Sends the buffered data as one chunk */
+static int sendbuffer(struct CLAMFI *cf) {
+    if(!cf->bufsz)
+	return 0;
+    if(cf->mux)
+	return nc_mux_send(cf->mux, cf->buffer, cf->bufsz);
+    cf->sendme = htonl(cf->bufsz);
+    return nc_send(cf->main, &cf->sendme, cf->bufsz + 4);
+}
+
+/* Sends data as one chunk, len 0 ends the stream */
+static int senddata(struct CLAMFI *cf, const void *data, uint32_t len) {
+    uint32_t sendmetoo;
+
+    if(cf->mux)
+	return nc_mux_send(cf->mux, data, len);
+    sendmetoo = htonl(len);
+    return nc_send(cf->main, &sendmetoo, 4) || (len && nc_send(cf->main, data, len));
+}
+
+
 static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, SMFICTX *ctx) {
     if(cf->totsz >= maxfilesize || len == 0)
 	return SMFIS_CONTINUE;
 
     if(!cf->totsz) {
 	sfsistat ret;
-	if(nc_connect_rand(&cf->main, &cf->alt, &cf->local)) {
+	if(nc_connect_rand(&cf->main, &cf->alt, &cf->local, &cf->mux, &cf->cpe)) {
 	    logg("!Failed to initiate streaming/fdpassing\n");
 	    nullify(ctx, cf, CF_NONE);
 	    return FailAction;
@@ -193,21 +231,22 @@ static sfsistat sendchunk(struct CLAMFI *cf, unsigned char *bodyp, size_t len, S
 	    memcpy(&cf->buffer[cf->bufsz], bodyp, len);
 	    cf->bufsz += len;
 	} else if(len < CLAMFIBUFSZ) {
-	    memcpy(&cf->buffer[cf->bufsz], bodyp, CLAMFIBUFSZ - cf->bufsz);
-	    cf->sendme = htonl(CLAMFIBUFSZ);
-	    sendfailed = nc_send(cf->main, &cf->sendme, CLAMFIBUFSZ + 4);
-	    len -= (CLAMFIBUFSZ - cf->bufsz);
-	    memcpy(cf->buffer, &bodyp[CLAMFIBUFSZ - cf->bufsz], len);
+	    unsigned int done = CLAMFIBUFSZ - cf->bufsz;
+
+	    memcpy(&cf->buffer[cf->bufsz], bodyp, done);
+	    cf->bufsz = CLAMFIBUFSZ;
+	    sendfailed = sendbuffer(cf);
+	    len -= done;
+	    memcpy(cf->buffer, &bodyp[done], len);
 	    cf->bufsz = len;
 	} else {
-	    uint32_t sendmetoo = htonl(len);
-	    cf->sendme = htonl(cf->bufsz);
-	    if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4) || nc_send(cf->main, bodyp, len))
+	    if(sendbuffer(cf) || senddata(cf, bodyp, len))
 		sendfailed = 1;
 	    cf->bufsz = 0;
 	}
 	if(sendfailed) {
 	    logg("!Streaming failed\n");
+	    release(cf, CP_DONE_FAIL);
 	    nullify(ctx, cf, CF_NONE);
 	    return FailAction;
 	}
@@ -303,6 +342,7 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
     char *reply;
     int len, ret;
     unsigned int crcpt;
+    struct timeval now;
 
     if(!(cf = (struct CLAMFI *)smfi_getpriv(ctx)))
 	return SMFIS_CONTINUE; /* whatever */
@@ -316,27 +356,28 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 	return ret;
     }
 
+    gettimeofday(&cf->sent, NULL);
     if(cf->local) {
 	lseek(cf->alt, 0, SEEK_SET);
 
 	if(nc_sendmsg(cf->main, cf->alt) == -1) {
 	    logg("!FD send failed\n");
+	    release(cf, CP_DONE_FAIL);
 	    nullify(ctx, cf, CF_ALT);
 	    free(cf);
 	    return FailAction;
 	}
     } else {
-	uint32_t sendmetoo = 0;
-	cf->sendme = htonl(cf->bufsz);
-	if((cf->bufsz && nc_send(cf->main, &cf->sendme, cf->bufsz + 4)) || nc_send(cf->main, &sendmetoo, 4))  {
+	if(sendbuffer(cf) || senddata(cf, NULL, 0))  {
 	    logg("!Failed to flush STREAM\n");
+	    release(cf, CP_DONE_FAIL);
 	    nullify(ctx, cf, CF_NONE);
 	    free(cf);
 	    return FailAction;
 	}
     }
 
-    reply = nc_recv(cf->main);
+    reply = cf->mux ? nc_mux_recv(cf->mux) : nc_recv(cf->main);
 
     if(cf->local)
 	close(cf->alt);
@@ -345,12 +386,25 @@ sfsistat clamfi_eom(SMFICTX *ctx) {
 
     if(!reply) {
 	logg("!No reply from clamd\n");
+	release(cf, CP_DONE_FAIL);
 	nullify(ctx, cf, CF_NONE);
 	free(cf);
 	return FailAction;
     }
 
     len = strlen(reply);
+    gettimeofday(&now, NULL);
+    if(cf->cpe) {
+	/* a clean or infected verdict leaves the session usable */
+	int s = -1;
+
+	if(!cf->mux && ((len>5 && !strcmp(reply + len - 5, ": OK\n")) || (len>7 && !strcmp(reply + len - 7, " FOUND\n")))) {
+	    s = cf->main;
+	    cf->main = -1;
+	}
+	cpool_done(cf->cpe, s, (now.tv_sec - cf->sent.tv_sec) * 1000000L + now.tv_usec - cf->sent.tv_usec, CP_DONE_OK);
+	cf->cpe = NULL;
+    }
     if(len>5 && !strcmp(reply + len - 5, ": OK\n")) {
 	if(addxvirus) add_x_header(ctx, "Clean", cf->scanned_count, cf->status_count);
 	if(loginfected & LOGCLN_FULL) {
@@ -710,6 +764,8 @@ sfsistat clamfi_envfrom(SMFICTX *ctx, char **argv) {
     cf->totsz = 0;
     cf->bufsz = 0;
     cf->main = cf->alt = -1;
+    cf->mux = NULL;
+    cf->cpe = NULL;
     cf->all_whitelisted = 1;
     cf->gotbody = 0;
     cf->msg_subj = cf->msg_date = cf->msg_id = NULL;
@@ -30,6 +30,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/select.h>
 #include <sys/un.h>
 #include <netdb.h>
 #include <unistd.h>
@@ -57,6 +58,27 @@ static pthread_cond_t mon_cond = PTHREAD_COND_INITIALIZER;
 static int quitting = 1;
 static pthread_t probe_th;
 
+/* protects the balancing counters and the idle connections */
+static pthread_mutex_t cp_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int idlemax = 0;
+
+struct CP_IDLE {
+    struct CP_IDLE *next;
+    int s;
+    time_t since;
+};
+
+/* idle connections older than this are not reused: clamd closes an
+ * IDSESSION that sends no command for ReadTimeout seconds (120 by default),
+ * this stays well below that and below the values it is commonly lowered to */
+#define CP_IDLE_MAX 15
+/* reply times below this don't make a server look any better (usecs) */
+#define CP_LATENCY_FLOOR 1000
+/* reply time charged for a failure, and failures in a row that make a
+ * server dead until it's probed again */
+#define CP_FAIL_PENALTY 100000
+#define CP_MAX_FAILS 3
+
 static int cpool_addunix(char *path) {
     struct sockaddr_un *srv;
     struct CP_ENTRY *cpe = &cp->pool[cp->entries-1];
@@ -158,9 +180,18 @@ static void cpool_probe(void) {
 
     for(i=1; i<=cp->entries; i++) {
 	if((cpe->dead && (cpe->last_poll < now - 120 || !cp->alive)) || cpe->last_poll < now - 15*60*60) {
+	    unsigned int wasdead = cpe->dead;
+
 	    cpe->last_poll = time(NULL);
 	    nc_ping_entry(cpe);
 	    logg("*Probe for slot %u returned: %s\n", i, cpe->dead ? "failed" : "success");
+	    if(wasdead && !cpe->dead) {
+		/* start over, the old reply times are meaningless */
+		pthread_mutex_lock(&cp_lock);
+		cpe->ewma = 0;
+		cpe->fails = 0;
+		pthread_mutex_unlock(&cp_lock);
+	    }
 	}
 	dead += cpe->dead;
 	cpe++;
@@ -202,6 +233,7 @@ void cpool_init(struct optstruct *opts) {
     }
 
     cp->local_cpe = NULL;
+    idlemax = optget(opts, "ClamdIdleConnections")->numarg;
 
     if((opt = optget(opts, "ClamdSocket"))->enabled) {
 	while(opt) {
@@ -253,8 +285,17 @@ void cpool_free(void) {
 
     if(cp) {
 	if(cp->pool) {
-	    for(i=0; i<cp->entries; i++)
+	    for(i=0; i<cp->entries; i++) {
+		struct CP_IDLE *idle;
+
+		nc_mux_free(&cp->pool[i]);
+		while((idle = cp->pool[i].idle)) {
+		    cp->pool[i].idle = idle->next;
+		    close(idle->s);
+		    free(idle);
+		}
 		FREESRV(cp->pool[i]);
+	    }
 	    free(cp->pool);
 	}
 	free(cp);
@@ -263,29 +304,129 @@ void cpool_free(void) {
 }
 
 
-struct CP_ENTRY *cpool_get_rand(int *s) {
+/* Picks the live server with the least messages in flight, weighted by
+ * its recent reply times. Called with cp_lock held. */
+static struct CP_ENTRY *cpool_pick(void) {
     unsigned int start, i;
+    struct CP_ENTRY *cpe, *best = NULL;
+    double score, bestscore = 0;
+
+    /* random start, so that ties are broken at random */
+    start = rand() % cp->entries;
+    for(i=0; i<cp->entries; i++) {
+	cpe = &cp->pool[(i+start) % cp->entries];
+	if(cpe->dead) continue;
+	if(cpe->local && cp->local_cpe && !cp->local_cpe->dead)
+	    cpe = cp->local_cpe;
+	score = (double)(cpe->inflight + 1) * (cpe->ewma + CP_LATENCY_FLOOR);
+	if(!best || score < bestscore) {
+	    best = cpe;
+	    bestscore = score;
+	}
+    }
+    return best;
+}
+
+
+/* Takes an idle connection which clamd didn't close meanwhile.
+ * Called with cp_lock held. */
+static int cpool_idle_pop(struct CP_ENTRY *cpe) {
+    time_t now = time(NULL);
+    struct CP_IDLE *idle;
+
+    while((idle = cpe->idle)) {
+	int s = idle->s, fresh = idle->since > now - CP_IDLE_MAX;
+
+	cpe->idle = idle->next;
+	cpe->nidle--;
+	free(idle);
+	if(fresh) {
+	    struct timeval tv = { 0, 0 };
+	    fd_set fds;
+
+	    /* nothing is due on an idle session: readable means closed */
+	    FD_ZERO(&fds);
+	    FD_SET(s, &fds);
+	    if(!select(s+1, &fds, NULL, NULL, &tv))
+		return s;
+	}
+	close(s);
+    }
+    return -1;
+}
+
+
+/* Returns the server to use and counts the message as in flight; the
+ * caller reports back with cpool_done(). If s is not NULL, it gets a
+ * connection to the server: a pooled one if available. */
+struct CP_ENTRY *cpool_get(int *s) {
     struct CP_ENTRY *cpe;
+    int idle;
 
-    if(cp->alive) {
-	start = rand() % cp->entries;
-	for(i=0; i<cp->entries; i++) {
-	    cpe = &cp->pool[(i+start) % cp->entries];
-	    if(cpe->dead) continue;
-	    if(cpe->local && cp->local_cpe && !cp->local_cpe->dead)
-		cpe = cp->local_cpe;
-	    if((*s = nc_connect_entry(cpe)) == -1) {
-		cpe->dead = 1;
-		continue;
-	    }
+    while(cp->alive) {
+	pthread_mutex_lock(&cp_lock);
+	if(!(cpe = cpool_pick())) {
+	    pthread_mutex_unlock(&cp_lock);
+	    break;
+	}
+	cpe->inflight++;
+	idle = s ? cpool_idle_pop(cpe) : -1;
+	pthread_mutex_unlock(&cp_lock);
+
+	if(!s) return cpe;
+	if(idle >= 0) {
+	    *s = idle;
 	    return cpe;
 	}
+	if((*s = nc_connect_entry(cpe)) != -1 && (!idlemax || !nc_send(*s, "nIDSESSION\n", 11)))
+	    return cpe;
+	pthread_mutex_lock(&cp_lock);
+	cpe->inflight--;
+	cpe->dead = 1;
+	pthread_mutex_unlock(&cp_lock);
     }
     pthread_cond_signal(&mon_cond);
     return NULL;
 }
 
 
+/* Ends a message started with cpool_get(): usecs is the time clamd took to
+ * reply. The connection s, if any, is kept for reuse when the reply was
+ * good and closed otherwise. */
+void cpool_done(struct CP_ENTRY *cpe, int s, long usecs, int how) {
+    struct CP_IDLE *idle;
+
+    pthread_mutex_lock(&cp_lock);
+    cpe->inflight--;
+    switch(how) {
+    case CP_DONE_OK:
+	cpe->ewma += (usecs - cpe->ewma) / 8;
+	cpe->fails = 0;
+	break;
+    case CP_DONE_FAIL:
+	if(cpe->ewma < 60000000)
+	    cpe->ewma = cpe->ewma * 2 + CP_FAIL_PENALTY;
+	if(++cpe->fails >= CP_MAX_FAILS && !cpe->dead) {
+	    logg("^clamd server failed %u times in a row, disabling it until the next probe\n", cpe->fails);
+	    cpe->dead = 1;
+	    pthread_cond_signal(&mon_cond);
+	}
+	break;
+    }
+    if(s >= 0 && how == CP_DONE_OK && cpe->nidle < idlemax && !cpe->dead && (idle = (struct CP_IDLE *)malloc(sizeof(*idle)))) {
+	idle->s = s;
+	idle->since = time(NULL);
+	idle->next = cpe->idle;
+	cpe->idle = idle;
+	cpe->nidle++;
+	s = -1;
+    }
+    pthread_mutex_unlock(&cp_lock);
+    if(s >= 0)
+	close(s);
+}
+
+
 /*
  * Local Variables:
  * mode: c
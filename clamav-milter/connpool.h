@@ -34,6 +34,9 @@
 
 #include "shared/optparser.h"
 
+struct NC_MUX;
+struct CP_IDLE;
+
 struct CP_ENTRY {
     struct sockaddr *server;
     void *gai;
@@ -42,6 +45,14 @@ struct CP_ENTRY {
     uint8_t type;
     uint8_t dead;
     uint8_t local;
+    struct NC_MUX *mux;
+    struct CP_IDLE *idle;
+    unsigned int nidle;
+    /* balancing: messages being scanned, recent reply time in usecs and
+     * failures in a row */
+    unsigned int inflight;
+    long ewma;
+    unsigned int fails;
 };
 
 struct CPOOL {
@@ -51,9 +62,16 @@ struct CPOOL {
     struct CP_ENTRY *pool;
 };
 
+enum {
+    CP_DONE_OK,
+    CP_DONE_FAIL,
+    CP_DONE_ABORT
+};
+
 void cpool_init(struct optstruct *copt);
 void cpool_free(void);
-struct CP_ENTRY *cpool_get_rand(int *s);
+struct CP_ENTRY *cpool_get(int *s);
+void cpool_done(struct CP_ENTRY *cpe, int s, long usecs, int how);
 
 extern struct CPOOL *cp;
 
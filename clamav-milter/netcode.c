@@ -42,11 +42,13 @@
 #include <errno.h>
 #include <netdb.h>
 #include <sys/uio.h>
+#include <pthread.h>
 
 #include "libclamav/clamav.h"
 #include "shared/output.h"
 #include "shared/optparser.h"
 #include "libclamav/others.h"
+#include "shared/clamdcom.h"
 #include "netcode.h"
 
 #define strerror_print(msg) logg(msg": %s\n", cli_strerror(errno, er, sizeof(er)))
@@ -67,6 +69,7 @@ struct LOCALNET {
 
 struct LOCALNET *lnet = NULL;
 char *tempdir = NULL;
+int muxscan = 0;
 
 /* for connect and send */
 #define TIMEOUT 30
@@ -143,7 +146,8 @@ static int nc_connect(int s, struct CP_ENTRY *cpe) {
 }
 
 
-int nc_send(int s, const void *buff, size_t len) {
+/* Like nc_send() but leaves the socket open on failure */
+static int nc_sendall(int s, const void *buff, size_t len) {
     char *buf = (char *)buff;
 
     while(len) {
@@ -154,7 +158,6 @@ int nc_send(int s, const void *buff, size_t len) {
 
 	if(!res) {
 	    logg("!Connection closed while sending data\n");
-	    close(s);
 	    return 1;
 	}
 	if(res!=-1) {
@@ -164,7 +167,6 @@ int nc_send(int s, const void *buff, size_t len) {
 	}
 	if(errno != EAGAIN && errno != EWOULDBLOCK) {
 	    strerror_print("!send failed");
-	    close(s);
 	    return 1;
 	}
 
@@ -185,7 +187,6 @@ int nc_send(int s, const void *buff, size_t len) {
 		    continue;
 		}
 		logg("!Failed to stream to clamd\n");
-		close(s);
 		return 1;
 	    }
 	    break;
@@ -195,6 +196,15 @@ int nc_send(int s, const void *buff, size_t len) {
 }
 
 
+int nc_send(int s, const void *buff, size_t len) {
+    if(nc_sendall(s, buff, len)) {
+	close(s);
+	return 1;
+    }
+    return 0;
+}
+
+
 int nc_sendmsg(int s, int fd) {
     struct iovec iov[1];
     struct msghdr msg;
@@ -310,33 +320,434 @@ void nc_ping_entry(struct CP_ENTRY *cpe) {
 }
 
 
-int nc_connect_rand(int *main, int *alt, int *local) {
-    struct CP_ENTRY *cpe = cpool_get_rand(main);
+/* MUXSESSION support: the messages for a tcp clamd share one connection.
+ * Whoever waits for a reply reads the socket on behalf of everybody and
+ * hands out the replies as they come. */
+struct NC_MUX {
+    int s;
+    int broken;
+    int reading;
+    unsigned int users;
+    unsigned int nstreams;
+    uint32_t lastid;
+    pthread_mutex_t sendlock;
+    struct NC_STREAM *streams;
+};
+
+struct NC_STREAM {
+    struct NC_MUX *mux;
+    struct NC_STREAM *next;
+    struct CP_ENTRY *cpe;
+    uint32_t id;
+    int state;
+    int sent; /* frames clamd accepted so far */
+    int retry; /* the session was reused, reconnect if the first frame fails */
+    int ended; /* the end frame went out */
+    struct mux_reply reply;
+    char text[256];
+};
+
+enum {
+    NC_STREAM_SENDING,
+    NC_STREAM_WAITING,
+    NC_STREAM_DONE
+};
+
+static pthread_mutex_t mux_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t mux_cond = PTHREAD_COND_INITIALIZER;
+
+static void nc_mux_unref(struct NC_MUX *m) {
+    if(--m->users || !m->broken)
+	return;
+    close(m->s);
+    pthread_mutex_destroy(&m->sendlock);
+    free(m);
+}
+
+/* Must be called with mux_lock held */
+static void nc_mux_break(struct NC_MUX *m) {
+    if(m->broken)
+	return;
+    m->broken = 1;
+    shutdown(m->s, SHUT_RDWR);
+    pthread_cond_broadcast(&mux_cond);
+}
+
+static struct NC_MUX *nc_mux_connect(struct CP_ENTRY *cpe) {
+    struct NC_MUX *m = (struct NC_MUX *)calloc(1, sizeof(*m));
+
+    if(!m) {
+	logg("!Out of memory while creating the clamd MUXSESSION\n");
+	return NULL;
+    }
+    if((m->s = nc_connect_entry(cpe)) == -1) {
+	cpe->dead = 1;
+	free(m);
+	return NULL;
+    }
+    if(nc_send(m->s, "zMUXSESSION", 12)) {
+	logg("!Failed to start a MUXSESSION with clamd\n");
+	free(m);
+	return NULL;
+    }
+    pthread_mutex_init(&m->sendlock, NULL);
+    return m;
+}
+
+/* Tells if clamd closed an idle session, e.g. on its ReadTimeout: it sends
+ * nothing unless asked, so anything to read means an error and EOF */
+static int nc_mux_closed(struct NC_MUX *m) {
+    struct timeval tv;
+    fd_set fds;
+
+    tv.tv_sec = tv.tv_usec = 0;
+    FD_ZERO(&fds);
+    FD_SET(m->s, &fds);
+    return select(m->s+1, &fds, NULL, NULL, &tv) != 0;
+}
+
+/* Returns the session of the pool entry, connecting if there is none or
+ * it broke. Must be called with mux_lock held */
+static struct NC_MUX *nc_mux_get(struct CP_ENTRY *cpe, int *reused) {
+    struct NC_MUX *m;
+
+    if((m = cpe->mux) && !m->broken && !m->streams && nc_mux_closed(m)) {
+	logg("*clamd closed the idle MUXSESSION\n");
+	nc_mux_break(m);
+    }
+    if(m && m->broken) {
+	/* drop the reference of the pool entry */
+	cpe->mux = NULL;
+	nc_mux_unref(m);
+	m = NULL;
+    }
+    *reused = (m != NULL);
+    if(!m) {
+	if(!(m = nc_mux_connect(cpe)))
+	    return NULL;
+	/* the pool entry holds a reference too */
+	m->users = 1;
+	cpe->mux = m;
+    }
+    return m;
+}
+
+/* Must be called with mux_lock held */
+static void nc_mux_attach(struct NC_MUX *m, struct NC_STREAM *st) {
+    if(++m->lastid == MUX_ABORT || !m->lastid)
+	m->lastid = 1;
+    st->id = m->lastid;
+    st->mux = m;
+    st->next = m->streams;
+    m->streams = st;
+    m->nstreams++;
+    m->users++;
+}
+
+/* Must be called with mux_lock held, may free m */
+static void nc_mux_detach(struct NC_MUX *m, struct NC_STREAM *st) {
+    struct NC_STREAM **pst;
+
+    for(pst = &m->streams; *pst && *pst != st; pst = &(*pst)->next);
+    if(*pst) {
+	*pst = st->next;
+	m->nstreams--;
+    }
+    nc_mux_unref(m);
+}
+
+struct NC_STREAM *nc_mux_open(struct CP_ENTRY *cpe) {
+    struct NC_STREAM *st = (struct NC_STREAM *)calloc(1, sizeof(*st));
+    struct NC_MUX *m;
+    int reused;
+
+    if(!st) {
+	logg("!Out of memory while opening a clamd stream\n");
+	return NULL;
+    }
+    pthread_mutex_lock(&mux_lock);
+    if(!(m = nc_mux_get(cpe, &reused))) {
+	pthread_mutex_unlock(&mux_lock);
+	free(st);
+	return NULL;
+    }
+    if(m->nstreams >= MUX_MAX_STREAMS) {
+	/* clamd would reject the stream, the caller falls back to INSTREAM */
+	pthread_mutex_unlock(&mux_lock);
+	free(st);
+	return NULL;
+    }
+    nc_mux_attach(m, st);
+    st->cpe = cpe;
+    st->retry = reused;
+    st->state = NC_STREAM_SENDING;
+    pthread_mutex_unlock(&mux_lock);
+    return st;
+}
+
+/* Sends one frame of the stream, len 0 ends it */
+int nc_mux_send(struct NC_STREAM *st, const void *buf, uint32_t len) {
+    struct NC_MUX *m = st->mux;
+    unsigned char hdr[MUX_FRAME_HDRLEN];
+    int ret = 1, done;
+
+    if(!m)
+	return ret;
+    pthread_mutex_lock(&mux_lock);
+    done = st->state == NC_STREAM_DONE;
+    pthread_mutex_unlock(&mux_lock);
+    /* clamd already replied (rejected or over StreamMaxLength) and would
+     * just discard the data; it still needs the end frame to let it go */
+    if(done && len)
+	return 0;
+    mux_putframe(hdr, st->id, len);
+    pthread_mutex_lock(&m->sendlock);
+    if(!m->broken)
+	ret = nc_sendall(m->s, hdr, sizeof(hdr)) || (len && nc_sendall(m->s, buf, len));
+    pthread_mutex_unlock(&m->sendlock);
+    pthread_mutex_lock(&mux_lock);
+    if(ret) {
+	nc_mux_break(m);
+	if(!st->sent && st->retry) {
+	    /* nothing of the stream was lost with the reused session, which
+	     * clamd may have just closed: move it to a new one, just once */
+	    int reused;
+
+	    st->retry = 0;
+	    nc_mux_detach(m, st);
+	    if((m = nc_mux_get(st->cpe, &reused))) {
+		nc_mux_attach(m, st);
+		pthread_mutex_unlock(&mux_lock);
+		logg("^Reconnected the clamd MUXSESSION, sending the stream again\n");
+		return nc_mux_send(st, buf, len);
+	    }
+	    /* nc_mux_close() has nothing left to release */
+	    st->mux = NULL;
+	}
+    } else {
+	st->sent++;
+	if(!len) {
+	    st->ended = 1;
+	    if(st->state == NC_STREAM_SENDING)
+		st->state = NC_STREAM_WAITING;
+	}
+    }
+    pthread_mutex_unlock(&mux_lock);
+    return ret;
+}
+
+static int nc_mux_recvall(int s, void *buff, size_t len, time_t timeout) {
+    char *buf = (char *)buff;
+
+    while(len) {
+	struct timeval tv;
+	fd_set fds;
+	time_t now = time(NULL);
+	int res;
+
+	if(readtimeout && now >= timeout) {
+	    logg("!Timed out while reading clamd reply\n");
+	    return -1;
+	}
+	tv.tv_sec = timeout - now;
+	tv.tv_usec = 0;
+	FD_ZERO(&fds);
+	FD_SET(s, &fds);
+	res = select(s+1, &fds, NULL, NULL, readtimeout ? &tv : NULL);
+	if(res<1) {
+	    if(res == -1 && errno != EINTR)
+		return 1;
+	    continue;
+	}
+	res = recv(s, buf, len, 0);
+	if(!res) {
+	    logg("!Connection closed while reading from socket\n");
+	    return 1;
+	}
+	if(res==-1) {
+	    char er[256];
+	    if(errno == EAGAIN || errno == EINTR)
+		continue;
+	    strerror_print("!recv failed after successful select");
+	    return 1;
+	}
+	len -= res;
+	buf += res;
+    }
+    return 0;
+}
+
+/* Reads one reply and files it with its stream.
+ * Returns 0 on success, -1 on timeout, 1 if the session is broken */
+static int nc_mux_readreply(struct NC_MUX *m, time_t timeout) {
+    unsigned char hdr[MUX_REPLY_HDRLEN];
+    char text[256], skip[256];
+    struct mux_reply r;
+    struct NC_STREAM *st;
+    unsigned int keep, left;
+    int ret;
+
+    if((ret = nc_mux_recvall(m->s, hdr, 1, timeout)))
+	return ret;
+    /* a reply is never left half read: once it started, wait for the rest */
+    if(nc_mux_recvall(m->s, hdr + 1, sizeof(hdr) - 1, time(NULL) + TIMEOUT))
+	return 1;
+    mux_getreply(&r, hdr);
+    keep = r.textlen < sizeof(text) ? r.textlen : sizeof(text) - 1;
+    if(keep && nc_mux_recvall(m->s, text, keep, time(NULL) + TIMEOUT))
+	return 1;
+    for(left = r.textlen - keep; left; left -= keep) {
+	keep = left < sizeof(skip) ? left : sizeof(skip);
+	if(nc_mux_recvall(m->s, skip, keep, time(NULL) + TIMEOUT))
+	    return 1;
+    }
+    r.textlen = r.textlen < sizeof(text) ? r.textlen : sizeof(text) - 1;
+    if(!r.id) {
+	logg("!clamd MUXSESSION error: %.*s\n", (int)r.textlen, text);
+	return 1;
+    }
+    pthread_mutex_lock(&mux_lock);
+    for(st = m->streams; st && st->id != r.id; st = st->next);
+    /* clamd replies early to streams it rejects or cuts off */
+    if(st && st->state != NC_STREAM_DONE) {
+	st->reply = r;
+	memcpy(st->text, text, st->reply.textlen);
+	st->text[st->reply.textlen] = '\0';
+	st->state = NC_STREAM_DONE;
+	pthread_cond_broadcast(&mux_cond);
+    }
+    pthread_mutex_unlock(&mux_lock);
+    return 0;
+}
+
+/* Waits for the reply to the stream and returns it in the INSTREAM format */
+char *nc_mux_recv(struct NC_STREAM *st) {
+    struct NC_MUX *m = st->mux;
+    time_t timeout = time(NULL) + readtimeout;
+    char *ret;
+    int res;
+
+    pthread_mutex_lock(&mux_lock);
+    while(st->state != NC_STREAM_DONE && !m->broken) {
+	if(readtimeout && time(NULL) >= timeout) {
+	    logg("!Timed out while reading clamd reply\n");
+	    pthread_mutex_unlock(&mux_lock);
+	    return NULL;
+	}
+	if(m->reading) {
+	    struct timespec t;
+
+	    t.tv_sec = readtimeout ? timeout : time(NULL) + TIMEOUT;
+	    t.tv_nsec = 0;
+	    pthread_cond_timedwait(&mux_cond, &mux_lock, &t);
+	    continue;
+	}
+	m->reading = 1;
+	pthread_mutex_unlock(&mux_lock);
+	res = nc_mux_readreply(m, timeout);
+	pthread_mutex_lock(&mux_lock);
+	m->reading = 0;
+	if(res > 0)
+	    nc_mux_break(m);
+	/* let somebody else take over the socket */
+	pthread_cond_broadcast(&mux_cond);
+    }
+    pthread_mutex_unlock(&mux_lock);
+    if(st->state != NC_STREAM_DONE)
+	return NULL;
+
+    if(!(ret = (char *)malloc(st->reply.textlen + 16))) {
+	logg("!malloc(%u) failed\n", st->reply.textlen + 16);
+	return NULL;
+    }
+    if(st->reply.status == MUX_STATUS_OK)
+	strcpy(ret, "stream: OK\n");
+    else
+	sprintf(ret, "stream: %s %s\n", st->text, st->reply.status == MUX_STATUS_FOUND ? "FOUND" : "ERROR");
+    return ret;
+}
+
+/* Releases the stream, dropping it on the clamd side if unfinished */
+void nc_mux_close(struct NC_STREAM *st) {
+    struct NC_MUX *m = st->mux;
+
+    if(!m) {
+	free(st);
+	return;
+    }
+    if(!st->ended) {
+	unsigned char hdr[MUX_FRAME_HDRLEN];
+
+	mux_putframe(hdr, st->id, MUX_ABORT);
+	pthread_mutex_lock(&m->sendlock);
+	if(!m->broken && nc_sendall(m->s, hdr, sizeof(hdr))) {
+	    pthread_mutex_lock(&mux_lock);
+	    nc_mux_break(m);
+	    pthread_mutex_unlock(&mux_lock);
+	}
+	pthread_mutex_unlock(&m->sendlock);
+    }
+    pthread_mutex_lock(&mux_lock);
+    nc_mux_detach(m, st);
+    pthread_mutex_unlock(&mux_lock);
+    free(st);
+}
+
+/* Drops the MUXSESSION of a pool entry, called at exit */
+void nc_mux_free(struct CP_ENTRY *cpe) {
+    struct NC_MUX *m;
+
+    pthread_mutex_lock(&mux_lock);
+    if((m = cpe->mux)) {
+	cpe->mux = NULL;
+	nc_mux_break(m);
+	nc_mux_unref(m);
+    }
+    pthread_mutex_unlock(&mux_lock);
+}
+
+
+int nc_connect_rand(int *main, int *alt, int *local, struct NC_STREAM **mux, struct CP_ENTRY **pcpe) {
+    struct CP_ENTRY *cpe;
+
+    *mux = NULL;
+    if(muxscan && (cpe = cpool_get(NULL))) {
+	if(cpe->server->sa_family != AF_UNIX && (*mux = nc_mux_open(cpe))) {
+	    *pcpe = cpe;
+	    *main = -1;
+	    *local = 0;
+	    return 0;
+	}
+	cpool_done(cpe, -1, 0, CP_DONE_ABORT);
+    }
 
+    cpe = cpool_get(main);
     if(!cpe) return 1;
     *local = (cpe->server->sa_family == AF_UNIX);
     if(*local) {
 	char *unlinkme;
 	if(cli_gentempfd(tempdir, &unlinkme, alt) != CL_SUCCESS) {
 	    logg("!Failed to create temporary file\n");
-	    close(*main);
+	    cpool_done(cpe, *main, 0, CP_DONE_ABORT);
 	    return 1;
 	}
 	unlink(unlinkme);
 	free(unlinkme);
+	/* nc_send() closes the socket on failure */
 	if(nc_send(*main, "nFILDES\n", 8)) {
 	    logg("!FD scan request failed\n");
 	    close(*alt);
-	    close(*main);
+	    cpool_done(cpe, -1, 0, CP_DONE_FAIL);
 	    return 1;
 	}
     } else {
 	if(nc_send(*main, "nINSTREAM\n", 10)) {
 	    logg("!Failed to communicate with clamd\n");
-	    close(*main);
+	    cpool_done(cpe, -1, 0, CP_DONE_FAIL);
 	    return 1;
 	}
     }
+    *pcpe = cpe;
     return 0;
 }
 
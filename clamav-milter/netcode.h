@@ -28,8 +28,15 @@
 #include "shared/optparser.h"
 #include "connpool.h"
 
+struct NC_STREAM;
+
 void nc_ping_entry(struct CP_ENTRY *cpe);
-int nc_connect_rand(int *main, int *alt, int *local);
+int nc_connect_rand(int *main, int *alt, int *local, struct NC_STREAM **mux, struct CP_ENTRY **pcpe);
+struct NC_STREAM *nc_mux_open(struct CP_ENTRY *cpe);
+int nc_mux_send(struct NC_STREAM *st, const void *buf, uint32_t len);
+char *nc_mux_recv(struct NC_STREAM *st);
+void nc_mux_close(struct NC_STREAM *st);
+void nc_mux_free(struct CP_ENTRY *cpe);
 int nc_send(int s, const void *buf, size_t len);
 char *nc_recv(int s);
 int nc_sendmsg(int s, int fd);
@@ -41,5 +48,6 @@ int islocalnet_sock(struct sockaddr *sa);
 
 extern long readtimeout;
 extern char *tempdir;
+extern int muxscan;
 
 #endif
@@ -64,6 +64,7 @@
 #include "shared/output.h"
 #include "shared/optparser.h"
 #include "shared/misc.h"
+#include "shared/scanindex.h"
 
 #include "server.h"
 #include "tcpserver.h"
@@ -343,6 +344,14 @@ int main(int argc, char **argv)
             procdev = sb.st_dev;
 #endif
 
+        if((opt = optget(opts, "ScanIndex"))->enabled) {
+            if(!(scanindex = scanindex_open(opt->strarg, optget(opts, "ScanIndexEntries")->numarg))) {
+                ret = 1;
+                break;
+            }
+            logg("#CONTSCAN and MULTISCAN skip unchanged clean files (index: %s)\n", opt->strarg);
+        }
+
         /* check socket type */
 
         if(optget(opts, "TCPSocket")->enabled)
@@ -407,6 +416,22 @@ int main(int argc, char **argv)
         if (optget(opts, "disable-cache")->enabled)
             cl_engine_set_num(engine, CL_ENGINE_DISABLE_CACHE, 1);
 
+        if((opt = optget(opts, "MemoryHugePages"))->enabled && strcmp(opt->strarg, "no")) {
+            enum cl_mpool_hugepages hp;
+
+            if(!strcmp(opt->strarg, "explicit"))
+                hp = CL_MPOOL_HUGEPAGES_EXPLICIT;
+            else
+                hp = CL_MPOOL_HUGEPAGES_TRANSPARENT;
+            if((ret = cl_engine_set_num(engine, CL_ENGINE_MPOOL_HUGEPAGES, hp))) {
+                logg("!cl_engine_set_num(CL_ENGINE_MPOOL_HUGEPAGES) failed: %s\n", cl_strerror(ret));
+                cl_engine_free(engine);
+                ret = 1;
+                break;
+            }
+            logg("#Signature memory: using %s huge pages.\n", opt->strarg);
+        }
+
         /* load the database(s) */
         dbdir = optget(opts, "DatabaseDirectory")->strarg;
         logg("#Reading databases from %s\n", dbdir);
@@ -544,6 +569,9 @@ int main(int argc, char **argv)
 
         cl_engine_set_clcb_virus_found(engine, clamd_virus_found_cb);
 
+        cl_engine_set_clcb_pre_cache(engine, filetype_callback);
+        cl_engine_set_clcb_trace(engine, trace_callback);
+
         if(optget(opts, "LeaveTemporaryFiles")->enabled)
             cl_engine_set_num(engine, CL_ENGINE_KEEPTMP, 1);
 
@@ -866,6 +894,7 @@ int main(int argc, char **argv)
     }
 
     free(lsockets);
+    scanindex_close(scanindex);
 
     logg_close();
     optfree(opts);
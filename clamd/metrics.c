@@ -0,0 +1,348 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "libclamav/clamav.h"
+#include "libclamav/others.h"
+
+#include "shared/output.h"
+
+#include "metrics.h"
+#include "others.h"
+
+/* upper bounds of the histogram buckets in microseconds, +Inf is implied */
+static const unsigned long long bucket_bounds[] = {
+    1000, 5000, 10000, 25000, 50000, 100000, 250000, 500000,
+    1000000, 2500000, 5000000, 10000000, 30000000, 60000000
+};
+#define NBUCKETS (sizeof(bucket_bounds)/sizeof(bucket_bounds[0]) + 1)
+
+/* slot 0 collects everything that is not a scan command */
+static const struct {
+    enum commands cmd;
+    const char *name;
+} command_names[] = {
+    { COMMAND_UNKNOWN,	    "OTHER" },
+    { COMMAND_SCAN,	    "SCAN" },
+    { COMMAND_CONTSCAN,	    "CONTSCAN" },
+    { COMMAND_MULTISCAN,    "MULTISCAN" },
+    { COMMAND_MULTISCANFILE, "MULTISCANFILE" },
+    { COMMAND_ALLMATCHSCAN, "ALLMATCHSCAN" },
+    { COMMAND_TRACESCAN,    "TRACESCAN" },
+    { COMMAND_INSTREAMSCAN, "INSTREAM" },
+    { COMMAND_FILDES,	    "FILDES" },
+    { COMMAND_STREAM,	    "STREAM" }
+};
+#define NCOMMANDS (sizeof(command_names)/sizeof(command_names[0]))
+
+/* distinct top level file types tracked per thread; the last slot takes
+ * whatever does not fit */
+#define NTYPES 128
+
+struct histogram {
+    unsigned long long buckets[NBUCKETS];
+    unsigned long long count;
+    unsigned long long usecs;
+};
+
+struct type_stats {
+    const char *name;		/* static string from libclamav, set last */
+    struct histogram hist;
+    unsigned long long bytes;
+};
+
+struct thread_metrics {
+    struct histogram commands[NCOMMANDS];
+    struct type_stats types[NTYPES];
+    struct histogram reload;
+    unsigned long long tempfile_bytes;
+    int owned;
+    pthread_mutex_t mutex; /* the counters, taken after metrics_mutex */
+    struct thread_metrics *next;
+};
+
+static pthread_mutex_t metrics_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct thread_metrics *metrics_list = NULL;
+static pthread_key_t metrics_key;
+static pthread_once_t metrics_once = PTHREAD_ONCE_INIT;
+static int metrics_key_ok = 0;
+
+static void metrics_release(void *arg)
+{
+    struct thread_metrics *m = arg;
+
+    /* keep the counters, a new thread takes the set over */
+    pthread_mutex_lock(&metrics_mutex);
+    m->owned = 0;
+    pthread_mutex_unlock(&metrics_mutex);
+}
+
+static void metrics_key_init(void)
+{
+    if (!pthread_key_create(&metrics_key, metrics_release))
+	metrics_key_ok = 1;
+}
+
+static struct thread_metrics *metrics_get(void)
+{
+    struct thread_metrics *m;
+
+    pthread_once(&metrics_once, metrics_key_init);
+    if (!metrics_key_ok)
+	return NULL;
+    if ((m = pthread_getspecific(metrics_key)))
+	return m;
+
+    pthread_mutex_lock(&metrics_mutex);
+    for (m = metrics_list; m; m = m->next)
+	if (!m->owned)
+	    break;
+    if (!m && (m = calloc(1, sizeof(*m)))) {
+	if (pthread_mutex_init(&m->mutex, NULL)) {
+	    free(m);
+	    m = NULL;
+	} else {
+	    m->next = metrics_list;
+	    metrics_list = m;
+	}
+    }
+    if (m)
+	m->owned = 1;
+    pthread_mutex_unlock(&metrics_mutex);
+
+    if (m)
+	pthread_setspecific(metrics_key, m);
+    return m;
+}
+
+static void histogram_add(struct histogram *h, unsigned long long usecs)
+{
+    unsigned i;
+
+    for (i = 0; i < NBUCKETS - 1; i++)
+	if (usecs <= bucket_bounds[i])
+	    break;
+    h->buckets[i]++;
+    h->count++;
+    h->usecs += usecs;
+}
+
+static void histogram_merge(struct histogram *dst, const struct histogram *src)
+{
+    unsigned i;
+
+    for (i = 0; i < NBUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    dst->usecs += src->usecs;
+}
+
+unsigned long long metrics_elapsed(const struct timeval *start)
+{
+    struct timeval now;
+    long long usecs;
+
+    gettimeofday(&now, NULL);
+    usecs = (long long)(now.tv_sec - start->tv_sec) * 1000000 + (now.tv_usec - start->tv_usec);
+    return usecs > 0 ? usecs : 0;
+}
+
+void metrics_command(enum commands cmd, unsigned long long usecs)
+{
+    struct thread_metrics *m = metrics_get();
+    unsigned i;
+
+    if (!m)
+	return;
+    for (i = 1; i < NCOMMANDS; i++)
+	if (command_names[i].cmd == cmd)
+	    break;
+    pthread_mutex_lock(&m->mutex);
+    histogram_add(&m->commands[i < NCOMMANDS ? i : 0], usecs);
+    pthread_mutex_unlock(&m->mutex);
+}
+
+void metrics_file(const char *filetype, unsigned long long bytes, unsigned long long usecs)
+{
+    struct thread_metrics *m = metrics_get();
+    unsigned i, n;
+
+    if (!m)
+	return;
+    if (!filetype)
+	filetype = "CL_TYPE_UNKNOWN";
+
+    /* the type names are static strings, compare the pointers */
+    pthread_mutex_lock(&m->mutex);
+    i = ((unsigned long)filetype >> 4) % (NTYPES - 1);
+    for (n = 0; n < NTYPES - 1; n++, i = (i + 1) % (NTYPES - 1)) {
+	if (m->types[i].name == filetype || !m->types[i].name)
+	    break;
+    }
+    if (n == NTYPES - 1) {
+	i = NTYPES - 1;
+	filetype = "OTHER";
+    }
+    histogram_add(&m->types[i].hist, usecs);
+    m->types[i].bytes += bytes;
+    m->types[i].name = filetype;
+    pthread_mutex_unlock(&m->mutex);
+}
+
+void metrics_tempfile(unsigned long long bytes)
+{
+    struct thread_metrics *m = metrics_get();
+
+    if (m) {
+	pthread_mutex_lock(&m->mutex);
+	m->tempfile_bytes += bytes;
+	pthread_mutex_unlock(&m->mutex);
+    }
+}
+
+void metrics_reload(unsigned long long usecs)
+{
+    struct thread_metrics *m = metrics_get();
+
+    if (m) {
+	pthread_mutex_lock(&m->mutex);
+	histogram_add(&m->reload, usecs);
+	pthread_mutex_unlock(&m->mutex);
+    }
+}
+
+static void print_histogram(int desc, const char *metric, const char *label, const char *value, const struct histogram *h)
+{
+    char labels[128];
+    unsigned long long cumulative = 0;
+    unsigned i;
+
+    if (label)
+	snprintf(labels, sizeof(labels), "%s=\"%s\",", label, value);
+    else
+	labels[0] = '\0';
+
+    for (i = 0; i < NBUCKETS - 1; i++) {
+	cumulative += h->buckets[i];
+	mdprintf(desc, "%s_bucket{%sle=\"%g\"} %llu\n", metric, labels, bucket_bounds[i] / 1e6, cumulative);
+    }
+    mdprintf(desc, "%s_bucket{%sle=\"+Inf\"} %llu\n", metric, labels, h->count);
+    if (label) {
+	mdprintf(desc, "%s_sum{%s=\"%s\"} %.6f\n", metric, label, value, h->usecs / 1e6);
+	mdprintf(desc, "%s_count{%s=\"%s\"} %llu\n", metric, label, value, h->count);
+    } else {
+	mdprintf(desc, "%s_sum %.6f\n", metric, h->usecs / 1e6);
+	mdprintf(desc, "%s_count %llu\n", metric, h->count);
+    }
+}
+
+void metrics_print(int desc, char term, const struct cl_engine *engine)
+{
+    struct histogram commands[NCOMMANDS], reload;
+    struct type_stats *types;
+    struct thread_metrics *m;
+    unsigned long long tempfile_bytes = 0, bytes = 0, usecs = 0, files = 0;
+    unsigned i, j, ntypes = 0, nthreads = 0;
+
+    memset(commands, 0, sizeof(commands));
+    memset(&reload, 0, sizeof(reload));
+
+    pthread_mutex_lock(&metrics_mutex);
+    for (m = metrics_list; m; m = m->next)
+	nthreads++;
+    types = calloc(nthreads * NTYPES + 1, sizeof(*types));
+    for (m = metrics_list; m; m = m->next) {
+	pthread_mutex_lock(&m->mutex);
+	for (i = 0; i < NCOMMANDS; i++)
+	    histogram_merge(&commands[i], &m->commands[i]);
+	histogram_merge(&reload, &m->reload);
+	tempfile_bytes += m->tempfile_bytes;
+	for (i = 0; types && i < NTYPES; i++) {
+	    const char *name = m->types[i].name;
+
+	    if (!name)
+		continue;
+	    for (j = 0; j < ntypes; j++)
+		if (!strcmp(types[j].name, name))
+		    break;
+	    if (j == ntypes)
+		types[ntypes++].name = name;
+	    histogram_merge(&types[j].hist, &m->types[i].hist);
+	    types[j].bytes += m->types[i].bytes;
+	}
+	pthread_mutex_unlock(&m->mutex);
+    }
+    pthread_mutex_unlock(&metrics_mutex);
+
+    mdprintf(desc, "# HELP clamd_command_duration_seconds Time spent executing clamd scan commands.\n");
+    mdprintf(desc, "# TYPE clamd_command_duration_seconds histogram\n");
+    for (i = 0; i < NCOMMANDS; i++)
+	if (commands[i].count)
+	    print_histogram(desc, "clamd_command_duration_seconds", "command", command_names[i].name, &commands[i]);
+
+    mdprintf(desc, "# HELP clamd_file_scan_duration_seconds Time spent scanning a file, by detected top level file type.\n");
+    mdprintf(desc, "# TYPE clamd_file_scan_duration_seconds histogram\n");
+    for (i = 0; i < ntypes; i++) {
+	print_histogram(desc, "clamd_file_scan_duration_seconds", "type", types[i].name, &types[i].hist);
+	files += types[i].hist.count;
+	usecs += types[i].hist.usecs;
+	bytes += types[i].bytes;
+    }
+
+    mdprintf(desc, "# HELP clamd_file_scanned_bytes_total Bytes scanned, by detected top level file type.\n");
+    mdprintf(desc, "# TYPE clamd_file_scanned_bytes_total counter\n");
+    for (i = 0; i < ntypes; i++)
+	mdprintf(desc, "clamd_file_scanned_bytes_total{type=\"%s\"} %llu\n", types[i].name, types[i].bytes);
+    free(types);
+
+    mdprintf(desc, "# HELP clamd_scanned_files_total Files scanned.\n");
+    mdprintf(desc, "# TYPE clamd_scanned_files_total counter\n");
+    mdprintf(desc, "clamd_scanned_files_total %llu\n", files);
+    mdprintf(desc, "# HELP clamd_scanned_bytes_total Bytes scanned.\n");
+    mdprintf(desc, "# TYPE clamd_scanned_bytes_total counter\n");
+    mdprintf(desc, "clamd_scanned_bytes_total %llu\n", bytes);
+    mdprintf(desc, "# HELP clamd_scan_bytes_per_second Average scan throughput of a single thread since startup.\n");
+    mdprintf(desc, "# TYPE clamd_scan_bytes_per_second gauge\n");
+    mdprintf(desc, "clamd_scan_bytes_per_second %.0f\n", usecs ? bytes * 1e6 / usecs : 0.0);
+
+    mdprintf(desc, "# HELP clamd_cache_hits_total Files found in the clean file cache.\n");
+    mdprintf(desc, "# TYPE clamd_cache_hits_total counter\n");
+    mdprintf(desc, "clamd_cache_hits_total %lld\n", cl_engine_get_num(engine, CL_ENGINE_CACHE_HITS, NULL));
+    mdprintf(desc, "# HELP clamd_cache_misses_total Files not found in the clean file cache.\n");
+    mdprintf(desc, "# TYPE clamd_cache_misses_total counter\n");
+    mdprintf(desc, "clamd_cache_misses_total %lld\n", cl_engine_get_num(engine, CL_ENGINE_CACHE_MISSES, NULL));
+
+    mdprintf(desc, "# HELP clamd_tempfile_bytes_total Bytes of streamed data written to temporary files.\n");
+    mdprintf(desc, "# TYPE clamd_tempfile_bytes_total counter\n");
+    mdprintf(desc, "clamd_tempfile_bytes_total %llu\n", tempfile_bytes);
+
+    mdprintf(desc, "# HELP clamd_reload_duration_seconds Time spent reloading the signature databases.\n");
+    mdprintf(desc, "# TYPE clamd_reload_duration_seconds histogram\n");
+    print_histogram(desc, "clamd_reload_duration_seconds", NULL, NULL, &reload);
+
+    mdprintf(desc, "# EOF%c", term);
+}
@@ -0,0 +1,49 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "libclamav/clamav.h"
+#include "session.h"
+
+/*
+ * Every thread records into its own set of counters, each with its own
+ * mutex: an update only contends with a concurrent metrics_print(), never
+ * with the other threads. The global list of sets is locked only when a
+ * thread takes a set on its first call or gives it up on exit.
+ * metrics_print() sums the sets of all threads, including those that have
+ * exited, and writes them in the Prometheus text exposition format.
+ */
+
+/* microseconds elapsed since start */
+unsigned long long metrics_elapsed(const struct timeval *start);
+
+void metrics_command(enum commands cmd, unsigned long long usecs);
+void metrics_file(const char *filetype, unsigned long long bytes, unsigned long long usecs);
+void metrics_tempfile(unsigned long long bytes);
+void metrics_reload(unsigned long long usecs);
+
+void metrics_print(int desc, char term, const struct cl_engine *engine);
+
+#endif
@@ -66,6 +66,10 @@
 #endif /* HAVE_POLL_H */
 #endif /* HAVE_POLL */
 
+#if HAVE_POLL && HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
 #include <limits.h>
 #include "libclamav/clamav.h"
 #include "shared/optparser.h"
@@ -242,6 +246,126 @@ realloc_polldata (struct fd_data *data)
     return 0;
 }
 
+#ifdef FDS_EPOLL
+/* Sets smaller than this (poll_fd(), the accept thread) stay on poll(),
+ * a set switches to epoll the first time it is polled with more fds. */
+#define FDS_EPOLL_MIN 64
+#define FDS_EPOLL_MAXEVENTS 1024
+
+static int
+fds_epoll_map (struct fd_data *data, int fd, size_t idx)
+{
+    if ((size_t) fd >= data->epoll_map_size)
+    {
+        size_t size = data->epoll_map_size ? data->epoll_map_size : 256;
+        unsigned *map;
+
+        while (size <= (size_t) fd)
+            size *= 2;
+        map = realloc (data->epoll_map, size * sizeof (*map));
+        if (!map)
+        {
+            logg ("!fds_epoll_map: Memory allocation failed for fd map\n");
+            return -1;
+        }
+        memset (map + data->epoll_map_size, 0,
+                (size - data->epoll_map_size) * sizeof (*map));
+        data->epoll_map = map;
+        data->epoll_map_size = size;
+    }
+    data->epoll_map[fd] = idx + 1;
+    return 0;
+}
+
+static int
+fds_epoll_watch (struct fd_data *data, size_t idx)
+{
+    struct fd_buf *buf = &data->buf[idx];
+    struct epoll_event ev;
+
+    if (data->epoll_fd < 0)
+        return 0;
+    if (fds_epoll_map (data, buf->fd, idx) == -1)
+        return -1;
+
+    /* the fd may have been closed and reused since it was added, in
+     * which case the old registration is already gone */
+    memset (&ev, 0, sizeof (ev));
+    ev.events = EPOLLIN;
+    ev.data.u64 = ((uint64_t) ++data->epoll_seq << 32) | (uint32_t) buf->fd;
+    if (epoll_ctl (data->epoll_fd, EPOLL_CTL_ADD, buf->fd, &ev) == -1 &&
+        (errno != EEXIST ||
+         epoll_ctl (data->epoll_fd, EPOLL_CTL_MOD, buf->fd, &ev) == -1))
+    {
+        char err[128];
+        logg ("!fds_epoll_watch: can't watch fd %d: %s\n", buf->fd,
+              cli_strerror (errno, err, sizeof (err)));
+        return -1;
+    }
+    buf->watched_fd = buf->fd;
+    buf->watch_id = data->epoll_seq;
+    return 0;
+}
+
+static void
+fds_epoll_unwatch (struct fd_data *data, struct fd_buf *buf)
+{
+    int fd = buf->watched_fd;
+
+    if (fd < 0)
+        return;
+    buf->watched_fd = -1;
+    if (data->epoll_fd < 0)
+        return;
+    /* Callers drop a descriptor by setting buf->fd to -1, and may close it
+     * before we get here. If the number was reused for a connection that is
+     * in the set now, the registration belongs to that one. */
+    if ((size_t) fd < data->epoll_map_size && data->epoll_map[fd])
+    {
+        struct fd_buf *cur = &data->buf[data->epoll_map[fd] - 1];
+        if (cur != buf && cur->fd == fd && cur->watched_fd == fd)
+            return;
+    }
+    epoll_ctl (data->epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/* Returns 1 if the set is watched with epoll */
+static int
+fds_epoll_start (struct fd_data *data)
+{
+    size_t i;
+
+    if (data->epoll_fd != -1)
+        return data->epoll_fd >= 0;
+    if (data->nfds < FDS_EPOLL_MIN)
+        return 0;
+
+    data->epoll_fd = epoll_create (FDS_EPOLL_MIN);
+    if (data->epoll_fd < 0)
+    {
+        char err[128];
+        logg ("^fds_epoll_start: epoll_create failed, using poll(): %s\n",
+              cli_strerror (errno, err, sizeof (err)));
+        data->epoll_fd = -2;
+        return 0;
+    }
+    for (i = 0; i < data->nfds; i++)
+    {
+        data->buf[i].watched_fd = -1;
+        if (data->buf[i].fd >= 0 && fds_epoll_watch (data, i) == -1)
+        {
+            logg ("^fds_epoll_start: falling back to poll()\n");
+            close (data->epoll_fd);
+            data->epoll_fd = -2;
+            return 0;
+        }
+    }
+    logg ("$fds_epoll_start: watching %u fds with epoll\n",
+          (unsigned) data->nfds);
+    return 1;
+}
+#endif
+
 int
 poll_fd (int fd, int timeout_sec, int check_signals)
 {
@@ -271,10 +395,19 @@ fds_cleanup (struct fd_data *data)
         {
             if (data->buf[i].buffer)
                 free (data->buf[i].buffer);
+#ifdef FDS_EPOLL
+            fds_epoll_unwatch (data, &data->buf[i]);
+#endif
             continue;
         }
         if (i != j)
+        {
             data->buf[j] = data->buf[i];
+#ifdef FDS_EPOLL
+            if (data->buf[j].watched_fd >= 0)
+                data->epoll_map[data->buf[j].fd] = j + 1;
+#endif
+        }
         j++;
     }
     if (j == data->nfds)
@@ -393,7 +526,16 @@ buf_init (struct fd_buf *buf, int listen_only, int timeout)
     buf->dumpfd = -1;
     buf->chunksize = 0;
     buf->quota = 0;
+    buf->deadline_ms = 0;
+    buf->trace = 0;
     buf->dumpname = NULL;
+    buf->nosplice = 0;
+    buf->hashctx = NULL;
+    buf->mux_streams = NULL;
+    buf->mux_cur = NULL;
+    buf->mux_left = 0;
+    buf->mux_nstreams = 0;
+    buf->mux_ndiscard = 0;
     buf->group = NULL;
     buf->term = '\0';
     if (!listen_only)
@@ -447,6 +589,13 @@ fds_add (struct fd_data *data, int fd, int listen_only, int timeout)
             /* clear stale data in buffer */
             if (buf_init (&data->buf[n], listen_only, timeout) < 0)
                 return -1;
+#ifdef FDS_EPOLL
+            if (fds_epoll_watch (data, n) == -1)
+            {
+                data->buf[n].fd = -1;
+                return -1;
+            }
+#endif
             return 0;
         }
 
@@ -463,6 +612,14 @@ fds_add (struct fd_data *data, int fd, int listen_only, int timeout)
     if (buf_init (&data->buf[n - 1], listen_only, timeout) < 0)
         return -1;
     data->buf[n - 1].fd = fd;
+#ifdef FDS_EPOLL
+    data->buf[n - 1].watched_fd = -1;
+    if (fds_epoll_watch (data, n - 1) == -1)
+    {
+        data->buf[n - 1].fd = -1;
+        return -1;
+    }
+#endif
     return 0;
 }
 
@@ -499,6 +656,118 @@ fds_remove (struct fd_data *data, int fd)
     fds_unlock (data);
 }
 
+#ifdef HAVE_POLL
+/* Handles the events poll() or epoll_wait() reported for buf, returns 0
+ * if the client disconnected or the descriptor failed */
+static int
+fds_revents (struct fd_buf *buf, short revents)
+{
+    if (revents & (POLLIN | POLLHUP))
+    {
+        logg ("$Received POLLIN|POLLHUP on fd %d\n", buf->fd);
+    }
+#ifndef _WIN32
+    if (revents & POLLHUP)
+    {
+        /* avoid SHUT_WR problem on Mac OS X */
+        int n;
+        int ret = send (buf->fd, &n, 0, 0);
+        if (!ret || (ret == -1 && errno == EINTR))
+            revents &= ~POLLHUP;
+    }
+#endif
+    if (revents & POLLIN)
+    {
+        int ret = read_fd_data (buf);
+        /* Data available to be read */
+        if (ret == -1)
+            revents |= POLLERR;
+        else if (!ret)
+            revents = POLLHUP;
+    }
+
+    if (revents & (POLLHUP | POLLERR | POLLNVAL))
+    {
+        if (revents & (POLLHUP | POLLNVAL))
+        {
+            /* remote disconnected */
+            logg ("*Client disconnected (FD %d)\n", buf->fd);
+        }
+        else
+        {
+            /* error on file descriptor */
+            logg ("^Error condition on fd %d\n", buf->fd);
+        }
+        buf->got_newdata = -1;
+        return 0;
+    }
+    return 1;
+}
+#endif
+
+#ifdef FDS_EPOLL
+/* The epoll counterpart of the poll() loop in fds_poll_recv(). The set is
+ * watched level-triggered: read_fd_data() does a single bounded recv() and
+ * the caller may leave a connection alone for a while (MODE_WAITANCILL, a
+ * full buffer), so whatever is left unread must wake us again.
+ * timeout is in ms. */
+static int
+fds_epoll_recv (struct fd_data *data, int timeout, int check_signals)
+{
+    size_t nevents = data->nfds < FDS_EPOLL_MAXEVENTS ? data->nfds : FDS_EPOLL_MAXEVENTS;
+    int retval, k;
+
+    if (data->epoll_events_nr < nevents)
+    {
+        struct epoll_event *events;
+
+        events = realloc (data->epoll_events, nevents * sizeof (*events));
+        if (!events)
+        {
+            logg ("!fds_epoll_recv: Memory allocation failed for events\n");
+            return -1;
+        }
+        data->epoll_events = events;
+        data->epoll_events_nr = nevents;
+    }
+    do
+    {
+        fds_unlock (data);
+        retval = epoll_wait (data->epoll_fd, data->epoll_events, nevents, timeout);
+        fds_lock (data);
+
+        for (k = 0; k < retval; k++)
+        {
+            uint64_t id = data->epoll_events[k].data.u64;
+            uint32_t ev = data->epoll_events[k].events;
+            int fd = (int) (uint32_t) id;
+            struct fd_buf *buf;
+
+            if ((size_t) fd >= data->epoll_map_size || !data->epoll_map[fd] ||
+                data->epoll_map[fd] > data->nfds)
+                continue;
+            buf = &data->buf[data->epoll_map[fd] - 1];
+            /* dropped from the set while we were waiting, or reused */
+            if (buf->fd != fd || buf->watch_id != (uint32_t) (id >> 32))
+                continue;
+            fds_revents (buf, ((ev & EPOLLIN) ? POLLIN : 0) |
+                         ((ev & EPOLLHUP) ? POLLHUP : 0) |
+                         ((ev & EPOLLERR) ? POLLERR : 0));
+        }
+    }
+    while (retval == -1 && !check_signals && errno == EINTR);
+
+    if (retval == -1 && errno != EINTR)
+    {
+        char err[128];
+        logg ("!poll_recv_fds: epoll_wait failed: %s\n",
+              cli_strerror (errno, err, sizeof (err)));
+    }
+
+    return retval;
+}
+#endif
+
 #define BUFFSIZE 1024
 /* Wait till data is available to be read on any of the fds,
  * read available data on all fds, and mark them as appropriate.
@@ -569,6 +838,11 @@ fds_poll_recv (struct fd_data *data, int timeout, int check_signals,
      *  recv() may still block according to the manpage
      */
 
+#ifdef FDS_EPOLL
+    if (fds_epoll_start (data))
+        return fds_epoll_recv (data, timeout > 0 ? timeout * 1000 : timeout,
+                               check_signals);
+#endif
     if (realloc_polldata (data) == -1)
         return -1;
     if (timeout > 0)
@@ -601,7 +875,6 @@ fds_poll_recv (struct fd_data *data, int timeout, int check_signals,
              * poll_data_nfds */
             for (i = 0; i < data->poll_data_nfds; i++)
             {
-                short revents;
                 if (data->buf[i].fd < 0)
                     continue;
                 if (data->buf[i].fd != data->poll_data[i].fd)
@@ -610,51 +883,8 @@ fds_poll_recv (struct fd_data *data, int timeout, int check_signals,
                     logg ("!poll_recv_fds FD mismatch\n");
                     continue;
                 }
-                revents = data->poll_data[i].revents;
-                if (revents & (POLLIN | POLLHUP))
-                {
-                    logg ("$Received POLLIN|POLLHUP on fd %d\n",
-                          data->poll_data[i].fd);
-                }
-#ifndef _WIN32
-                if (revents & POLLHUP)
-                {
-                    /* avoid SHUT_WR problem on Mac OS X */
-                    int ret = send (data->poll_data[i].fd, &n, 0, 0);
-                    if (!ret || (ret == -1 && errno == EINTR))
-                        revents &= ~POLLHUP;
-                }
-#endif
-                if (revents & POLLIN)
-                {
-                    int ret = read_fd_data (&data->buf[i]);
-                    /* Data available to be read */
-                    if (ret == -1)
-                        revents |= POLLERR;
-                    else if (!ret)
-                        revents = POLLHUP;
-                }
-
-                if (revents & (POLLHUP | POLLERR | POLLNVAL))
-                {
-                    if (revents & (POLLHUP | POLLNVAL))
-                    {
-                        /* remote disconnected */
-                        logg ("*Client disconnected (FD %d)\n",
-                              data->poll_data[i].fd);
-                    }
-                    else
-                    {
-                        /* error on file descriptor */
-                        logg ("^Error condition on fd %d\n",
-                              data->poll_data[i].fd);
-                    }
-                    data->buf[i].got_newdata = -1;
-                }
-                else
-                {
+                if (fds_revents (&data->buf[i], data->poll_data[i].revents))
                     fdsok++;
-                }
             }
         }
     }
@@ -795,6 +1025,17 @@ fds_free (struct fd_data *data)
 #ifdef HAVE_POLL
     if (data->poll_data)
         free (data->poll_data);
+#endif
+#ifdef FDS_EPOLL
+    if (data->epoll_fd >= 0)
+        close (data->epoll_fd);
+    free (data->epoll_events);
+    free (data->epoll_map);
+    data->epoll_fd = -1;
+    data->epoll_events = NULL;
+    data->epoll_events_nr = 0;
+    data->epoll_map = NULL;
+    data->epoll_map_size = 0;
 #endif
     data->buf = NULL;
     data->nfds = 0;
@@ -31,11 +31,28 @@
 #include "thrmgr.h"
 #include "cltypes.h"
 
+#if defined(HAVE_POLL) && defined(HAVE_SYS_EPOLL_H)
+/* large descriptor sets are watched with epoll instead of poll() */
+#define FDS_EPOLL 1
+struct epoll_event;
+#endif
+
 enum mode {
     MODE_COMMAND,
     MODE_STREAM,
     MODE_WAITREPLY,
-    MODE_WAITANCILL
+    MODE_WAITANCILL,
+    MODE_MUX
+};
+
+/* an open MUXSESSION stream */
+struct mux_stream {
+    uint32_t id;
+    int dumpfd; /* -1 if rejected or dropped for exceeding the quota */
+    char *dumpname; /* NULL for a memfd */
+    long quota;
+    void *hashctx; /* MD5 of the data so far, NULL - not hashed */
+    struct mux_stream *next;
 };
 
 struct fd_buf {
@@ -53,9 +70,22 @@ struct fd_buf {
     int dumpfd;
     uint32_t chunksize;
     long quota;
-    char *dumpname;
+    char *dumpname; /* NULL for a memfd */
+    int nosplice; /* INSTREAM data can't be spliced into dumpfd */
+    void *hashctx; /* MD5 of the INSTREAM data so far, NULL - not hashed */
+    struct mux_stream *mux_streams;
+    struct mux_stream *mux_cur; /* frame being received, NULL - expect a header */
+    uint32_t mux_left; /* bytes of mux_cur's frame still to come */
+    unsigned int mux_nstreams;
+    unsigned int mux_ndiscard; /* streams in mux_nstreams without a dumpfd */
     time_t timeout_at; /* 0 - no timeout */
+    unsigned int deadline_ms; /* set by DEADLINE, 0 - no deadline */
+    int trace; /* set by TRACESCAN without a path */
     jobgroup_t *group;
+#ifdef FDS_EPOLL
+    int watched_fd; /* fd registered with epoll, -1 - none */
+    uint32_t watch_id; /* tells registrations of a reused fd number apart */
+#endif
 };
 
 struct fd_data {
@@ -66,9 +96,19 @@ struct fd_data {
     struct pollfd *poll_data;
     size_t poll_data_nfds;
 #endif
+#ifdef FDS_EPOLL
+    int epoll_fd; /* -1 - not created yet, -2 - unavailable */
+    struct epoll_event *epoll_events;
+    size_t epoll_events_nr;
+    unsigned *epoll_map; /* fd -> index in buf + 1 */
+    size_t epoll_map_size;
+    uint32_t epoll_seq;
+#endif
 };
 
-#ifdef HAVE_POLL
+#ifdef FDS_EPOLL
+#define FDS_INIT(mutex) { (mutex), NULL, 0, NULL, 0, -1, NULL, 0, NULL, 0, 0}
+#elif defined(HAVE_POLL)
 #define FDS_INIT(mutex) { (mutex), NULL, 0, NULL, 0}
 #else
 #define FDS_INIT(mutex) { (mutex), NULL, 0}
@@ -57,17 +57,22 @@
 #include "shared/optparser.h"
 #include "shared/output.h"
 #include "shared/misc.h"
+#include "shared/clamdcom.h"
+#include "shared/scanindex.h"
 
 #include "others.h"
 #include "scanner.h"
 #include "shared.h"
 #include "thrmgr.h"
 #include "server.h"
+#include "metrics.h"
 
 #ifdef C_LINUX
 dev_t procdev; /* /proc device */
 #endif
 
+struct scan_index *scanindex = NULL;
+
 extern int progexit;
 extern time_t reloaded_time;
 extern pthread_mutex_t reload_mutex;
@@ -133,6 +138,47 @@ void clamd_virus_found_cb(int fd, const char *virname, void *ctx)
     return;
 }
 
+cl_error_t filetype_callback(int fd, const char *type, void *ctx)
+{
+    struct cb_context *c = ctx;
+    UNUSEDPARAM(fd);
+
+    /* the first call of a scan is made for the top level file */
+    if (c && !c->filetype)
+	c->filetype = type;
+    return CL_CLEAN;
+}
+
+void trace_callback(unsigned int depth, const char *type, const char *parser, unsigned long long size,
+                    unsigned long long usecs, unsigned long long match_usecs, unsigned long long unpack_usecs,
+                    unsigned long long tempbytes, void *ctx)
+{
+    struct cb_context *c = ctx;
+    char line[256];
+
+    if (!c || !c->conn)
+	return;
+    snprintf(line, sizeof(line), "%*s%s size: %llu parser: %s time: %llu match: %llu unpack: %llu temp: %llu",
+	     depth * 2, "", type, size, parser, usecs, match_usecs, unpack_usecs, tempbytes);
+    conn_reply(c->conn, c->replyname, line, "TRACE");
+}
+
+/* milliseconds left until the DEADLINE of the request, 0 when there is none */
+static int request_timeout(const client_conn_t *conn, unsigned int *timeout)
+{
+    uint64_t now;
+
+    *timeout = 0;
+    if (!conn || !conn->deadline)
+	return CL_SUCCESS;
+    now = cli_monotonic_usecs();
+    if (now >= conn->deadline)
+	return CL_ETIMEOUT;
+    /* round up, 0 would mean no limit at all */
+    *timeout = (unsigned int)((conn->deadline - now + 999) / 1000);
+    return CL_SUCCESS;
+}
+
 #define BUFFSIZE 1024
 int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data)
 {
@@ -141,6 +187,10 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
     int ret;
     int type = scandata->type;
     struct cb_context context;
+    struct timeval tv_start;
+    unsigned int timeout;
+    STATBUF isb;
+    uint64_t stamp = 0;
 
     /* detect disconnected socket, 
      * this should NOT detect half-shutdown sockets (SHUT_WR) */
@@ -217,6 +267,7 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
 	    client_conn->options = scandata->options;
 	    client_conn->opts = scandata->opts;
 	    client_conn->group = scandata->group;
+	    client_conn->deadline = scandata->conn->deadline;
 	    if(cl_engine_addref(scandata->engine)) {
 		logg("!cl_engine_addref() failed\n");
 		free(filename);
@@ -255,11 +306,33 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
 	return CL_SUCCESS;
     }
 
+    if (scanindex && (type == TYPE_CONTSCAN || scandata->conn->cmdtype == COMMAND_MULTISCANFILE)) {
+	/* MULTISCAN doesn't stat while walking */
+	if (!sb && CLAMSTAT(filename, &isb) == 0)
+	    sb = &isb;
+	if (sb) {
+	    stamp = scanindex_stamp(scandata->engine, scandata->options);
+	    if (scanindex_lookup(scanindex, sb, stamp)) {
+		if (logok)
+		    logg("~%s: OK (unchanged)\n", filename);
+		free(filename);
+		return CL_SUCCESS;
+	    }
+	}
+    }
+
     thrmgr_setactivetask(filename, NULL);
     context.filename = filename;
+    context.replyname = filename;
     context.virsize = 0;
+    context.filetype = NULL;
     context.scandata = scandata;
-    ret = cl_scanfile_callback(filename, &virname, &scandata->scanned, scandata->engine, scandata->options, &context);
+    context.conn = scandata->conn;
+    if ((ret = request_timeout(scandata->conn, &timeout)) == CL_SUCCESS) {
+	gettimeofday(&tv_start, NULL);
+	ret = cl_scanfile_timeout(filename, &virname, &scandata->scanned, scandata->engine, scandata->options, timeout, &context);
+	metrics_file(context.filetype, sb ? sb->st_size : 0, metrics_elapsed(&tv_start));
+    }
     thrmgr_setactivetask(NULL, NULL);
 
     if (thrmgr_group_need_terminate(scandata->conn->group)) {
@@ -295,8 +368,11 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
 	    return CL_ETIMEOUT;
 	}
 	logg("~%s: %s ERROR\n", filename, cl_strerror(ret));
-    } else if (logok) {
-	logg("~%s: OK\n", filename);
+    } else {
+	if (stamp)
+	    scanindex_update(scanindex, sb, stamp);
+	if (logok)
+	    logg("~%s: OK\n", filename);
     }
 
     free(filename);
@@ -304,6 +380,14 @@ int scan_callback(STATBUF *sb, char *filename, const char *msg, enum cli_ftw_rea
     if(ret == CL_EMEM) /* stop scanning */
 	return ret;
 
+    if (ret == CL_ETIMEOUT) {
+	/* out of time, but to our callers CL_ETIMEOUT means a dead client:
+	 * SCAN stops here, the others report the remaining files unscanned */
+	if (type == TYPE_SCAN && scandata->conn->cmdtype != COMMAND_MULTISCANFILE)
+	    return CL_BREAK;
+	return CL_SUCCESS;
+    }
+
     if (type == TYPE_SCAN) {
 	/* virus -> break */
 	return ret;
@@ -351,8 +435,11 @@ int scanfd(const client_conn_t *conn, unsigned long int *scanned,
 	const char *virname;
 	STATBUF statbuf;
 	struct cb_context context;
+	struct timeval tv_start;
 	char fdstr[32];
 	const char*reply_fdstr;
+	unsigned int timeout;
+	unsigned long long usecs = 0;
 
     UNUSEDPARAM(odesc);
 
@@ -377,9 +464,23 @@ int scanfd(const client_conn_t *conn, unsigned long int *scanned,
 
 	thrmgr_setactivetask(fdstr, NULL);
 	context.filename = fdstr;
+	context.replyname = reply_fdstr;
 	context.virsize = 0;
+	context.filetype = NULL;
         context.scandata = NULL;
-	ret = cl_scandesc_callback(fd, &virname, scanned, engine, options, &context);
+	context.conn = conn;
+	/* a MUXSESSION has one reply per stream */
+	if (conn->trace && conn->mode != MODE_MUX)
+	    options |= CL_SCAN_TRACE;
+	if ((ret = request_timeout(conn, &timeout)) == CL_SUCCESS) {
+	    gettimeofday(&tv_start, NULL);
+	    if (conn->have_md5)
+		ret = cl_scandesc_md5(fd, conn->md5, &virname, scanned, engine, options, timeout, &context);
+	    else
+		ret = cl_scandesc_timeout(fd, &virname, scanned, engine, options, timeout, &context);
+	    usecs = metrics_elapsed(&tv_start);
+	    metrics_file(context.filetype, statbuf.st_size, usecs);
+	}
 	thrmgr_setactivetask(NULL, NULL);
 
 	if (thrmgr_group_need_terminate(conn->group)) {
@@ -387,7 +488,28 @@ int scanfd(const client_conn_t *conn, unsigned long int *scanned,
 	    return ret == CL_ETIMEOUT ? ret : CL_BREAK;
 	}
 
-	if(ret == CL_VIRUS) {
+	if (conn->mode == MODE_MUX) {
+		/* one structured reply, with the scan time and size */
+		unsigned int status = MUX_STATUS_OK;
+		const char *text = NULL;
+
+		if (ret == CL_VIRUS) {
+		    status = MUX_STATUS_FOUND;
+		    text = virname;
+		    logg("%s: %s FOUND\n", fdstr, virname);
+		    virusaction(reply_fdstr, virname, opts);
+		} else if (ret != CL_CLEAN) {
+		    status = MUX_STATUS_ERROR;
+		    text = cl_strerror(ret);
+		    logg("%s: %s ERROR\n", fdstr, text);
+		} else if (logok)
+		    logg("%s: OK\n", fdstr);
+		if (conn_reply_mux(conn, status, text, usecs, statbuf.st_size) == -1)
+		    ret = CL_ETIMEOUT;
+		else if (ret == CL_ETIMEOUT)
+		    /* out of time, the client is still there */
+		    ret = CL_BREAK;
+	} else if(ret == CL_VIRUS) {
 		if (conn_reply_virus(conn, reply_fdstr, virname) == -1)
 		    ret = CL_ETIMEOUT;
 		if(context.virsize && optget(opts, "ExtendedDetectionInfo")->enabled)
@@ -396,9 +518,12 @@ int scanfd(const client_conn_t *conn, unsigned long int *scanned,
 		    logg("%s: %s FOUND\n", fdstr, virname);
 		virusaction(reply_fdstr, virname, opts);
 	} else if(ret != CL_CLEAN) {
+		logg("%s: %s ERROR\n", fdstr, cl_strerror(ret));
 		if (conn_reply(conn, reply_fdstr, cl_strerror(ret), "ERROR") == -1)
 		    ret = CL_ETIMEOUT;
-		logg("%s: %s ERROR\n", fdstr, cl_strerror(ret));
+		else if (ret == CL_ETIMEOUT)
+		    /* out of time, the client is still there */
+		    ret = CL_BREAK;
 	} else {
 		if (conn_reply_single(conn, reply_fdstr, "OK") == CL_ETIMEOUT)
 		    ret = CL_ETIMEOUT;
@@ -414,11 +539,13 @@ int scanstream(int odesc, unsigned long int *scanned, const struct cl_engine *en
 	int tmpd, bread, retval, firsttimeout, timeout, btread;
 	unsigned int port = 0, portscan, min_port, max_port;
 	unsigned long int quota = 0, maxsize = 0;
+	unsigned long long streamed = 0;
 	short bound = 0;
 	const char *virname;
 	char buff[FILEBUFF];
 	char peer_addr[32];
 	struct cb_context context;
+	struct timeval tv_start;
 	struct sockaddr_in server;
 	struct sockaddr_in peer;
 	socklen_t addrlen;
@@ -515,6 +642,8 @@ int scanstream(int odesc, unsigned long int *scanned, const struct cl_engine *en
 	    break;
 
 	quota -= bread;
+	streamed += bread;
+	metrics_tempfile(bread);
 
 	if(writen(tmpd, buff, bread) != bread) {
 	    shutdown(sockfd, 2);
@@ -545,9 +674,14 @@ int scanstream(int odesc, unsigned long int *scanned, const struct cl_engine *en
 	lseek(tmpd, 0, SEEK_SET);
 	thrmgr_setactivetask(peer_addr, NULL);
 	context.filename = peer_addr;
+	context.replyname = peer_addr;
 	context.virsize = 0;
+	context.filetype = NULL;
         context.scandata = NULL;
+	context.conn = NULL;
+	gettimeofday(&tv_start, NULL);
 	ret = cl_scandesc_callback(tmpd, &virname, scanned, engine, options, &context);
+	metrics_file(context.filetype, streamed, metrics_elapsed(&tv_start));
 	thrmgr_setactivetask(NULL, NULL);
     } else {
     	ret = -1;
@@ -54,7 +54,10 @@ struct cb_context {
     const char *filename;
     unsigned long long virsize;
     char virhash[33];
+    const char *filetype;	/* detected type of the top level file */
     struct scan_cb_data *scandata;
+    const client_conn_t *conn; /* for the TRACE replies, NULL - none */
+    const char *replyname; /* filename as the client knows it */
 };
 
 int scanfd(const client_conn_t *conn, unsigned long int *scanned, const struct cl_engine *engine, unsigned int options, const struct optstruct *opts, int odesc, int stream);
@@ -64,5 +67,9 @@ int scan_pathchk(const char *path, struct cli_ftw_cbdata *data);
 void hash_callback(int fd, unsigned long long size, const unsigned char *md5, const char *virname, void *ctx);
 void msg_callback(enum cl_msg severity, const char *fullmsg, const char *msg, void *ctx);
 void clamd_virus_found_cb(int fd, const char *virname, void *context);
+cl_error_t filetype_callback(int fd, const char *type, void *context);
+void trace_callback(unsigned int depth, const char *type, const char *parser, unsigned long long size,
+                    unsigned long long usecs, unsigned long long match_usecs, unsigned long long unpack_usecs,
+                    unsigned long long tempbytes, void *context);
 
 #endif
@@ -50,12 +50,15 @@
 #include "shared/output.h"
 #include "shared/optparser.h"
 #include "shared/misc.h"
+#include "shared/clamdcom.h"
 
 #include "onaccess_fan.h"
 #include "server.h"
 #include "thrmgr.h"
 #include "session.h"
+#include "metrics.h"
 #include "others.h"
+#include "tcpserver.h"
 #include "shared.h"
 #include "libclamav/others.h"
 #include "libclamav/readdb.h"
@@ -83,6 +86,7 @@ static void scanner_thread(void *arg)
 #endif
 	int ret;
 	int virus=0, errors = 0;
+	struct timeval tv_start;
 
 #ifndef	_WIN32
     /* ignore all signals */
@@ -100,7 +104,9 @@ static void scanner_thread(void *arg)
     pthread_sigmask(SIG_SETMASK, &sigset, NULL);
 #endif
 
+    gettimeofday(&tv_start, NULL);
     ret = command(conn, &virus);
+    metrics_command(conn->cmdtype, metrics_elapsed(&tv_start));
     if (ret == -1) {
 	pthread_mutex_lock(&exit_mutex);
 	progexit = 1;
@@ -315,9 +321,16 @@ struct acceptdata {
     int commandtimeout;
     int syncpipe_wake_recv[2];
     int syncpipe_wake_accept[2];
+    unsigned int shard; /* 0 for the main thread's loops */
+    int splice_pipe[2]; /* INSTREAM socket to dump file, see stream_splice() */
+    size_t rr_last;
+    int readtimeout;
+    unsigned int options;
+    const struct optstruct *opts;
+    threadpool_t *thr_pool;
 };
 
-#define ACCEPTDATA_INIT(mutex1, mutex2) { FDS_INIT(mutex1), FDS_INIT(mutex2), PTHREAD_COND_INITIALIZER, 0, 0, {-1, -1}, {-1, -1}}
+#define ACCEPTDATA_INIT(mutex1, mutex2) { FDS_INIT(mutex1), FDS_INIT(mutex2), PTHREAD_COND_INITIALIZER, 0, 0, {-1, -1}, {-1, -1}, 0, {-1, -1}, 0, 0, 0, NULL, NULL}
 
 static void *acceptloop_th(void *arg)
 {
@@ -432,7 +445,7 @@ static void *acceptloop_th(void *arg)
 		    continue;
 		}
 #endif
-	    } else if (errno != EINTR) {
+	    } else if (errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK) {
 		/* very bad - need to exit or restart */
 #ifdef HAVE_STRERROR_R
 		strerror_r(errno, buff, BUFFSIZE);
@@ -456,7 +469,9 @@ static void *acceptloop_th(void *arg)
     }
     pthread_mutex_unlock(fds->buf_mutex);
 
-    if (sd_listen_fds(0) == 0)
+    /* extra receive loops share or clone these, recvshard_free() closes
+     * their own */
+    if (!data->shard && sd_listen_fds(0) == 0)
     {
         /* only close the sockets, when not using systemd socket activation */
         for (i=0;i < fds->nfds; i++)
@@ -497,6 +512,7 @@ static const char* parse_dispatch_cmd(client_conn_t *conn, struct fd_buf *buf, s
 	   (cmd = get_cmd(buf, pos, &cmdlen, &term, &oldstyle)) != NULL) {
 	const char *argument;
 	enum commands cmdtype;
+	int setup;
 	if (conn->group && oldstyle) {
 	    logg("$Received oldstyle command inside IDSESSION: %s\n", cmd);
 	    conn_reply_error(conn, "Only nCMDS\\n and zCMDS\\0 are accepted inside IDSESSION.");
@@ -538,7 +554,10 @@ static const char* parse_dispatch_cmd(client_conn_t *conn, struct fd_buf *buf, s
 	    *error = CL_ETIMEOUT;
 	    break;
 	}
-	if (*error || !conn->group || rc) {
+	/* DEADLINE and TRACESCAN without a path only set up the commands
+	 * that follow them */
+	setup = cmdtype == COMMAND_DEADLINE || (cmdtype == COMMAND_TRACESCAN && !argument);
+	if (*error || (!conn->group && !setup) || rc) {
 	    if (rc && thrmgr_group_finished(conn->group, EXIT_OK)) {
 		logg("$Receive thread: closing conn (FD %d), group finished\n", conn->sd);
 		/* if there are no more active jobs */
@@ -585,16 +604,20 @@ static const char* parse_dispatch_cmd(client_conn_t *conn, struct fd_buf *buf, s
 	    /* TODO: this doesn't belong here */
 	    buf->dumpname = conn->filename;
 	    buf->dumpfd = conn->scanfd;
-	    logg("$Receive thread: INSTREAM: %s fd %u\n", buf->dumpname, buf->dumpfd);
+	    buf->hashctx = optget(conn->opts, "StreamHash")->enabled ? cl_hash_init("md5") : NULL;
+	    logg("$Receive thread: INSTREAM: %s fd %u\n", buf->dumpname ? buf->dumpname : "memfd", buf->dumpfd);
 	}
 	if (conn->mode != MODE_COMMAND) {
 	    logg("$Breaking command loop, mode is no longer MODE_COMMAND\n");
 	    break;
 	}
-	conn->id++;
+	if (!setup)
+	    conn->id++;
     }
     *ppos = pos;
     buf->mode = conn->mode;
+    buf->deadline_ms = conn->deadline_ms;
+    buf->trace = conn->trace;
     buf->id = conn->id;
     buf->group = conn->group;
     buf->quota = conn->quota;
@@ -624,8 +647,77 @@ static const char* parse_dispatch_cmd(client_conn_t *conn, struct fd_buf *buf, s
     return cmd;
 }
 
+#if defined(HAVE_SPLICE) && !defined(_WIN32)
+#define STREAM_SPLICE_MAX 65536
+
+/* Moves up to len bytes of chunk data straight from the socket into the
+ * dump file through splice_pipe, without copying it through fd_buf.
+ * Returns the number of bytes stored, 0 when nothing could be spliced (no
+ * data yet, or splice isn't supported for this socket) or -1 when writing
+ * the dump file failed. */
+static ssize_t stream_splice(struct fd_buf *buf, size_t len, int *splice_pipe)
+{
+    char tmp[BUFSIZ];
+    ssize_t n, m, left;
+
+    if (splice_pipe[0] == -1 && pipe(splice_pipe) == -1) {
+	splice_pipe[0] = splice_pipe[1] = -1;
+	return 0;
+    }
+    if (len > STREAM_SPLICE_MAX)
+	len = STREAM_SPLICE_MAX;
+    n = splice(buf->fd, NULL, splice_pipe[1], NULL, len, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n <= 0) {
+	if (n == -1 && errno != EAGAIN && errno != EINTR) {
+	    logg("$INSTREAM: splice from fd %d failed, copying instead: %s\n", buf->fd, strerror(errno));
+	    buf->nosplice = 1;
+	}
+	/* EOF and errors are seen by the next recv() */
+	return 0;
+    }
+    for (left = n; left > 0; left -= m) {
+	m = splice(splice_pipe[0], NULL, buf->dumpfd, NULL, left, SPLICE_F_MOVE);
+	if (m > 0)
+	    continue;
+	/* the dump file doesn't take spliced data: drain the pipe by hand */
+	buf->nosplice = 1;
+	if ((m = read(splice_pipe[0], tmp, (size_t)left < sizeof(tmp) ? (size_t)left : sizeof(tmp))) <= 0 ||
+	    cli_writen(buf->dumpfd, tmp, m) < 0) {
+	    /* the pipe may hold data now, don't reuse it */
+	    close(splice_pipe[0]);
+	    close(splice_pipe[1]);
+	    splice_pipe[0] = splice_pipe[1] = -1;
+	    return -1;
+	}
+    }
+    return n;
+}
+#endif
+
+/* Hands the MD5 of a complete stream over to its scan, see StreamHash */
+static void instream_hash(void **hashctx, client_conn_t *conn)
+{
+    if (!*hashctx)
+	return;
+    conn->have_md5 = !cl_finish_hash(*hashctx, conn->md5);
+    *hashctx = NULL;
+}
+
+/* Nothing may change a memfd (no dumpname) while it's being scanned */
+static void instream_seal(int fd, const char *dumpname)
+{
+#ifdef F_ADD_SEALS
+    if (!dumpname &&
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) == -1)
+	logg("*INSTREAM: Can't seal memfd: %s\n", strerror(errno));
+#else
+    UNUSEDPARAM(fd);
+    UNUSEDPARAM(dumpname);
+#endif
+}
+
 /* static const unsigned char* parse_dispatch_cmd(client_conn_t *conn, struct fd_buf *buf, size_t *ppos, int *error, const struct optstruct *opts, int readtimeout) */
-static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct optstruct *opts, int *error, size_t *ppos, int readtimeout)
+static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct optstruct *opts, int *error, size_t *ppos, int readtimeout, int *splice_pipe)
 {
     int rc;
     size_t pos = *ppos;
@@ -646,6 +738,8 @@ static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct o
 		logg("$Got chunksize: %u\n", buf->chunksize);
 		if (!buf->chunksize) {
 		    /* chunksize 0 marks end of stream */
+		    instream_seal(buf->dumpfd, buf->dumpname);
+		    instream_hash(&buf->hashctx, conn);
 		    conn->scanfd = buf->dumpfd;
 		    conn->term = buf->term;
 		    buf->dumpfd = -1;
@@ -699,11 +793,34 @@ static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct o
 	    logg("!INSTREAM: Can't write to temporary file.\n");
 	    *error = 1;
 	}
+	if (buf->hashctx)
+	    cl_update_hash(buf->hashctx, buf->buffer + pos, cmdlen);
+	metrics_tempfile(cmdlen);
 	logg("$Processed %llu bytes of chunkdata, pos %llu\n", (long long unsigned)cmdlen, (long long unsigned)pos);
 	pos += cmdlen;
 	if (pos == buf->off) {
 	    buf->off = 0;
 	    pos = 0;
+#if defined(HAVE_SPLICE) && !defined(_WIN32)
+	    /* the rest of the chunk can bypass fd_buf, unless it's hashed */
+	    while (!*error && buf->chunksize && !buf->nosplice && !buf->hashctx) {
+		ssize_t n = stream_splice(buf, buf->chunksize, splice_pipe);
+
+		if (n < 0) {
+		    conn_reply_error(conn, "Error writing to temporary file");
+		    logg("!INSTREAM: Can't write to temporary file.\n");
+		    *error = 1;
+		} else if (!n) {
+		    break;
+		} else {
+		    buf->chunksize -= n;
+		    metrics_tempfile(n);
+		    logg("$Spliced %llu bytes of chunkdata\n", (long long unsigned)n);
+		}
+	    }
+#else
+	    UNUSEDPARAM(splice_pipe);
+#endif
 	    /* need more data, so return and wait for some */
 	    *ppos = pos;
             return -1;
@@ -713,6 +830,624 @@ static int handle_stream(client_conn_t *conn, struct fd_buf *buf, const struct o
     return 0;
 }
 
+/* streams whose data is being discarded a MUXSESSION may keep open on top
+ * of MUX_MAX_STREAMS, beyond that the client is ignoring the error replies */
+#define MUX_MAX_DISCARD MUX_MAX_STREAMS
+
+static void mux_drop(struct mux_stream *st)
+{
+    cl_hash_destroy(st->hashctx);
+    if (st->dumpfd != -1) {
+	close(st->dumpfd);
+	if (st->dumpname)
+	    cli_unlink(st->dumpname);
+    }
+    free(st->dumpname);
+    free(st);
+}
+
+/* Drops the streams a MUXSESSION left unfinished */
+static void mux_free(struct fd_buf *buf)
+{
+    struct mux_stream *st;
+
+    while ((st = buf->mux_streams)) {
+	buf->mux_streams = st->next;
+	mux_drop(st);
+    }
+    buf->mux_cur = NULL;
+    buf->mux_left = 0;
+    buf->mux_nstreams = 0;
+    buf->mux_ndiscard = 0;
+}
+
+/* Opens stream id. A stream that can't be received gets an error reply of
+ * its own and no dump file, so its data is discarded while the other
+ * streams go on. Returns NULL if the session can't go on. */
+static struct mux_stream *mux_open(client_conn_t *conn, struct fd_buf *buf, uint32_t id, const struct optstruct *opts)
+{
+    struct mux_stream *st;
+    const char *reject = NULL;
+
+    if (buf->mux_nstreams >= MUX_MAX_STREAMS + MUX_MAX_DISCARD) {
+	conn_reply_error(conn, "MUXSESSION: too many open streams.");
+	return NULL;
+    }
+    if (!(st = calloc(1, sizeof(*st)))) {
+	conn_reply_error(conn, "MUXSESSION: out of memory.");
+	return NULL;
+    }
+    st->id = id;
+    st->dumpfd = -1;
+    st->next = buf->mux_streams;
+    buf->mux_streams = st;
+    buf->mux_nstreams++;
+
+    if (buf->mux_nstreams - buf->mux_ndiscard > MUX_MAX_STREAMS)
+	reject = "MUXSESSION: too many open streams.";
+    else if (instream_open(conn) != CL_SUCCESS)
+	reject = "Can't create temporary file.";
+    if (reject) {
+	logg("^MUXSESSION: rejected stream %u: %s\n", id, reject);
+	buf->mux_ndiscard++;
+	conn->id = id;
+	conn_reply_error(conn, reject);
+	conn->id = 0;
+	return st;
+    }
+    st->dumpfd = conn->scanfd;
+    st->dumpname = conn->filename;
+    st->quota = optget(opts, "StreamMaxLength")->numarg;
+    st->hashctx = optget(opts, "StreamHash")->enabled ? cl_hash_init("md5") : NULL;
+    conn->scanfd = -1;
+    conn->filename = NULL;
+    logg("$MUXSESSION: opened stream %u\n", id);
+    return st;
+}
+
+/* Queues the scan of a finished stream, the scanner thread owns it then */
+static int mux_dispatch(client_conn_t *conn, struct mux_stream *st, const struct optstruct *opts)
+{
+    int rc;
+
+    instream_seal(st->dumpfd, st->dumpname);
+    instream_hash(&st->hashctx, conn);
+    conn->scanfd = st->dumpfd;
+    conn->filename = st->dumpname;
+    conn->id = st->id;
+    free(st);
+    logg("$MUXSESSION: stream %u complete\n", conn->id);
+    if ((rc = execute_or_dispatch_command(conn, COMMAND_INSTREAMSCAN, NULL)) < 0) {
+	logg("!Command dispatch failed\n");
+	if(rc == -1 && optget(opts, "ExitOnOOM")->enabled) {
+	    pthread_mutex_lock(&exit_mutex);
+	    progexit = 1;
+	    pthread_mutex_unlock(&exit_mutex);
+	}
+	if (conn->scanfd != -1) {
+	    close(conn->scanfd);
+	    conn->scanfd = -1;
+	}
+    }
+    conn->id = 0;
+    conn->filename = NULL;
+    conn->have_md5 = 0;
+    return rc;
+}
+
+/* The client ended the session: close the connection once the last scan
+ * has replied, see COMMAND_END in parse_dispatch_cmd() */
+static void mux_end(struct fd_buf *buf)
+{
+    mux_free(buf);
+    if (thrmgr_group_finished(buf->group, EXIT_OK)) {
+	logg("$Receive thread: closing conn (FD %d), group finished\n", buf->fd);
+	shutdown(buf->fd, 2);
+	closesocket(buf->fd);
+	buf->group = NULL;
+    } else {
+	logg("$mode -> MODE_WAITREPLY\n");
+	buf->mode = MODE_WAITREPLY;
+    }
+    buf->fd = -1;
+}
+
+/* Receives MUXSESSION frames: the data goes to the dump files of the
+ * streams, finished streams are dispatched like INSTREAM */
+static int handle_mux(client_conn_t *conn, struct fd_buf *buf, const struct optstruct *opts, int *error, size_t *ppos, int readtimeout)
+{
+    struct mux_stream *st, **pst;
+    size_t pos = *ppos, n;
+    uint32_t id, len;
+
+    logg("$mode == MODE_MUX\n");
+    /* replies not tied to a stream go to stream 0 */
+    conn->id = 0;
+    time(&buf->timeout_at);
+    buf->timeout_at += readtimeout;
+    while (!*error && buf->mode == MODE_MUX) {
+	if (!buf->mux_cur) {
+	    if (buf->off - pos < MUX_FRAME_HDRLEN)
+		break;
+	    id = mux_get32((const unsigned char *)buf->buffer + pos);
+	    len = mux_get32((const unsigned char *)buf->buffer + pos + 4);
+	    pos += MUX_FRAME_HDRLEN;
+	    if (!id) {
+		if (len) {
+		    conn_reply_error(conn, "MUXSESSION: data sent for stream 0.");
+		    *error = 1;
+		    break;
+		}
+		mux_end(buf);
+		break;
+	    }
+	    for (pst = &buf->mux_streams; *pst && (*pst)->id != id; pst = &(*pst)->next);
+	    st = *pst;
+	    if (!len || len == MUX_ABORT) {
+		if (!st) {
+		    if (len == MUX_ABORT)
+			continue;
+		    conn_reply_error(conn, "MUXSESSION: unknown stream.");
+		    *error = 1;
+		    break;
+		}
+		*pst = st->next;
+		buf->mux_nstreams--;
+		if (st->dumpfd == -1)
+		    buf->mux_ndiscard--;
+		if (len == MUX_ABORT || st->dumpfd == -1) {
+		    /* aborted or already replied to */
+		    mux_drop(st);
+		    continue;
+		}
+		if (mux_dispatch(conn, st, opts) < 0)
+		    *error = 1;
+		else if (thrmgr_group_need_terminate(conn->group)) {
+		    logg("$Receive thread: have to terminate group\n");
+		    *error = CL_ETIMEOUT;
+		}
+		continue;
+	    }
+	    if (!st && !(st = mux_open(conn, buf, id, opts))) {
+		*error = 1;
+		break;
+	    }
+	    if (st->dumpfd != -1) {
+		if (len > st->quota) {
+		    /* the other streams go on */
+		    logg("^MUXSESSION: Size limit reached for stream %u, (max: %lu)\n", id, (unsigned long)st->quota);
+		    conn->id = id;
+		    conn_reply_error(conn, "INSTREAM size limit exceeded.");
+		    conn->id = 0;
+		    close(st->dumpfd);
+		    st->dumpfd = -1;
+		    buf->mux_ndiscard++;
+		    cl_hash_destroy(st->hashctx);
+		    st->hashctx = NULL;
+		    if (st->dumpname) {
+			cli_unlink(st->dumpname);
+			free(st->dumpname);
+			st->dumpname = NULL;
+		    }
+		} else
+		    st->quota -= len;
+	    }
+	    buf->mux_cur = st;
+	    buf->mux_left = len;
+	}
+	n = buf->off - pos;
+	if (n > buf->mux_left)
+	    n = buf->mux_left;
+	if (!n)
+	    break;
+	if (buf->mux_cur->dumpfd != -1) {
+	    if (cli_writen(buf->mux_cur->dumpfd, buf->buffer + pos, n) < 0) {
+		conn_reply_error(conn, "Error writing to temporary file");
+		logg("!MUXSESSION: Can't write to temporary file.\n");
+		*error = 1;
+		break;
+	    }
+	    if (buf->mux_cur->hashctx)
+		cl_update_hash(buf->mux_cur->hashctx, buf->buffer + pos, n);
+	    metrics_tempfile(n);
+	}
+	pos += n;
+	buf->mux_left -= n;
+	if (!buf->mux_left)
+	    buf->mux_cur = NULL;
+    }
+    /* keep a partial frame header for the next round */
+    if (pos < buf->off) {
+	memmove(buf->buffer, &buf->buffer[pos], buf->off - pos);
+	buf->off -= pos;
+    } else
+	buf->off = 0;
+    *ppos = 0;
+    return -1;
+}
+
+/* Waits for data on the connections of one accept/receive loop pair, then
+ * parses and dispatches what arrived. Returns the fds_poll_recv() result. */
+static int recvloop_process(struct acceptdata *data, struct cl_engine *engine, int timeout, int check_signals)
+{
+    char buff[BUFFSIZE + 1];
+    struct fd_data *fds = &data->recv_fds;
+    size_t i = 0, j;
+    int new_sd;
+
+    /* Block waiting for connection on any of the sockets */
+    pthread_mutex_lock(fds->buf_mutex);
+    fds_cleanup(fds);
+    /* signal that we can accept more connections */
+    if (fds->nfds <= (unsigned)data->max_queue)
+	pthread_cond_signal(&data->cond_nfds);
+    new_sd = fds_poll_recv(fds, timeout, check_signals, event_wake_recv);
+#ifdef _WIN32
+    ResetEvent(event_wake_recv);
+#else
+    if (!fds->nfds) {
+	/* at least the dummy/sync pipe should have remained */
+	logg("!All recv() descriptors gone: fatal\n");
+	pthread_mutex_lock(&exit_mutex);
+	progexit = 1;
+	pthread_mutex_unlock(&exit_mutex);
+	pthread_mutex_unlock(fds->buf_mutex);
+	return new_sd;
+    }
+#endif
+    if (new_sd == -1 && errno != EINTR) {
+	logg("!Failed to poll sockets, fatal\n");
+	pthread_mutex_lock(&exit_mutex);
+	progexit = 1;
+	pthread_mutex_unlock(&exit_mutex);
+    }
+
+
+    if(fds->nfds) i = (data->rr_last + 1) % fds->nfds;
+    for (j = 0;  j < fds->nfds && new_sd >= 0; j++, i = (i+1) % fds->nfds) {
+	size_t pos = 0;
+	int error = 0;
+	struct fd_buf *buf = &fds->buf[i];
+	if (!buf->got_newdata)
+	    continue;
+
+#ifndef _WIN32
+	if (buf->fd == data->syncpipe_wake_recv[0]) {
+	    /* dummy sync pipe, just to wake us */
+	    if (read(buf->fd, buff, sizeof(buff)) < 0) {
+		logg("^Syncpipe read failed\n");
+	    }
+	    continue;
+	}
+#endif
+	if (buf->got_newdata == -1) {
+	    if (buf->mode == MODE_WAITREPLY) {
+		logg("$mode WAIT_REPLY -> closed\n");
+		buf->fd = -1;
+		thrmgr_group_terminate(buf->group);
+		thrmgr_group_finished(buf->group, EXIT_ERROR);
+		continue;
+	    } else {
+		logg("$client read error or EOF on read\n");
+		error = 1;
+	    }
+	}
+
+	if (buf->fd != -1 && buf->got_newdata == -2) {
+	    if (buf->mode == MODE_MUX && thrmgr_group_pending(buf->group)) {
+		/* the client is waiting for the replies of its streams */
+		logg("$MUXSESSION: scans pending, not timing out\n");
+		time(&buf->timeout_at);
+		buf->timeout_at += data->readtimeout;
+	    } else if (buf->mode == MODE_MUX) {
+		client_conn_t conn;
+
+		logg("$Client read timed out\n");
+		memset(&conn, 0, sizeof(conn));
+		conn.sd = buf->fd;
+		conn.mode = MODE_MUX;
+		conn_reply_mux(&conn, MUX_STATUS_ERROR, "COMMAND READ TIMED OUT", 0, 0);
+		error = 1;
+	    } else {
+		logg("$Client read timed out\n");
+		mdprintf(buf->fd, "COMMAND READ TIMED OUT\n");
+		error = 1;
+	    }
+	}
+
+	data->rr_last = i;
+	if (buf->mode == MODE_WAITANCILL) {
+	    buf->mode = MODE_COMMAND;
+	    logg("$mode -> MODE_COMMAND\n");
+	}
+	while (!error && buf->fd != -1 && buf->buffer && pos < buf->off &&
+	       buf->mode != MODE_WAITANCILL) {
+	    client_conn_t conn;
+	    const char *cmd = NULL;
+	    int rc;
+	    /* New data available to read on socket. */
+
+	    memset(&conn, 0, sizeof(conn));
+	    conn.scanfd = buf->recvfd;
+	    buf->recvfd = -1;
+	    conn.sd = buf->fd;
+	    conn.options = data->options;
+	    conn.opts = data->opts;
+	    conn.thrpool = data->thr_pool;
+	    conn.engine = engine;
+	    conn.group = buf->group;
+	    conn.id = buf->id;
+	    conn.quota = buf->quota;
+	    conn.filename = buf->dumpname;
+	    conn.mode = buf->mode;
+	    conn.term = buf->term;
+	    conn.deadline_ms = buf->deadline_ms;
+	    conn.trace = buf->trace;
+
+	    /* Parse & dispatch command */
+	    cmd = parse_dispatch_cmd(&conn, buf, &pos, &error, data->opts, data->readtimeout);
+
+	    if (conn.mode == MODE_COMMAND && !cmd)
+		break;
+	    if (!error) {
+		if (buf->mode == MODE_WAITREPLY && buf->off) {
+		    /* Client is not supposed to send anything more */
+		    logg("^Client sent garbage after last command: %lu bytes\n", (unsigned long)buf->off);
+		    buf->buffer[buf->off] = '\0';
+		    logg("$Garbage: %s\n", buf->buffer);
+		    error = 1;
+		} else if (buf->mode == MODE_STREAM) {
+		    rc = handle_stream(&conn, buf, data->opts, &error, &pos, data->readtimeout, data->splice_pipe);
+		    if (rc == -1)
+			break;
+		    else
+			continue;
+		} else if (buf->mode == MODE_MUX) {
+		    handle_mux(&conn, buf, data->opts, &error, &pos, data->readtimeout);
+		    break;
+		}
+	    }
+	    if (error && error != CL_ETIMEOUT) {
+		conn_reply_error(&conn, "Error processing command.");
+	    }
+	}
+	if (error) {
+	    mux_free(buf);
+	    cl_hash_destroy(buf->hashctx);
+	    buf->hashctx = NULL;
+	    if (buf->dumpfd != -1) {
+		close(buf->dumpfd);
+		if (buf->dumpname) {
+		    cli_unlink(buf->dumpname);
+		    free(buf->dumpname);
+		}
+		buf->dumpfd = -1;
+	    }
+	    thrmgr_group_terminate(buf->group);
+	    if (thrmgr_group_finished(buf->group, EXIT_ERROR)) {
+		if (buf->fd < 0) {
+		    logg("$Skipping shutdown of bad socket after error (FD %d)\n", buf->fd);
+		}
+		else {
+		    logg("$Shutting down socket after error (FD %d)\n", buf->fd);
+		    shutdown(buf->fd, 2);
+		    closesocket(buf->fd);
+		}
+	    } else
+		logg("$Socket not shut down due to active tasks\n");
+	    buf->fd = -1;
+	}
+    }
+    pthread_mutex_unlock(fds->buf_mutex);
+
+
+    return new_sd;
+}
+
+static void recvloop_close(struct acceptdata *data)
+{
+    struct fd_data *fds = &data->recv_fds;
+    size_t i;
+
+    pthread_mutex_lock(fds->buf_mutex);
+    if (sd_listen_fds(0) == 0)
+    {
+        /* only close the sockets, when not using systemd socket activation */
+        for (i=0;i < fds->nfds; i++)
+        {
+            if (fds->buf[i].fd == -1)
+                continue;
+            thrmgr_group_terminate(fds->buf[i].group);
+            if (thrmgr_group_finished(fds->buf[i].group, EXIT_ERROR))
+            {
+                logg("$Shutdown closed fd %d\n", fds->buf[i].fd);
+                shutdown(fds->buf[i].fd, 2);
+                closesocket(fds->buf[i].fd);
+                fds->buf[i].fd = -1;
+            }
+        }
+    }
+    pthread_mutex_unlock(fds->buf_mutex);
+}
+
+#ifndef _WIN32
+/*
+ * With ReceiveThreads > 1 more accept/receive loop pairs run next to the
+ * main thread's, each owning the connections it accepts. A TCP listener is
+ * cloned with SO_REUSEPORT for every loop so the kernel spreads connections
+ * across them; listeners that can't be cloned (local socket, systemd) are
+ * shared. All loops dispatch into the same thread pool. The extra loops get
+ * the engine through shard_engine, which is NULL during a reload.
+ */
+struct recvshard {
+    struct acceptdata data;
+    pthread_mutex_t fds_mutex;
+    pthread_mutex_t recvfds_mutex;
+    pthread_t accept_th;
+    pthread_t recv_th;
+    int *lsockets; /* listeners opened for this loop */
+    unsigned int nlsockets;
+};
+
+static struct cl_engine *shard_engine = NULL;
+static int shard_exit = 0;
+static pthread_mutex_t shard_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t shard_cond = PTHREAD_COND_INITIALIZER;
+
+static void shard_set_engine(struct cl_engine *engine, int exiting)
+{
+    pthread_mutex_lock(&shard_mutex);
+    shard_engine = engine;
+    shard_exit = exiting;
+    pthread_cond_broadcast(&shard_cond);
+    pthread_mutex_unlock(&shard_mutex);
+}
+
+/* Returns a reference the caller must drop with cl_engine_free(), or NULL
+ * when clamd is shutting down */
+static struct cl_engine *shard_get_engine(void)
+{
+    struct cl_engine *engine = NULL;
+
+    pthread_mutex_lock(&shard_mutex);
+    while (!shard_engine && !shard_exit)
+	pthread_cond_wait(&shard_cond, &shard_mutex);
+    if (shard_engine && !cl_engine_addref(shard_engine))
+	engine = shard_engine;
+    pthread_mutex_unlock(&shard_mutex);
+    return engine;
+}
+
+static void *recvshard_th(void *arg)
+{
+    struct acceptdata *data = (struct acceptdata *)arg;
+    struct cl_engine *engine;
+    int exiting;
+
+    for (;;) {
+	if (!(engine = shard_get_engine()))
+	    break;
+	recvloop_process(data, engine, -1, 0);
+	cl_engine_free(engine);
+
+	pthread_mutex_lock(&exit_mutex);
+	exiting = progexit;
+	pthread_mutex_unlock(&exit_mutex);
+	if (exiting)
+	    break;
+    }
+    recvloop_close(data);
+    return NULL;
+}
+
+static int recvshard_start(struct recvshard *shard, unsigned int id, const struct acceptdata *main_data, int *socketds, unsigned nsockets)
+{
+    struct acceptdata *data = &shard->data;
+    struct acceptdata init = ACCEPTDATA_INIT(&shard->fds_mutex, &shard->recvfds_mutex);
+    unsigned int i;
+    int sd, *t;
+
+    *data = init;
+    pthread_mutex_init(&shard->fds_mutex, NULL);
+    pthread_mutex_init(&shard->recvfds_mutex, NULL);
+    pthread_cond_init(&data->cond_nfds, NULL);
+    data->shard = id;
+    data->max_queue = main_data->max_queue;
+    data->commandtimeout = main_data->commandtimeout;
+    data->readtimeout = main_data->readtimeout;
+    data->options = main_data->options;
+    data->opts = main_data->opts;
+    data->thr_pool = main_data->thr_pool;
+
+    for (i = 0; i < nsockets; i++) {
+	sd = tcpserver_clone(socketds[i], data->opts);
+	if (sd >= 0) {
+	    if ((t = realloc(shard->lsockets, (shard->nlsockets + 1) * sizeof(*t)))) {
+		shard->lsockets = t;
+		shard->lsockets[shard->nlsockets++] = sd;
+	    } else {
+		closesocket(sd);
+		sd = socketds[i];
+	    }
+	} else {
+	    sd = socketds[i];
+	}
+	if (fds_add(&data->fds, sd, 1, 0) == -1)
+	    return -1;
+    }
+
+    if (pipe(data->syncpipe_wake_recv) == -1 ||
+	pipe(data->syncpipe_wake_accept) == -1) {
+	logg("!pipe failed\n");
+	return -1;
+    }
+    if (fds_add(&data->recv_fds, data->syncpipe_wake_recv[0], 1, 0) == -1 ||
+	fds_add(&data->fds, data->syncpipe_wake_accept[0], 1, 0) == -1) {
+	logg("!failed to add pipe fd\n");
+	return -1;
+    }
+
+    if (pthread_create(&shard->accept_th, NULL, acceptloop_th, data) ||
+	pthread_create(&shard->recv_th, NULL, recvshard_th, data)) {
+	logg("!pthread_create failed\n");
+	return -1;
+    }
+    logg("*Receive thread %u started, %u own listening socket%s\n", id,
+	 shard->nlsockets, shard->nlsockets == 1 ? "" : "s");
+    return 0;
+}
+
+static void recvshard_wake(struct recvshard *shards, unsigned int nshards)
+{
+    unsigned int i;
+
+    for (i = 0; i < nshards; i++)
+	if (write(shards[i].data.syncpipe_wake_recv[1], "", 1) < 0)
+	    logg("^Write to syncpipe failed\n");
+}
+
+/* Stops the receive loops, must be done before the thread pool goes away */
+static void recvshard_stop(struct recvshard *shards, unsigned int nshards)
+{
+    unsigned int i;
+
+    shard_set_engine(NULL, 1);
+    for (i = 0; i < nshards; i++)
+	if (write(shards[i].data.syncpipe_wake_accept[1], "", 1) < 0)
+	    logg("^Write to syncpipe failed\n");
+    recvshard_wake(shards, nshards);
+    for (i = 0; i < nshards; i++)
+	pthread_join(shards[i].recv_th, NULL);
+}
+
+static void recvshard_free(struct recvshard *shards, unsigned int nshards)
+{
+    unsigned int i, j;
+
+    for (i = 0; i < nshards; i++) {
+	struct recvshard *shard = &shards[i];
+
+	pthread_join(shard->accept_th, NULL);
+	fds_free(&shard->data.recv_fds);
+	pthread_mutex_destroy(&shard->fds_mutex);
+	pthread_mutex_destroy(&shard->recvfds_mutex);
+	pthread_cond_destroy(&shard->data.cond_nfds);
+	close(shard->data.syncpipe_wake_accept[1]);
+	close(shard->data.syncpipe_wake_recv[1]);
+	if (shard->data.splice_pipe[0] != -1) {
+	    close(shard->data.splice_pipe[0]);
+	    close(shard->data.splice_pipe[1]);
+	}
+	for (j = 0; j < shard->nlsockets; j++) {
+	    shutdown(shard->lsockets[j], 2);
+	    closesocket(shard->lsockets[j]);
+	}
+	free(shard->lsockets);
+    }
+    free(shards);
+}
+#endif
+
 int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsigned int dboptions, const struct optstruct *opts)
 {
 	int max_threads, max_queue, readtimeout, ret = 0;
@@ -725,19 +1460,23 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 #endif
 	mode_t old_umask;
 	const struct optstruct *opt;
-	char buff[BUFFSIZE + 1];
 	pid_t mainpid;
 	int idletimeout;
 	unsigned long long val;
-	size_t i, j, rr_last = 0;
+	size_t i;
 	pthread_t accept_th;
 	pthread_mutex_t fds_mutex = PTHREAD_MUTEX_INITIALIZER;
 	pthread_mutex_t recvfds_mutex = PTHREAD_MUTEX_INITIALIZER;
 	struct acceptdata acceptdata = ACCEPTDATA_INIT(&fds_mutex, &recvfds_mutex);
 	struct fd_data *fds = &acceptdata.recv_fds;
 	time_t start_time, current_time;
+	struct timeval tv_reload;
 	unsigned int selfchk;
 	threadpool_t *thr_pool;
+	unsigned int nshards = 1;
+#ifndef _WIN32
+	struct recvshard *shards = NULL;
+#endif
 
 #if defined(FANOTIFY) || defined(CLAMAUTH)
 	pthread_t fan_pid;
@@ -918,6 +1657,25 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     val = cl_engine_get_num(engine, CL_ENGINE_PCRE_MAX_FILESIZE, NULL);
     logg("Limits: PCREMaxFileSize limit set to %llu.\n", val);
 
+    if((opt = optget(opts, "ReadaheadPages"))->active) {
+        if((ret = cl_engine_set_num(engine, CL_ENGINE_READAHEAD, opt->numarg))) {
+            logg("!cli_engine_set_num(ReadaheadPages) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 1;
+        }
+    }
+    val = cl_engine_get_num(engine, CL_ENGINE_READAHEAD, NULL);
+    logg("ReadaheadPages set to %llu.\n", val);
+
+    if(optget(opts, "SignatureProfiling")->enabled) {
+        if((ret = cl_engine_set_num(engine, CL_ENGINE_SIGPROFILE, 1))) {
+            logg("!cli_engine_set_num(SignatureProfiling) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 1;
+        }
+        logg("Signature profiling enabled.\n");
+    }
+
     if(optget(opts, "ScanArchive")->enabled) {
 	logg("Archive support enabled.\n");
 	options |= CL_SCAN_ARCHIVE;
@@ -1104,6 +1862,10 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     max_queue = optget(opts, "MaxQueue")->numarg;
     acceptdata.commandtimeout = optget(opts, "CommandReadTimeout")->numarg;
     readtimeout = optget(opts, "ReadTimeout")->numarg;
+#ifndef _WIN32
+    if ((nshards = optget(opts, "ReceiveThreads")->numarg) < 1)
+	nshards = 1;
+#endif
 
 #if !defined(_WIN32) && defined(RLIMIT_NOFILE)
     if (getrlimit(RLIMIT_NOFILE, &rlim) == 0) {
@@ -1156,7 +1918,11 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     }
 #endif
     logg("*MaxQueue set to: %d\n", max_queue);
-    acceptdata.max_queue = max_queue;
+    /* each receive loop gets its share of the queue */
+    acceptdata.max_queue = (max_queue + nshards - 1) / nshards;
+    acceptdata.readtimeout = readtimeout;
+    acceptdata.options = options;
+    acceptdata.opts = opts;
 
     if(optget(opts, "ScanOnAccess")->enabled)
 
@@ -1247,6 +2013,34 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	logg("!thrmgr_new failed\n");
 	exit(-1);
     }
+    acceptdata.thr_pool = thr_pool;
+
+#ifndef _WIN32
+    if (nshards > 1) {
+	int flags;
+
+	/* several accept loops may wake up for the same shared listener */
+	for (i = 0; i < nsockets; i++) {
+	    flags = fcntl(socketds[i], F_GETFL, 0);
+	    if (flags == -1 || fcntl(socketds[i], F_SETFL, flags | O_NONBLOCK) == -1) {
+		logg("!Can't set O_NONBLOCK on listening socket %d\n", socketds[i]);
+		exit(-1);
+	    }
+	}
+
+	shard_set_engine(engine, 0);
+	if (!(shards = calloc(nshards - 1, sizeof(*shards)))) {
+	    logg("!Can't allocate memory for receive threads\n");
+	    exit(-1);
+	}
+	for (i = 1; i < nshards; i++)
+	    if (recvshard_start(&shards[i - 1], i, &acceptdata, socketds, nsockets) == -1) {
+		logg("!Can't start receive thread %u\n", (unsigned int)i);
+		exit(-1);
+	    }
+	logg("*Receive threads: %u\n", nshards);
+    }
+#endif
 
     if (pthread_create(&accept_th, NULL, acceptloop_th, &acceptdata)) {
 	logg("!pthread_create failed\n");
@@ -1257,170 +2051,13 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     for(;;) {
 	int new_sd;
 
-	/* Block waiting for connection on any of the sockets */
-	pthread_mutex_lock(fds->buf_mutex);
-	fds_cleanup(fds);
-	/* signal that we can accept more connections */
-	if (fds->nfds <= (unsigned)max_queue)
-	    pthread_cond_signal(&acceptdata.cond_nfds);
-	new_sd = fds_poll_recv(fds, selfchk ? (int)selfchk : -1, 1, event_wake_recv);
-#ifdef _WIN32
-	ResetEvent(event_wake_recv);
-#else
-	if (!fds->nfds) {
-	    /* at least the dummy/sync pipe should have remained */
-	    logg("!All recv() descriptors gone: fatal\n");
-	    pthread_mutex_lock(&exit_mutex);
-	    progexit = 1;
-	    pthread_mutex_unlock(&exit_mutex);
-	    pthread_mutex_unlock(fds->buf_mutex);
-	    break;
-	}
-#endif
-	if (new_sd == -1 && errno != EINTR) {
-	    logg("!Failed to poll sockets, fatal\n");
-	    pthread_mutex_lock(&exit_mutex);
-	    progexit = 1;
-	    pthread_mutex_unlock(&exit_mutex);
-	}
-
-
-	if(fds->nfds) i = (rr_last + 1) % fds->nfds;
-	for (j = 0;  j < fds->nfds && new_sd >= 0; j++, i = (i+1) % fds->nfds) {
-	    size_t pos = 0;
-	    int error = 0;
-	    struct fd_buf *buf = &fds->buf[i];
-	    if (!buf->got_newdata)
-		continue;
-
-#ifndef _WIN32
-	    if (buf->fd == acceptdata.syncpipe_wake_recv[0]) {
-		/* dummy sync pipe, just to wake us */
-		if (read(buf->fd, buff, sizeof(buff)) < 0) {
-		    logg("^Syncpipe read failed\n");
-		}
-		continue;
-	    }
-#endif
-	    if (buf->got_newdata == -1) {
-		if (buf->mode == MODE_WAITREPLY) {
-		    logg("$mode WAIT_REPLY -> closed\n");
-		    buf->fd = -1;
-		    thrmgr_group_terminate(buf->group);
-		    thrmgr_group_finished(buf->group, EXIT_ERROR);
-		    continue;
-		} else {
-		    logg("$client read error or EOF on read\n");
-		    error = 1;
-		}
-	    }
-
-	    if (buf->fd != -1 && buf->got_newdata == -2) {
-		logg("$Client read timed out\n");
-		mdprintf(buf->fd, "COMMAND READ TIMED OUT\n");
-		error = 1;
-	    }
-
-	    rr_last = i;
-	    if (buf->mode == MODE_WAITANCILL) {
-		buf->mode = MODE_COMMAND;
-		logg("$mode -> MODE_COMMAND\n");
-	    }
-	    while (!error && buf->fd != -1 && buf->buffer && pos < buf->off &&
-		   buf->mode != MODE_WAITANCILL) {
-		client_conn_t conn;
-		const char *cmd = NULL;
-		int rc;
-		/* New data available to read on socket. */
-
-		memset(&conn, 0, sizeof(conn));
-		conn.scanfd = buf->recvfd;
-		buf->recvfd = -1;
-		conn.sd = buf->fd;
-		conn.options = options;
-		conn.opts = opts;
-		conn.thrpool = thr_pool;
-		conn.engine = engine;
-		conn.group = buf->group;
-		conn.id = buf->id;
-		conn.quota = buf->quota;
-		conn.filename = buf->dumpname;
-		conn.mode = buf->mode;
-		conn.term = buf->term;
-
-		/* Parse & dispatch command */
-		cmd = parse_dispatch_cmd(&conn, buf, &pos, &error, opts, readtimeout);
-
-		if (conn.mode == MODE_COMMAND && !cmd)
-		    break;
-		if (!error) {
-		    if (buf->mode == MODE_WAITREPLY && buf->off) {
-			/* Client is not supposed to send anything more */
-			logg("^Client sent garbage after last command: %lu bytes\n", (unsigned long)buf->off);
-			buf->buffer[buf->off] = '\0';
-			logg("$Garbage: %s\n", buf->buffer);
-			error = 1;
-		    } else if (buf->mode == MODE_STREAM) {
-			rc = handle_stream(&conn, buf, opts, &error, &pos, readtimeout);
-			if (rc == -1)
-			    break;
-			else
-			    continue;
-		    }
-		}
-		if (error && error != CL_ETIMEOUT) {
-		    conn_reply_error(&conn, "Error processing command.");
-		}
-	    }
-	    if (error) {
-		if (buf->dumpfd != -1) {
-		    close(buf->dumpfd);
-		    if (buf->dumpname) {
-			cli_unlink(buf->dumpname);
-			free(buf->dumpname);
-		    }
-		    buf->dumpfd = -1;
-		}
-		thrmgr_group_terminate(buf->group);
-		if (thrmgr_group_finished(buf->group, EXIT_ERROR)) {
-		    if (buf->fd < 0) {
-			logg("$Skipping shutdown of bad socket after error (FD %d)\n", buf->fd);
-		    }
-		    else {
-			logg("$Shutting down socket after error (FD %d)\n", buf->fd);
-			shutdown(buf->fd, 2);
-			closesocket(buf->fd);
-		    }
-		} else
-		    logg("$Socket not shut down due to active tasks\n");
-		buf->fd = -1;
-	    }
-	}
-	pthread_mutex_unlock(fds->buf_mutex);
+	new_sd = recvloop_process(&acceptdata, engine, selfchk ? (int)selfchk : -1, 1);
 
 	/* handle progexit */
 	pthread_mutex_lock(&exit_mutex);
 	if (progexit) {
 	    pthread_mutex_unlock(&exit_mutex);
-	    pthread_mutex_lock(fds->buf_mutex);
-        if (sd_listen_fds(0) == 0)
-        {
-            /* only close the sockets, when not using systemd socket activation */
-            for (i=0;i < fds->nfds; i++)
-            {
-                if (fds->buf[i].fd == -1)
-                    continue;
-                thrmgr_group_terminate(fds->buf[i].group);
-                if (thrmgr_group_finished(fds->buf[i].group, EXIT_ERROR))
-                {
-                    logg("$Shutdown closed fd %d\n", fds->buf[i].fd);
-                    shutdown(fds->buf[i].fd, 2);
-                    closesocket(fds->buf[i].fd);
-                    fds->buf[i].fd = -1;
-                }
-            }
-	    }
-	    pthread_mutex_unlock(fds->buf_mutex);
+	    recvloop_close(&acceptdata);
 	    break;
 	}
 	pthread_mutex_unlock(&exit_mutex);
@@ -1452,6 +2089,14 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	if(reload) {
 	    pthread_mutex_unlock(&reload_mutex);
 
+	    gettimeofday(&tv_reload, NULL);
+#ifndef _WIN32
+	    if (shards) {
+		/* make the other receive loops drop the old engine */
+		shard_set_engine(NULL, 0);
+		recvshard_wake(shards, nshards - 1);
+	    }
+#endif
 	    engine = reload_db(engine, dboptions, opts, FALSE, &ret);
 	    if(ret) {
 		logg("Terminating because of a fatal error.\n");
@@ -1464,6 +2109,11 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 	    reload = 0;
 	    time(&reloaded_time);
 	    pthread_mutex_unlock(&reload_mutex);
+	    metrics_reload(metrics_elapsed(&tv_reload));
+#ifndef _WIN32
+	    if (shards)
+		shard_set_engine(engine, 0);
+#endif
 
 #if defined(FANOTIFY) || defined(CLAMAUTH)
 	    if(optget(opts, "ScanOnAccess")->enabled && tharg) {
@@ -1485,6 +2135,10 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     if (write(acceptdata.syncpipe_wake_accept[1], "", 1) < 0) {
 	logg("^Write to syncpipe failed\n");
     }
+#endif
+#ifndef _WIN32
+    if (shards)
+	recvshard_stop(shards, nshards - 1);
 #endif
     /* Destroy the thread manager.
      * This waits for all current tasks to end
@@ -1507,6 +2161,10 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
     }
 
     pthread_join(accept_th, NULL);
+#ifndef _WIN32
+    if (shards)
+	recvshard_free(shards, nshards - 1);
+#endif
     fds_free(fds);
     pthread_mutex_destroy(fds->buf_mutex);
     pthread_cond_destroy(&acceptdata.cond_nfds);
@@ -1516,6 +2174,10 @@ int recvloop_th(int *socketds, unsigned nsockets, struct cl_engine *engine, unsi
 #else
     close(acceptdata.syncpipe_wake_accept[1]);
     close(acceptdata.syncpipe_wake_recv[1]);
+    if (acceptdata.splice_pipe[0] != -1) {
+	close(acceptdata.splice_pipe[0]);
+	close(acceptdata.splice_pipe[1]);
+    }
 #endif
     if(dbstat.entries)
 	cl_statfree(&dbstat);
@@ -44,6 +44,9 @@
 
 #include <sys/time.h>
 #endif
+#ifdef HAVE_MEMFD_CREATE
+#include <sys/mman.h>
+#endif
 #include <pthread.h>
 #include <time.h>
 #include <errno.h>
@@ -58,10 +61,14 @@
 #include "shared/output.h"
 #include "shared/misc.h"
 
+#include "shared/clamdcom.h"
+
 #include "others.h"
 #include "scanner.h"
 #include "server.h"
 #include "session.h"
+#include "metrics.h"
+#include "walker.h"
 #include "thrmgr.h"
 
 #ifndef HAVE_FDPASSING
@@ -74,7 +81,7 @@ static struct {
     const char *cmd;
     const size_t len;
     enum commands cmdtype;
-    int need_arg;
+    int need_arg; /* 2 - optional */
     int support_old;
     int enabled;
 } commands[] = {
@@ -96,7 +103,12 @@ static struct {
     {CMD17, sizeof(CMD17)-1,	COMMAND_INSTREAM,   0,	0, 1},
     {CMD19, sizeof(CMD19)-1,	COMMAND_DETSTATSCLEAR,	0, 1, 1},
     {CMD20, sizeof(CMD20)-1,	COMMAND_DETSTATS,   0, 1, 1},
-    {CMD21, sizeof(CMD21)-1,	COMMAND_ALLMATCHSCAN,  1, 0, 1}
+    {CMD21, sizeof(CMD21)-1,	COMMAND_ALLMATCHSCAN,  1, 0, 1},
+    {CMD22, sizeof(CMD22)-1,	COMMAND_SIGPROFILE, 0, 0, 1},
+    {CMD23, sizeof(CMD23)-1,	COMMAND_METRICS,    0, 0, 1},
+    {CMD24, sizeof(CMD24)-1,	COMMAND_TRACESCAN,  2, 0, 1},
+    {CMD25, sizeof(CMD25)-1,	COMMAND_DEADLINE,   1, 0, 1},
+    {CMD26, sizeof(CMD26)-1,	COMMAND_MUXSESSION, 0, 0, 1}
 };
 
 enum commands parse_command(const char *cmd, const char **argument, int oldstyle)
@@ -109,10 +121,12 @@ enum commands parse_command(const char *cmd, const char **argument, int oldstyle
 	    const char *arg = cmd + len;
 	    if (commands[i].need_arg) {
 		if (!*arg) {/* missing argument */
-		    logg("$Command %s missing argument!\n", commands[i].cmd);
-		    return COMMAND_UNKNOWN;
-		}
-		*argument = arg+1;
+		    if (commands[i].need_arg == 1) {
+			logg("$Command %s missing argument!\n", commands[i].cmd);
+			return COMMAND_UNKNOWN;
+		    }
+		} else
+		    *argument = arg+1;
 	    } else {
 		if (*arg) {/* extra stuff after command */
 		    logg("$Command %s has trailing garbage!\n", commands[i].cmd);
@@ -130,8 +144,31 @@ enum commands parse_command(const char *cmd, const char **argument, int oldstyle
     return COMMAND_UNKNOWN;
 }
 
+/* Sends a MUXSESSION reply frame for the stream in conn->id */
+int conn_reply_mux(const client_conn_t *conn, unsigned int status, const char *text, unsigned long long usecs, unsigned long long bytes)
+{
+    unsigned char frame[MUX_REPLY_HDRLEN + 256];
+    struct mux_reply r;
+    size_t len = text ? strlen(text) : 0;
+
+    if (len > sizeof(frame) - MUX_REPLY_HDRLEN)
+	len = sizeof(frame) - MUX_REPLY_HDRLEN;
+    r.id = conn->id;
+    r.status = status;
+    r.textlen = len;
+    r.usecs = usecs;
+    r.bytes = bytes;
+    mux_putreply(frame, &r);
+    if (len)
+	memcpy(frame + MUX_REPLY_HDRLEN, text, len);
+    return mdwrite(conn->sd, frame, MUX_REPLY_HDRLEN + len);
+}
+
 int conn_reply_single(const client_conn_t *conn, const char *path, const char *status)
 {
+    if (conn->mode == MODE_MUX)
+	return conn_reply_mux(conn, strcmp(status, "OK") ? MUX_STATUS_ERROR : MUX_STATUS_OK,
+			      strcmp(status, "OK") ? status : NULL, 0, 0);
     if (conn->id) {
 	if (path)
 	    return mdprintf(conn->sd, "%u: %s: %s%c", conn->id, path, status, conn->term);
@@ -145,6 +182,8 @@ int conn_reply_single(const client_conn_t *conn, const char *path, const char *s
 int conn_reply(const client_conn_t *conn, const char *path,
 	       const char *msg, const char *status)
 {
+    if (conn->mode == MODE_MUX)
+	return conn_reply_mux(conn, MUX_STATUS_ERROR, msg, 0, 0);
     if (conn->id) {
 	if (path)
 	    return mdprintf(conn->sd, "%u: %s: %s %s%c", conn->id, path, msg,
@@ -160,6 +199,8 @@ int conn_reply(const client_conn_t *conn, const char *path,
 int conn_reply_virus(const client_conn_t *conn, const char *file,
 	       const char *virname)
 {
+    if (conn->mode == MODE_MUX)
+	return conn_reply_mux(conn, MUX_STATUS_FOUND, virname, 0, 0);
     if (conn->id) {
 	return mdprintf(conn->sd, "%u: %s: %s FOUND%c", conn->id, file, virname,
 	    conn->term);
@@ -182,6 +223,26 @@ int conn_reply_errno(const client_conn_t *conn, const char *path,
     return conn_reply(conn, path, msg, err);
 }
 
+#define SIGPROFILE_MAX 100
+static int sigprofile_line(const char *virname, const char *kind, unsigned long long calls, unsigned long long matches, unsigned long long usecs, void *context)
+{
+    mdprintf(*(int *)context, "%s %s runs: %llu matches: %llu usecs: %llu avg: %.2f\n",
+	     virname, kind, calls, matches, usecs, calls ? (double)usecs / calls : 0.0);
+    return 0;
+}
+
+static void print_sigprofile(int desc, char term, const struct cl_engine *engine)
+{
+    if (!cl_engine_get_num(engine, CL_ENGINE_SIGPROFILE, NULL)) {
+	mdprintf(desc, "Signature profiling disabled by clamd configuration. ERROR%c", term);
+	return;
+    }
+    mdprintf(desc, "SIGNATURES (top %u by total time):\n", SIGPROFILE_MAX);
+    if (cl_sigprof_report(SIGPROFILE_MAX, sigprofile_line, &desc) != CL_SUCCESS)
+	mdprintf(desc, "(ERROR: out of memory)\n");
+    mdprintf(desc, "END%c", term);
+}
+
 /* returns
  *  -1 on fatal error (shutdown)
  *  0 on ok
@@ -326,6 +387,18 @@ int command(client_conn_t *conn, int *virus)
 		 mdprintf(desc, "%u: ", conn->id);
 	     thrmgr_printstats(desc, conn->term);
 	     return 0;
+	 case COMMAND_METRICS:
+	     thrmgr_setactivetask(NULL, "METRICS");
+	     if (conn->group)
+		 mdprintf(desc, "%u: ", conn->id);
+	     metrics_print(desc, conn->term, engine);
+	     return 0;
+	 case COMMAND_SIGPROFILE:
+	     thrmgr_setactivetask(NULL, "SIGPROFILE");
+	     if (conn->group)
+		 mdprintf(desc, "%u: ", conn->id);
+	     print_sigprofile(desc, conn->term, engine);
+	     return 0;
 	 case COMMAND_STREAM:
 	     thrmgr_setactivetask(NULL, "STREAM");
 	     ret = scanstream(desc, NULL, engine, options, opts, conn->term);
@@ -354,13 +427,15 @@ int command(client_conn_t *conn, int *virus)
 		 ret = 1;
 	     } else
 		 ret = 0;
-	     if (ftruncate(conn->scanfd, 0) == -1) {
+	     /* a memfd (no filename) is sealed and goes away on close */
+	     if (conn->filename && ftruncate(conn->scanfd, 0) == -1) {
 		 /* not serious, we're going to close it and unlink it anyway */
 		 logg("*ftruncate failed: %d\n", errno);
 	     }
 	     close(conn->scanfd);
 	     conn->scanfd = -1;
-	     cli_unlink(conn->filename);
+	     if (conn->filename)
+		 cli_unlink(conn->filename);
 	     return ret;
 	 case COMMAND_ALLMATCHSCAN:
 	     if (!optget(opts, "AllowAllMatchScan")->enabled) {
@@ -372,6 +447,11 @@ int command(client_conn_t *conn, int *virus)
 	    scandata.options |= CL_SCAN_ALLMATCHES;
 	    type = TYPE_SCAN;
 	    break;
+	 case COMMAND_TRACESCAN:
+	    thrmgr_setactivetask(NULL, "TRACESCAN");
+	    scandata.options |= CL_SCAN_TRACE;
+	    type = TYPE_SCAN;
+	    break;
 	 default:
 	    logg("!Invalid command dispatched: %d\n", conn->cmdtype);
 	    return 1;
@@ -388,7 +468,11 @@ int command(client_conn_t *conn, int *virus)
 	 if(CLAMSTAT(conn->filename, &sb) == 0)
 	     scandata.dev = sb.st_dev;
 
-     ret = cli_ftw(conn->filename, flags,  maxdirrec ? maxdirrec : INT_MAX, scan_callback, &data, scan_pathchk);
+     if (type == TYPE_MULTISCAN)
+	 ret = walker_ftw(conn->filename, flags, maxdirrec ? maxdirrec : INT_MAX,
+			  optget(opts, "MultiscanWalkThreads")->numarg, scan_callback, &data, scan_pathchk);
+     else
+	 ret = cli_ftw(conn->filename, flags,  maxdirrec ? maxdirrec : INT_MAX, scan_callback, &data, scan_pathchk);
      if (ret == CL_EMEM) {
 	 if(optget(opts, "ExitOnOOM")->enabled)
 	     return -1;
@@ -429,6 +513,9 @@ int command(client_conn_t *conn, int *virus)
      }
      memcpy(dup_conn, conn, sizeof(*conn));
      dup_conn->cmdtype = cmd;
+     /* the time spent in the queue counts too */
+     if (conn->deadline_ms)
+	 dup_conn->deadline = cli_monotonic_usecs() + (uint64_t)conn->deadline_ms * 1000;
      if(cl_engine_addref(dup_conn->engine)) {
 	 logg("!cl_engine_addref() failed\n");
 	 free(dup_conn);
@@ -450,6 +537,7 @@ int command(client_conn_t *conn, int *virus)
 	 case COMMAND_CONTSCAN:
 	 case COMMAND_MULTISCAN:
 	 case COMMAND_ALLMATCHSCAN:
+	 case COMMAND_TRACESCAN:
 	    dup_conn->filename = cli_strdup_to_utf8(argument);
 	    if (!dup_conn->filename) {
 		logg("!Failed to allocate memory for filename\n");
@@ -462,6 +550,8 @@ int command(client_conn_t *conn, int *virus)
 	    break;
 	case COMMAND_STREAM:
 	case COMMAND_STATS:
+	case COMMAND_SIGPROFILE:
+	case COMMAND_METRICS:
 	    /* not a scan command, don't queue to bulk */
 	    bulk = 0;
 	    /* just dispatch the command */
@@ -484,6 +574,25 @@ int command(client_conn_t *conn, int *virus)
     return ret;
 }
 
+/* Opens the file INSTREAM data is collected in: an anonymous memory file
+ * with StreamInMemory, otherwise a temporary file */
+int instream_open(client_conn_t *conn)
+{
+#ifdef HAVE_MEMFD_CREATE
+    if (optget(conn->opts, "StreamInMemory")->enabled) {
+	int fd = memfd_create("clamd-instream", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+	if (fd != -1) {
+	    conn->filename = NULL;
+	    conn->scanfd = fd;
+	    return CL_SUCCESS;
+	}
+	logg("^INSTREAM: memfd_create failed, using a temporary file: %s\n", strerror(errno));
+    }
+#endif
+    return cli_gentempfd(optget(conn->opts, "TemporaryDirectory")->strarg, &conn->filename, &conn->scanfd);
+}
+
 static int print_ver(int desc, char term, const struct cl_engine *engine)
 {
     uint32_t ver;
@@ -543,13 +652,17 @@ int execute_or_dispatch_command(client_conn_t *conn, enum commands cmd, const ch
 	switch (cmd) {
 	    case COMMAND_FILDES:
 	    case COMMAND_SCAN:
+	    case COMMAND_TRACESCAN:
 	    case COMMAND_END:
 	    case COMMAND_INSTREAM:
 	    case COMMAND_INSTREAMSCAN:
 	    case COMMAND_VERSION:
 	    case COMMAND_PING:
 	    case COMMAND_STATS:
+	    case COMMAND_SIGPROFILE:
+	    case COMMAND_METRICS:
 	    case COMMAND_COMMANDS:
+	    case COMMAND_DEADLINE:
 		/* These commands are accepted inside IDSESSION */
 		break;
 	    default:
@@ -607,7 +720,7 @@ int execute_or_dispatch_command(client_conn_t *conn, enum commands cmd, const ch
 	    }
 	case COMMAND_INSTREAM:
 	    {
-		int rc = cli_gentempfd(optget(conn->opts, "TemporaryDirectory")->strarg, &conn->filename, &conn->scanfd);
+		int rc = instream_open(conn);
 		if (rc != CL_SUCCESS)
 		    return rc;
 		conn->quota = optget(conn->opts, "StreamMaxLength")->numarg;
@@ -618,16 +731,48 @@ int execute_or_dispatch_command(client_conn_t *conn, enum commands cmd, const ch
 	case COMMAND_MULTISCAN:
 	case COMMAND_CONTSCAN:
 	case COMMAND_STATS:
+	case COMMAND_SIGPROFILE:
+	case COMMAND_METRICS:
 	case COMMAND_FILDES:
 	case COMMAND_SCAN:
 	case COMMAND_INSTREAMSCAN:
 	case COMMAND_ALLMATCHSCAN:
 	    return dispatch_command(conn, cmd, argument);
+	case COMMAND_TRACESCAN:
+	    if (!argument) {
+		/* no reply, it applies to the INSTREAM and FILDES commands
+		 * that follow, like DEADLINE */
+		conn->trace = 1;
+		return 0;
+	    }
+	    return dispatch_command(conn, cmd, argument);
+	case COMMAND_DEADLINE:
+	    {
+		char *end;
+		unsigned long ms;
+
+		/* no reply, it applies to the commands that follow */
+		errno = 0;
+		ms = argument ? strtoul(argument, &end, 10) : 0;
+		if (!argument || end == argument || *end || errno || ms > UINT_MAX) {
+		    conn_reply_error(conn, "DEADLINE requires a number of milliseconds.");
+		    return 1;
+		}
+		conn->deadline_ms = ms;
+		return 0;
+	    }
 	case COMMAND_IDSESSION:
 	    conn->group = thrmgr_group_new();
 	    if (!conn->group)
 		return CL_EMEM;
 	    return 0;
+	case COMMAND_MUXSESSION:
+	    /* a session of its own, the streams are its jobs */
+	    conn->group = thrmgr_group_new();
+	    if (!conn->group)
+		return CL_EMEM;
+	    conn->mode = MODE_MUX;
+	    return 0;
 	case COMMAND_END:
 	    if (!conn->group) {
 		/* end without idsession? */
@@ -45,6 +45,11 @@
 #define CMD20 "DETSTATS"
 
 #define CMD21 "ALLMATCHSCAN"
+#define CMD22 "SIGPROFILE"
+#define CMD23 "METRICS"
+#define CMD24 "TRACESCAN"
+#define CMD25 "DEADLINE"
+#define CMD26 "MUXSESSION"
 
 #include "libclamav/clamav.h"
 #include "shared/optparser.h"
@@ -74,7 +79,12 @@ enum commands {
     /* internal commands */
     COMMAND_MULTISCANFILE,
     COMMAND_INSTREAMSCAN,
-    COMMAND_ALLMATCHSCAN
+    COMMAND_ALLMATCHSCAN,
+    COMMAND_SIGPROFILE,
+    COMMAND_METRICS,
+    COMMAND_TRACESCAN,
+    COMMAND_DEADLINE,
+    COMMAND_MUXSESSION
 };
 
 typedef struct client_conn_tag {
@@ -92,6 +102,11 @@ typedef struct client_conn_tag {
     long quota;
     jobgroup_t *group;
     enum mode mode;
+    unsigned int deadline_ms; /* per connection, from DEADLINE */
+    int trace; /* per connection, from TRACESCAN without a path */
+    uint64_t deadline; /* of this request, cli_monotonic_usecs() */
+    unsigned char md5[16]; /* of the INSTREAM data, see StreamHash */
+    int have_md5;
 } client_conn_t;
 
 int command(client_conn_t *conn, int *virus);
@@ -103,4 +118,6 @@ int conn_reply_single(const client_conn_t *conn, const char *path, const char *s
 int conn_reply_virus(const client_conn_t *conn, const char *file, const char *virname);
 int conn_reply_error(const client_conn_t *conn, const char *msg);
 int conn_reply_errno(const client_conn_t *conn, const char *path, const char *msg);
+int conn_reply_mux(const client_conn_t *conn, unsigned int status, const char *text, unsigned long long usecs, unsigned long long bytes);
+int instream_open(client_conn_t *conn);
 #endif
@@ -24,6 +24,10 @@
 
 extern short debug_mode, logok;
 
+/* index of unchanged clean files for CONTSCAN and MULTISCAN, or NULL */
+struct scan_index;
+extern struct scan_index *scanindex;
+
 #ifdef C_LINUX
 #include <sys/types.h>
 extern dev_t procdev;
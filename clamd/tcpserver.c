@@ -148,6 +148,14 @@ int tcpserver(int **lsockets, unsigned int *nlsockets, char *ipaddr, const struc
             logg("!TCP: setsocktopt(SO_REUSEADDR) error: %s\n", strerror(errno));
         }
 
+#ifdef SO_REUSEPORT
+        /* lets tcpserver_clone() open one listener per receive thread */
+        if (optget(opts, "ReceiveThreads")->numarg > 1 &&
+            setsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void *) &yes, sizeof(yes)) == -1) {
+            logg("^TCP: setsocktopt(SO_REUSEPORT) error: %s\n", strerror(errno));
+        }
+#endif
+
 #ifdef IPV6_V6ONLY
         if (p->ai_family == AF_INET6 &&
             setsockopt(sockfd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes)) == -1) {
@@ -200,3 +208,61 @@ int tcpserver(int **lsockets, unsigned int *nlsockets, char *ipaddr, const struc
 
     return 0;
 }
+
+/* Opens another listener on the address of sockfd, which must be a TCP
+ * socket bound with SO_REUSEPORT. Returns the new socket or -1. */
+int tcpserver_clone(int sockfd, const struct optstruct *opts)
+{
+#if defined(SO_REUSEPORT) && !defined(_WIN32)
+    struct sockaddr_storage addr;
+    socklen_t addrlen = sizeof(addr);
+    int yes = 1, val = 0;
+    socklen_t vallen = sizeof(val);
+    int newfd;
+
+    if (getsockname(sockfd, (struct sockaddr *) &addr, &addrlen) == -1)
+        return -1;
+    if (addr.ss_family != AF_INET && addr.ss_family != AF_INET6)
+        return -1;
+    /* systemd passed sockets and local sockets are shared instead */
+    if (getsockopt(sockfd, SOL_SOCKET, SO_REUSEPORT, (void *) &val, &vallen) == -1 || !val)
+        return -1;
+
+    if ((newfd = socket(addr.ss_family, SOCK_STREAM, 0)) == -1) {
+        logg("!TCP: socket() error: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (setsockopt(newfd, SOL_SOCKET, SO_REUSEADDR, (void *) &yes, sizeof(yes)) == -1 ||
+        setsockopt(newfd, SOL_SOCKET, SO_REUSEPORT, (void *) &yes, sizeof(yes)) == -1) {
+        logg("!TCP: setsocktopt(SO_REUSEPORT) error: %s\n", strerror(errno));
+        closesocket(newfd);
+        return -1;
+    }
+
+#ifdef IPV6_V6ONLY
+    if (addr.ss_family == AF_INET6 &&
+        setsockopt(newfd, IPPROTO_IPV6, IPV6_V6ONLY, &yes, sizeof(yes)) == -1) {
+        logg("!TCP: setsocktopt(IPV6_V6ONLY) error: %s\n", strerror(errno));
+    }
+#endif /* IPV6_V6ONLY */
+
+    if (bind(newfd, (struct sockaddr *) &addr, addrlen) == -1) {
+        logg("!TCP: Cannot bind cloned listener: %s\n", strerror(errno));
+        closesocket(newfd);
+        return -1;
+    }
+
+    if (listen(newfd, optget(opts, "MaxConnectionQueueLength")->numarg) == -1) {
+        logg("!TCP: Cannot listen on cloned listener: %s\n", strerror(errno));
+        closesocket(newfd);
+        return -1;
+    }
+
+    return newfd;
+#else
+    UNUSEDPARAM(sockfd);
+    UNUSEDPARAM(opts);
+    return -1;
+#endif
+}
@@ -25,5 +25,6 @@
 #include "shared/optparser.h"
 
 int tcpserver(int **lsockets, unsigned int *nlsockets, char *ipaddr, const struct optstruct *opts);
+int tcpserver_clone(int sockfd, const struct optstruct *opts);
 
 #endif
@@ -879,6 +879,21 @@ jobgroup_t *thrmgr_group_new(void)
     return group;
 }
 
+/* returns the number of jobs of the group that are queued or running */
+unsigned thrmgr_group_pending(jobgroup_t *group)
+{
+    unsigned ret = 0;
+
+    if (group) {
+	pthread_mutex_lock(&group->mutex);
+	/* the receiving thread holds one */
+	if (group->jobs > 1)
+	    ret = group->jobs - 1;
+	pthread_mutex_unlock(&group->mutex);
+    }
+    return ret;
+}
+
 int thrmgr_group_need_terminate(jobgroup_t *group)
 {
     int ret;
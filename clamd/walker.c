@@ -0,0 +1,398 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#ifdef	HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <pthread.h>
+
+#if defined(HAVE_READDIR_R_3) || defined(HAVE_READDIR_R_2)
+#include <limits.h>
+#include <stddef.h>
+#endif
+
+#include "libclamav/clamav.h"
+#include "libclamav/others.h"
+
+#include "shared/output.h"
+
+#include "walker.h"
+
+#ifdef HAVE_FSTATAT
+#if defined(HAVE_STAT64) && STAT64_BLACKLIST
+#define FSTATAT fstatat64
+#else
+#define FSTATAT fstatat
+#endif
+/* stat the entry through its directory, so no path lookup is repeated */
+#define WALK_LSTAT(dfd, name, path, sb) FSTATAT(dfd, name, sb, AT_SYMLINK_NOFOLLOW)
+#define WALK_STAT(dfd, name, path, sb) FSTATAT(dfd, name, sb, 0)
+#else
+#define WALK_LSTAT(dfd, name, path, sb) LSTAT(path, sb)
+#define WALK_STAT(dfd, name, path, sb) CLAMSTAT(path, sb)
+#endif
+
+#define FOLLOW_SYMLINK_MASK (CLI_FTW_FOLLOW_FILE_SYMLINK | CLI_FTW_FOLLOW_DIR_SYMLINK)
+
+struct walk_dir {
+    char *path;
+    int maxdepth;		/* directory levels left below path */
+    struct walk_dir *next;
+};
+
+struct walk_state {
+    pthread_mutex_t mutex;	/* protects the fields below and serializes the callback */
+    pthread_cond_t cond;
+    struct walk_dir *head;	/* directories not read yet, newest first */
+    unsigned int busy;		/* threads reading a directory */
+    int stop;			/* the callback asked to break out */
+    int ret;
+    int flags;
+    cli_ftw_cb callback;
+    cli_ftw_pathchk pathchk;
+    struct cli_ftw_cbdata *data;
+};
+
+enum walk_type {
+    walk_file,
+    walk_directory,
+    walk_ignored,
+    walk_skipped_link,
+    walk_skipped_special,
+    walk_error
+};
+
+static int walk_report(struct walk_state *w, STATBUF *sb, char *filename, const char *path, enum cli_ftw_reason reason)
+{
+    int ret;
+
+    pthread_mutex_lock(&w->mutex);
+    if (w->stop) {
+	ret = w->ret;
+	pthread_mutex_unlock(&w->mutex);
+	free(filename);
+	return ret;
+    }
+    ret = w->callback(sb, filename, path, reason, w->data);
+    if (ret != CL_SUCCESS) {
+	w->stop = 1;
+	w->ret = ret;
+	pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return ret;
+}
+
+static int walk_stopped(struct walk_state *w)
+{
+    int stop;
+
+    pthread_mutex_lock(&w->mutex);
+    stop = w->stop;
+    pthread_mutex_unlock(&w->mutex);
+    return stop;
+}
+
+/* takes over path */
+static int walk_push(struct walk_state *w, char *path, int maxdepth)
+{
+    struct walk_dir *d;
+    int ret;
+
+    if (maxdepth < 0) {
+	/* exceeded recursion limit */
+	ret = walk_report(w, NULL, NULL, path, warning_skipped_dir);
+	free(path);
+	return ret;
+    }
+    if (!(d = malloc(sizeof(*d)))) {
+	ret = walk_report(w, NULL, NULL, path, error_mem);
+	free(path);
+	return ret;
+    }
+    d->path = path;
+    d->maxdepth = maxdepth;
+    pthread_mutex_lock(&w->mutex);
+    d->next = w->head;
+    w->head = d;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    return CL_SUCCESS;
+}
+
+/* the same decisions as get_filetype() in libclamav/others_common.c */
+static enum walk_type walk_type(int flags, int dfd, const struct dirent *dent, const char *path, STATBUF *sb, int *stated)
+{
+    int link = 0;
+
+    *stated = 0;
+#ifdef _DIRENT_HAVE_D_TYPE
+    switch (dent->d_type) {
+	case DT_DIR:
+	    if (!(flags & CLI_FTW_NEED_STAT))
+		return walk_directory;
+	    break;
+	case DT_REG:
+	    if (!(flags & CLI_FTW_NEED_STAT))
+		return walk_file;
+	    break;
+	case DT_LNK:
+	    /* we don't follow symlinks, don't bother stating it */
+	    if (!(flags & FOLLOW_SYMLINK_MASK))
+		return walk_ignored;
+	    break;
+	case DT_UNKNOWN:
+	    break;
+	default:
+	    return walk_skipped_special;
+    }
+#endif
+
+    if ((flags & FOLLOW_SYMLINK_MASK) != FOLLOW_SYMLINK_MASK) {
+	if (WALK_LSTAT(dfd, dent->d_name, path, sb) == -1)
+	    return walk_error;
+	*stated = 1;
+	if (!S_ISLNK(sb->st_mode)) {
+	    if (S_ISDIR(sb->st_mode))
+		return walk_directory;
+	    return S_ISREG(sb->st_mode) ? walk_file : walk_skipped_special;
+	}
+	if (!(flags & FOLLOW_SYMLINK_MASK))
+	    return walk_skipped_link;
+	link = 1;
+    }
+
+    if (WALK_STAT(dfd, dent->d_name, path, sb) == -1)
+	return walk_error;
+    *stated = 1;
+    if (S_ISDIR(sb->st_mode) && (!link || (flags & CLI_FTW_FOLLOW_DIR_SYMLINK)))
+	return walk_directory;
+    if (S_ISREG(sb->st_mode) && (!link || (flags & CLI_FTW_FOLLOW_FILE_SYMLINK)))
+	return walk_file;
+    return link ? walk_skipped_link : walk_skipped_special;
+}
+
+static void walk_dir(struct walk_state *w, const struct walk_dir *d)
+{
+    DIR *dd;
+#if defined(HAVE_READDIR_R_3) || defined(HAVE_READDIR_R_2)
+    union {
+	struct dirent d;
+	char b[offsetof(struct dirent, d_name) + NAME_MAX + 1];
+    } result;
+#endif
+    struct dirent *dent;
+    STATBUF sb;
+    size_t len;
+    char *fname;
+    int dfd = -1, stated, ret, err = 0;
+
+    if (!(dd = opendir(d->path))) {
+	walk_report(w, NULL, NULL, d->path, error_stat);
+	return;
+    }
+#ifdef HAVE_FSTATAT
+    dfd = dirfd(dd);
+#endif
+    len = strlen(d->path);
+
+    while (!walk_stopped(w)) {
+	errno = 0;
+#ifdef HAVE_READDIR_R_3
+	if ((err = readdir_r(dd, &result.d, &dent)) || !dent)
+	    break;
+#elif defined(HAVE_READDIR_R_2)
+	if (!(dent = (struct dirent *) readdir_r(dd, &result.d))) {
+	    err = errno;
+	    break;
+	}
+#else
+	if (!(dent = readdir(dd))) {
+	    err = errno;
+	    break;
+	}
+#endif
+	if (!strcmp(dent->d_name, ".") || !strcmp(dent->d_name, ".."))
+	    continue;
+
+	if (!(fname = malloc(len + strlen(dent->d_name) + 2))) {
+	    if (walk_report(w, NULL, NULL, d->path, error_mem) != CL_SUCCESS)
+		break;
+	    continue;
+	}
+	if (!strcmp(d->path, PATHSEP))
+	    sprintf(fname, PATHSEP"%s", dent->d_name);
+	else
+	    sprintf(fname, "%s"PATHSEP"%s", d->path, dent->d_name);
+
+	if (w->pathchk && w->pathchk(fname, w->data) == 1) {
+	    free(fname);
+	    continue;
+	}
+
+	switch (walk_type(w->flags, dfd, dent, fname, &sb, &stated)) {
+	    case walk_file:
+		/* the callback frees fname */
+		ret = walk_report(w, stated ? &sb : NULL, fname, fname, visit_file);
+		break;
+	    case walk_directory:
+		ret = walk_push(w, fname, d->maxdepth - 1);
+		break;
+	    case walk_skipped_link:
+		ret = walk_report(w, stated ? &sb : NULL, NULL, fname, warning_skipped_link);
+		free(fname);
+		break;
+	    case walk_skipped_special:
+		ret = walk_report(w, stated ? &sb : NULL, NULL, fname, warning_skipped_special);
+		free(fname);
+		break;
+	    case walk_error:
+		ret = walk_report(w, NULL, NULL, fname, error_stat);
+		free(fname);
+		break;
+	    default:
+		ret = CL_SUCCESS;
+		free(fname);
+		break;
+	}
+	if (ret != CL_SUCCESS)
+	    break;
+    }
+    closedir(dd);
+
+    if (err) {
+	logg("^Unable to readdir() directory %s: %s\n", d->path, strerror(err));
+	walk_report(w, NULL, NULL, d->path, error_stat);
+    }
+}
+
+static void *walk_thread(void *arg)
+{
+    struct walk_state *w = arg;
+    struct walk_dir *d;
+
+    pthread_mutex_lock(&w->mutex);
+    for (;;) {
+	while (!w->head && w->busy && !w->stop)
+	    pthread_cond_wait(&w->cond, &w->mutex);
+	/* nothing queued and nobody left to queue more: done */
+	if (w->stop || !w->head)
+	    break;
+	d = w->head;
+	w->head = d->next;
+	w->busy++;
+	pthread_mutex_unlock(&w->mutex);
+
+	walk_dir(w, d);
+	free(d->path);
+	free(d);
+
+	pthread_mutex_lock(&w->mutex);
+	if (!--w->busy && !w->head)
+	    pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+int walker_ftw(char *path, int flags, int maxdepth, unsigned int nthreads, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk)
+{
+    struct walk_state w;
+    struct walk_dir *d;
+    pthread_t *tids = NULL;
+    unsigned int i, started = 0;
+    STATBUF sb;
+    char *top, *pathend;
+    int ret;
+
+    if (nthreads < 2)
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+
+    /* trim slashes as cli_ftw() does, so that dir and dir/ behave the same */
+    if (path[0] && path[1]) {
+	while (path[0] == *PATHSEP && path[1] == *PATHSEP) path++;
+	pathend = path + strlen(path);
+	while (pathend > path && pathend[-1] == *PATHSEP) --pathend;
+	*pathend = '\0';
+    }
+    if (pathchk && pathchk(path, data) == 1)
+	return CL_SUCCESS;
+
+    /* files, errors and everything else get reported by cli_ftw() */
+    if (LSTAT(path, &sb) == -1)
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+    if (S_ISLNK(sb.st_mode) && (flags & CLI_FTW_FOLLOW_DIR_SYMLINK) && CLAMSTAT(path, &sb) == -1)
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+    if (!S_ISDIR(sb.st_mode))
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+
+    ret = callback(&sb, NULL, path, visit_directory_toplev, data);
+    if (ret != CL_SUCCESS)
+	return ret;
+    if (!(top = strdup(path)))
+	return callback(NULL, NULL, path, error_mem, data);
+
+    memset(&w, 0, sizeof(w));
+    if (pthread_mutex_init(&w.mutex, NULL)) {
+	free(top);
+	return cli_ftw(path, flags, maxdepth, callback, data, pathchk);
+    }
+    pthread_cond_init(&w.cond, NULL);
+    w.flags = flags;
+    w.callback = callback;
+    w.pathchk = pathchk;
+    w.data = data;
+    walk_push(&w, top, maxdepth);
+
+    /* the calling thread is one of the walkers */
+    if ((tids = malloc((nthreads - 1) * sizeof(*tids)))) {
+	for (i = 0; i < nthreads - 1; i++) {
+	    if (pthread_create(&tids[started], NULL, walk_thread, &w)) {
+		logg("^walker_ftw: started only %u of %u threads\n", started + 1, nthreads);
+		break;
+	    }
+	    started++;
+	}
+    }
+    walk_thread(&w);
+    for (i = 0; i < started; i++)
+	pthread_join(tids[i], NULL);
+    free(tids);
+
+    while ((d = w.head)) {
+	w.head = d->next;
+	free(d->path);
+	free(d);
+    }
+    pthread_cond_destroy(&w.cond);
+    pthread_mutex_destroy(&w.mutex);
+    return w.stop ? w.ret : CL_SUCCESS;
+}
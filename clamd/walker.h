@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __WALKER_H
+#define __WALKER_H
+
+#include "libclamav/clamav.h"
+#include "libclamav/others.h"
+
+/*
+ * Same contract as cli_ftw(), but up to nthreads threads (the caller being
+ * one of them) read and stat different directories at the same time.
+ * Entries are reported in no particular order. The callback is called by
+ * one thread at a time; pathchk is not serialized and must be safe to call
+ * concurrently. A path that is not a directory is handed to cli_ftw().
+ */
+int walker_ftw(char *path, int flags, int maxdepth, unsigned int nthreads, cli_ftw_cb callback, struct cli_ftw_cbdata *data, cli_ftw_pathchk pathchk);
+
+#endif
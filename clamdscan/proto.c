@@ -632,6 +632,255 @@ static int parallel_callback(STATBUF *sb, char *filename, const char *path, enum
     return CL_SUCCESS;
 }
 
+/* Receives exactly len bytes
+ * Returns 1 on success, 0 if the connection is closed, -1 on error */
+static int recvall(int sockd, void *buf, size_t len) {
+    char *p = (char *)buf;
+
+    while(len) {
+	int r = recv(sockd, p, len, 0);
+	if(r < 0) {
+	    if(errno == EINTR) continue;
+	    logg("!Communication error\n");
+	    return -1;
+	}
+	if(!r) return 0;
+	p += r;
+	len -= r;
+    }
+    return 1;
+}
+
+/* Issues a MUXSESSION stream and sends the given file in frames
+ * Returns >0 on success, 0 soft fail, -1 hard fail */
+static int send_mux_stream(int sockd, unsigned int id, const char *filename) {
+    unsigned char buf[MUX_FRAME_HDRLEN + BUFSIZ];
+    int fd, len;
+    unsigned long int todo = maxstream;
+
+    if((fd = safe_open(filename, O_RDONLY | O_BINARY))<0) {
+	logg("~%s: Access denied. ERROR\n", filename);
+	return 0;
+    }
+
+    while((len = read(fd, &buf[MUX_FRAME_HDRLEN], BUFSIZ)) > 0) {
+	if((unsigned int)len > todo) len = todo;
+	mux_putframe(buf, id, len);
+	if(sendln(sockd, (const char *)buf, len + MUX_FRAME_HDRLEN)) {
+	    close(fd);
+	    return -1;
+	}
+	todo -= len;
+	if(!todo) {
+	    len = 0;
+	    break;
+	}
+    }
+    close(fd);
+    if(len) {
+	logg("!Failed to read from %s.\n", filename);
+	/* clamd drops it without a reply */
+	mux_putframe(buf, id, MUX_ABORT);
+	return sendln(sockd, (const char *)buf, MUX_FRAME_HDRLEN) ? -1 : 0;
+    }
+    mux_putframe(buf, id, 0);
+    return sendln(sockd, (const char *)buf, MUX_FRAME_HDRLEN) ? -1 : 1;
+}
+
+/* Receives and reports one MUXSESSION reply
+ * Returns 0 on success, 1 on hard failures, 2 if the connection is closed */
+static int muxresult(struct client_parallel_data *c) {
+    unsigned char hdr[MUX_REPLY_HDRLEN];
+    char text[0x10000];
+    struct mux_reply r;
+    struct SCANID **id, *cid;
+    int ret;
+
+    if((ret = recvall(c->sockd, hdr, sizeof(hdr))) <= 0)
+	return ret ? 1 : 2;
+    mux_getreply(&r, hdr);
+    if(r.textlen && recvall(c->sockd, text, r.textlen) <= 0)
+	return 1;
+    text[r.textlen] = '\0';
+    if(!r.id) {
+	logg("!clamd: %s\n", text);
+	return 1;
+    }
+    for(id = &c->ids; *id && (*id)->id != r.id; id = &(*id)->next);
+    if(!*id) {
+	logg("!Bogus session id from clamd\n");
+	return 1;
+    }
+    cid = *id;
+    if(r.status == MUX_STATUS_FOUND) {
+	c->infected++;
+	c->printok = 0;
+	logg("~%s: %s FOUND\n", cid->file, text);
+	if(action) action(cid->file);
+    } else if(r.status != MUX_STATUS_OK) {
+	c->errors++;
+	c->printok = 0;
+	logg("~%s: %s ERROR\n", cid->file, text);
+    }
+    *id = cid->next;
+    free((void *)cid->file);
+    free(cid);
+    return 0;
+}
+
+/* FTW callback for scanning in MUXSESSION mode
+ * Returns SUCCESS on success, CL_EXXX or BREAK on error */
+static int mux_callback(STATBUF *sb, char *filename, const char *path, enum cli_ftw_reason reason, struct cli_ftw_cbdata *data) {
+    struct client_parallel_data *c = (struct client_parallel_data *)data->data;
+    struct SCANID *cid;
+    int res;
+
+    UNUSEDPARAM(sb);
+
+    if(chkpath(path))
+	return CL_SUCCESS;
+    c->files++;
+    switch(reason) {
+    case error_stat:
+	logg("!Can't access file %s\n", path);
+	c->errors++;
+	return CL_SUCCESS;
+    case error_mem:
+	logg("!Memory allocation failed in ftw\n");
+	c->errors++;
+	return CL_EMEM;
+    case warning_skipped_dir:
+	logg("^Directory recursion limit reached\n");
+	return CL_SUCCESS;
+    case warning_skipped_special:
+	logg("^%s: Not supported file type\n", path);
+	c->errors++;
+    case warning_skipped_link:
+    case visit_directory_toplev:
+	return CL_SUCCESS;
+    case visit_file:
+	break;
+    }
+
+    while(1) {
+	/* pick up the replies that are ready, see parallel_callback() */
+	fd_set rfds;
+	struct timeval tv = { 0, 0 };
+	FD_ZERO(&rfds);
+	FD_SET(c->sockd, &rfds);
+	if((res = select(c->sockd + 1, &rfds, NULL, NULL, &tv)) < 0) {
+	    if(errno == EINTR) continue;
+	    free(filename);
+	    logg("!select() failed during session: %s\n", strerror(errno));
+	    return CL_BREAK;
+	}
+	if(!res) break;
+	if(muxresult(c)) {
+	    free(filename);
+	    return CL_BREAK;
+	}
+    }
+
+    cid = (struct SCANID *)malloc(sizeof(struct SCANID));
+    if(!cid) {
+	free(filename);
+	logg("!Failed to allocate scanid entry: %s\n", strerror(errno));
+	return CL_BREAK;
+    }
+    cid->id = ++c->lastid;
+    cid->file = filename;
+    cid->next = c->ids;
+    c->ids = cid;
+
+    res = send_mux_stream(c->sockd, cid->id, filename);
+    if(res <= 0) {
+	c->printok = 0;
+	c->errors++;
+	c->ids = cid->next;
+	free(cid);
+	free(filename);
+	return res ? CL_BREAK : CL_SUCCESS;
+    }
+    return CL_SUCCESS;
+}
+
+/* Checks once whether clamd knows MUXSESSION */
+static int mux_supported(void) {
+    static int supported = -1;
+    struct RCVLN rcv;
+    char *bol;
+    int sockd;
+
+    if(supported != -1)
+	return supported;
+    supported = 0;
+    if((sockd = dconnect()) < 0)
+	return 0;
+    recvlninit(&rcv, sockd);
+    if(!sendln(sockd, "zVERSIONCOMMANDS", 17) && recvln(&rcv, &bol, NULL) > 0)
+	supported = strstr(bol, " MUXSESSION") != NULL;
+    closesocket(sockd);
+    return supported;
+}
+
+/* MUXSESSION handler, streams are sent back to back and the replies are
+ * collected as they come
+ * Returns non zero for serious errors, zero otherwise */
+static int mux_client_scan(char *file, int *infected, int *err, int maxlevel, int flags) {
+    struct cli_ftw_cbdata data;
+    struct client_parallel_data cdata;
+    unsigned char end[MUX_FRAME_HDRLEN];
+    int ftw;
+
+    if((cdata.sockd = dconnect()) < 0)
+	return 1;
+
+    if(sendln(cdata.sockd, "zMUXSESSION", 12)) {
+	closesocket(cdata.sockd);
+	return 1;
+    }
+
+    cdata.infected = 0;
+    cdata.files = 0;
+    cdata.errors = 0;
+    cdata.scantype = STREAM;
+    cdata.lastid = 0;
+    cdata.ids = NULL;
+    cdata.printok = printinfected^1;
+    data.data = &cdata;
+
+    ftw = cli_ftw(file, flags, maxlevel ? maxlevel : INT_MAX, mux_callback, &data, ftw_chkpath);
+
+    if(ftw != CL_SUCCESS) {
+	*err += cdata.errors;
+	*infected += cdata.infected;
+	closesocket(cdata.sockd);
+	return 1;
+    }
+
+    mux_putframe(end, 0, 0);
+    sendln(cdata.sockd, (const char *)end, sizeof(end));
+    while(cdata.ids && !muxresult(&cdata));
+    closesocket(cdata.sockd);
+
+    *infected += cdata.infected;
+    *err += cdata.errors;
+
+    if(cdata.ids) {
+	logg("!Clamd closed the connection before scanning all files.\n");
+	return 1;
+    }
+    if(cdata.errors)
+	return 1;
+
+    if(!cdata.files)
+	return 0;
+
+    if(cdata.printok)
+	logg("~%s: OK\n", file);
+    return 0;
+}
+
 /* IDSESSION handler
  * Returns non zero for serious errors, zero otherwise */
 int parallel_client_scan(char *file, int scantype, int *infected, int *err, int maxlevel, int flags) {
@@ -639,6 +888,10 @@ int parallel_client_scan(char *file, int scantype, int *infected, int *err, int
     struct client_parallel_data cdata;
     int ftw;
 
+    /* streams are multiplexed when clamd can do it */
+    if(scantype == STREAM && mux_supported())
+	return mux_client_scan(file, infected, err, maxlevel, flags);
+
     if((cdata.sockd = dconnect()) < 0)
 	return 1;
 
@@ -70,6 +70,7 @@ typedef struct connection {
 	struct timeval tv_conn;
 	char *version;
 	int line;
+	int metrics; /* clamd knows the METRICS command */
 } conn_t;
 
 struct global_stats {
@@ -97,11 +98,16 @@ struct stats {
 	double mem;/* in megabytes */
 	unsigned long lheapu, lmmapu, ltotalu, ltotalf, lreleasable, lpoolu, lpoolt;
 	unsigned pools_cnt;
+	/* METRICS */
+	int metrics;
+	unsigned long long files, bytes, cache_hits, cache_misses;
+	double bps;
 };
 
 static void cleanup(void);
 static int send_string_noreconn(conn_t *conn, const char *cmd);
 static void send_string(conn_t *conn, const char *cmd);
+static int recv_line(conn_t *conn, char *buf, size_t len);
 static int read_version(conn_t *conn);
 char *get_ip(const char *ip);
 char *get_port(const char *ip);
@@ -708,10 +714,27 @@ end:
     return 0;
 }
 
+/* An older clamd doesn't know METRICS, and an unknown command would end
+ * the IDSESSION: ask on a connection of its own */
+static void probe_metrics(const char *soname, conn_t *conn)
+{
+    char buf[1024];
+
+    conn->metrics = 0;
+    if (make_connection_real(soname, conn))
+        return;
+    if (send_string_noreconn(conn, "nVERSIONCOMMANDS\n") != -1 && recv_line(conn, buf, sizeof(buf)))
+        conn->metrics = strstr(buf, " METRICS") != NULL;
+    if (conn->sd != -1)
+        close(conn->sd);
+    conn->sd = -1;
+}
+
 static int make_connection(const char *soname, conn_t *conn)
 {
     int rc;
 
+    probe_metrics(soname, conn);
     if ((rc = make_connection_real(soname, conn)))
         return rc;
 
@@ -722,6 +745,7 @@ static int make_connection(const char *soname, conn_t *conn)
         return 0;
 
     /* clamd < 0.95 */
+    conn->metrics = 0;
     if ((rc = make_connection_real(soname, conn)))
         return rc;
 
@@ -1043,6 +1067,15 @@ static int output_stats(struct stats *stats, unsigned idx)
 		snprintf(buf, sizeof(buf), "%6u items %6u max", stats->current_q, stats->biggest_queue);
 		print_colored(win, buf);
 		show_bar(win, i++, stats->current_q, 0, stats->biggest_queue, blink);
+		if (stats->metrics) {
+			mvwprintw(win, i, 0, "Scanned:");
+			snprintf(buf, sizeof(buf), "%9llu files %7lluM %6.1fM/s", stats->files,
+				 stats->bytes / (1024*1024), stats->bps / (1024*1024));
+			print_colored(win, buf);
+			mvwprintw(win, i+1, 0, "Cache:  ");
+			snprintf(buf, sizeof(buf), "%9llu hits %8llu misses", stats->cache_hits, stats->cache_misses);
+			print_colored(win, buf);
+		}
 		i += 2;
 		werase(mem_window);
 		output_memstats(stats);
@@ -1207,6 +1240,30 @@ static void parse_stats(conn_t *conn, struct stats *stats, unsigned idx)
 	}
 }
 
+static void parse_metrics(conn_t *conn, struct stats *stats)
+{
+	char buf[1025];
+	const char *line;
+
+	stats->metrics = 1;
+	while(recv_line(conn, buf, sizeof(buf)-1) && !strstr(buf, "# EOF")) {
+		/* the first line carries the IDSESSION reply number */
+		line = isdigit(buf[0]) ? strstr(buf, ": ") : NULL;
+		line = line ? line + 2 : buf;
+		if(line[0] == '#')
+			continue;
+		if(sscanf(line, "clamd_scanned_files_total %llu", &stats->files) == 1)
+			continue;
+		if(sscanf(line, "clamd_scanned_bytes_total %llu", &stats->bytes) == 1)
+			continue;
+		if(sscanf(line, "clamd_scan_bytes_per_second %lf", &stats->bps) == 1)
+			continue;
+		if(sscanf(line, "clamd_cache_hits_total %llu", &stats->cache_hits) == 1)
+			continue;
+		sscanf(line, "clamd_cache_misses_total %llu", &stats->cache_misses);
+	}
+}
+
 static int read_version(conn_t *conn)
 {
 	char buf[1024];
@@ -1399,6 +1456,8 @@ static int show_help(void)
 	explain("idle","Waiting for commands, will exit after idle_timeout");
 	explain("max", "Maximum number of threads configured for this pool");
 	explain("Queue","Tasks queued for processing, but not yet picked up by a thread");
+	explain("Scanned","Files and bytes scanned, scan speed of one thread");
+	explain("Cache","Files found/not found in the clean file cache");
 	explain("COMMAND","Command this thread is executing");
 	explain("QUEUEDSINCE","How long this task is executing");
 	explain("FILE","Which file it is processing (if applicable)");
@@ -1481,6 +1540,10 @@ int main(int argc, char *argv[])
 				memset(stats, 0, sizeof(*stats));
 				stats->biggest_queue = biggest_q;
 				parse_stats(&global.conn[i], stats, i);
+				if (global.conn[i].metrics && global.conn[i].sd != -1 && !stats->stats_unsupp) {
+					send_string(&global.conn[i], "nMETRICS\n");
+					parse_metrics(&global.conn[i], stats);
+				}
 			}
 			if (global.tasks)
 				qsort(global.tasks, global.n, sizeof(*global.tasks), tasks_compare);
@@ -177,6 +177,8 @@ int main(int argc, char **argv)
 	logg("Engine version: %s\n", get_version());
 	logg("Scanned directories: %u\n", info.dirs);
 	logg("Scanned files: %u\n", info.files);
+	if(info.ufiles)
+	    logg("Unchanged files: %u\n", info.ufiles);
 	logg("Infected files: %u\n", info.ifiles);
 	if(info.errors)
 	    logg("Total errors: %u\n", info.errors);
@@ -243,6 +245,9 @@ void help(void)
     mprintf("    --exclude-dir=REGEX                  Don't scan directories matching REGEX\n");
     mprintf("    --include=REGEX                      Only scan file names matching REGEX\n");
     mprintf("    --include-dir=REGEX                  Only scan directories matching REGEX\n");
+    mprintf("    --scan-index=FILE                    Skip files found clean by an earlier scan and\n");
+    mprintf("                                         not changed since, as recorded in FILE\n");
+    mprintf("    --scan-index-entries=#n              Number of files a new index can hold\n");
 #ifdef _WIN32
     mprintf("    --memory                             Scan loaded executable modules\n");
     mprintf("    --kill                -k             Kill/Unload infected loaded modules\n");
@@ -252,7 +257,8 @@ void help(void)
     mprintf("    --bytecode[=yes(*)/no]               Load bytecode from the database\n");
     mprintf("    --bytecode-unsigned[=yes/no(*)]      Load unsigned bytecode\n");
     mprintf("    --bytecode-timeout=N                 Set bytecode timeout (in milliseconds)\n");
-    mprintf("    --statistics[=none(*)/bytecode/pcre] Collect and print execution statistics\n");
+    mprintf("    --statistics[=none(*)/bytecode/pcre/signatures] Collect and print execution statistics\n");
+    mprintf("    --trace-scan[=yes/no(*)]             Print the tree of scanned objects with timings\n");
     mprintf("    --detect-pua[=yes/no(*)]             Detect Possibly Unwanted Applications\n");
     mprintf("    --exclude-pua=CAT                    Skip PUA sigs of category CAT\n");
     mprintf("    --include-pua=CAT                    Load PUA sigs of category CAT\n");
@@ -300,6 +306,7 @@ void help(void)
     mprintf("    --pcre-recmatch-limit=#n             Maximum recursive calls to the PCRE match function.\n");
     mprintf("    --pcre-max-filesize=#n               Maximum size file to perform PCRE subsig matching.\n");
 #endif /* HAVE_PCRE */
+    mprintf("    --readahead-pages=#n                 Pages to prefetch ahead of sequential file reads\n");
     mprintf("    --enable-stats                       Enable statistical reporting of malware\n");
     mprintf("    --disable-pe-stats                   Disable submission of individual PE sections in stats submissions\n");
     mprintf("    --stats-timeout=#n                   Number of seconds to wait for waiting a response back from the stats server\n");
@@ -56,11 +56,13 @@
 #include "shared/actions.h"
 #include "shared/output.h"
 #include "shared/misc.h"
+#include "shared/scanindex.h"
 
 #include "libclamav/clamav.h"
 #include "libclamav/others.h"
 #include "libclamav/matcher-ac.h"
 #include "libclamav/matcher-pcre.h"
+#include "libclamav/sigprof.h"
 #include "libclamav/str.h"
 #include "libclamav/readdb.h"
 #include "libclamav/cltypes.h"
@@ -115,6 +117,8 @@ typedef struct _cb_data_t
 } cb_data_t;
 
 static cb_data_t cbdata;
+static struct scan_index *scanidx = NULL;
+static uint64_t scanidx_stamp;
 static const char *rotation = "|/-\\";
 
 static void rotate(cb_data_t *cbctx, const char *fmt)
@@ -376,9 +380,20 @@ static void clamscan_virus_found_cb(int fd, const char *virname, void *context)
     return;
 }
 
+static void clamscan_trace_cb(unsigned int depth, const char *type, const char *parser, unsigned long long size,
+                              unsigned long long usecs, unsigned long long match_usecs, unsigned long long unpack_usecs,
+                              unsigned long long tempbytes, void *context)
+{
+    struct clamscan_cb_data *data = (struct clamscan_cb_data *)context;
+    const char *filename = (data && data->filename) ? data->filename : "(filename not set)";
+
+    logg("%s: TRACE %*s%s size: %llu parser: %s time: %llu match: %llu unpack: %llu temp: %llu\n",
+         filename, depth * 2, "", type, size, parser, usecs, match_usecs, unpack_usecs, tempbytes);
+}
+
 static void scanfile(const char *filename, struct cl_engine *engine, const struct optstruct *opts, unsigned int options)
 {
-    int ret = 0, fd, included;
+    int ret = 0, fd, included, stated = 0;
     unsigned i;
     const struct optstruct *opt;
     const char *virname;
@@ -437,6 +452,7 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
         }
 
         info.rblocks += sb.st_size / CL_COUNT_PRECISION;
+        stated = 1;
     }
 
 #ifndef _WIN32
@@ -451,6 +467,16 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
     }
 #endif
 
+    /* found clean before and not changed since */
+    if(stated && scanindex_lookup(scanidx, &sb, scanidx_stamp)) {
+        if(!printinfected && printclean)
+            mprintf("~%s: OK\n", filename);
+
+        info.files++;
+        info.ufiles++;
+        return;
+    }
+
     memset(&chain, 0, sizeof(chain));
     if(optget(opts, "archive-verbose")->enabled) {
         chain.chains = malloc(sizeof(char **));
@@ -504,6 +530,8 @@ static void scanfile(const char *filename, struct cl_engine *engine, const struc
             mprintf("~%s: OK\n", filename);
 
         info.files++;
+        if(stated)
+            scanindex_update(scanidx, &sb, scanidx_stamp);
     } else {
         if(!printinfected)
             logg("~%s: %s ERROR\n", filename, cl_strerror(ret));
@@ -935,6 +963,9 @@ int scanmanager(const struct optstruct *opts)
 	    else if (!strcasecmp(opt->strarg, "pcre")) {
 		dboptions |= CL_DB_PCRE_STATS;
 	    }
+	    else if (!strcasecmp(opt->strarg, "signatures")) {
+		cl_engine_set_num(engine, CL_ENGINE_SIGPROFILE, 1);
+	    }
 	    opt = opt->nextarg;
         }
     }
@@ -1168,12 +1199,25 @@ int scanmanager(const struct optstruct *opts)
         }
     }
 
+    if ((opt = optget(opts, "readahead-pages"))->active) {
+        if ((ret = cl_engine_set_num(engine, CL_ENGINE_READAHEAD, opt->numarg))) {
+            logg("!cli_engine_set_num(CL_ENGINE_READAHEAD) failed: %s\n", cl_strerror(ret));
+            cl_engine_free(engine);
+            return 2;
+        }
+    }
+
     /* set scan options */
     if(optget(opts, "allmatch")->enabled) {
         options |= CL_SCAN_ALLMATCHES;
         cl_engine_set_clcb_virus_found(engine, clamscan_virus_found_cb);
     }
 
+    if(optget(opts, "trace-scan")->enabled) {
+        options |= CL_SCAN_TRACE;
+        cl_engine_set_clcb_trace(engine, clamscan_trace_cb);
+    }
+
     if(optget(opts,"phishing-ssl")->enabled)
         options |= CL_SCAN_PHISHING_BLOCKSSL;
 
@@ -1286,6 +1330,14 @@ int scanmanager(const struct optstruct *opts)
         options |= CL_SCAN_FILE_PROPERTIES;
 #endif
 
+    if((opt = optget(opts, "scan-index"))->enabled) {
+        if(!(scanidx = scanindex_open(opt->strarg, optget(opts, "scan-index-entries")->numarg))) {
+            cl_engine_free(engine);
+            return 2;
+        }
+        scanidx_stamp = scanindex_stamp(engine, options);
+    }
+
 #ifdef _WIN32
     /* scan only memory */
     if (optget(opts, "memory")->enabled && (!opts->filename && !optget(opts, "file-list")->enabled))
@@ -1372,10 +1424,16 @@ int scanmanager(const struct optstruct *opts)
 		cli_pcre_perf_events_destroy();
 	    }
 #endif
+	    else if (!strcasecmp(opt->strarg, "signatures")) {
+		cli_sigprof_print();
+	    }
 	    opt = opt->nextarg;
         }
     }
 
+    scanindex_close(scanidx);
+    scanidx = NULL;
+
     /* free the engine */
     cl_engine_free(engine);
 
@@ -0,0 +1,249 @@
+/*
+ *  Per-scan arena allocator
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "arena.h"
+
+#define ARENA_CHUNK_SIZE (256 * 1024)
+#define ARENA_MIN_SHIFT 4                       /* smallest block: 16 bytes */
+#define ARENA_CLASSES 13                        /* largest block: 64KB */
+#define ARENA_LARGE ARENA_CLASSES
+#define ARENA_CLASS_SIZE(c) ((size_t)1 << ((c) + ARENA_MIN_SHIFT))
+
+/* precedes every block handed out; keeps the payload 8-byte aligned */
+union arena_hdr {
+    struct {
+        uint32_t cls;
+        uint32_t size;  /* usable bytes */
+    } h;
+    uint64_t align;
+};
+
+struct arena_chunk {
+    struct arena_chunk *next;
+    size_t align;
+};
+
+struct arena_large {
+    struct arena_large *prev, *next;
+    union arena_hdr hdr;
+};
+
+struct arena_free {
+    struct arena_free *next;
+};
+
+struct cli_arena {
+    struct arena_chunk *chunks;
+    unsigned char *cur, *end;
+    struct arena_free *avail[ARENA_CLASSES];
+    struct arena_large *large;
+};
+
+static inline unsigned int arena_class(size_t need)
+{
+    unsigned int c = 0;
+
+    while(ARENA_CLASS_SIZE(c) < need)
+        c++;
+    return c;
+}
+
+struct cli_arena *cli_arena_create(void)
+{
+    struct cli_arena *arena = cli_calloc(1, sizeof(*arena));
+    struct arena_chunk *chunk;
+
+    if(!arena)
+        return NULL;
+    chunk = cli_malloc(sizeof(*chunk) + ARENA_CHUNK_SIZE);
+    if(!chunk) {
+        free(arena);
+        return NULL;
+    }
+    chunk->next = NULL;
+    arena->chunks = chunk;
+    arena->cur = (unsigned char *)(chunk + 1);
+    arena->end = arena->cur + ARENA_CHUNK_SIZE;
+    return arena;
+}
+
+void cli_arena_reset(struct cli_arena *arena)
+{
+    struct arena_chunk *chunk, *next;
+    struct arena_large *large, *lnext;
+
+    if(!arena)
+        return;
+
+    for(large = arena->large; large; large = lnext) {
+        lnext = large->next;
+        free(large);
+    }
+    arena->large = NULL;
+
+    /* keep the first chunk around for the next scan */
+    for(chunk = arena->chunks; chunk->next; chunk = next) {
+        next = chunk->next;
+        free(chunk);
+    }
+    arena->chunks = chunk;
+    arena->cur = (unsigned char *)(chunk + 1);
+    arena->end = arena->cur + ARENA_CHUNK_SIZE;
+    memset(arena->avail, 0, sizeof(arena->avail));
+}
+
+void cli_arena_destroy(struct cli_arena *arena)
+{
+    if(!arena)
+        return;
+    cli_arena_reset(arena);
+    free(arena->chunks);
+    free(arena);
+}
+
+void *cli_arena_malloc(struct cli_arena *arena, size_t size)
+{
+    union arena_hdr *hdr;
+    size_t need;
+    unsigned int cls;
+
+    if(!arena)
+        return cli_malloc(size);
+
+    if(!size || size > CLI_MAX_ALLOCATION) {
+        cli_errmsg("cli_arena_malloc(): Attempt to allocate %lu bytes. Please report to https://bugzilla.clamav.net\n", (unsigned long int) size);
+        return NULL;
+    }
+
+    size = (size + 7) & ~(size_t)7;
+    need = size + sizeof(union arena_hdr);
+    if(need > ARENA_CLASS_SIZE(ARENA_CLASSES - 1)) {
+        struct arena_large *large = cli_malloc(sizeof(*large) + size);
+
+        if(!large)
+            return NULL;
+        large->prev = NULL;
+        large->next = arena->large;
+        if(arena->large)
+            arena->large->prev = large;
+        arena->large = large;
+        large->hdr.h.cls = ARENA_LARGE;
+        large->hdr.h.size = size;
+        return &large->hdr + 1;
+    }
+
+    cls = arena_class(need);
+    if(arena->avail[cls]) {
+        hdr = (union arena_hdr *)arena->avail[cls];
+        arena->avail[cls] = arena->avail[cls]->next;
+    } else {
+        if((size_t)(arena->end - arena->cur) < ARENA_CLASS_SIZE(cls)) {
+            struct arena_chunk *chunk = cli_malloc(sizeof(*chunk) + ARENA_CHUNK_SIZE);
+
+            if(!chunk)
+                return NULL;
+            chunk->next = arena->chunks;
+            arena->chunks = chunk;
+            arena->cur = (unsigned char *)(chunk + 1);
+            arena->end = arena->cur + ARENA_CHUNK_SIZE;
+        }
+        hdr = (union arena_hdr *)arena->cur;
+        arena->cur += ARENA_CLASS_SIZE(cls);
+    }
+    hdr->h.cls = cls;
+    hdr->h.size = ARENA_CLASS_SIZE(cls) - sizeof(union arena_hdr);
+    return hdr + 1;
+}
+
+void *cli_arena_calloc(struct cli_arena *arena, size_t nmemb, size_t size)
+{
+    void *ptr;
+
+    if(!arena)
+        return cli_calloc(nmemb, size);
+
+    if(!size || !nmemb || nmemb > CLI_MAX_ALLOCATION / size) {
+        cli_errmsg("cli_arena_calloc(): Attempt to allocate %lu bytes. Please report to https://bugzilla.clamav.net\n", (unsigned long int) nmemb * size);
+        return NULL;
+    }
+    if((ptr = cli_arena_malloc(arena, nmemb * size)))
+        memset(ptr, 0, nmemb * size);
+    return ptr;
+}
+
+void cli_arena_free(struct cli_arena *arena, void *ptr)
+{
+    union arena_hdr *hdr;
+
+    if(!ptr)
+        return;
+    if(!arena) {
+        free(ptr);
+        return;
+    }
+
+    hdr = (union arena_hdr *)ptr - 1;
+    if(hdr->h.cls == ARENA_LARGE) {
+        struct arena_large *large = (struct arena_large *)((char *)hdr - offsetof(struct arena_large, hdr));
+
+        if(large->prev)
+            large->prev->next = large->next;
+        else
+            arena->large = large->next;
+        if(large->next)
+            large->next->prev = large->prev;
+        free(large);
+    } else {
+        struct arena_free *blk = (struct arena_free *)hdr;
+        uint32_t cls = hdr->h.cls;
+
+        blk->next = arena->avail[cls];
+        arena->avail[cls] = blk;
+    }
+}
+
+void *cli_arena_realloc(struct cli_arena *arena, void *ptr, size_t size)
+{
+    union arena_hdr *hdr;
+    void *nptr;
+
+    if(!arena)
+        return cli_realloc(ptr, size);
+    if(!ptr)
+        return cli_arena_malloc(arena, size);
+
+    hdr = (union arena_hdr *)ptr - 1;
+    if(size && size <= hdr->h.size)
+        return ptr;
+    if(!(nptr = cli_arena_malloc(arena, size)))
+        return NULL;
+    memcpy(nptr, ptr, hdr->h.size);
+    cli_arena_free(arena, ptr);
+    return nptr;
+}
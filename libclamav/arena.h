@@ -0,0 +1,47 @@
+/*
+ *  Per-scan arena allocator
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/*
+ * A cli_arena is owned by a single scan (cli_ctx) and is never shared
+ * between threads, so none of the calls below take a lock. Small blocks
+ * are carved out of large chunks and recycled through per size class free
+ * lists; blocks above the largest class go straight to the heap but are
+ * still tracked so that cli_arena_reset() releases everything at once.
+ *
+ * All calls accept a NULL arena and then behave like their cli_malloc()
+ * family counterparts, so code paths without a scan context keep working.
+ */
+struct cli_arena;
+
+struct cli_arena *cli_arena_create(void);
+void cli_arena_destroy(struct cli_arena *arena);
+void cli_arena_reset(struct cli_arena *arena);
+
+void *cli_arena_malloc(struct cli_arena *arena, size_t size);
+void *cli_arena_calloc(struct cli_arena *arena, size_t nmemb, size_t size);
+void *cli_arena_realloc(struct cli_arena *arena, void *ptr, size_t size);
+void cli_arena_free(struct cli_arena *arena, void *ptr);
+
+#endif
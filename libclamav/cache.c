@@ -736,6 +736,9 @@ struct CACHE {
 #ifdef CL_THREAD_SAFE
     pthread_mutex_t mutex;
 #endif
+    /* lookup outcomes, updated under the tree mutex */
+    uint64_t hits;
+    uint64_t misses;
 };
 
 /* Allocates the trees for the engine cache */
@@ -772,6 +775,7 @@ int cli_cache_init(struct cl_engine *engine) {
 	    mpool_free(engine->mempool, cache);
 	    return 1;
 	}
+	cache[i].hits = cache[i].misses = 0;
     }
     engine->cache = cache;
     return 0;
@@ -796,6 +800,21 @@ void cli_cache_destroy(struct cl_engine *engine) {
     mpool_free(engine->mempool, cache);
 }
 
+/* Sums the lookup outcomes of all trees */
+void cli_cache_stats(const struct cl_engine *engine, uint64_t *hits, uint64_t *misses) {
+    unsigned int i;
+
+    *hits = *misses = 0;
+    if(!engine || !engine->cache || (engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE))
+	return;
+
+    for(i=0; i<TREES; i++) {
+	/* a stale read only skews the numbers by a lookup or two */
+	*hits += engine->cache[i].hits;
+	*misses += engine->cache[i].misses;
+    }
+}
+
 /* Looks up an hash in the proper tree */
 static int cache_lookup_hash(unsigned char *md5, size_t len, struct CACHE *cache, uint32_t reclevel) {
     unsigned int key = getkey(md5);
@@ -811,6 +830,10 @@ static int cache_lookup_hash(unsigned char *md5, size_t len, struct CACHE *cache
     /* cli_warnmsg("cache_lookup_hash: key is %u\n", key); */
 
     ret = (cacheset_lookup(&c->cacheset, md5, len, reclevel)) ? CL_CLEAN : CL_VIRUS;
+    if(ret == CL_CLEAN)
+	c->hits++;
+    else
+	c->misses++;
     pthread_mutex_unlock(&c->mutex);
     /* if(ret == CL_CLEAN) cli_warnmsg("cached\n"); */
     return ret;
@@ -903,6 +926,10 @@ int cache_get_MD5(unsigned char *hash, cli_ctx *ctx)
     void *hashctx;
 
     map = *ctx->fmap;
+    if (map->have_maphash) {
+        memcpy(hash, map->maphash, 16);
+        return CL_CLEAN;
+    }
     todo = map->len;
 
     hashctx = cl_hash_init("md5");
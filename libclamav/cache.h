@@ -32,4 +32,5 @@ int cache_get_MD5(unsigned char *hash, cli_ctx *ctx);
 int cache_check(unsigned char *hash, cli_ctx *ctx);
 int cli_cache_init(struct cl_engine *engine);
 void cli_cache_destroy(struct cl_engine *engine);
+void cli_cache_stats(const struct cl_engine *engine, uint64_t *hits, uint64_t *misses);
 #endif
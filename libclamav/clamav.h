@@ -178,6 +178,7 @@ typedef enum {
 #define CL_SCAN_PARTITION_INTXN         0x800000
 #define CL_SCAN_XMLDOCS                 0x1000000
 #define CL_SCAN_HWP3                    0x2000000
+#define CL_SCAN_TRACE                   0x4000000 /* report the tree of scanned objects through clcb_trace */
 #define CL_SCAN_FILE_PROPERTIES         0x10000000
 //#define UNUSED                        0x20000000
 #define CL_SCAN_PERFORMANCE_INFO        0x40000000 /* collect performance timings */
@@ -252,7 +253,13 @@ enum cl_engine_field {
     CL_ENGINE_TIME_LIMIT,           /* uint32_t */
     CL_ENGINE_PCRE_MATCH_LIMIT,     /* uint64_t */
     CL_ENGINE_PCRE_RECMATCH_LIMIT,  /* uint64_t */
-    CL_ENGINE_PCRE_MAX_FILESIZE     /* uint64_t */
+    CL_ENGINE_PCRE_MAX_FILESIZE,    /* uint64_t */
+    CL_ENGINE_READAHEAD,            /* uint32_t */
+    CL_ENGINE_MPOOL_HUGEPAGES,      /* uint32_t */
+    CL_ENGINE_SIGPROFILE,           /* uint32_t */
+    CL_ENGINE_CACHE_HITS,           /* uint64_t, read only */
+    CL_ENGINE_CACHE_MISSES,         /* uint64_t, read only */
+    CL_ENGINE_DB_STAMP              /* uint64_t, read only, changes with any loaded database file */
 };
 
 enum bytecode_security {
@@ -270,6 +277,12 @@ enum bytecode_mode {
     CL_BYTECODE_MODE_OFF /* for query only, not settable */
 };
 
+enum cl_mpool_hugepages {
+    CL_MPOOL_HUGEPAGES_NONE=0, /* regular pages for signature memory */
+    CL_MPOOL_HUGEPAGES_TRANSPARENT, /* madvise(MADV_HUGEPAGE) */
+    CL_MPOOL_HUGEPAGES_EXPLICIT /* MAP_HUGETLB, fallback to transparent */
+};
+
 struct cli_section_hash {
     unsigned char md5[16];
     size_t len;
@@ -446,6 +459,22 @@ extern void cl_engine_set_clcb_meta(struct cl_engine *engine, clcb_meta callback
 typedef int (*clcb_file_props)(const char *j_propstr, int rc, void *cbdata);
 extern void cl_engine_set_clcb_file_props(struct cl_engine *engine, clcb_file_props callback);
 
+/* Scan trace callback, see CL_SCAN_TRACE */
+typedef void (*clcb_trace)(unsigned int depth, const char *type, const char *parser, unsigned long long size,
+                           unsigned long long usecs, unsigned long long match_usecs, unsigned long long unpack_usecs,
+                           unsigned long long tempbytes, void *context);
+/* Called once per scanned object when the scan is over, parents before
+ * their children. depth is 0 for the file passed to cl_scan*(), parser tells
+ * which stage of the parent produced the object (raw, container, script,
+ * pe or other). Times are in microseconds: usecs includes the children,
+ * match_usecs and unpack_usecs do not. tempbytes is the size of the temporary
+ * files the object was unpacked into. Without a callback the trace is logged
+ * through the message callback.
+ * Input:
+ * context = opaque application provided data
+ */
+extern void cl_engine_set_clcb_trace(struct cl_engine *engine, clcb_trace callback);
+
 /* Statistics/intelligence gathering callbacks */
 extern void cl_engine_set_stats_set_cbdata(struct cl_engine *engine, void *cbdata);
 
@@ -501,6 +530,17 @@ extern int cl_scandesc_callback(int desc, const char **virname, unsigned long in
 extern int cl_scanfile(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions);
 extern int cl_scanfile_callback(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context);
 
+/* Same as the _callback variants, but the scan gives up with CL_ETIMEOUT once
+ * timeout milliseconds have passed. The earlier of timeout and
+ * CL_ENGINE_TIME_LIMIT wins, 0 means no limit of its own. */
+extern int cl_scandesc_timeout(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context);
+extern int cl_scanfile_timeout(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context);
+
+/* Same as cl_scandesc_timeout(), for a file whose MD5 (16 bytes) the caller
+ * already computed, e.g. while receiving it. The hash is trusted: the scan
+ * uses it for the cache instead of reading the whole file once more first. */
+extern int cl_scandesc_md5(int desc, const unsigned char *md5, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context);
+
 /* database handling */
 extern int cl_load(const char *path, struct cl_engine *engine, unsigned int *signo, unsigned int dboptions);
 extern const char *cl_retdbdir(void);
@@ -567,6 +607,26 @@ extern void cl_fmap_close(cl_fmap_t*);
 /* Scan custom data */
 extern int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context);
 
+/* Scan many maps in a row, reusing the scan context, the match state
+ * allocations and the hash contexts from one map to the next. For small
+ * objects this setup costs more than the scan itself.
+ * results[i] gets what cl_scanmap_callback() would have returned for maps[i].
+ * If virnames is not NULL, virnames[i] gets the detection name.
+ * If contexts is not NULL, contexts[i] is passed to the callbacks.
+ * Returns CL_SUCCESS once every map has been scanned, or an error if the
+ * batch could not be started at all. */
+extern int cl_scanmaps_batch(cl_fmap_t **maps, unsigned int count, int *results, const char **virnames, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void **contexts);
+
+/* Signature profiling (enabled with CL_ENGINE_SIGPROFILE)
+ * The callback is invoked for each profiled signature, most expensive first;
+ * kind is one of "ac", "pcre", "lsig" or "bytecode". Return non-zero from
+ * the callback to stop the report early. max = 0 reports all signatures.
+ * Samples from all engines and threads are merged by signature name.
+ */
+typedef int (*clcb_sigprof)(const char *virname, const char *kind, unsigned long long calls, unsigned long long matches, unsigned long long usecs, void *context);
+extern int cl_sigprof_report(unsigned int max, clcb_sigprof callback, void *context);
+extern void cl_sigprof_reset(void);
+
 /* Crypto/hashing functions */
 #define SHA1_HASH_SIZE 20
 #define SHA256_HASH_SIZE 32
@@ -581,6 +641,18 @@ extern int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned lo
  */
 unsigned char *cl_hash_data(char *alg, const void *buf, size_t len, unsigned char *obuf, unsigned int *olen);
 
+/** Generate hashes of several independent buffers with the same algorithm.
+ The digest context is reused across buffers, so this is cheaper than
+ calling cl_hash_data() in a loop for many small buffers.
+ @param[in] alg The hashing algorithm to use
+ @param[in] count The number of buffers
+ @param[in] bufs The data to be hashed
+ @param[in] lens The length of each buffer
+ @param[out] obufs Caller-supplied buffers that receive each digest
+ @return 0 on success, -1 on error
+ */
+int cl_hash_data_batch(const char *alg, size_t count, const void * const *bufs, const size_t *lens, unsigned char **obufs);
+
 /** Generate a hash of a file.
  @param[in] ctx A pointer to the OpenSSL EVP_MD_CTX object
  @param[in] fd The file descriptor
@@ -65,6 +65,10 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
 #if defined(_WIN32)
 char * strptime(const char *buf, const char *fmt, struct tm *tm);
 #endif
@@ -83,6 +87,12 @@ char * strptime(const char *buf, const char *fmt, struct tm *tm);
     #define MIN(x,y) ((x)<(y)?(x):(y))
 #endif
 
+/* Largest amount of data handed to a single EVP_DigestUpdate() call */
+#define HASH_UPDATE_CHUNK (1024*1024)
+
+/* Number of idle digest contexts kept around per thread */
+#define HASH_CTX_CACHE_SIZE 8
+
 #if !defined(HAVE_TIMEGM) && !defined(_WIN32)
 /*
  * Solaris 10 and earlier don't have timegm. Provide a portable version of it.
@@ -121,6 +131,162 @@ time_t timegm(struct tm *t)
 }
 #endif
 
+/*
+ * Digest context pool.
+ *
+ * Every cl_hash_data() and cl_hash_init() call used to create and destroy
+ * an EVP_MD_CTX, and to look the digest up by name. Contexts are now taken
+ * from a small per-thread cache and handed back by cl_finish_hash() and
+ * cl_hash_destroy(), so steady-state hashing does not touch the heap.
+ * EVP_DigestInit_ex() fully reinitializes a recycled context, and OpenSSL
+ * picks its SHA-NI/AVX2 code paths at runtime on its own.
+ */
+struct hash_ctx_cache {
+    unsigned int count;
+    EVP_MD_CTX *ctx[HASH_CTX_CACHE_SIZE];
+};
+
+static void hash_ctx_cache_free(void *arg)
+{
+    struct hash_ctx_cache *cache = (struct hash_ctx_cache *)arg;
+
+    if (!cache)
+        return;
+
+    while (cache->count)
+        EVP_MD_CTX_destroy(cache->ctx[--cache->count]);
+    free(cache);
+}
+
+#ifdef CL_THREAD_SAFE
+static pthread_key_t hash_ctx_key;
+static pthread_once_t hash_ctx_once = PTHREAD_ONCE_INIT;
+static int hash_ctx_key_ok = 0;
+
+static void hash_ctx_key_init(void)
+{
+    if (!pthread_key_create(&hash_ctx_key, hash_ctx_cache_free))
+        hash_ctx_key_ok = 1;
+}
+
+static struct hash_ctx_cache *hash_ctx_cache_get(int create)
+{
+    struct hash_ctx_cache *cache;
+
+    pthread_once(&hash_ctx_once, hash_ctx_key_init);
+    if (!hash_ctx_key_ok)
+        return NULL;
+
+    cache = (struct hash_ctx_cache *)pthread_getspecific(hash_ctx_key);
+    if (!cache && create) {
+        cache = (struct hash_ctx_cache *)calloc(1, sizeof(*cache));
+        if (cache && pthread_setspecific(hash_ctx_key, cache)) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+
+static void hash_ctx_cache_release(void)
+{
+    struct hash_ctx_cache *cache = hash_ctx_cache_get(0);
+
+    if (cache) {
+        pthread_setspecific(hash_ctx_key, NULL);
+        hash_ctx_cache_free(cache);
+    }
+}
+#else
+static struct hash_ctx_cache *hash_ctx_global = NULL;
+
+static struct hash_ctx_cache *hash_ctx_cache_get(int create)
+{
+    if (!hash_ctx_global && create)
+        hash_ctx_global = (struct hash_ctx_cache *)calloc(1, sizeof(*hash_ctx_global));
+
+    return hash_ctx_global;
+}
+
+static void hash_ctx_cache_release(void)
+{
+    hash_ctx_cache_free(hash_ctx_global);
+    hash_ctx_global = NULL;
+}
+#endif
+
+static const EVP_MD *hash_get_md(const char *alg)
+{
+    /* avoid the digest name table lookup for the algorithms we use ourselves */
+    if (!strcmp(alg, "md5"))
+        return EVP_md5();
+    if (!strcmp(alg, "sha1"))
+        return EVP_sha1();
+    if (!strcmp(alg, "sha256"))
+        return EVP_sha256();
+
+    return EVP_get_digestbyname(alg);
+}
+
+static EVP_MD_CTX *hash_ctx_get(const EVP_MD *md)
+{
+    struct hash_ctx_cache *cache = hash_ctx_cache_get(0);
+    EVP_MD_CTX *ctx;
+
+    if (cache && cache->count) {
+        ctx = cache->ctx[--cache->count];
+    } else {
+        ctx = EVP_MD_CTX_create();
+        if (!(ctx))
+            return NULL;
+
+#ifdef EVP_MD_CTX_FLAG_NON_FIPS_ALLOW
+        /* we will be using MD5, which is not allowed under FIPS */
+        EVP_MD_CTX_set_flags(ctx, EVP_MD_CTX_FLAG_NON_FIPS_ALLOW);
+#endif
+    }
+
+    if (!EVP_DigestInit_ex(ctx, md, NULL)) {
+        EVP_MD_CTX_destroy(ctx);
+        return NULL;
+    }
+
+    return ctx;
+}
+
+static void hash_ctx_put(EVP_MD_CTX *ctx)
+{
+    struct hash_ctx_cache *cache = hash_ctx_cache_get(1);
+
+    if (cache && cache->count < HASH_CTX_CACHE_SIZE)
+        cache->ctx[cache->count++] = ctx;
+    else
+        EVP_MD_CTX_destroy(ctx);
+}
+
+static int hash_ctx_update(EVP_MD_CTX *ctx, const void *buf, size_t len)
+{
+    size_t cur = 0;
+    int winres=0;
+
+    while (cur < len) {
+        size_t todo = MIN((size_t)HASH_UPDATE_CHUNK, len-cur);
+
+        EXCEPTION_PREAMBLE
+        if (!EVP_DigestUpdate(ctx, (void *)(((unsigned char *)buf)+cur), todo))
+            return -1;
+        EXCEPTION_POSTAMBLE
+
+        if (winres)
+            return -1;
+
+        cur += todo;
+    }
+
+    return 0;
+}
+
 int cl_initialize_crypto(void)
 {
     SSL_load_error_strings();
@@ -135,6 +301,7 @@ int cl_initialize_crypto(void)
 
 void cl_cleanup_crypto(void)
 {
+    hash_ctx_cache_release();
     EVP_cleanup();
 }
 
@@ -145,10 +312,8 @@ unsigned char *cl_hash_data(char *alg, const void *buf, size_t len, unsigned cha
     size_t mdsz;
     const EVP_MD *md;
     unsigned int i;
-    size_t cur;
-    int winres=0;
 
-    md = EVP_get_digestbyname(alg);
+    md = hash_get_md(alg);
     if (!(md))
         return NULL;
 
@@ -158,20 +323,18 @@ unsigned char *cl_hash_data(char *alg, const void *buf, size_t len, unsigned cha
     if (!(ret))
         return NULL;
 
-    ctx = EVP_MD_CTX_create();
+    ctx = hash_ctx_get(md);
     if (!(ctx)) {
         if (!(obuf))
             free(ret);
 
+        if ((olen))
+            *olen = 0;
+
         return NULL;
     }
 
-#ifdef EVP_MD_CTX_FLAG_NON_FIPS_ALLOW
-    /* we will be using MD5, which is not allowed under FIPS */
-    EVP_MD_CTX_set_flags(ctx, EVP_MD_CTX_FLAG_NON_FIPS_ALLOW);
-#endif
-
-    if (!EVP_DigestInit_ex(ctx, md, NULL)) {
+    if (hash_ctx_update(ctx, buf, len) || !EVP_DigestFinal_ex(ctx, ret, &i)) {
         if (!(obuf))
             free(ret);
 
@@ -182,54 +345,43 @@ unsigned char *cl_hash_data(char *alg, const void *buf, size_t len, unsigned cha
         return NULL;
     }
 
-    cur=0;
-    while (cur < len) {
-        size_t todo = MIN((unsigned long)EVP_MD_block_size(md), (unsigned long)(len-cur));
+    hash_ctx_put(ctx);
 
-        EXCEPTION_PREAMBLE
-        if (!EVP_DigestUpdate(ctx, (void *)(((unsigned char *)buf)+cur), todo)) {
-            if (!(obuf))
-                free(ret);
+    if ((olen))
+        *olen = i;
 
-            if ((olen))
-                *olen = 0;
+    return ret;
+}
 
-            EVP_MD_CTX_destroy(ctx);
-            return NULL;
-        }
-        EXCEPTION_POSTAMBLE
+int cl_hash_data_batch(const char *alg, size_t count, const void * const *bufs, const size_t *lens, unsigned char **obufs)
+{
+    EVP_MD_CTX *ctx;
+    const EVP_MD *md;
+    size_t n;
 
-        if (winres) {
-            if (!(obuf))
-                free(ret);
+    if (!(alg) || (count && (!(bufs) || !(lens) || !(obufs))))
+        return -1;
 
-            if ((olen))
-                *olen = 0;
+    md = hash_get_md(alg);
+    if (!(md))
+        return -1;
+
+    ctx = hash_ctx_get(md);
+    if (!(ctx))
+        return -1;
 
+    for (n = 0; n < count; n++) {
+        if ((n && !EVP_DigestInit_ex(ctx, md, NULL)) ||
+            hash_ctx_update(ctx, bufs[n], lens[n]) ||
+            !EVP_DigestFinal_ex(ctx, obufs[n], NULL)) {
             EVP_MD_CTX_destroy(ctx);
-            return NULL;
+            return -1;
         }
-
-        cur += todo;
     }
 
-    if (!EVP_DigestFinal_ex(ctx, ret, &i)) {
-        if (!(obuf))
-            free(ret);
-
-        if ((olen))
-            *olen = 0;
+    hash_ctx_put(ctx);
 
-        EVP_MD_CTX_destroy(ctx);
-        return NULL;
-    }
-
-    EVP_MD_CTX_destroy(ctx);
-
-    if ((olen))
-        *olen = i;
-
-    return ret;
+    return 0;
 }
 
 unsigned char *cl_hash_file_fd(int fd, char *alg, unsigned int *olen)
@@ -1135,29 +1287,13 @@ X509_CRL *cl_load_crl(const char *file)
 
 void *cl_hash_init(const char *alg)
 {
-    EVP_MD_CTX *ctx;
     const EVP_MD *md;
 
-    md = EVP_get_digestbyname(alg);
+    md = hash_get_md(alg);
     if (!(md))
         return NULL;
 
-    ctx = EVP_MD_CTX_create();
-    if (!(ctx)) {
-        return NULL;
-    }
-
-#ifdef EVP_MD_CTX_FLAG_NON_FIPS_ALLOW
-    /* we will be using MD5, which is not allowed under FIPS */
-    EVP_MD_CTX_set_flags(ctx, EVP_MD_CTX_FLAG_NON_FIPS_ALLOW);
-#endif
-
-    if (!EVP_DigestInit_ex(ctx, md, NULL)) {
-        EVP_MD_CTX_destroy(ctx);
-        return NULL;
-    }
-
-    return (void *)ctx;
+    return (void *)hash_ctx_get(md);
 }
 
 int cl_update_hash(void *ctx, void *data, size_t sz)
@@ -1188,7 +1324,7 @@ int cl_finish_hash(void *ctx, void *buf)
     if (!EVP_DigestFinal_ex((EVP_MD_CTX *)ctx, (unsigned char *)buf, NULL))
         res = -1;
 
-    EVP_MD_CTX_destroy((EVP_MD_CTX *)ctx);
+    hash_ctx_put((EVP_MD_CTX *)ctx);
 
     return res;
 }
@@ -1198,5 +1334,5 @@ void cl_hash_destroy(void *ctx)
     if (!(ctx))
         return;
 
-    EVP_MD_CTX_destroy((EVP_MD_CTX *)ctx);
+    hash_ctx_put((EVP_MD_CTX *)ctx);
 }
@@ -53,4 +53,7 @@
 #define CLI_DEFAULT_PCRE_RECMATCH_LIMIT  5000
 #define CLI_DEFAULT_PCRE_MAX_FILESIZE    26214400
 
+/* pages */
+#define CLI_DEFAULT_READAHEAD           32
+
 #endif
@@ -37,6 +37,7 @@
 #endif
 #endif
 #include <errno.h>
+#include <fcntl.h>
 
 #ifdef C_LINUX
 #include <pthread.h>
@@ -175,7 +176,6 @@ fmap_t *fmap_check_empty(int fd, off_t offset, size_t len, int *empty) { /* WIN3
 /* FIXME: tune this stuff */
 #define UNPAGE_THRSHLD_LO 4*1024*1024
 #define UNPAGE_THRSHLD_HI 8*1024*1024
-#define READAHEAD_PAGES 8
 
 #if defined(ANONYMOUS_MAP) && defined(C_LINUX) && defined(CL_THREAD_SAFE)
 /*
@@ -271,6 +271,10 @@ extern cl_fmap_t *cl_fmap_open_handle(void *handle, size_t offset, size_t len,
     m->pgsz = pgsz;
     m->paged = 0;
     m->dont_cache_flag = 0;
+    m->have_maphash = 0;
+    m->readahead = 0;
+    m->ra_next = 0;
+    m->ra_advised = 0;
     m->unmap = use_aging ? unmap_mmap : unmap_malloc;
     m->need = handle_need;
     m->need_offstr = handle_need_offstr;
@@ -472,6 +476,39 @@ static int fmap_readpage(fmap_t *m, unsigned int first_page, unsigned int count,
 }
 
 
+/* Called with the page range of a need; returns the (possibly extended)
+ * last page to read. Once two consecutive needs continue where the previous
+ * one stopped, the next m->readahead pages are prefetched: fd backed maps
+ * ask the kernel to start reading them in the background, other handles
+ * fold them into the current read so the pread callback sees fewer, larger
+ * requests. */
+static unsigned int fmap_readahead(fmap_t *m, unsigned int first_page, unsigned int last_page) {
+    unsigned int sequential, ra_last;
+
+    sequential = (first_page == m->ra_next || (m->ra_next && first_page == m->ra_next - 1));
+    m->ra_next = last_page + 1;
+    if(!sequential || !m->readahead || last_page + 1 >= m->pages)
+	return last_page;
+
+    ra_last = MIN(last_page + m->readahead, m->pages - 1);
+    if(m->handle_is_fd) {
+#if defined(HAVE_POSIX_FADVISE) && defined(POSIX_FADV_WILLNEED)
+	unsigned int ra_first = MAX(last_page + 1, m->ra_advised);
+
+	/* only advise again once half the previous window was consumed */
+	if(ra_first <= ra_last && last_page + m->readahead / 2 >= m->ra_advised) {
+	    posix_fadvise((int)(ssize_t)m->handle,
+			  m->offset + (off_t)ra_first * m->pgsz,
+			  (off_t)(ra_last - ra_first + 1) * m->pgsz,
+			  POSIX_FADV_WILLNEED);
+	    m->ra_advised = ra_last + 1;
+	}
+#endif
+	return last_page;
+    }
+    return ra_last;
+}
+
 static const void *handle_need(fmap_t *m, size_t at, size_t len, int lock) {
     unsigned int first_page, last_page, lock_count;
     char *ret;
@@ -488,10 +525,7 @@ static const void *handle_need(fmap_t *m, size_t at, size_t len, int lock) {
     first_page = fmap_which_page(m, at);
     last_page = fmap_which_page(m, at + len - 1);
     lock_count = (lock!=0) * (last_page-first_page+1);
-#ifdef READAHED_PAGES
-    last_page += READAHED_PAGES;
-    if(last_page >= m->pages) last_page = m->pages - 1;
-#endif
+    last_page = fmap_readahead(m, first_page, last_page);
 
     if(fmap_readpage(m, first_page, last_page-first_page+1, lock_count))
 	return NULL;
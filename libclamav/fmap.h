@@ -52,6 +52,14 @@ struct cl_fmap {
     unsigned short aging;
     unsigned short dont_cache_flag;
     unsigned short handle_is_fd;
+    /* MD5 of the whole map, when the caller computed it beforehand */
+    unsigned char maphash[16];
+    unsigned int have_maphash;
+
+    /* sequential readahead */
+    unsigned int readahead;/* pages to prefetch past a sequential need, 0 = off */
+    unsigned int ra_next;/* page following the last need */
+    unsigned int ra_advised;/* first page not yet prefetched */
 
     /* memory interface */
     const void *data;
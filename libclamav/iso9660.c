@@ -54,43 +54,64 @@ static const void *needblock(const iso9660_t *iso, unsigned int block, int temp)
 }
 
 
-static int iso_scan_file(const iso9660_t *iso, unsigned int block, unsigned int len) {
-    char *tmpf;
-    int fd, ret = CL_SUCCESS;
-
-    if(cli_gentempfd(iso->ctx->engine->tmpdir, &tmpf, &fd) != CL_SUCCESS)
-        return CL_ETMPFILE;
-
-    cli_dbgmsg("iso_scan_file: dumping to %s\n", tmpf);
-    while(len) {
-        const void *buf = needblock(iso, block, 1);
-        unsigned int todo = MIN(len, iso->blocksz);
-        if(!buf) {
-            /* Block outside file */
-            cli_dbgmsg("iso_scan_file: cannot dump block outside file, ISO may be truncated\n");
-            ret = CL_EFORMAT;
-            break;
-        }
-        if((unsigned int)cli_writen(fd, buf, todo) != todo) {
-            cli_warnmsg("iso_scan_file: Can't write to file %s\n", tmpf);
-            ret = CL_EWRITE;
+/* a file in a raw sector image, gathered from the user data of each sector */
+struct iso_extent {
+    const iso9660_t *iso;
+    fmap_t *map;
+    unsigned int block;
+};
+
+static off_t iso_extent_pread(void *handle, void *buf, size_t count, off_t offset) {
+    const struct iso_extent *ext = handle;
+    const iso9660_t *iso = ext->iso;
+    unsigned int blocks_per_sect = (2048 / iso->blocksz);
+    size_t done = 0;
+
+    while(done < count) {
+        unsigned int block = ext->block + (offset + done) / iso->blocksz;
+        unsigned int skip = (offset + done) % iso->blocksz;
+        unsigned int todo = MIN(count - done, iso->blocksz - skip);
+        size_t loff = (block / blocks_per_sect) * iso->sectsz + (block % blocks_per_sect) * iso->blocksz;
+        const char *src = fmap_need_off_once(ext->map, iso->base_offset + loff + skip, todo);
+
+        if(!src)
             break;
-        }
-        len -= todo;
-        block++;
+        memcpy((char *)buf + done, src, todo);
+        done += todo;
     }
+    return done;
+}
 
-    if (!len)
-        ret = cli_magic_scandesc(fd, iso->ctx);
+static int iso_scan_file(const iso9660_t *iso, unsigned int block, unsigned int len) {
+    cli_ctx *ctx = iso->ctx;
+    unsigned int blocks_per_sect = (2048 / iso->blocksz);
+    struct iso_extent ext;
+    fmap_t *map;
+    int ret;
+
+    if(!len)
+        return CL_SUCCESS;
+    if(!needblock(iso, block + (len - 1) / iso->blocksz, 1)) {
+        cli_dbgmsg("iso_scan_file: file extends beyond the image, ISO may be truncated\n");
+        return CL_EFORMAT;
+    }
 
-    close(fd);
-    if(!iso->ctx->engine->keeptmp) {
-	if(cli_unlink(tmpf)) {
-	    ret = CL_EUNLINK;
-	}
+    if(iso->sectsz == blocks_per_sect * iso->blocksz) {
+        /* cooked image: the blocks are contiguous, scan them in place */
+        size_t loff = (block / blocks_per_sect) * iso->sectsz + (block % blocks_per_sect) * iso->blocksz;
+        return cli_map_scan(*ctx->fmap, iso->base_offset + loff, len, ctx, CL_TYPE_ANY);
     }
 
-    free(tmpf);
+    /* raw image: skip the sector headers and error correction data */
+    ext.iso = iso;
+    ext.map = *ctx->fmap;
+    ext.block = block;
+    if(!(map = cl_fmap_open_handle(&ext, 0, len, iso_extent_pread, 1))) {
+        cli_errmsg("iso_scan_file: can't map the file extent\n");
+        return CL_EMAP;
+    }
+    ret = cli_map_scan(map, 0, len, ctx, CL_TYPE_ANY);
+    cl_fmap_close(map);
     return ret;
 }
 
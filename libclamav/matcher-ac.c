@@ -46,6 +46,12 @@
 #include "filtering.h"
 
 #include "mpool.h"
+#include "arena.h"
+#include "sigprof.h"
+
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #define AC_SPECIAL_ALT_CHAR             1
 #define AC_SPECIAL_ALT_STR_FIXED        2
@@ -480,11 +486,73 @@ static int ac_maketrans(struct cli_matcher *root)
     return CL_SUCCESS;
 }
 
+/*
+ * Collects the lsigs that cli_exp_eval() has to look at even when none of
+ * their subsigs matched: YARA rules, and expressions that are already true
+ * with all counters at zero (e.g. "0=0").
+ */
+static int ac_lsig_always(struct cli_matcher *root)
+{
+    const struct cli_ac_lsig *lsig;
+    uint32_t i, n, zero[64];
+    unsigned int cnt;
+    uint64_t ids;
+    uint8_t *always;
+
+    mpool_free(root->mempool, root->ac_lsig_always);
+    root->ac_lsig_always = NULL;
+    root->ac_lsig_always_num = 0;
+    if(!root->ac_lsigs)
+        return CL_SUCCESS;
+
+    always = (uint8_t *) cli_calloc(root->ac_lsigs, sizeof(uint8_t));
+    if(!always) {
+        cli_errmsg("cli_ac_buildtrie: Can't allocate memory for lsig evaluation list\n");
+        return CL_EMEM;
+    }
+
+    memset(zero, 0, sizeof(zero));
+    for(i = 0, n = 0; i < root->ac_lsigs; i++) {
+        lsig = root->ac_lsigtable[i];
+        if(lsig->type != CLI_LSIG_NORMAL) {
+            always[i] = 1;
+        } else if(lsig->prog) {
+            always[i] = (cli_ac_evallsig(lsig->prog, zero) == 1);
+        } else {
+            cnt = 0;
+            ids = 0;
+            always[i] = (cli_ac_chklsig(lsig->u.logic, lsig->u.logic + strlen(lsig->u.logic), zero, &cnt, &ids, 0) == 1);
+        }
+        n += always[i];
+    }
+
+    if(n) {
+        root->ac_lsig_always = (uint32_t *) mpool_malloc(root->mempool, n * sizeof(uint32_t));
+        if(!root->ac_lsig_always) {
+            cli_errmsg("cli_ac_buildtrie: Can't allocate memory for lsig evaluation list\n");
+            free(always);
+            return CL_EMEM;
+        }
+        for(i = 0; i < root->ac_lsigs; i++)
+            if(always[i])
+                root->ac_lsig_always[root->ac_lsig_always_num++] = i;
+    }
+    cli_dbgmsg("cli_ac_buildtrie: %u of %u lsigs are evaluated unconditionally\n", n, root->ac_lsigs);
+
+    free(always);
+    return CL_SUCCESS;
+}
+
 int cli_ac_buildtrie(struct cli_matcher *root)
 {
+    int ret;
+
     if(!root)
         return CL_EMALFDB;
 
+    if((ret = ac_lsig_always(root)) != CL_SUCCESS)
+        return ret;
+
     if(!(root->ac_root)) {
         cli_dbgmsg("cli_ac_buildtrie: AC pattern matcher is not initialised\n");
         return CL_SUCCESS;
@@ -575,6 +643,9 @@ void cli_ac_free(struct cli_matcher *root)
     uint32_t i;
     struct cli_ac_patt *patt;
 
+    mpool_free(root->mempool, root->ac_lsig_always);
+    root->ac_lsig_always = NULL;
+
     for(i = 0; i < root->ac_patterns; i++) {
         patt = root->ac_pattable[i];
         mpool_free(root->mempool, patt->prefix ? patt->prefix : patt->pattern);
@@ -861,6 +932,247 @@ int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigne
     }
 }
 
+/*
+ * Compiles a logical expression into postfix form. The parsing below mirrors
+ * cli_ac_chklsig() step by step so that cli_ac_evallsig() gives exactly the
+ * same answers; the only difference is that nodes are emitted instead of
+ * being evaluated.
+ */
+static int ac_lsig_emit(const char *expr, const char *end, struct cli_lsig_node *code, unsigned int *ncode)
+{
+    unsigned int i, len = end - expr, pth = 0, opoff = 0, op1off = 0;
+    unsigned int blkend = 0, id, modval1 = 0, modval2 = 0, modoff = 0;
+    int ret;
+    char op = 0, op1 = 0, mod = 0, blkmod = 0;
+    const char *lstart = expr, *lend = NULL, *rstart = NULL, *rend = end, *pt;
+    struct cli_lsig_node *node;
+
+    for(i = 0; i < len; i++) {
+        switch(expr[i]) {
+        case '(':
+            pth++;
+            break;
+
+        case ')':
+            if(!pth)
+                return -1;
+            pth--;
+
+        case '>':
+        case '<':
+        case '=':
+            mod = expr[i];
+            modoff = i;
+            break;
+
+        default:
+            if(strchr("&|", expr[i])) {
+                if(!pth) {
+                    op = expr[i];
+                    opoff = i;
+                } else if(pth == 1) {
+                    op1 = expr[i];
+                    op1off = i;
+                }
+            }
+        }
+
+        if(op)
+            break;
+
+        if(op1 && !pth) {
+            blkend = i;
+            if(expr[i + 1] == '>' || expr[i + 1] == '<' || expr[i + 1] == '=') {
+                blkmod = expr[i + 1];
+
+                ret = sscanf(&expr[i + 2], "%u,%u", &modval1, &modval2);
+                if(ret != 2)
+                    ret = sscanf(&expr[i + 2], "%u", &modval1);
+
+                if(!ret || ret == EOF)
+                    return -1;
+
+                for(i += 2; i + 1 < len && (isdigit(expr[i + 1]) || expr[i + 1] == ','); i++)
+                    ;
+            }
+
+            if(&expr[i + 1] == rend)
+                break;
+            else
+                blkmod = 0;
+        }
+    }
+
+    if(pth)
+        return -1;
+
+    if(!op && !op1) {
+        if(expr[0] == '(')
+            return ac_lsig_emit(++expr, --end, code, ncode);
+
+        ret = sscanf(expr, "%u", &id);
+        if(!ret || ret == EOF || id >= 64)
+            return -1;
+
+        if(mod) {
+            pt = expr + modoff + 1;
+            ret = sscanf(pt, "%u", &modval1);
+            if(!ret || ret == EOF)
+                return -1;
+        }
+
+        if(*ncode == CLI_LSIG_PROG_MAX)
+            return -1;
+        node = &code[(*ncode)++];
+        node->op = CLI_LSIG_OP_SUBSIG;
+        node->mod = mod;
+        node->id = id;
+        node->modval1 = modval1;
+        node->modval2 = 0;
+        return 0;
+    }
+
+    if(!op) {
+        op = op1;
+        opoff = op1off;
+        lstart++;
+        rend = &expr[blkend];
+    }
+
+    if(!opoff || opoff + 1 == len)
+        return -1;
+
+    lend = &expr[opoff];
+    rstart = &expr[opoff + 1];
+
+    if(ac_lsig_emit(lstart, lend, code, ncode) == -1 || ac_lsig_emit(rstart, rend, code, ncode) == -1)
+        return -1;
+
+    if(*ncode == CLI_LSIG_PROG_MAX)
+        return -1;
+    node = &code[(*ncode)++];
+    node->op = (op == '&') ? CLI_LSIG_OP_AND : CLI_LSIG_OP_OR;
+    node->mod = blkmod;
+    node->id = 0;
+    node->modval1 = modval1;
+    node->modval2 = modval2;
+    return 0;
+}
+
+struct cli_lsig_prog *cli_ac_compilelsig(mpool_t *mempool, const char *expr)
+{
+    struct cli_lsig_node code[CLI_LSIG_PROG_MAX];
+    struct cli_lsig_prog *prog;
+    unsigned int i, ncode = 0, depth = 0, maxdepth = 0;
+
+    if(!expr || !*expr || ac_lsig_emit(expr, expr + strlen(expr), code, &ncode) == -1)
+        return NULL;
+
+    for(i = 0; i < ncode; i++) {
+        if(code[i].op == CLI_LSIG_OP_SUBSIG) {
+            if(++depth > maxdepth)
+                maxdepth = depth;
+        } else {
+            depth--;
+        }
+    }
+    if(depth != 1 || maxdepth > CLI_LSIG_STACK_MAX)
+        return NULL;
+
+    prog = (struct cli_lsig_prog *) mpool_malloc(mempool, sizeof(struct cli_lsig_prog) + (ncode - 1) * sizeof(struct cli_lsig_node));
+    if(!prog) {
+        cli_errmsg("cli_ac_compilelsig: Can't allocate memory for lsig program\n");
+        return NULL;
+    }
+    prog->len = ncode;
+    memcpy(prog->code, code, ncode * sizeof(struct cli_lsig_node));
+    return prog;
+}
+
+static inline int ac_lsig_cmp(char mod, uint32_t val, uint32_t modval)
+{
+    switch(mod) {
+    case '=':
+        return val == modval;
+    case '<':
+        return val < modval;
+    case '>':
+        return val > modval;
+    default:
+        return 0;
+    }
+}
+
+/* Evaluates a program built by cli_ac_compilelsig(); same result as cli_ac_chklsig() */
+int cli_ac_evallsig(const struct cli_lsig_prog *prog, const uint32_t *lsigcnt)
+{
+    struct {
+        int val;
+        uint32_t cnt;
+        uint64_t ids;
+    } stack[CLI_LSIG_STACK_MAX], *l, *r;
+    const struct cli_lsig_node *node = prog->code, *last = prog->code + prog->len;
+    unsigned int sp = 0, val;
+    uint32_t tcnt;
+    uint64_t tids;
+
+    for(; node < last; node++) {
+        if(node->op == CLI_LSIG_OP_SUBSIG) {
+            l = &stack[sp++];
+            val = lsigcnt[node->id];
+            if(node->mod ? ac_lsig_cmp(node->mod, val, node->modval1) : (val != 0)) {
+                l->val = 1;
+                l->cnt = val;
+                l->ids = (uint64_t) 1 << node->id;
+            } else {
+                l->val = 0;
+                l->cnt = 0;
+                l->ids = 0;
+            }
+            continue;
+        }
+
+        r = &stack[--sp];
+        l = &stack[sp - 1];
+        if(node->op == CLI_LSIG_OP_AND)
+            l->val = l->val && r->val;
+        else
+            l->val = l->val || r->val;
+
+        if(l->val) {
+            tcnt = l->cnt + r->cnt;
+            tids = l->ids | r->ids;
+        } else {
+            tcnt = 0;
+            tids = 0;
+        }
+
+        if(!node->mod) {
+            l->cnt = tcnt;
+            l->ids = tids;
+            continue;
+        }
+
+        /* block modifiers only pass the count on, never the ids */
+        l->cnt = tcnt;
+        l->ids = 0;
+        l->val = ac_lsig_cmp(node->mod, tcnt, node->modval1);
+        if(l->val && node->modval2) {
+            val = 0;
+            while(tids) {
+                val += tids & (uint64_t) 1;
+                tids >>= 1;
+            }
+            if(val < node->modval2)
+                l->val = 0;
+        }
+        if(!l->val)
+            l->cnt = 0;
+    }
+
+    return stack[0].val;
+}
+
 inline static int ac_findmatch_special(const unsigned char *buffer, uint32_t offset, uint32_t bp, uint32_t fileoffset, uint32_t length,
                                        const struct cli_ac_patt *pattern, uint32_t pp, uint16_t specialcnt, uint32_t *start, uint32_t *end, int rev);
 static int ac_backward_match_branch(const unsigned char *buffer, uint32_t bp, uint32_t offset, uint32_t length, uint32_t fileoffset,
@@ -1250,9 +1562,175 @@ inline static int ac_findmatch(const unsigned char *buffer, uint32_t offset, uin
     return 0;
 }
 
+/*
+ * The per-lsig tables of a cli_ac_data take time proportional to the
+ * number of lsigs to set up, however few of them an object touches. So
+ * cli_ac_freedata() puts back only the entries of the lsigs that were
+ * touched and parks the tables in a small per-thread cache, and the next
+ * object with the same number of lsigs takes them over as they are.
+ */
+#define AC_LSIG_TABLES_CACHED 8
+
+struct cli_ac_lsig_tables {
+    struct cli_ac_lsig_tables *next;
+    uint32_t lsigs;
+    uint32_t **lsigcnt;                     /* lsigcnt, suboff_last, suboff_first */
+    struct cli_lsig_matches **matches;
+    uint32_t *shared;
+    uint32_t *dirty;
+    uint32_t *yr;
+    uint8_t *yr_matches;
+};
+
+struct ac_lsig_tables_cache {
+    struct cli_ac_lsig_tables *head;
+    unsigned int count;
+};
+
+static struct cli_ac_lsig_tables *ac_lsig_tables_new(uint32_t lsigs)
+{
+    struct cli_ac_lsig_tables *t;
+    unsigned char *p;
+    uint32_t i;
+
+    /* pointers first, then the uint32_t arrays, then the bytes */
+    t = (struct cli_ac_lsig_tables *) cli_malloc(sizeof(*t) +
+            4 * lsigs * sizeof(void *) + (2 * 64 + 2 * lsigs) * sizeof(uint32_t) + lsigs);
+    if(!t)
+        return NULL;
+
+    p = (unsigned char *)(t + 1);
+    t->next = NULL;
+    t->lsigs = lsigs;
+    t->lsigcnt = (uint32_t **) p;
+    p += 3 * lsigs * sizeof(uint32_t *);
+    t->matches = (struct cli_lsig_matches **) p;
+    p += lsigs * sizeof(struct cli_lsig_matches *);
+    t->shared = (uint32_t *) p;
+    p += 2 * 64 * sizeof(uint32_t);
+    t->dirty = (uint32_t *) p;
+    p += lsigs * sizeof(uint32_t);
+    t->yr = (uint32_t *) p;
+    p += lsigs * sizeof(uint32_t);
+    t->yr_matches = (uint8_t *) p;
+
+    memset(t->shared, 0, 64 * sizeof(uint32_t));
+    for(i = 64; i < 2 * 64; i++)
+        t->shared[i] = CLI_OFF_NONE;
+    for(i = 0; i < lsigs; i++) {
+        t->lsigcnt[i] = t->shared;
+        t->lsigcnt[lsigs + i] = t->shared + 64;
+        t->lsigcnt[2 * lsigs + i] = t->shared + 64;
+        t->matches[i] = NULL;
+    }
+    memset(t->yr_matches, 0, lsigs);
+    return t;
+}
+
+static void ac_lsig_tables_cache_free(void *arg)
+{
+    struct ac_lsig_tables_cache *cache = (struct ac_lsig_tables_cache *)arg;
+    struct cli_ac_lsig_tables *t;
+
+    if(!cache)
+        return;
+
+    while((t = cache->head)) {
+        cache->head = t->next;
+        free(t);
+    }
+    free(cache);
+}
+
+#ifdef CL_THREAD_SAFE
+static pthread_key_t ac_lsig_tables_key;
+static pthread_once_t ac_lsig_tables_once = PTHREAD_ONCE_INIT;
+static int ac_lsig_tables_key_ok = 0;
+
+static void ac_lsig_tables_key_init(void)
+{
+    if(!pthread_key_create(&ac_lsig_tables_key, ac_lsig_tables_cache_free))
+        ac_lsig_tables_key_ok = 1;
+}
+
+static struct ac_lsig_tables_cache *ac_lsig_tables_cache_get(int create)
+{
+    struct ac_lsig_tables_cache *cache;
+
+    pthread_once(&ac_lsig_tables_once, ac_lsig_tables_key_init);
+    if(!ac_lsig_tables_key_ok)
+        return NULL;
+
+    cache = (struct ac_lsig_tables_cache *)pthread_getspecific(ac_lsig_tables_key);
+    if(!cache && create) {
+        cache = (struct ac_lsig_tables_cache *)calloc(1, sizeof(*cache));
+        if(cache && pthread_setspecific(ac_lsig_tables_key, cache)) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+#else
+static struct ac_lsig_tables_cache *ac_lsig_tables_global = NULL;
+
+static struct ac_lsig_tables_cache *ac_lsig_tables_cache_get(int create)
+{
+    if(!ac_lsig_tables_global && create)
+        ac_lsig_tables_global = (struct ac_lsig_tables_cache *)calloc(1, sizeof(*ac_lsig_tables_global));
+
+    return ac_lsig_tables_global;
+}
+#endif
+
+static struct cli_ac_lsig_tables *ac_lsig_tables_get(uint32_t lsigs)
+{
+    struct ac_lsig_tables_cache *cache = ac_lsig_tables_cache_get(0);
+    struct cli_ac_lsig_tables **pt, *t;
+
+    /* each root has its own number of lsigs */
+    for(pt = cache ? &cache->head : NULL; pt && (t = *pt); pt = &t->next) {
+        if(t->lsigs == lsigs) {
+            *pt = t->next;
+            cache->count--;
+            t->next = NULL;
+            return t;
+        }
+    }
+
+    return ac_lsig_tables_new(lsigs);
+}
+
+static void ac_lsig_tables_put(struct cli_ac_lsig_tables *t)
+{
+    struct ac_lsig_tables_cache *cache = ac_lsig_tables_cache_get(1);
+    struct cli_ac_lsig_tables **pt;
+
+    if(!cache) {
+        free(t);
+        return;
+    }
+    t->next = cache->head;
+    cache->head = t;
+    if(++cache->count > AC_LSIG_TABLES_CACHED) {
+        /* drop the least recently used, e.g. left by a reloaded engine */
+        for(pt = &cache->head; (*pt)->next; pt = &(*pt)->next)
+            ;
+        free(*pt);
+        *pt = NULL;
+        cache->count--;
+    }
+}
+
 int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen)
 {
-    unsigned int i, j;
+    return cli_ac_initdata_arena(data, partsigs, lsigs, reloffsigs, tracklen, NULL);
+}
+
+int cli_ac_initdata_arena(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen, struct cli_arena *arena)
+{
+    unsigned int i;
 
     UNUSEDPARAM(tracklen);
 
@@ -1261,10 +1739,11 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
         return CL_ENULLARG;
     }
     memset((void *)data, 0, sizeof(struct cli_ac_data));
+    data->arena = arena;
 
     data->reloffsigs = reloffsigs;
     if(reloffsigs) {
-        data->offset = (uint32_t *) cli_malloc(reloffsigs * 2 * sizeof(uint32_t));
+        data->offset = (uint32_t *) cli_arena_malloc(data->arena, reloffsigs * 2 * sizeof(uint32_t));
         if(!data->offset) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offset\n");
             return CL_EMEM;
@@ -1275,12 +1754,12 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
 
     data->partsigs = partsigs;
     if(partsigs) {
-        data->offmatrix = (int32_t ***) cli_calloc(partsigs, sizeof(int32_t **));
+        data->offmatrix = (int32_t ***) cli_arena_calloc(data->arena, partsigs, sizeof(int32_t **));
         if(!data->offmatrix) {
             cli_errmsg("cli_ac_init: Can't allocate memory for data->offmatrix\n");
 
             if(reloffsigs)
-                free(data->offset);
+                cli_arena_free(data->arena, data->offset);
 
             return CL_EMEM;
         }
@@ -1288,108 +1767,28 @@ int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs,
  
     data->lsigs = lsigs;
     if(lsigs) {
-        data->lsigcnt = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        if(!data->lsigcnt) {
+        /* Counters and suboffsets are allocated per lsig on its first subsig
+         * match (ac_lsig_touch()); until then all lsigs share one read-only
+         * row of zero counters and CLI_OFF_NONE suboffsets. The tables that
+         * point at them come clean from ac_lsig_tables_get(). */
+        if(!(data->lsig_tables = ac_lsig_tables_get(lsigs))) {
             if(partsigs)
-                free(data->offmatrix);
+                cli_arena_free(data->arena, data->offmatrix);
 
             if(reloffsigs)
-                free(data->offset);
+                cli_arena_free(data->arena, data->offset);
 
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt\n");
+            cli_errmsg("cli_ac_init: Can't allocate memory for lsig match data\n");
             return CL_EMEM;
         }
-        data->lsigcnt[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        if(!data->lsigcnt[0]) {
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigcnt[0]\n");
-            return CL_EMEM;
-        }
-        for(i = 1; i < lsigs; i++)
-            data->lsigcnt[i] = data->lsigcnt[0] + 64 * i;
-        data->yr_matches = (uint8_t *) cli_calloc(lsigs, sizeof(uint8_t));
-        if (data->yr_matches == NULL) {
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-            
-            if(reloffsigs)
-                free(data->offset);
-            return CL_EMEM;
-        }
-
-        /* subsig offsets */
-        data->lsig_matches = (struct cli_lsig_matches **) cli_calloc(lsigs, sizeof(struct cli_lsig_matches *));
-        if(!data->lsig_matches) {
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsig_matches\n");
-            return CL_EMEM;
-        }
-        data->lsigsuboff_last = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        data->lsigsuboff_first = (uint32_t **) cli_malloc(lsigs * sizeof(uint32_t *));
-        if(!data->lsigsuboff_last || !data->lsigsuboff_first) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)\n");
-            return CL_EMEM;
-        }
-        data->lsigsuboff_last[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        data->lsigsuboff_first[0] = (uint32_t *) cli_calloc(lsigs * 64, sizeof(uint32_t));
-        if(!data->lsigsuboff_last[0] || !data->lsigsuboff_first[0]) {
-            free(data->lsig_matches);
-            free(data->lsigsuboff_last[0]);
-            free(data->lsigsuboff_first[0]);
-            free(data->lsigsuboff_last);
-            free(data->lsigsuboff_first);
-            free(data->yr_matches);
-            free(data->lsigcnt[0]);
-            free(data->lsigcnt);
-            if(partsigs)
-                free(data->offmatrix);
-
-            if(reloffsigs)
-                free(data->offset);
-
-            cli_errmsg("cli_ac_init: Can't allocate memory for data->lsigsuboff_(last|first)[0]\n");
-            return CL_EMEM;
-        }
-        for(j = 0; j < 64; j++) {
-            data->lsigsuboff_last[0][j] = CLI_OFF_NONE;
-            data->lsigsuboff_first[0][j] = CLI_OFF_NONE;
-        }
-        for(i = 1; i < lsigs; i++) {
-            data->lsigsuboff_last[i] = data->lsigsuboff_last[0] + 64 * i;
-            data->lsigsuboff_first[i] = data->lsigsuboff_first[0] + 64 * i;
-            for(j = 0; j < 64; j++) {
-                data->lsigsuboff_last[i][j] = CLI_OFF_NONE;
-                data->lsigsuboff_first[i][j] = CLI_OFF_NONE;
-            }
-        }
+        data->lsigcnt = data->lsig_tables->lsigcnt;
+        data->lsigsuboff_last = data->lsigcnt + lsigs;
+        data->lsigsuboff_first = data->lsigcnt + 2 * lsigs;
+        data->lsig_shared = data->lsig_tables->shared;
+        data->lsig_dirty = data->lsig_tables->dirty;
+        data->lsig_yr = data->lsig_tables->yr;
+        data->yr_matches = data->lsig_tables->yr_matches;
+        data->lsig_matches = data->lsig_tables->matches;
     }
     for (i=0;i<32;i++)
         data->macro_lastmatch[i] = CLI_OFF_NONE;
@@ -1425,7 +1824,7 @@ int cli_ac_caloff(const struct cli_matcher *root, struct cli_ac_data *data, cons
 
 void cli_ac_freedata(struct cli_ac_data *data)
 {
-    uint32_t i;
+    uint32_t i, k;
 
     if (!data)
         return;
@@ -1433,46 +1832,49 @@ void cli_ac_freedata(struct cli_ac_data *data)
     if(data->partsigs) {
         for(i = 0; i < data->partsigs; i++) {
             if(data->offmatrix[i]) {
-                free(data->offmatrix[i][0]);
-                free(data->offmatrix[i]);
+                cli_arena_free(data->arena, data->offmatrix[i][0]);
+                cli_arena_free(data->arena, data->offmatrix[i]);
             }
         }
-        free(data->offmatrix);
+        cli_arena_free(data->arena, data->offmatrix);
         data->offmatrix = NULL;
         data->partsigs = 0;
     }
 
     if(data->lsigs) {
-        if (data->lsig_matches) {
-            for (i = 0; i < data->lsigs; i++) {
-                struct cli_lsig_matches * ls_matches;
-                if ((ls_matches = data->lsig_matches[i])) {
-                    uint32_t j;
-                    for (j = 0; j < ls_matches->subsigs; j++) {
-                        if (ls_matches->matches[j]) {
-                            free(ls_matches->matches[j]);
-                            ls_matches->matches[j] = 0;
-                        }
-                    }
-                    free(data->lsig_matches[i]);
-                    data->lsig_matches[i] = 0;
+        /* put back what the object touched, the tables go to the cache */
+        for (k = 0; k < data->lsig_ndirty; k++) {
+            struct cli_lsig_matches * ls_matches;
+            i = data->lsig_dirty[k];
+            if ((ls_matches = data->lsig_matches[i])) {
+                uint32_t j;
+                for (j = 0; j < ls_matches->subsigs; j++) {
+                    if (ls_matches->matches[j])
+                        cli_arena_free(data->arena, ls_matches->matches[j]);
                 }
+                cli_arena_free(data->arena, ls_matches);
+                data->lsig_matches[i] = NULL;
             }
-            free(data->lsig_matches);
-            data->lsig_matches = 0;
-        }
-        free(data->yr_matches);
-        free(data->lsigcnt[0]);
-        free(data->lsigcnt);
-        free(data->lsigsuboff_last[0]);
-        free(data->lsigsuboff_last);
-        free(data->lsigsuboff_first[0]);
-        free(data->lsigsuboff_first);
+            cli_arena_free(data->arena, data->lsigcnt[i]);
+            data->lsigcnt[i] = data->lsig_shared;
+            data->lsigsuboff_last[i] = data->lsig_shared + 64;
+            data->lsigsuboff_first[i] = data->lsig_shared + 64;
+        }
+        data->lsig_ndirty = 0;
+        for (k = 0; k < data->lsig_nyr; k++)
+            data->yr_matches[data->lsig_yr[k]] = 0;
+        data->lsig_nyr = 0;
+        ac_lsig_tables_put(data->lsig_tables);
+        data->lsig_tables = NULL;
+        data->lsigcnt = data->lsigsuboff_last = data->lsigsuboff_first = NULL;
+        data->lsig_shared = data->lsig_dirty = data->lsig_yr = NULL;
+        data->lsig_matches = NULL;
+        data->yr_matches = NULL;
         data->lsigs = 0;
     }
 
     if(data->reloffsigs) {
-        free(data->offset);
+        cli_arena_free(data->arena, data->offset);
         data->reloffsigs = 0;
     }
 }
@@ -1511,12 +1913,38 @@ inline static int ac_addtype(struct cli_matched_type **list, cli_file_t type, of
     return CL_SUCCESS;
 }
 
+/* gives an lsig its own counters and puts it on the dirty list */
+static int ac_lsig_touch(struct cli_ac_data *mdata, uint32_t lsigid)
+{
+    uint32_t *row;
+    unsigned int j;
+
+    row = (uint32_t *) cli_arena_malloc(mdata->arena, 3 * 64 * sizeof(uint32_t));
+    if(!row) {
+        cli_errmsg("lsig_sub_matched: Can't allocate memory for lsig counters\n");
+        return CL_EMEM;
+    }
+    memset(row, 0, 64 * sizeof(uint32_t));
+    for(j = 64; j < 3 * 64; j++)
+        row[j] = CLI_OFF_NONE;
+
+    mdata->lsigcnt[lsigid] = row;
+    mdata->lsigsuboff_last[lsigid] = row + 64;
+    mdata->lsigsuboff_first[lsigid] = row + 2 * 64;
+    mdata->lsig_dirty[mdata->lsig_ndirty++] = lsigid;
+    return CL_SUCCESS;
+}
+
 int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t lsigid1, uint32_t lsigid2, uint32_t realoff, int partial)
 {
     const struct cli_ac_lsig *ac_lsig = root->ac_lsigtable[lsigid1];
     const struct cli_lsig_tdb *tdb = &ac_lsig->tdb;
+    int ret;
 
     if(realoff != CLI_OFF_NONE) {
+        if(mdata->lsigcnt[lsigid1] == mdata->lsig_shared && (ret = ac_lsig_touch(mdata, lsigid1)) != CL_SUCCESS)
+            return ret;
+
         if(mdata->lsigsuboff_first[lsigid1][lsigid2] == CLI_OFF_NONE)
             mdata->lsigsuboff_first[lsigid1][lsigid2] = realoff;
 
@@ -1536,7 +1964,7 @@ int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata,
 
         ls_matches = mdata->lsig_matches[lsigid1];
         if (ls_matches == NULL) { /* allocate cli_lsig_matches */
-            ls_matches = mdata->lsig_matches[lsigid1] = (struct cli_lsig_matches *)cli_calloc(1, sizeof(struct cli_lsig_matches) +
+            ls_matches = mdata->lsig_matches[lsigid1] = (struct cli_lsig_matches *)cli_arena_calloc(mdata->arena, 1, sizeof(struct cli_lsig_matches) +
                                                                                               (ac_lsig->tdb.subsigs - 1) * sizeof(struct cli_subsig_matches *));
             if (ls_matches == NULL) {
                 cli_errmsg("lsig_sub_matched: cli_calloc failed for cli_lsig_matches\n");
@@ -1546,7 +1974,7 @@ int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata,
         }
         ss_matches = ls_matches->matches[lsigid2];
         if (ss_matches == NULL) { /*  allocate cli_subsig_matches */
-            ss_matches = ls_matches->matches[lsigid2] = cli_malloc(sizeof(struct cli_subsig_matches));
+            ss_matches = ls_matches->matches[lsigid2] = cli_arena_malloc(mdata->arena, sizeof(struct cli_subsig_matches));
             if (ss_matches == NULL) {
                 cli_errmsg("lsig_sub_matched: cli_malloc failed for cli_subsig_matches struct\n");
                 return CL_EMEM;
@@ -1555,7 +1983,7 @@ int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata,
             ss_matches->last = sizeof(ss_matches->offsets) / sizeof(uint32_t) - 1; 
         }
         if (ss_matches->next > ss_matches->last) {  /* cli_matches out of space? realloc */
-            ss_matches = ls_matches->matches[lsigid2] = cli_realloc(ss_matches, sizeof(struct cli_subsig_matches) + sizeof(uint32_t) * ss_matches->last * 2);
+            ss_matches = ls_matches->matches[lsigid2] = cli_arena_realloc(mdata->arena, ss_matches, sizeof(struct cli_subsig_matches) + sizeof(uint32_t) * ss_matches->last * 2);
             if (ss_matches == NULL) {
                 cli_errmsg("lsig_sub_matched: cli_realloc failed for cli_subsig_matches struct\n");
                 return CL_EMEM;
@@ -1635,7 +2063,8 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
     int32_t **offmatrix, swp;
     int type = CL_CLEAN;
     struct cli_ac_result *newres;
-    int rc;
+    int rc, prof = ctx && ctx->engine->sigprofile;
+    struct timeval tv;
 
     if(!root->ac_root)
         return CL_CLEAN;
@@ -1682,7 +2111,14 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
                 }
 
                 ptN = pattN;
-                if(ac_findmatch(buffer, bp, offset + bp, length, patt, &matchstart, &matchend)) {
+                if(prof) {
+                    cli_sigprof_start(&tv);
+                    found = ac_findmatch(buffer, bp, offset + bp, length, patt, &matchstart, &matchend);
+                    cli_sigprof_stop(&tv, patt->virname, CLI_SIGPROF_AC, found);
+                } else {
+                    found = ac_findmatch(buffer, bp, offset + bp, length, patt, &matchstart, &matchend);
+                }
+                if(found) {
                     while(ptN) {
                         pt = ptN->me;
                         if(pt->partno > mdata->min_partno)
@@ -1735,16 +2171,16 @@ int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 
                             /* sparsely populated matrix, so allocate and initialize if NULL */
                             if(!mdata->offmatrix[pt->sigid - 1]) {
-                                mdata->offmatrix[pt->sigid - 1] = cli_malloc(pt->parts * sizeof(int32_t *));
+                                mdata->offmatrix[pt->sigid - 1] = cli_arena_malloc(mdata->arena, pt->parts * sizeof(int32_t *));
                                 if(!mdata->offmatrix[pt->sigid - 1]) {
                                     cli_errmsg("cli_ac_scanbuff: Can't allocate memory for mdata->offmatrix[%u]\n", pt->sigid - 1);
                                     return CL_EMEM;
                                 }
 
-                                mdata->offmatrix[pt->sigid - 1][0] = cli_malloc(pt->parts * (CLI_DEFAULT_AC_TRACKLEN + 2) * sizeof(int32_t));
+                                mdata->offmatrix[pt->sigid - 1][0] = cli_arena_malloc(mdata->arena, pt->parts * (CLI_DEFAULT_AC_TRACKLEN + 2) * sizeof(int32_t));
                                 if(!mdata->offmatrix[pt->sigid - 1][0]) {
                                     cli_errmsg("cli_ac_scanbuff: Can't allocate memory for mdata->offmatrix[%u][0]\n", pt->sigid - 1);
-                                    free(mdata->offmatrix[pt->sigid - 1]);
+                                    cli_arena_free(mdata->arena, mdata->offmatrix[pt->sigid - 1]);
                                     mdata->offmatrix[pt->sigid - 1] = NULL;
                                     return CL_EMEM;
                                 }
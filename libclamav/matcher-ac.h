@@ -28,6 +28,10 @@
 #include "cltypes.h"
 #include "fmap.h"
 #include "hashtab.h"
+#include "mpool.h"
+
+struct cli_arena;
+struct cli_ac_lsig_tables;
 
 #define AC_CH_MAXDIST 32
 #define ACPATT_ALTN_MAXNEST 15
@@ -56,18 +60,44 @@ struct cli_lsig_matches {
     struct cli_subsig_matches * matches[1]; /* matches[] is variable length */ 
 };
 
+/* Logical expressions compiled to postfix form at load time */
+#define CLI_LSIG_OP_SUBSIG 0
+#define CLI_LSIG_OP_AND    1
+#define CLI_LSIG_OP_OR     2
+
+#define CLI_LSIG_PROG_MAX  256 /* expressions with more nodes are evaluated from the string */
+#define CLI_LSIG_STACK_MAX 64
+
+struct cli_lsig_node {
+    uint8_t op;
+    char mod;           /* '=', '<', '>' or 0 */
+    uint16_t id;        /* subsig id for CLI_LSIG_OP_SUBSIG */
+    uint32_t modval1, modval2;
+};
+
+struct cli_lsig_prog {
+    uint32_t len;
+    struct cli_lsig_node code[1]; /* code[] is variable length */
+};
+
 struct cli_ac_data {
     int32_t ***offmatrix;
     uint32_t partsigs, lsigs, reloffsigs;
     uint32_t **lsigcnt;
     uint32_t **lsigsuboff_last, **lsigsuboff_first;
+    uint32_t *lsig_shared;  /* counters/suboffsets of lsigs with no match yet */
+    uint32_t *lsig_dirty, lsig_ndirty;  /* lsigs with at least one subsig match */
     struct cli_lsig_matches **lsig_matches;
     uint8_t *yr_matches;
+    uint32_t *lsig_yr, lsig_nyr;        /* lsigs with yr_matches set */
+    struct cli_ac_lsig_tables *lsig_tables; /* backs all the per-lsig arrays */
     uint32_t *offset;
     uint32_t macro_lastmatch[32];
     /** Hashset for versioninfo matching */
     const struct cli_hashset *vinfo;
     uint32_t min_partno;
+    /** Per-scan allocator backing the arrays above (NULL: heap) */
+    struct cli_arena *arena;
 };
 
 struct cli_alt_node {
@@ -130,9 +160,12 @@ struct cli_ac_result {
 
 int cli_ac_addpatt(struct cli_matcher *root, struct cli_ac_patt *pattern);
 int cli_ac_initdata(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen);
+int cli_ac_initdata_arena(struct cli_ac_data *data, uint32_t partsigs, uint32_t lsigs, uint32_t reloffsigs, uint8_t tracklen, struct cli_arena *arena);
 int lsig_sub_matched(const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t lsigid1, uint32_t lsigid2, uint32_t realoff, int partial);
 int cli_ac_chkmacro(struct cli_matcher *root, struct cli_ac_data *data, unsigned lsigid1);
 int cli_ac_chklsig(const char *expr, const char *end, uint32_t *lsigcnt, unsigned int *cnt, uint64_t *ids, unsigned int parse_only);
+struct cli_lsig_prog *cli_ac_compilelsig(mpool_t *mempool, const char *expr);
+int cli_ac_evallsig(const struct cli_lsig_prog *prog, const uint32_t *lsigcnt);
 void cli_ac_freedata(struct cli_ac_data *data);
 int cli_ac_scanbuff(const unsigned char *buffer, uint32_t length, const char **virname, void **customdata, struct cli_ac_result **res, const struct cli_matcher *root, struct cli_ac_data *mdata, uint32_t offset, cli_file_t ftype, struct cli_matched_type **ftoffset, unsigned int mode, cli_ctx *ctx);
 int cli_ac_buildtrie(struct cli_matcher *root);
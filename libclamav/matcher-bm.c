@@ -24,6 +24,7 @@
 #endif
 
 #include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include "clamav.h"
@@ -38,50 +39,31 @@
 #include "mpool.h"
 
 #define BM_MIN_LENGTH	3
+#define BM_MAX_WINDOW	8
 #define BM_BLOCK_SIZE	3
 #define HASH(a,b,c) (211 * a + 37 * b + c)
+#define BM_TABLE_SIZE	(HASH(255, 255, 255) + 1)
+#define BM_HIT_COST	4 /* lookups a suffix chain walk costs, roughly */
 
-int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const char *offset)
+/*
+ * The matcher is a Wu-Manber variant: the scan looks at the last block of a
+ * window of root->bm_window bytes, a pattern is chained under the block that
+ * ends its window and the shift table says how far the window can move when
+ * the block doesn't end any pattern window. cli_bm_init() starts with the
+ * window of the shortest possible signature (one block, so every position is
+ * looked up); cli_bm_build() widens it once all the signatures are known.
+ */
+static void bm_link(struct cli_matcher *root, struct cli_bm_patt *pattern)
 {
 	uint16_t idx, i;
 	const unsigned char *pt = pattern->pattern;
 	struct cli_bm_patt *prev, *next = NULL;
-	int ret;
-
-
-    if(pattern->length < BM_MIN_LENGTH) {
-	cli_errmsg("cli_bm_addpatt: Signature for %s is too short\n", pattern->virname);
-	return CL_EMALFDB;
-    }
-
-    if((ret = cli_caloff(offset, NULL, root->type, pattern->offdata, &pattern->offset_min, &pattern->offset_max))) {
-	cli_errmsg("cli_bm_addpatt: Can't calculate offset for signature %s\n", pattern->virname);
-	return ret;
-    }
-    if(pattern->offdata[0] != CLI_OFF_ANY) {
-	if(pattern->offdata[0] == CLI_OFF_ABSOLUTE)
-	    root->bm_absoff_num++;
-	else
-	    root->bm_reloff_num++;
-    }
+	uint32_t tail = root->bm_window - BM_BLOCK_SIZE;
 
-    /* bm_offmode doesn't use the prefilter for BM signatures anyway, so
-     * don't add these to the filter. */
-    if(root->filter && !root->bm_offmode) {
-	/* the bm_suffix load balancing below can shorten the sig,
-	 * we want to see the entire signature! */
-	if (filter_add_static(root->filter, pattern->pattern, pattern->length, pattern->virname) == -1) {
-	    cli_warnmsg("cli_bm_addpatt: cannot use filter for trie\n");
-	    mpool_free(root->mempool, root->filter);
-	    root->filter = NULL;
-	}
-	/* TODO: should this affect maxpatlen? */
-    }
 
-#if BM_MIN_LENGTH == BM_BLOCK_SIZE
     /* try to load balance bm_suffix (at the cost of bm_shift) */
-    for(i = 0; i < pattern->length - BM_BLOCK_SIZE + 1; i++) {
-	idx = HASH(pt[i], pt[i + 1], pt[i + 2]);
+    for(i = 0; i + root->bm_window <= pattern->length; i++) {
+	idx = HASH(pt[i + tail], pt[i + tail + 1], pt[i + tail + 2]);
 	if(!root->bm_suffix[idx]) {
 	    if(i) {
 		pattern->prefix = pattern->pattern;
@@ -93,11 +75,10 @@ int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const
 	    break;
 	}
     }
-#endif
 
-    for(i = 0; i <= BM_MIN_LENGTH - BM_BLOCK_SIZE; i++) {
+    for(i = 0; i <= tail; i++) {
 	idx = HASH(pt[i], pt[i + 1], pt[i + 2]);
-	root->bm_shift[idx] = MIN(root->bm_shift[idx], BM_MIN_LENGTH - BM_BLOCK_SIZE - i);
+	root->bm_shift[idx] = MIN(root->bm_shift[idx], tail - i);
     }
 
     prev = next = root->bm_suffix[idx];
@@ -119,6 +100,43 @@ int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const
     }
     pattern->pattern0 = pattern->pattern[0];
     root->bm_suffix[idx]->cnt++;
+}
+
+int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const char *offset)
+{
+	int ret;
+
+
+    if(pattern->length < BM_MIN_LENGTH || pattern->length < root->bm_window) {
+	cli_errmsg("cli_bm_addpatt: Signature for %s is too short\n", pattern->virname);
+	return CL_EMALFDB;
+    }
+
+    if((ret = cli_caloff(offset, NULL, root->type, pattern->offdata, &pattern->offset_min, &pattern->offset_max))) {
+	cli_errmsg("cli_bm_addpatt: Can't calculate offset for signature %s\n", pattern->virname);
+	return ret;
+    }
+    if(pattern->offdata[0] != CLI_OFF_ANY) {
+	if(pattern->offdata[0] == CLI_OFF_ABSOLUTE)
+	    root->bm_absoff_num++;
+	else
+	    root->bm_reloff_num++;
+    }
+
+    /* bm_offmode doesn't use the prefilter for BM signatures anyway, so
+     * don't add these to the filter. */
+    if(root->filter && !root->bm_offmode) {
+	/* the bm_suffix load balancing below can shorten the sig,
+	 * we want to see the entire signature! */
+	if (filter_add_static(root->filter, pattern->pattern, pattern->length, pattern->virname) == -1) {
+	    cli_warnmsg("cli_bm_addpatt: cannot use filter for trie\n");
+	    mpool_free(root->mempool, root->filter);
+	    root->filter = NULL;
+	}
+	/* TODO: should this affect maxpatlen? */
+    }
+
+    bm_link(root, pattern);
 
     if(root->bm_offmode) {
 	root->bm_pattab = (struct cli_bm_patt **) mpool_realloc2(root->mempool, root->bm_pattab, (root->bm_patterns + 1) * sizeof(struct cli_bm_patt *));
@@ -137,7 +155,7 @@ int cli_bm_addpatt(struct cli_matcher *root, struct cli_bm_patt *pattern, const
 
 int cli_bm_init(struct cli_matcher *root)
 {
-	uint16_t i, size = HASH(255, 255, 255) + 1;
+	uint16_t i, size = BM_TABLE_SIZE;
 #ifdef USE_MPOOL
     assert (root->mempool && "mempool must be initialized");
 #endif
@@ -150,12 +168,122 @@ int cli_bm_init(struct cli_matcher *root)
 	return CL_EMEM;
     }
 
+    root->bm_window = BM_MIN_LENGTH;
     for(i = 0; i < size; i++)
 	root->bm_shift[i] = BM_MIN_LENGTH - BM_BLOCK_SIZE + 1;
 
     return CL_SUCCESS;
 }
 
+/* bytes the scan moves per unit of work with a given window, assuming
+ * evenly spread input blocks */
+static unsigned int bm_window_score(struct cli_bm_patt **pattab, uint32_t patterns, uint32_t window, uint8_t *shift)
+{
+	uint32_t i, j, tail = window - BM_BLOCK_SIZE, hits = 0;
+	uint64_t sum = 0;
+	const unsigned char *pt;
+
+
+    memset(shift, tail + 1, BM_TABLE_SIZE);
+    for(i = 0; i < patterns; i++) {
+	pt = pattab[i]->prefix ? pattab[i]->prefix : pattab[i]->pattern;
+	for(j = 0; j <= tail; j++) {
+	    uint16_t idx = HASH(pt[j], pt[j + 1], pt[j + 2]);
+	    shift[idx] = MIN(shift[idx], tail - j);
+	}
+    }
+    /* a hit costs a chain walk and then moves by one */
+    for(i = 0; i < BM_TABLE_SIZE; i++) {
+	if(shift[i]) {
+	    sum += shift[i];
+	} else {
+	    sum++;
+	    hits++;
+	}
+    }
+
+    return (unsigned int) (sum * 1000 / (BM_TABLE_SIZE + (uint64_t) hits * BM_HIT_COST));
+}
+
+int cli_bm_build(struct cli_matcher *root)
+{
+	struct cli_bm_patt **pattab, *patt;
+	uint32_t i, n = 0, minlen = BM_MAX_WINDOW, window, best = BM_MIN_LENGTH;
+	unsigned int score, best_score = 0;
+	uint8_t *shift;
+
+
+    if(!root->bm_shift || !root->bm_patterns)
+	return CL_SUCCESS;
+
+    if(!(pattab = (struct cli_bm_patt **) cli_malloc(root->bm_patterns * sizeof(struct cli_bm_patt *)))) {
+	cli_errmsg("cli_bm_build: Can't allocate memory for pattab\n");
+	return CL_EMEM;
+    }
+    for(i = 0; i < BM_TABLE_SIZE; i++) {
+	for(patt = root->bm_suffix[i]; patt && n < root->bm_patterns; patt = patt->next) {
+	    pattab[n++] = patt;
+	    minlen = MIN(minlen, patt->length + patt->prefix_length);
+	}
+    }
+
+    /* pick the window from the shift table each candidate would produce;
+     * one short signature limits all of them */
+    if(minlen > BM_MIN_LENGTH) {
+	if(!(shift = (uint8_t *) cli_malloc(BM_TABLE_SIZE))) {
+	    cli_errmsg("cli_bm_build: Can't allocate memory for shift\n");
+	    free(pattab);
+	    return CL_EMEM;
+	}
+	for(window = BM_MIN_LENGTH; window <= minlen; window++) {
+	    score = bm_window_score(pattab, n, window, shift);
+	    if(score > best_score) {
+		best_score = score;
+		best = window;
+	    }
+	}
+	free(shift);
+    }
+
+    if(best != root->bm_window) {
+	root->bm_window = best;
+	for(i = 0; i < BM_TABLE_SIZE; i++) {
+	    root->bm_shift[i] = best - BM_BLOCK_SIZE + 1;
+	    root->bm_suffix[i] = NULL;
+	}
+	for(i = 0; i < n; i++) {
+	    patt = pattab[i];
+	    if(patt->prefix) {
+		patt->length += patt->prefix_length;
+		patt->pattern = patt->prefix;
+		patt->prefix = NULL;
+		patt->prefix_length = 0;
+	    }
+	    patt->next = NULL;
+	    patt->cnt = 0;
+	    bm_link(root, patt);
+	}
+    }
+    free(pattab);
+
+    cli_dbgmsg("cli_bm_build: %u patterns, shortest %u, window %u\n", n, minlen, root->bm_window);
+    return CL_SUCCESS;
+}
+
+void cli_bm_roi(struct cli_matcher *root)
+{
+	struct cli_bm_patt *patt;
+	uint32_t i;
+
+
+    if(!root->bm_suffix)
+	return;
+
+    for(i = 0; i < BM_TABLE_SIZE && root->roi_on; i++)
+	for(patt = root->bm_suffix[i]; patt && root->roi_on; patt = patt->next)
+	    cli_roi_add(root, patt->offdata, root->maxpatlen, root->maxpatlen);
+}
+
 int cli_bm_initoff(const struct cli_matcher *root, struct cli_bm_off *data, const struct cli_target_info *info)
 {
 	int ret;
@@ -218,7 +346,7 @@ void cli_bm_freeoff(struct cli_bm_off *data)
 void cli_bm_free(struct cli_matcher *root)
 {
 	struct cli_bm_patt *patt, *prev;
-	uint16_t i, size = HASH(255, 255, 255) + 1;
+	uint16_t i, size = BM_TABLE_SIZE;
 
 
     if(root->bm_shift)
@@ -255,14 +383,16 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	const unsigned char *bp, *pt;
 	unsigned char prefix;
         int ret, viruses_found = 0;
+	uint32_t tail;
 
     if(!root || !root->bm_shift)
 	return CL_CLEAN;
 
-    if(length < BM_MIN_LENGTH)
+    if(length < root->bm_window)
 	return CL_CLEAN;
 
-    i = BM_MIN_LENGTH - BM_BLOCK_SIZE;
+    tail = root->bm_window - BM_BLOCK_SIZE;
+    i = tail;
     if(offdata) {
 	if(!offdata->cnt)
 	    return CL_CLEAN;
@@ -280,11 +410,11 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	shift = root->bm_shift[idx];
 
 	if(shift == 0) {
-	    prefix = buffer[i - BM_MIN_LENGTH + BM_BLOCK_SIZE];
+	    prefix = buffer[i - tail];
 	    p = root->bm_suffix[idx];
 	    if(p && p->cnt == 1 && p->pattern0 != prefix) {
 		if(offdata) {
-		    off = offset + i - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+		    off = offset + i - tail;
 		    for(; offdata->pos < offdata->cnt && off >= offdata->offtab[offdata->pos]; offdata->pos++);
 		    if(offdata->pos == offdata->cnt || off >= offdata->offtab[offdata->pos]) {
 			if (viruses_found)
@@ -306,7 +436,7 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 		    continue;
 		} else pchain = 1;
 
-		off = i - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+		off = i - tail;
 		bp = buffer + off;
 
 		if((off + p->length > length) || (p->prefix_length > off)) {
@@ -373,7 +503,7 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 			    off_min = p->offset_min;
 			    off_max = p->offset_max;
 			}
-			off = offset + i - p->prefix_length - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+			off = offset + i - p->prefix_length - tail;
 			if(off_min == CLI_OFF_NONE || off_max < off || off_min > off) {
 			    p = p->next;
 			    continue;
@@ -383,7 +513,7 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 			*virname = p->virname;
 			if(ctx != NULL && SCAN_ALL) {
 			    cli_append_virus(ctx, *virname);
-			    //*viroffset = offset + i + j - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+			    //*viroffset = offset + i + j - tail;
 			}
 		    }
 		    if(patt)
@@ -400,7 +530,7 @@ int cli_bm_scanbuff(const unsigned char *buffer, uint32_t length, const char **v
 	}
 
 	if(offdata) {
-	    off = offset + i - BM_MIN_LENGTH + BM_BLOCK_SIZE;
+	    off = offset + i - tail;
 	    for(; offdata->pos < offdata->cnt && off >= offdata->offtab[offdata->pos]; offdata->pos++);
 	    if(offdata->pos == offdata->cnt || off >= offdata->offtab[offdata->pos]) {
 		if (viruses_found)
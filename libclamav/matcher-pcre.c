@@ -37,6 +37,7 @@
 #include "mpool.h"
 #include "readdb.h"
 #include "regex_pcre.h"
+#include "sigprof.h"
 
 #if HAVE_PCRE
 #if USING_PCRE2
@@ -269,6 +270,10 @@ int cli_pcre_addpatt(struct cli_matcher *root, const char *virname, const char *
         mpool_free(root->mempool, pm);
         return CL_EMEM;
     }
+#ifdef PCRE_BYPASS
+    if (strcmp(trigger, PCRE_BYPASS))
+#endif
+        pm->tprog = cli_ac_compilelsig(root->mempool, trigger);
 
     pm->virname = (char *)cli_mpool_virname(root->mempool, virname, options & CL_DB_OFFICIAL);
     if(!pm->virname) {
@@ -594,6 +599,8 @@ int cli_pcre_scanbuf(const unsigned char *buffer, uint32_t length, const char **
     uint64_t maxfilesize, evalids = 0;
     uint32_t global, encompass, rolling;
     int rc, offset, ret = CL_SUCCESS, options=0;
+    int prof = ctx && ctx->engine->sigprofile;
+    struct timeval tv;
     uint8_t viruses_found = 0;
 
     if ((root->pcre_metas == 0) || (!root->pcre_metatable) || (ctx && ctx->dconf && !(ctx->dconf->pcre & PCRE_CONF_SUPPORT)))
@@ -623,7 +630,8 @@ int cli_pcre_scanbuf(const unsigned char *buffer, uint32_t length, const char **
 #ifdef PCRE_BYPASS
             if (strcmp(pm->trigger, PCRE_BYPASS))
 #endif
-                if (cli_ac_chklsig(pm->trigger, pm->trigger + strlen(pm->trigger), mdata->lsigcnt[pm->lsigid[1]], &evalcnt, &evalids, 0) != 1)
+                if (pm->tprog ? cli_ac_evallsig(pm->tprog, mdata->lsigcnt[pm->lsigid[1]]) != 1 :
+                    cli_ac_chklsig(pm->trigger, pm->trigger + strlen(pm->trigger), mdata->lsigcnt[pm->lsigid[1]], &evalcnt, &evalids, 0) != 1)
                     continue;
         }
         else {
@@ -693,7 +701,11 @@ int cli_pcre_scanbuf(const unsigned char *buffer, uint32_t length, const char **
 
             /* performance metrics */
             cli_event_time_start(p_sigevents, pm->sigtime_id);
+            if (prof)
+                cli_sigprof_start(&tv);
             rc = cli_pcre_match(pd, buffer+adjbuffer, adjlength, offset, options, &p_res);
+            if (prof)
+                cli_sigprof_stop(&tv, pm->virname, CLI_SIGPROF_PCRE, rc > 0);
             cli_event_time_stop(p_sigevents, pm->sigtime_id);
             /* if debug, generate a match report */
             if (cli_debug_flag)
@@ -784,6 +796,11 @@ void cli_pcre_freemeta(struct cli_matcher *root, struct cli_pcre_meta *pm)
         pm->trigger = NULL;
     }
 
+    if (pm->tprog) {
+        mpool_free(root->mempool, pm->tprog);
+        pm->tprog = NULL;
+    }
+
     if (pm->virname) {
         mpool_free(root->mempool, pm->virname);
         pm->virname = NULL;
@@ -55,6 +55,7 @@ struct cli_pcre_off {
 
 struct cli_pcre_meta {
     char *trigger;
+    struct cli_lsig_prog *tprog; /* compiled trigger, NULL to parse trigger */
     char *virname;
     uint32_t lsigid[3]; /* 0=valid, 1=lsigid, 2=subsigid */
     struct cli_pcre_data pdata;
@@ -55,6 +55,9 @@
 #include "perflogging.h"
 #include "bytecode_priv.h"
 #include "bytecode_api_impl.h"
+#include "sigprof.h"
+#include "trace.h"
+#include "mpool.h"
 #ifdef HAVE_YARA
 #include "yara_clam.h"
 #include "yara_exec.h"
@@ -233,7 +236,7 @@ static inline int matcher_run(const struct cli_matcher *root,
     return ret;
 }
 
-int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset, cli_ctx *ctx, cli_file_t ftype, struct cli_ac_data **acdata)
+static int scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset, cli_ctx *ctx, cli_file_t ftype, struct cli_ac_data **acdata)
 {
 	int ret = CL_CLEAN;
 	unsigned int i = 0, j = 0, viruses_found = 0;
@@ -263,7 +266,7 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
 
     if(troot) {
 
-	if(!acdata && (ret = cli_ac_initdata(&mdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+	if(!acdata && (ret = cli_ac_initdata_arena(&mdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena)))
 	    return ret;
 
 	ret = matcher_run(troot, buffer, length, &virname, acdata ? (acdata[0]): (&mdata), offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, *ctx->fmap, NULL, NULL, ctx);
@@ -283,7 +286,7 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
 
     virname = NULL;
 
-    if(!acdata && (ret = cli_ac_initdata(&mdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+    if(!acdata && (ret = cli_ac_initdata_arena(&mdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena)))
 	return ret;
 
     ret = matcher_run(groot, buffer, length, &virname, acdata ? (acdata[1]): (&mdata), offset, NULL, ftype, NULL, AC_SCAN_VIR, PCRE_SCAN_BUFF, NULL, *ctx->fmap, NULL, NULL, ctx);
@@ -296,6 +299,20 @@ int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset,
     return ret;
 }
 
+int cli_scanbuff(const unsigned char *buffer, uint32_t length, uint32_t offset, cli_ctx *ctx, cli_file_t ftype, struct cli_ac_data **acdata)
+{
+    struct cli_trace_mark mark;
+    int ret;
+
+    if (!ctx || !ctx->trace)
+	return scanbuff(buffer, length, offset, ctx, ftype, acdata);
+
+    cli_trace_match_start(ctx, &mark);
+    ret = scanbuff(buffer, length, offset, ctx, ftype, acdata);
+    cli_trace_match_stop(ctx, &mark);
+    return ret;
+}
+
 /*
  * offdata[0]: type
  * offdata[1]: offset value
@@ -473,6 +490,97 @@ int cli_caloff(const char *offstr, const struct cli_target_info *info, unsigned
     return CL_SUCCESS;
 }
 
+/*
+ * Region of interest: when every signature of a root is anchored to an
+ * offset (absolute, EOF-, EP or section relative) the root only needs to see
+ * the bytes around those offsets. The offsets are collected once, with
+ * duplicates folded together; fmap_scandesc() resolves them for each file
+ * and doesn't run the root over blocks outside all of them.
+ */
+void cli_roi_add(struct cli_matcher *root, const uint32_t *offdata, uint32_t before, uint32_t after)
+{
+	struct cli_roi *roi;
+	unsigned int i;
+
+
+    if(!root->roi_on)
+	return;
+
+    if(offdata[0] == CLI_OFF_ANY || offdata[0] == CLI_OFF_VERSION || offdata[0] == CLI_OFF_MACRO) {
+	root->roi_on = 0;
+	return;
+    }
+
+    for(i = 0; i < root->roi_num; i++) {
+	roi = &root->roi[i];
+	if(!memcmp(roi->offdata, offdata, sizeof(roi->offdata))) {
+	    roi->before = MAX(roi->before, before);
+	    if(after == CLI_OFF_ANY || roi->after == CLI_OFF_ANY)
+		roi->after = CLI_OFF_ANY;
+	    else
+		roi->after = MAX(roi->after, after);
+	    return;
+	}
+    }
+
+    /* not worth it with this many different offsets */
+    if(root->roi_num == CLI_ROI_MAX) {
+	root->roi_on = 0;
+	return;
+    }
+
+    roi = (struct cli_roi *) mpool_realloc(root->mempool, root->roi, (root->roi_num + 1) * sizeof(struct cli_roi));
+    if(!roi) {
+	root->roi_on = 0;
+	return;
+    }
+    root->roi = roi;
+    roi = &root->roi[root->roi_num++];
+    memcpy(roi->offdata, offdata, sizeof(roi->offdata));
+    roi->before = before;
+    roi->after = after;
+}
+
+int cli_roi_build(struct cli_matcher *root)
+{
+	struct cli_ac_patt *patt;
+	uint32_t i, after;
+
+
+    root->roi_num = 0;
+    root->roi_on = 1;
+
+#if HAVE_PCRE
+    /* the pcres look at the whole map */
+    if(root->pcre_metas)
+	root->roi_on = 0;
+#endif
+
+    for(i = 0; i < root->ac_patterns && root->roi_on; i++) {
+	patt = root->ac_pattable[i];
+	/* only the first part of a split signature is anchored */
+	if(patt->sigid && patt->partno > 1)
+	    after = CLI_OFF_ANY;
+	else
+	    after = root->maxpatlen + patt->ch_maxdist[1];
+	cli_roi_add(root, patt->offdata, root->maxpatlen + patt->ch_maxdist[0], after);
+    }
+
+    if(!root->ac_only && root->roi_on)
+	cli_bm_roi(root);
+
+    if(!root->roi_on) {
+	if(root->roi)
+	    mpool_free(root->mempool, root->roi);
+	root->roi = NULL;
+	root->roi_num = 0;
+    } else {
+	cli_dbgmsg("cli_roi_build: %s: all signatures within %u offsets\n", cli_mtargets[root->type].name, root->roi_num);
+    }
+
+    return CL_SUCCESS;
+}
+
 void cli_targetinfo(struct cli_target_info *info, unsigned int target, fmap_t *map)
 {
 	int (*einfo)(fmap_t *, struct cli_exe_info *) = NULL;
@@ -700,6 +808,20 @@ int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struc
     return ret;
 }
 
+static int lsig_bytecode(cli_ctx *ctx, struct cli_target_info *target_info, struct cli_ac_data *acdata, const struct cli_ac_lsig *ac_lsig, uint32_t lsid, fmap_t *map)
+{
+    struct timeval tv;
+    int rc;
+
+    if(!ctx->engine->sigprofile)
+        return cli_bytecode_runlsig(ctx, target_info, &ctx->engine->bcs, ac_lsig->bc_idx, acdata->lsigcnt[lsid], acdata->lsigsuboff_first[lsid], map);
+
+    cli_sigprof_start(&tv);
+    rc = cli_bytecode_runlsig(ctx, target_info, &ctx->engine->bcs, ac_lsig->bc_idx, acdata->lsigcnt[lsid], acdata->lsigsuboff_first[lsid], map);
+    cli_sigprof_stop(&tv, ac_lsig->virname, CLI_SIGPROF_BYTECODE, rc == CL_VIRUS);
+    return rc;
+}
+
 static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash, uint32_t lsid)
 {
     unsigned evalcnt = 0;
@@ -707,13 +829,13 @@ static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
     fmap_t *map = *ctx->fmap;
     struct cli_ac_lsig *ac_lsig = root->ac_lsigtable[lsid];
     char * exp = ac_lsig->u.logic;
-    char* exp_end = exp + strlen(exp);
     int rc;
 
     rc = cli_ac_chkmacro(root, acdata, lsid);
     if (rc != CL_SUCCESS)
         return rc;
-    if (cli_ac_chklsig(exp, exp_end, acdata->lsigcnt[lsid], &evalcnt, &evalids, 0) == 1) {
+    if (ac_lsig->prog ? cli_ac_evallsig(ac_lsig->prog, acdata->lsigcnt[lsid]) == 1 :
+        cli_ac_chklsig(exp, exp + strlen(exp), acdata->lsigcnt[lsid], &evalcnt, &evalids, 0) == 1) {
         if(ac_lsig->tdb.container && ac_lsig->tdb.container[0] != ctx->container_type)
             return CL_CLEAN;
         if(ac_lsig->tdb.filesize && (ac_lsig->tdb.filesize[0] > map->len || ac_lsig->tdb.filesize[1] < map->len))
@@ -748,7 +870,7 @@ static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
                 if(!ac_lsig->bc_idx) {
                     cli_append_virus(ctx, ac_lsig->virname);
                     return CL_VIRUS;
-                } else if(cli_bytecode_runlsig(ctx, target_info, &ctx->engine->bcs, ac_lsig->bc_idx, acdata->lsigcnt[lsid], acdata->lsigsuboff_first[lsid], map) == CL_VIRUS) {
+                } else if(lsig_bytecode(ctx, target_info, acdata, ac_lsig, lsid, map) == CL_VIRUS) {
                     return CL_VIRUS;
                 }
             }
@@ -758,7 +880,7 @@ static int lsig_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
             cli_append_virus(ctx, ac_lsig->virname);
             return CL_VIRUS;
         }
-        if(cli_bytecode_runlsig(ctx, target_info, &ctx->engine->bcs, ac_lsig->bc_idx, acdata->lsigcnt[lsid], acdata->lsigsuboff_first[lsid], map) == CL_VIRUS) {
+        if(lsig_bytecode(ctx, target_info, acdata, ac_lsig, lsid, map) == CL_VIRUS) {
             return CL_VIRUS;
         }
     }
@@ -793,15 +915,44 @@ static int yara_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data
 }
 #endif
 
+static int lsig_id_cmp(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return (x > y) - (x < y);
+}
+
 int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash)
 {
     uint8_t viruses_found = 0;
-    uint32_t i;
+    uint32_t i, d = 0, a = 0, ndirty = acdata->lsig_ndirty;
     int32_t rc = CL_SUCCESS;
+    struct timeval tv;
+
+    /* Only lsigs with a subsig match (the dirty list) and those that can
+     * match without one are evaluated; walk both in lsig id order so that
+     * detections are reported in the same order as a full scan would. */
+    if(ndirty > 1)
+        cli_qsort(acdata->lsig_dirty, ndirty, sizeof(uint32_t), lsig_id_cmp);
 
-    for(i = 0; i < root->ac_lsigs; i++) {
-        if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL)
-            rc = lsig_eval(ctx, root, acdata, target_info, hash, i);
+    while(d < ndirty || a < root->ac_lsig_always_num) {
+        if(a == root->ac_lsig_always_num || (d < ndirty && acdata->lsig_dirty[d] < root->ac_lsig_always[a])) {
+            i = acdata->lsig_dirty[d++];
+        } else {
+            i = root->ac_lsig_always[a++];
+            if(d < ndirty && acdata->lsig_dirty[d] == i)
+                d++;
+        }
+
+        if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
+            if (ctx->engine->sigprofile) {
+                cli_sigprof_start(&tv);
+                rc = lsig_eval(ctx, root, acdata, target_info, hash, i);
+                cli_sigprof_stop(&tv, root->ac_lsigtable[i]->virname, CLI_SIGPROF_LSIG, rc == CL_VIRUS);
+            } else {
+                rc = lsig_eval(ctx, root, acdata, target_info, hash, i);
+            }
+        }
 #ifdef HAVE_YARA
         else if (root->ac_lsigtable[i]->type == CLI_YARA_NORMAL || root->ac_lsigtable[i]->type == CLI_YARA_OFFSET)
             rc = yara_eval(ctx, root, acdata, target_info, hash, i);
@@ -818,13 +969,89 @@ int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acd
     return CL_CLEAN;
 }
 
-int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash)
+/* where a root's signatures can match in the current file */
+struct roi_map {
+    uint32_t start[CLI_ROI_MAX], end[CLI_ROI_MAX];
+    unsigned int cnt, pos;
+    int all;
+};
+
+static void roi_map_init(struct roi_map *map, const struct cli_matcher *root, const struct cli_target_info *info)
+{
+	const struct cli_roi *roi;
+	uint32_t min, max, start, end;
+	unsigned int i, j;
+
+
+    map->cnt = map->pos = 0;
+    map->all = !root->roi_on;
+
+    for(i = 0; i < root->roi_num && !map->all; i++) {
+	roi = &root->roi[i];
+	if(roi->offdata[0] == CLI_OFF_ABSOLUTE) {
+	    min = roi->offdata[1];
+	    max = min + roi->offdata[2];
+	} else if(cli_caloff(NULL, info, root->type, (uint32_t *) roi->offdata, &min, &max) != CL_SUCCESS) {
+	    map->all = 1;
+	    break;
+	}
+	if(min == CLI_OFF_NONE || min >= info->fsize)
+	    continue;
+	if(max == CLI_OFF_NONE || max < min)
+	    max = min;
+
+	start = min > roi->before ? min - roi->before : 0;
+	if(roi->after == CLI_OFF_ANY || max + roi->after < max)
+	    end = info->fsize;
+	else
+	    end = MIN(max + roi->after, info->fsize);
+
+	/* keep them sorted by start */
+	for(j = map->cnt; j && map->start[j - 1] > start; j--) {
+	    map->start[j] = map->start[j - 1];
+	    map->end[j] = map->end[j - 1];
+	}
+	map->start[j] = start;
+	map->end[j] = end;
+	map->cnt++;
+    }
+
+    if(map->all || !map->cnt)
+	return;
+
+    /* fold overlapping regions */
+    for(i = 0, j = 1; j < map->cnt; j++) {
+	if(map->start[j] <= map->end[i]) {
+	    map->end[i] = MAX(map->end[i], map->end[j]);
+	} else {
+	    i++;
+	    map->start[i] = map->start[j];
+	    map->end[i] = map->end[j];
+	}
+    }
+    map->cnt = i + 1;
+}
+
+/* blocks are asked for in increasing order */
+static int roi_map_hit(struct roi_map *map, uint32_t offset, uint32_t length)
+{
+    if(map->all)
+	return 1;
+
+    while(map->pos < map->cnt && map->end[map->pos] <= offset)
+	map->pos++;
+
+    return map->pos < map->cnt && map->start[map->pos] < offset + length;
+}
+
+static int fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash)
 {
     const unsigned char *buff;
     int ret = CL_CLEAN, type = CL_CLEAN, bytes, compute_hash[CLI_HASH_AVAIL_TYPES];
-    unsigned int i = 0, j = 0, bm_offmode = 0;
+    unsigned int i = 0, j = 0, bm_offmode = 0, need_g = 0, need_t = 0;
     uint32_t maxpatlen, offset = 0;
     struct cli_ac_data gdata, tdata;
+    struct roi_map groi, troi;
     struct cli_bm_off toff;
     struct cli_pcre_off gpoff, tpoff;
     unsigned char digest[CLI_HASH_AVAIL_TYPES][32];
@@ -841,21 +1068,45 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
         return CL_ENULLARG;
     }
 
-    md5ctx = cl_hash_init("md5");
-    if (!(md5ctx))
-        return CL_EMEM;
+    hdb = ctx->engine->hm_hdb;
+    fp = ctx->engine->hm_fp;
+    md5ctx = sha1ctx = sha256ctx = NULL;
 
-    sha1ctx = cl_hash_init("sha1");
-    if (!(sha1ctx)) {
-        cl_hash_destroy(md5ctx);
-        return CL_EMEM;
-    }
+    if(!ftonly && hdb) {
+        if(!refhash) {
+            if(cli_hm_have_size(hdb, CLI_HASH_MD5, map->len) || cli_hm_have_size(fp, CLI_HASH_MD5, map->len)) {
+                compute_hash[CLI_HASH_MD5] = 1;
+            } else {
+                compute_hash[CLI_HASH_MD5] = 0;
+            }
+        } else {
+            compute_hash[CLI_HASH_MD5] = 0;
+            memcpy(digest[CLI_HASH_MD5], refhash, 16);
+        }
+
+        if(cli_hm_have_size(hdb, CLI_HASH_SHA1, map->len) || cli_hm_have_wild(hdb, CLI_HASH_SHA1)
+            || cli_hm_have_size(fp, CLI_HASH_SHA1, map->len) || cli_hm_have_wild(fp, CLI_HASH_SHA1) ) {
+            compute_hash[CLI_HASH_SHA1] = 1;
+        } else {
+            compute_hash[CLI_HASH_SHA1] = 0;
+        }
+
+        if(cli_hm_have_size(hdb, CLI_HASH_SHA256, map->len) || cli_hm_have_wild(hdb, CLI_HASH_SHA256)
+            || cli_hm_have_size(fp, CLI_HASH_SHA256, map->len) || cli_hm_have_wild(fp, CLI_HASH_SHA256)) {
+            compute_hash[CLI_HASH_SHA256] = 1;
+        } else {
+            compute_hash[CLI_HASH_SHA256] = 0;
+        }
 
-    sha256ctx = cl_hash_init("sha256");
-    if (!(sha256ctx)) {
-        cl_hash_destroy(md5ctx);
-        cl_hash_destroy(sha1ctx);
-        return CL_EMEM;
+        /* only set up the digests some signature can use */
+        if((compute_hash[CLI_HASH_MD5] && !(md5ctx = cl_hash_init("md5"))) ||
+           (compute_hash[CLI_HASH_SHA1] && !(sha1ctx = cl_hash_init("sha1"))) ||
+           (compute_hash[CLI_HASH_SHA256] && !(sha256ctx = cl_hash_init("sha256")))) {
+            cl_hash_destroy(md5ctx);
+            cl_hash_destroy(sha1ctx);
+            cl_hash_destroy(sha256ctx);
+            return CL_EMEM;
+        }
     }
 
     if(!ftonly)
@@ -892,7 +1143,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     cli_targetinfo(&info, i, map);
 
     if(!ftonly) {
-        if((ret = cli_ac_initdata(&gdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(groot, &gdata, &info))) {
+        if((ret = cli_ac_initdata_arena(&gdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena)) || (ret = cli_ac_caloff(groot, &gdata, &info))) {
             if(info.exeinfo.section)
                 free(info.exeinfo.section);
 
@@ -914,10 +1165,11 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             return ret;
 
         }
+        roi_map_init(&groi, groot, &info);
     }
 
     if(troot) {
-        if((ret = cli_ac_initdata(&tdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)) || (ret = cli_ac_caloff(troot, &tdata, &info))) {
+        if((ret = cli_ac_initdata_arena(&tdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena)) || (ret = cli_ac_caloff(troot, &tdata, &info))) {
             if(!ftonly) {
                 cli_ac_freedata(&gdata);
                 cli_pcre_freeoff(&gpoff);
@@ -971,42 +1223,22 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             cl_hash_destroy(sha256ctx);
             return ret;
         }
-    }
-
-    hdb = ctx->engine->hm_hdb;
-    fp = ctx->engine->hm_fp;
-
-    if(!ftonly && hdb) {
-        if(!refhash) {
-            if(cli_hm_have_size(hdb, CLI_HASH_MD5, map->len) || cli_hm_have_size(fp, CLI_HASH_MD5, map->len)) {
-                compute_hash[CLI_HASH_MD5] = 1;
-            } else {
-                compute_hash[CLI_HASH_MD5] = 0;
-            }
-        } else {
-            compute_hash[CLI_HASH_MD5] = 0;
-            memcpy(digest[CLI_HASH_MD5], refhash, 16);
-        }
-
-        if(cli_hm_have_size(hdb, CLI_HASH_SHA1, map->len) || cli_hm_have_wild(hdb, CLI_HASH_SHA1)
-            || cli_hm_have_size(fp, CLI_HASH_SHA1, map->len) || cli_hm_have_wild(fp, CLI_HASH_SHA1) ) {
-            compute_hash[CLI_HASH_SHA1] = 1;
-        } else {
-            compute_hash[CLI_HASH_SHA1] = 0;
-        }
-
-        if(cli_hm_have_size(hdb, CLI_HASH_SHA256, map->len) || cli_hm_have_wild(hdb, CLI_HASH_SHA256)
-            || cli_hm_have_size(fp, CLI_HASH_SHA256, map->len) || cli_hm_have_wild(fp, CLI_HASH_SHA256)) {
-            compute_hash[CLI_HASH_SHA256] = 1;
-        } else {
-            compute_hash[CLI_HASH_SHA256] = 0;
-        }
+        roi_map_init(&troi, troot, &info);
     }
 
     while(offset < map->len) {
-        bytes = MIN(map->len - offset, SCANBUFF);
-        if(!(buff = fmap_need_off_once(map, offset, bytes)))
+        /* a block is worth a clock read; the partial result is not cached */
+        if(cli_checktimelimit(ctx) != CL_SUCCESS)
             break;
+        bytes = MIN(map->len - offset, SCANBUFF);
+        need_t = troot && roi_map_hit(&troi, offset, bytes);
+        need_g = !ftonly && roi_map_hit(&groi, offset, bytes);
+        /* don't even page in blocks no signature can match in */
+        buff = NULL;
+        if(need_t || need_g || md5ctx || sha1ctx || sha256ctx) {
+            if(!(buff = fmap_need_off_once(map, offset, bytes)))
+                break;
+        }
         if(ctx->scanned)
             *ctx->scanned += bytes / CL_COUNT_PRECISION;
 
@@ -1015,7 +1247,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             !ctx->engine->cb_progress((ssize_t) map->handle, bytes, ctx->engine->cb_progress_ctx))
             return CL_BREAK;
 
-        if(troot) {
+        if(need_t) {
                 virname = NULL;
                 ret = matcher_run(troot, buff, bytes, &virname, &tdata, offset, &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, map, bm_offmode ? &toff : NULL, &tpoff, ctx);
 
@@ -1045,7 +1277,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
             }
         }
 
-        if(!ftonly) {
+        if(need_g) {
             virname = NULL;
             ret = matcher_run(groot, buff, bytes, &virname, &gdata, offset, &info, ftype, ftoffset, acmode, PCRE_SCAN_FMAP, acres, map, NULL, &gpoff, ctx);
 
@@ -1075,20 +1307,20 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
                 if(ret > type)
                     type = ret;
             }
+        }
 
-            /* if (bytes <= (maxpatlen * (offset!=0))), it means the last window finished the file hashing *
-             *   since the last window is responsible for adding intersection between windows (maxpatlen)  */
-            if(hdb && (bytes > (maxpatlen * (offset!=0)))) {
-                const void *data = buff + maxpatlen * (offset!=0);
-                uint32_t data_len = bytes - maxpatlen * (offset!=0);
-
-                if(compute_hash[CLI_HASH_MD5])
-                    cl_update_hash(md5ctx, (void *)data, data_len);
-                if(compute_hash[CLI_HASH_SHA1])
-                    cl_update_hash(sha1ctx, (void *)data, data_len);
-                if(compute_hash[CLI_HASH_SHA256])
-                    cl_update_hash(sha256ctx, (void *)data, data_len);
-            }
+        /* if (bytes <= (maxpatlen * (offset!=0))), it means the last window finished the file hashing *
+         *   since the last window is responsible for adding intersection between windows (maxpatlen)  */
+        if(buff && !ftonly && hdb && (bytes > (maxpatlen * (offset!=0)))) {
+            const void *data = buff + maxpatlen * (offset!=0);
+            uint32_t data_len = bytes - maxpatlen * (offset!=0);
+
+            if(compute_hash[CLI_HASH_MD5])
+                cl_update_hash(md5ctx, (void *)data, data_len);
+            if(compute_hash[CLI_HASH_SHA1])
+                cl_update_hash(sha1ctx, (void *)data, data_len);
+            if(compute_hash[CLI_HASH_SHA256])
+                cl_update_hash(sha256ctx, (void *)data, data_len);
         }
 
         if(bytes < SCANBUFF)
@@ -1097,7 +1329,7 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
         offset += bytes - maxpatlen;
     }
 
-    if(!ftonly && hdb) {
+    if(!ftonly && hdb && !ctx->timed_out) {
         enum CLI_HASH_TYPE hashtype, hashtype2;
 
         if(compute_hash[CLI_HASH_MD5]) {
@@ -1206,6 +1438,20 @@ int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli
     return (acmode & AC_SCAN_FT) ? type : CL_CLEAN;
 }
 
+int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash)
+{
+    struct cli_trace_mark mark;
+    int ret;
+
+    if (!ctx->trace)
+	return fmap_scandesc(ctx, ftype, ftonly, ftoffset, acmode, acres, refhash);
+
+    cli_trace_match_start(ctx, &mark);
+    ret = fmap_scandesc(ctx, ftype, ftonly, ftoffset, acmode, acres, refhash);
+    cli_trace_match_stop(ctx, &mark);
+    return ret;
+}
+
 int cli_matchmeta(cli_ctx *ctx, const char *fname, size_t fsizec, size_t fsizer, int encrypted, unsigned int filepos, int res1, void *res2)
 {
 	const struct cli_cdb *cdb;
@@ -95,6 +95,15 @@ struct cli_ac_lsig {
     } u;
     const char *virname;
     struct cli_lsig_tdb tdb;
+    struct cli_lsig_prog *prog; /* compiled u.logic, NULL if too complex */
+};
+
+/* one offset some signatures of a root are anchored to, see cli_roi_build() */
+#define CLI_ROI_MAX 64
+struct cli_roi {
+    uint32_t offdata[4];
+    uint32_t before, after; /* bytes a match can reach around the offset,
+			     * after == CLI_OFF_ANY: up to the end of file */
 };
 
 struct cli_matcher {
@@ -105,6 +114,7 @@ struct cli_matcher {
     struct cli_bm_patt **bm_suffix, **bm_pattab;
     uint32_t *soff, soff_len; /* for PE section sigs */
     uint32_t bm_offmode, bm_patterns, bm_reloff_num, bm_absoff_num;
+    uint32_t bm_window; /* bytes covered by one shift lookup, see cli_bm_build() */
 
     /* HASH */
     struct cli_hash_patt hm;
@@ -113,6 +123,7 @@ struct cli_matcher {
     /* Extended Aho-Corasick */
     uint32_t ac_partsigs, ac_nodes, ac_lists, ac_patterns, ac_lsigs;
     struct cli_ac_lsig **ac_lsigtable;
+    uint32_t *ac_lsig_always, ac_lsig_always_num; /* lsigs evaluated even without subsig matches */
     struct cli_ac_node *ac_root, **ac_nodetable;
     struct cli_ac_list **ac_listtable;
     struct cli_ac_patt **ac_pattable;
@@ -124,6 +135,11 @@ struct cli_matcher {
     uint16_t maxpatlen;
     uint8_t ac_only;
 
+    /* Region of interest */
+    struct cli_roi *roi;
+    uint32_t roi_num;
+    uint8_t roi_on; /* all signatures are anchored to one of roi[] */
+
     /* Perl-Compiled Regular Expressions */
 #if HAVE_PCRE
     uint32_t pcre_metas;
@@ -201,6 +217,8 @@ int cli_scandesc(int desc, cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struc
 int cli_fmap_scandesc(cli_ctx *ctx, cli_file_t ftype, uint8_t ftonly, struct cli_matched_type **ftoffset, unsigned int acmode, struct cli_ac_result **acres, unsigned char *refhash);
 int cli_exp_eval(cli_ctx *ctx, struct cli_matcher *root, struct cli_ac_data *acdata, struct cli_target_info *target_info, const char *hash);
 int cli_caloff(const char *offstr, const struct cli_target_info *info, unsigned int target, uint32_t *offdata, uint32_t *offset_min, uint32_t *offset_max);
+int cli_roi_build(struct cli_matcher *root);
+void cli_roi_add(struct cli_matcher *root, const uint32_t *offdata, uint32_t before, uint32_t after);
 
 int cli_checkfp(unsigned char *digest, size_t size, cli_ctx *ctx);
 
@@ -72,6 +72,9 @@ static inline void spam(const char *fmt, ...) { UNUSEDPARAM(fmt); }
 #define MIN_FRAGSIZE 262144
 #endif
 
+/* Huge page size assumed when /proc/meminfo doesn't report one */
+#define MPOOL_HUGEPAGE_SIZE 2097152
+
 #if SIZEOF_VOID_P==8
 static const unsigned int fragsz[] = {
     8,
@@ -370,10 +373,13 @@ struct MPMAP {
   struct MPMAP *next;
   size_t size;
   size_t usize;
+  unsigned int hugepage;
 };
 
 struct MP {
   size_t psize;
+  size_t hpsize;
+  unsigned int hugepages;
   struct FRAG *avail[FRAGSBITS];
   union {
       struct MPMAP mpm;
@@ -446,12 +452,89 @@ static inline size_t alignto(size_t p, size_t size)
     return (p+size-1)&(~(size-1));
 }
 
+/* Returns the default huge page size from the "Hugepagesize:" line of
+ * /proc/meminfo, or MPOOL_HUGEPAGE_SIZE if it can't be read */
+static size_t mpool_hugepage_size(void) {
+  size_t hpsize = MPOOL_HUGEPAGE_SIZE;
+#ifndef _WIN32
+  unsigned long kb;
+  char buff[128];
+  FILE *fs;
+
+  if (!(fs = fopen("/proc/meminfo", "r")))
+    return hpsize;
+  while (fgets(buff, sizeof(buff), fs)) {
+    if (sscanf(buff, "Hugepagesize: %lu kB", &kb) == 1) {
+      /* alignto() needs a power of 2 */
+      if (kb && !((kb * 1024) & (kb * 1024 - 1)))
+        hpsize = (size_t)kb * 1024;
+      break;
+    }
+  }
+  fclose(fs);
+#endif
+  return hpsize;
+}
+
+void mpool_set_hugepages(struct MP *mp, unsigned int mode) {
+  mp->hugepages = mode;
+  if (mode != CL_MPOOL_HUGEPAGES_NONE && !mp->hpsize)
+    mp->hpsize = mpool_hugepage_size();
+}
+
+#ifndef _WIN32
+/* Maps a chunk of at least *size bytes for mpool_malloc().
+ * With huge pages requested, chunks are grown to a multiple of the huge page
+ * size and aligned to it; a MIN_FRAGSIZE chunk thus becomes one huge page,
+ * which later allocations fill up like any other chunk. Explicit mode tries
+ * MAP_HUGETLB first and falls back to transparent huge pages when no reserved
+ * pages are left; transparent mode maps an oversized region, trims it to
+ * alignment and marks it with MADV_HUGEPAGE. */
+static struct MPMAP *mpool_map_chunk(struct MP *mp, size_t *size, unsigned int *hugepage) {
+  void *p;
+  *hugepage = 0;
+
+  if (mp->hugepages != CL_MPOOL_HUGEPAGES_NONE) {
+    size_t hsize = alignto(*size, mp->hpsize);
+#ifdef MAP_HUGETLB
+    if (mp->hugepages == CL_MPOOL_HUGEPAGES_EXPLICIT) {
+      if ((p = mmap(NULL, hsize, PROT_READ | PROT_WRITE, MAP_PRIVATE|ANONYMOUS_MAP|MAP_HUGETLB, -1, 0)) != MAP_FAILED) {
+        *size = hsize;
+        *hugepage = 1;
+        return (struct MPMAP *)p;
+      }
+      spam("MAP_HUGETLB failed for %lu bytes, trying transparent huge pages\n", (unsigned long)hsize);
+    }
+#endif
+#if defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    if ((p = mmap(NULL, hsize + mp->hpsize, PROT_READ | PROT_WRITE, MAP_PRIVATE|ANONYMOUS_MAP, -1, 0)) != MAP_FAILED) {
+      char *start = (char *)p, *aligned = (char *)alignto((size_t)start, mp->hpsize);
+
+      if (aligned > start)
+        munmap(start, aligned - start);
+      if (start + mp->hpsize > aligned)
+        munmap(aligned + hsize, start + mp->hpsize - aligned);
+      madvise(aligned, hsize, MADV_HUGEPAGE);
+      *size = hsize;
+      *hugepage = 1;
+      return (struct MPMAP *)aligned;
+    }
+#endif
+  }
+
+  if ((p = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_PRIVATE|ANONYMOUS_MAP, -1, 0)) == MAP_FAILED)
+    return NULL;
+  return (struct MPMAP *)p;
+}
+#endif
+
 struct MP *mpool_create() {
   struct MP mp, *mpool_p;
   size_t sz;
   memset(&mp, 0, sizeof(mp));
   mp.psize = cli_getpagesize();
   sz = align_to_pagesize(&mp, MIN_FRAGSIZE);
+  mp.hugepages = CL_MPOOL_HUGEPAGES_NONE;
   mp.u.mpm.usize = sizeof(struct MPMAP);
   mp.u.mpm.size = sz - sizeof(mp);
   if (FRAGSBITS > 255) {
@@ -514,7 +597,11 @@ void mpool_flush(struct MP *mp) {
 
     while((mpm = mpm_next)) {
 	mpm_next = mpm->next;
-	mused = align_to_pagesize(mp, mpm->usize);
+	/* only release whole huge pages so the rest of the chunk keeps them */
+	if(mpm->hugepage)
+	    mused = alignto(mpm->usize, mp->hpsize);
+	else
+	    mused = align_to_pagesize(mp, mpm->usize);
 	if(mused < mpm->size) {
 #ifdef CL_DEBUG
 	    memset((char *)mpm + mused, FREEPOISON, mpm->size - mused);
@@ -612,6 +699,7 @@ void *mpool_malloc(struct MP *mp, size_t size) {
   const unsigned int sbits = to_bits(needed);
   struct FRAG *f = NULL;
   struct MPMAP *mpm = &mp->u.mpm;
+  unsigned int hugepage = 0;
 
   /*  check_all(mp); */
   if (!size || sbits == FRAGSBITS) {
@@ -658,7 +746,7 @@ void *mpool_malloc(struct MP *mp, size_t size) {
   i = align_to_pagesize(mp, MIN_FRAGSIZE);
 
 #ifndef _WIN32
-  if ((mpm = (struct MPMAP *)mmap(NULL, i, PROT_READ | PROT_WRITE, MAP_PRIVATE|ANONYMOUS_MAP, -1, 0)) == MAP_FAILED) {
+  if (!(mpm = mpool_map_chunk(mp, &i, &hugepage))) {
 #else
   if (!(mpm = (struct MPMAP *)VirtualAlloc(NULL, i, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE))) {
 #endif
@@ -670,6 +758,7 @@ void *mpool_malloc(struct MP *mp, size_t size) {
   memset(mpm, ALLOCPOISON, i);
 #endif
   mpm->size = i;
+  mpm->hugepage = hugepage;
   mpm->usize = sizeof(*mpm);
   mpm->next = mp->u.mpm.next;
   mp->u.mpm.next = mpm;
@@ -461,6 +461,9 @@ struct cl_engine *cl_engine_new(void)
     new->pcre_recmatch_limit = CLI_DEFAULT_PCRE_RECMATCH_LIMIT;
     new->pcre_max_filesize = CLI_DEFAULT_PCRE_MAX_FILESIZE;
 
+    new->readahead = CLI_DEFAULT_READAHEAD;
+    new->mpool_hugepages = CL_MPOOL_HUGEPAGES_NONE;
+
 #ifdef HAVE_YARA
 
     /* YARA */
@@ -552,6 +555,9 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	case CL_ENGINE_DB_OPTIONS:
 	case CL_ENGINE_DB_VERSION:
 	case CL_ENGINE_DB_TIME:
+	case CL_ENGINE_DB_STAMP:
+	case CL_ENGINE_CACHE_HITS:
+	case CL_ENGINE_CACHE_MISSES:
 	    cli_warnmsg("cl_engine_set_num: The field is read only\n");
 	    return CL_EARG;
 	case CL_ENGINE_AC_ONLY:
@@ -639,6 +645,20 @@ int cl_engine_set_num(struct cl_engine *engine, enum cl_engine_field field, long
 	case CL_ENGINE_PCRE_MAX_FILESIZE:
 	    engine->pcre_max_filesize = (uint64_t)num;
 	    break;
+	case CL_ENGINE_READAHEAD:
+	    engine->readahead = (uint32_t)num;
+	    break;
+	case CL_ENGINE_MPOOL_HUGEPAGES:
+	    if (num < CL_MPOOL_HUGEPAGES_NONE || num > CL_MPOOL_HUGEPAGES_EXPLICIT) {
+		cli_errmsg("cl_engine_set_num: Invalid CL_ENGINE_MPOOL_HUGEPAGES mode\n");
+		return CL_EARG;
+	    }
+	    engine->mpool_hugepages = (uint32_t)num;
+	    mpool_set_hugepages(engine->mempool, engine->mpool_hugepages);
+	    break;
+	case CL_ENGINE_SIGPROFILE:
+	    engine->sigprofile = num ? 1 : 0;
+	    break;
 	default:
 	    cli_errmsg("cl_engine_set_num: Incorrect field number\n");
 	    return CL_EARG;
@@ -688,6 +708,8 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->dbversion[0];
 	case CL_ENGINE_DB_TIME:
 	    return engine->dbversion[1];
+	case CL_ENGINE_DB_STAMP:
+	    return engine->dbstamp;
 	case CL_ENGINE_AC_ONLY:
 	    return engine->ac_only;
 	case CL_ENGINE_AC_MINDEPTH:
@@ -722,6 +744,20 @@ long long cl_engine_get_num(const struct cl_engine *engine, enum cl_engine_field
 	    return engine->pcre_recmatch_limit;
 	case CL_ENGINE_PCRE_MAX_FILESIZE:
 	    return engine->pcre_max_filesize;
+	case CL_ENGINE_READAHEAD:
+	    return engine->readahead;
+	case CL_ENGINE_MPOOL_HUGEPAGES:
+	    return engine->mpool_hugepages;
+	case CL_ENGINE_SIGPROFILE:
+	    return engine->sigprofile;
+	case CL_ENGINE_CACHE_HITS:
+	case CL_ENGINE_CACHE_MISSES:
+	    {
+		uint64_t hits, misses;
+
+		cli_cache_stats(engine, &hits, &misses);
+		return field == CL_ENGINE_CACHE_HITS ? hits : misses;
+	    }
 	default:
 	    cli_errmsg("cl_engine_get: Incorrect field number\n");
 	    if(err)
@@ -820,6 +856,7 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->cb_hash = engine->cb_hash;
     settings->cb_meta = engine->cb_meta;
     settings->cb_file_props = engine->cb_file_props;
+    settings->cb_trace = engine->cb_trace;
     settings->engine_options = engine->engine_options;
 
     settings->cb_stats_add_sample = engine->cb_stats_add_sample;
@@ -840,6 +877,10 @@ struct cl_settings *cl_engine_settings_copy(const struct cl_engine *engine)
     settings->pcre_recmatch_limit = engine->pcre_recmatch_limit;
     settings->pcre_max_filesize = engine->pcre_max_filesize;
 
+    settings->readahead = engine->readahead;
+    settings->mpool_hugepages = engine->mpool_hugepages;
+    settings->sigprofile = engine->sigprofile;
+
     return settings;
 }
 
@@ -894,6 +935,7 @@ int cl_engine_settings_apply(struct cl_engine *engine, const struct cl_settings
     engine->cb_hash = settings->cb_hash;
     engine->cb_meta = settings->cb_meta;
     engine->cb_file_props = settings->cb_file_props;
+    engine->cb_trace = settings->cb_trace;
 
     engine->cb_stats_add_sample = settings->cb_stats_add_sample;
     engine->cb_stats_remove_sample = settings->cb_stats_remove_sample;
@@ -913,6 +955,11 @@ int cl_engine_settings_apply(struct cl_engine *engine, const struct cl_settings
     engine->pcre_recmatch_limit = settings->pcre_recmatch_limit;
     engine->pcre_max_filesize = settings->pcre_max_filesize;
 
+    engine->readahead = settings->readahead;
+    engine->mpool_hugepages = settings->mpool_hugepages;
+    mpool_set_hugepages(engine->mempool, engine->mpool_hugepages);
+    engine->sigprofile = settings->sigprofile;
+
     return CL_SUCCESS;
 }
 
@@ -958,6 +1005,12 @@ int cli_checklimits(const char *who, cli_ctx *ctx, unsigned long need1, unsigned
         cli_dbgmsg("%s: files limit reached (max: %u)\n", who, ctx->engine->maxfiles);
 	return CL_EMAXFILES;
     }
+
+    /* the unpackers call us for every member, so this is where they notice */
+    if(cli_checktimelimit(ctx) != CL_SUCCESS) {
+        cli_dbgmsg("%s: scan deadline reached\n", who);
+	return CL_ETIMEOUT;
+    }
     return ret;
 }
 
@@ -972,18 +1025,32 @@ int cli_updatelimits(cli_ctx *ctx, unsigned long needed) {
     return CL_CLEAN;
 }
 
+/* microseconds from an arbitrary point, not affected by changes to the wall clock */
+uint64_t cli_monotonic_usecs(void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+    {
+        struct timeval tv;
+
+        gettimeofday(&tv, NULL);
+        return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    }
+}
+
 int cli_checktimelimit(cli_ctx *ctx)
 {
-    if (ctx->time_limit.tv_sec != 0) {
-        struct timeval now;
-        if (gettimeofday(&now, NULL) == 0) {
-            if (now.tv_sec < ctx->time_limit.tv_sec)
-                return CL_SUCCESS;
-            if (now.tv_sec > ctx->time_limit.tv_sec || now.tv_usec > ctx->time_limit.tv_usec)
-                return CL_ETIMEOUT;
-        }
+    if (!ctx || !ctx->deadline)
+        return CL_SUCCESS;
+    if (!ctx->timed_out && cli_monotonic_usecs() >= ctx->deadline) {
+        cli_dbgmsg("cli_checktimelimit: scan deadline reached\n");
+        ctx->timed_out = 1;
     }
-    return CL_SUCCESS;
+    return ctx->timed_out ? CL_ETIMEOUT : CL_SUCCESS;
 }
 
 /*
@@ -1406,3 +1473,8 @@ void cl_engine_set_clcb_file_props(struct cl_engine *engine, clcb_file_props cal
 {
     engine->cb_file_props = callback;
 }
+
+void cl_engine_set_clcb_trace(struct cl_engine *engine, clcb_trace callback)
+{
+    engine->cb_trace = callback;
+}
@@ -156,7 +156,12 @@ typedef struct cli_ctx_tag {
     struct json_object *properties;
     struct json_object *wrkproperty;
 #endif
-    struct timeval time_limit;
+    uint64_t deadline;          /* cli_monotonic_usecs() value, 0 for none */
+    unsigned int deadline_ticks;
+    int timed_out;
+    const unsigned char *top_md5; /* precomputed MD5 of the top level file */
+    struct cli_arena *arena;
+    struct cli_trace *trace;
 } cli_ctx;
 
 #define STATS_ANON_UUID "5b585e8f-3be5-11e3-bf0b-18037319526c"
@@ -252,6 +257,7 @@ struct cl_engine {
     uint32_t sdb;
     uint32_t dboptions;
     uint32_t dbversion[2];
+    uint64_t dbstamp;	/* xor of the hashes of the loaded database files */
     uint32_t ac_only;
     uint32_t ac_mindepth;
     uint32_t ac_maxdepth;
@@ -344,6 +350,7 @@ struct cl_engine {
     clcb_hash cb_hash;
     clcb_meta cb_meta;
     clcb_file_props cb_file_props;
+    clcb_trace cb_trace;
 
     /* Used for bytecode */
     struct cli_all_bc bcs;
@@ -387,6 +394,15 @@ struct cl_engine {
     uint64_t pcre_recmatch_limit;
     uint64_t pcre_max_filesize;
 
+    /* pages prefetched ahead of sequential reads of scanned files */
+    uint32_t readahead;
+
+    /* huge page backing of the signature memory pool */
+    uint32_t mpool_hugepages;
+
+    /* per-signature time and match profiling */
+    uint32_t sigprofile;
+
 #ifdef HAVE_YARA
     /* YARA */
     struct _yara_global * yara_global;
@@ -426,6 +442,7 @@ struct cl_settings {
     clcb_hash cb_hash;
     clcb_meta cb_meta;
     clcb_file_props cb_file_props;
+    clcb_trace cb_trace;
 
     /* Engine max settings */
     uint64_t maxembeddedpe;  /* max size to scan MSEXE for PE */
@@ -456,6 +473,10 @@ struct cl_settings {
     uint64_t pcre_match_limit;
     uint64_t pcre_recmatch_limit;
     uint64_t pcre_max_filesize;
+
+    uint32_t readahead;
+    uint32_t mpool_hugepages;
+    uint32_t sigprofile;
 };
 
 extern int (*cli_unrar_open)(int fd, const char *dirname, unrar_state_t *state);
@@ -702,6 +723,24 @@ int cli_matchregex(const char *str, const char *regex);
 void cli_qsort(void *a, size_t n, size_t es, int (*cmp)(const void *, const void *));
 void cli_qsort_r(void *a, size_t n, size_t es, int (*cmp)(const void*, const void *, const void *), void *arg);
 int cli_checktimelimit(cli_ctx *ctx);
+uint64_t cli_monotonic_usecs(void);
+
+/* Reading the clock costs more than one iteration of most inner loops,
+ * so cli_checkdeadline() only does it every CLI_DEADLINE_STRIDE calls.
+ * Once the deadline has passed it keeps failing without the clock. */
+#define CLI_DEADLINE_STRIDE 64
+
+static inline int cli_checkdeadline(cli_ctx *ctx)
+{
+    if (!ctx || !ctx->deadline)
+        return CL_SUCCESS;
+    if (ctx->timed_out)
+        return CL_ETIMEOUT;
+    if (++ctx->deadline_ticks < CLI_DEADLINE_STRIDE)
+        return CL_SUCCESS;
+    ctx->deadline_ticks = 0;
+    return cli_checktimelimit(ctx);
+}
 
 /* symlink behaviour */
 #define CLI_FTW_FOLLOW_FILE_SYMLINK 0x01
@@ -196,6 +196,68 @@ static int find_stream_bounds(const char *start, off_t bytesleft, off_t byteslef
     return 0;
 }
 
+#define PDF_OBJHASH_MIN 256
+
+static inline uint32_t pdf_objhash(uint32_t id, unsigned size)
+{
+    return (id * 2654435761U) & (size - 1);
+}
+
+/* Adds objs[idx] to the object id index used by find_obj(). The table is
+ * doubled and rebuilt whenever it fills up; if that fails the index is
+ * dropped for the rest of the file and find_obj() searches linearly. */
+static void pdf_hashobj(struct pdf_struct *pdf, unsigned idx)
+{
+    uint32_t *hash, *chain;
+    unsigned size, i;
+    uint32_t h;
+
+    if (idx >= pdf->objhash_size) {
+        if (pdf->objhash_size && !pdf->objhash)
+            return;
+
+        size = pdf->objhash_size ? pdf->objhash_size * 2 : PDF_OBJHASH_MIN;
+        hash = cli_calloc(size, sizeof(*hash));
+        chain = cli_malloc(size * sizeof(*chain));
+        free(pdf->objhash);
+        free(pdf->objchain);
+        pdf->objhash = pdf->objchain = NULL;
+        pdf->objhash_size = size;
+        if (!hash || !chain) {
+            cli_dbgmsg("cli_pdf: can't grow object index to %u entries\n", size);
+            free(hash);
+            free(chain);
+            return;
+        }
+
+        for (i = 0; i < idx; i++) {
+            h = pdf_objhash(pdf->objs[i].id, size);
+            chain[i] = hash[h];
+            hash[h] = i + 1;
+        }
+
+        pdf->objhash = hash;
+        pdf->objchain = chain;
+    }
+
+    if (!pdf->objhash)
+        return;
+
+    h = pdf_objhash(pdf->objs[idx].id, pdf->objhash_size);
+    pdf->objchain[idx] = pdf->objhash[h];
+    pdf->objhash[h] = idx + 1;
+}
+
+static void pdf_freeobjs(struct pdf_struct *pdf)
+{
+    free(pdf->objs);
+    free(pdf->objhash);
+    free(pdf->objchain);
+    pdf->objs = NULL;
+    pdf->objhash = pdf->objchain = NULL;
+    pdf->objhash_size = 0;
+}
+
 /* Expected returns: 1 if success, 0 if no more objects, -1 if error */
 int pdf_findobj(struct pdf_struct *pdf)
 {
@@ -245,6 +307,7 @@ int pdf_findobj(struct pdf_struct *pdf)
 
     objid = atoi(q);
     obj->id = (objid << 8) | (genid&0xff);
+    pdf_hashobj(pdf, pdf->nobjs-1);
     obj->start = q2+4 - pdf->map;
     obj->flags = 0;
     bytesleft -= 4;
@@ -286,7 +349,111 @@ int pdf_findobj(struct pdf_struct *pdf)
     return 1;/* truncated */
 }
 
-static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fout, const char *buf, off_t len, off_t *sum)
+/* Output of an object dump. Data stays in buf until it grows past
+ * PDF_DUMP_MEMMAX and is only written to path from then on (or from the
+ * start, when fd is opened by pdf_dump_init()). */
+#define PDF_DUMP_MEMMAX (1024 * 1024)
+
+struct pdf_dump {
+    char path[NAME_MAX + 1];
+    int fd;
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+static int pdf_dump_open(struct pdf_dump *dump)
+{
+    dump->fd = open(dump->path, O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
+    if (dump->fd < 0) {
+        char err[128];
+
+        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", dump->path, cli_strerror(errno, err, sizeof(err)));
+        return CL_ETMPFILE;
+    }
+
+    if (dump->len && cli_writen(dump->fd, dump->buf, dump->len) != (int)dump->len)
+        return CL_EWRITE;
+
+    free(dump->buf);
+    dump->buf = NULL;
+    dump->len = dump->size = 0;
+
+    return CL_SUCCESS;
+}
+
+static int pdf_dump_init(struct pdf_dump *dump, int inmem)
+{
+    dump->fd = -1;
+    dump->buf = NULL;
+    dump->len = dump->size = 0;
+
+    return inmem ? CL_SUCCESS : pdf_dump_open(dump);
+}
+
+static int pdf_dump_write(struct pdf_dump *dump, const char *buf, size_t len)
+{
+    if (dump->fd < 0) {
+        if (dump->len + len > PDF_DUMP_MEMMAX) {
+            if (pdf_dump_open(dump) != CL_SUCCESS)
+                return -1;
+
+            return cli_writen(dump->fd, buf, len);
+        }
+
+        if (dump->len + len > dump->size) {
+            size_t size = dump->size ? dump->size : BUFSIZ;
+            char *p;
+
+            while (size < dump->len + len)
+                size *= 2;
+
+            if (size > PDF_DUMP_MEMMAX)
+                size = PDF_DUMP_MEMMAX;
+
+            p = cli_realloc(dump->buf, size);
+            if (!p)
+                return -1;
+
+            dump->buf = p;
+            dump->size = size;
+        }
+
+        memcpy(dump->buf + dump->len, buf, len);
+        dump->len += len;
+
+        return len;
+    }
+
+    return cli_writen(dump->fd, buf, len);
+}
+
+static int pdf_dump_scan(struct pdf_dump *dump, cli_ctx *ctx)
+{
+    if (dump->fd < 0)
+        return dump->len ? cli_mem_scandesc(dump->buf, dump->len, ctx) : CL_CLEAN;
+
+    lseek(dump->fd, 0, SEEK_SET);
+
+    return cli_magic_scandesc(dump->fd, ctx);
+}
+
+static int pdf_dump_close(struct pdf_dump *dump, cli_ctx *ctx)
+{
+    free(dump->buf);
+    dump->buf = NULL;
+    if (dump->fd < 0)
+        return CL_SUCCESS;
+
+    close(dump->fd);
+    dump->fd = -1;
+    if (!ctx->engine->keeptmp && cli_unlink(dump->path))
+        return CL_EUNLINK;
+
+    return CL_SUCCESS;
+}
+
+static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, struct pdf_dump *fout, const char *buf, off_t len, off_t *sum)
 {
     UNUSEDPARAM(obj);
 
@@ -295,7 +462,7 @@ static int filter_writen(struct pdf_struct *pdf, struct pdf_obj *obj, int fout,
 
     *sum += len;
 
-    return cli_writen(fout, buf, len);
+    return pdf_dump_write(fout, buf, len);
 }
 
 static void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_flag flag)
@@ -375,7 +542,7 @@ static void pdfobj_flag(struct pdf_struct *pdf, struct pdf_obj *obj, enum pdf_fl
     cli_dbgmsg("cli_pdf: %s flagged in object %u %u\n", s, obj->id>>8, obj->id&0xff);
 }
 
-static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, const char *buf, off_t len, int fout, off_t *sum)
+static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, const char *buf, off_t len, struct pdf_dump *fout, off_t *sum)
 {
     int skipped = 0;
     int zstat;
@@ -426,6 +593,11 @@ static int filter_flatedecode(struct pdf_struct *pdf, struct pdf_obj *obj, const
                     nbytes += written;
                     stream.next_out = (Bytef *)output;
                     stream.avail_out = sizeof(output);
+
+                    if (cli_checkdeadline(pdf->ctx) != CL_SUCCESS) {
+                        inflateEnd(&stream);
+                        return CL_ETIMEOUT;
+                    }
                 }
 
                 continue;
@@ -526,6 +698,25 @@ struct pdf_obj *find_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t o
     /* search starting at previous obj (if exists) */
     i = (obj != pdf->objs) ? obj - pdf->objs : 0;
 
+    if (pdf->objhash) {
+        struct pdf_obj *wrapped = NULL;
+
+        /* buckets are chained newest first, so the last hit at or after i is
+         * the one the linear search below would have returned */
+        obj = NULL;
+        for (j = pdf->objhash[pdf_objhash(objid, pdf->objhash_size)]; j; j = pdf->objchain[j-1]) {
+            if (j-1 >= pdf->nobjs || pdf->objs[j-1].id != objid)
+                continue;
+
+            if (j-1 >= i)
+                obj = &pdf->objs[j-1];
+            else
+                wrapped = &pdf->objs[j-1];
+        }
+
+        return obj ? obj : wrapped;
+    }
+
     for (j=i;j<pdf->nobjs;j++) {
         obj = &pdf->objs[j];
         if (obj->id == objid)
@@ -868,7 +1059,7 @@ enum cstate {
     CSTATE_TJ_PAROPEN
 };
 
-static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, int fout)
+static void process(struct text_norm_state *s, enum cstate *st, const char *buf, int length, struct pdf_dump *fout)
 {
     do {
         switch (*st) {
@@ -895,7 +1086,7 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
                 *st = CSTATE_TJ;
             } else {
                 if (text_normalize_buffer(s, (const unsigned char *)buf, 1) != 1) {
-                    cli_writen(fout, s->out, s->out_pos);
+                    pdf_dump_write(fout, s->out, s->out_pos);
                     text_normalize_reset(s);
                 }
             }
@@ -908,42 +1099,51 @@ static void process(struct text_norm_state *s, enum cstate *st, const char *buf,
     } while (length > 0);
 }
 
-static int pdf_scan_contents(int fd, struct pdf_struct *pdf)
+static int pdf_scan_contents(struct pdf_dump *in, struct pdf_struct *pdf)
 {
     struct text_norm_state s;
-    char fullname[1024];
+    struct pdf_dump out;
     char outbuff[BUFSIZ];
     char inbuf[BUFSIZ];
-    int fout, n, rc;
+    size_t off = 0;
+    int n, rc;
     enum cstate st = CSTATE_NONE;
 
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u_c", pdf->dir, (pdf->files-1));
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
-
-        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-        return CL_ETMPFILE;
+    snprintf(out.path, sizeof(out.path), "%s"PATHSEP"pdf%02u_c", pdf->dir, (pdf->files-1));
+    rc = pdf_dump_init(&out, !pdf->ctx->engine->keeptmp);
+    if (rc != CL_SUCCESS) {
+        pdf_dump_close(&out, pdf->ctx);
+        return rc;
     }
 
+    if (in->fd >= 0)
+        lseek(in->fd, 0, SEEK_SET);
+
     text_normalize_init(&s, (unsigned char *)outbuff, sizeof(outbuff));
     while (1) {
-        n = cli_readn(fd, inbuf, sizeof(inbuf));
-        if (n <= 0)
-            break;
+        /* same chunking for both, process() drops chunks without a newline */
+        if (in->fd >= 0) {
+            n = cli_readn(in->fd, inbuf, sizeof(inbuf));
+            if (n <= 0)
+                break;
 
-        process(&s, &st, inbuf, n, fout);
-    }
+            process(&s, &st, inbuf, n, &out);
+        } else {
+            if (off >= in->len)
+                break;
+
+            n = (in->len - off > sizeof(inbuf)) ? sizeof(inbuf) : in->len - off;
 
-    cli_writen(fout, s.out, s.out_pos);
+            process(&s, &st, in->buf + off, n, &out);
+            off += n;
+        }
+    }
 
-    lseek(fout, 0, SEEK_SET);
-    rc = cli_magic_scandesc(fout, pdf->ctx);
-    close(fout);
+    pdf_dump_write(&out, s.out, s.out_pos);
 
-    if (!pdf->ctx->engine->keeptmp)
-        if (cli_unlink(fullname) && rc != CL_VIRUS)
-            rc = CL_EUNLINK;
+    rc = pdf_dump_scan(&out, pdf->ctx);
+    if (pdf_dump_close(&out, pdf->ctx) != CL_SUCCESS && rc != CL_VIRUS)
+        rc = CL_EUNLINK;
 
     return rc;
 }
@@ -955,8 +1155,7 @@ static char *pdf_readstring(const char *q0, int len, const char *key, unsigned *
 
 int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 {
-    char fullname[NAME_MAX + 1];
-    int fout;
+    struct pdf_dump fout;
     off_t sum = 0;
     int rc = CL_SUCCESS;
     char *ascii_decoded = NULL;
@@ -986,18 +1185,18 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
     cli_dbgmsg("cli_pdf: dumping obj %u %u\n", obj->id>>8, obj->id&0xff);
 
-    snprintf(fullname, sizeof(fullname), "%s"PATHSEP"pdf%02u", pdf->dir, pdf->files++);
-    fout = open(fullname,O_RDWR|O_CREAT|O_EXCL|O_TRUNC|O_BINARY, 0600);
-    if (fout < 0) {
-        char err[128];
-        cli_errmsg("cli_pdf: can't create temporary file %s: %s\n", fullname, cli_strerror(errno, err, sizeof(err)));
-        free(ascii_decoded);
-
-        return CL_ETMPFILE;
+    /* keep the dump in memory unless something needs it as a file: callers
+     * that don't scan it, keeptmp, and bytecode PDF hooks which map the fd */
+    snprintf(fout.path, sizeof(fout.path), "%s"PATHSEP"pdf%02u", pdf->dir, pdf->files++);
+    rc = pdf_dump_init(&fout, (flags & PDF_EXTRACT_OBJ_SCAN) && !pdf->ctx->engine->keeptmp &&
+                       !pdf->ctx->engine->hooks_cnt[BC_PDF - _BC_START_HOOKS]);
+    if (rc != CL_SUCCESS) {
+        pdf_dump_close(&fout, pdf->ctx);
+        return rc;
     }
 
     if (!(flags & PDF_EXTRACT_OBJ_SCAN))
-        obj->path = strdup(fullname);
+        obj->path = strdup(fout.path);
 
     do {
         if (obj->flags & (1 << OBJ_STREAM)) {
@@ -1144,7 +1343,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
                 if (obj->flags & (1 << OBJ_FILTER_FLATE)) {
                     cli_dbgmsg("cli_pdf: deflate len %ld (orig %ld)\n", ascii_decoded_size, (long)orig_length);
-                    rc = filter_flatedecode(pdf, obj, flate_in, ascii_decoded_size, fout, &sum);
+                    rc = filter_flatedecode(pdf, obj, flate_in, ascii_decoded_size, &fout, &sum);
                     if (rc == CL_EFORMAT) {
                         if (decrypted) {
                             flate_in = flate_orig;
@@ -1154,13 +1353,13 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
                         cli_dbgmsg("cli_pdf: dumping raw stream (probably encrypted)\n");
                         noisy_warnmsg("cli_pdf: dumping raw stream, probably encrypted and we failed to decrypt'n");
 
-                        if (filter_writen(pdf, obj, fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size) {
+                        if (filter_writen(pdf, obj, &fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size) {
                             cli_errmsg("cli_pdf: failed to write output file\n");
-                            return CL_EWRITE;
+                            rc = CL_EWRITE;
                         }
                     }
                 } else {
-                    if (filter_writen(pdf, obj, fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size)
+                    if (filter_writen(pdf, obj, &fout, flate_in, ascii_decoded_size, &sum) != ascii_decoded_size)
                         rc = CL_EWRITE;
                 }
             } else {
@@ -1205,7 +1404,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
                         }
                     }
 
-                    if (filter_writen(pdf, obj, fout, out, js_len, &sum) != js_len) {
+                    if (filter_writen(pdf, obj, &fout, out, js_len, &sum) != js_len) {
                         rc = CL_EWRITE;
                                 free(js);
                         break;
@@ -1229,7 +1428,7 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
                         if (q2 > q) {
                             q--;
-                            filter_writen(pdf, obj, fout, q, q2 - q, &sum);
+                            filter_writen(pdf, obj, &fout, q, q2 - q, &sum);
                             q++;
                         }
                     }
@@ -1241,13 +1440,14 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
 
             if (bytesleft < 0)
                 rc = CL_EFORMAT;
-            else if (filter_writen(pdf, obj, fout , pdf->map + obj->start, bytesleft,&sum) != bytesleft)
+            else if (filter_writen(pdf, obj, &fout, pdf->map + obj->start, bytesleft,&sum) != bytesleft)
                 rc = CL_EWRITE;
         }
     } while (0);
 
     cli_dbgmsg("cli_pdf: extracted %ld bytes %u %u obj\n", sum, obj->id>>8, obj->id&0xff);
-    cli_dbgmsg("         ... to %s\n", fullname);
+    if (fout.fd >= 0)
+        cli_dbgmsg("         ... to %s\n", fout.path);
 
     if (flags & PDF_EXTRACT_OBJ_SCAN && sum) {
         int rc2;
@@ -1255,22 +1455,20 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
         cli_updatelimits(pdf->ctx, sum);
 
         /* TODO: invoke bytecode on this pdf obj with metainformation associated */
-        lseek(fout, 0, SEEK_SET);
-        rc2 = cli_magic_scandesc(fout, pdf->ctx);
+        rc2 = pdf_dump_scan(&fout, pdf->ctx);
         if (rc2 == CL_VIRUS || rc == CL_SUCCESS)
             rc = rc2;
 
         if ((rc == CL_CLEAN) || ((rc == CL_VIRUS) && (pdf->ctx->options & CL_SCAN_ALLMATCHES))) {
-            rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, fout, obj - pdf->objs);
+            rc2 = run_pdf_hooks(pdf, PDF_PHASE_POSTDUMP, fout.fd, obj - pdf->objs);
             if (rc2 == CL_VIRUS)
                 rc = rc2;
         }
 
         if (((rc == CL_CLEAN) || ((rc == CL_VIRUS) && (pdf->ctx->options & CL_SCAN_ALLMATCHES))) && (obj->flags & (1 << OBJ_CONTENTS))) {
-            lseek(fout, 0, SEEK_SET);
             cli_dbgmsg("cli_pdf: dumping contents %u %u\n", obj->id>>8, obj->id&0xff);
 
-            rc2 = pdf_scan_contents(fout, pdf);
+            rc2 = pdf_scan_contents(&fout, pdf);
             if (rc2 == CL_VIRUS)
                 rc = rc2;
 
@@ -1278,13 +1476,15 @@ int pdf_extract_obj(struct pdf_struct *pdf, struct pdf_obj *obj, uint32_t flags)
         }
     }
 
-    close(fout);
     free(ascii_decoded);
     free(decrypted);
 
-    if (flags & PDF_EXTRACT_OBJ_SCAN && !pdf->ctx->engine->keeptmp)
-        if (cli_unlink(fullname) && rc != CL_VIRUS)
+    if (flags & PDF_EXTRACT_OBJ_SCAN) {
+        if (pdf_dump_close(&fout, pdf->ctx) != CL_SUCCESS && rc != CL_VIRUS)
             rc = CL_EUNLINK;
+    } else if (fout.fd >= 0) {
+        close(fout.fd);
+    }
 
     return rc;
 }
@@ -2610,6 +2810,9 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
         struct pdf_obj *obj = &pdf.objs[pdf.nobjs-1];
 
         cli_dbgmsg("cli_pdf: found %d %d obj @%ld\n", obj->id >> 8, obj->id&0xff, obj->start + offset);
+        /* the parse loop below notices and cleans up */
+        if (cli_checkdeadline(ctx) != CL_SUCCESS)
+            break;
     }
 
     if (pdf.nobjs)
@@ -2627,7 +2830,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 #if HAVE_JSON
             pdf_export_json(&pdf);
 #endif
-            free(pdf.objs);
+            pdf_freeobjs(&pdf);
             if (pdf.fileID)
                 free(pdf.fileID);
             if (pdf.key)
@@ -2676,7 +2879,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 #if HAVE_JSON
             pdf_export_json(&pdf);
 #endif
-            free(pdf.objs);
+            pdf_freeobjs(&pdf);
             if (pdf.fileID)
                 free(pdf.fileID);
             if (pdf.key)
@@ -2752,7 +2955,7 @@ int cli_pdf(const char *dir, cli_ctx *ctx, off_t offset)
 #endif
 
     cli_dbgmsg("cli_pdf: returning %d\n", rc);
-    free(pdf.objs);
+    pdf_freeobjs(&pdf);
     free(pdf.fileID);
     free(pdf.key);
 
@@ -122,6 +122,9 @@ enum enc_method {
 struct pdf_struct {
     struct pdf_obj *objs;
     unsigned nobjs;
+    uint32_t *objhash;        /* object id hash buckets, objs index + 1 */
+    uint32_t *objchain;       /* next objs index + 1 in the same bucket */
+    unsigned objhash_size;
     unsigned flags;
     unsigned enc_method_stream;
     unsigned enc_method_string;
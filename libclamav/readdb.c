@@ -1741,6 +1741,7 @@ static int load_oneldb(char *buffer, int chkpua, struct cl_engine *engine, unsig
         mpool_free(engine->mempool, lsig);
         return CL_EMEM;
     }
+    lsig->prog = cli_ac_compilelsig(engine->mempool, logic);
 
     lsigid[0] = lsig->id = root->ac_lsigs;
 
@@ -3781,6 +3782,7 @@ static int load_oneyara(YR_RULE *rule, int chkpua, struct cl_engine *engine, uns
             free(newident);
             return CL_EMEM;
         }
+        lsig->prog = cli_ac_compilelsig(engine->mempool, lsig->u.logic);
     } else {
         if (NULL != (lsig->u.code_start = rule->code_start)) {
             lsig->type = (rule->cl_flags & RULE_OFFSETS) ? CLI_YARA_OFFSET : CLI_YARA_NORMAL;
@@ -4216,6 +4218,7 @@ int cli_load(const char *filename, struct cl_engine *engine, unsigned int *signo
 	uint8_t skipped = 0;
 	const char *dbname;
 	char buff[FILEBUFF];
+	STATBUF sb;
 
 
     if(dbio && dbio->chkonly) {
@@ -4241,6 +4244,18 @@ int cli_load(const char *filename, struct cl_engine *engine, unsigned int *signo
     else
 	dbname = filename;
 
+    if(fs && FSTAT(fileno(fs), &sb) == 0) {
+	/* FNV-1a of name, size and mtime; xored so the load order doesn't matter */
+	uint64_t h = 14695981039346656037ULL;
+	const char *pt;
+
+	for(pt = dbname; *pt; pt++)
+	    h = (h ^ (unsigned char) *pt) * 1099511628211ULL;
+	h = (h ^ (uint64_t) sb.st_size) * 1099511628211ULL;
+	h = (h ^ (uint64_t) sb.st_mtime) * 1099511628211ULL;
+	engine->dbstamp ^= h;
+    }
+
 #ifdef HAVE_YARA
     if(options & CL_DB_YARA_ONLY) {
         if(cli_strbcasestr(dbname, ".yar") || cli_strbcasestr(dbname, ".yara"))
@@ -4924,10 +4939,14 @@ int cl_engine_free(struct cl_engine *engine)
 		if(!root->ac_only)
 		    cli_bm_free(root);
 		cli_ac_free(root);
+		if(root->roi)
+		    mpool_free(root->mempool, root->roi);
 		if(root->ac_lsigtable) {
 		    for(j = 0; j < root->ac_lsigs; j++) {
-			if (root->ac_lsigtable[j]->type == CLI_LSIG_NORMAL)
+			if (root->ac_lsigtable[j]->type == CLI_LSIG_NORMAL) {
 			    mpool_free(engine->mempool, root->ac_lsigtable[j]->u.logic);
+			    mpool_free(engine->mempool, root->ac_lsigtable[j]->prog);
+			}
 			FREE_TDB(root->ac_lsigtable[j]->tdb);
 			mpool_free(engine->mempool, root->ac_lsigtable[j]);
 		    }
@@ -5049,8 +5068,10 @@ int cl_engine_free(struct cl_engine *engine)
 	cli_ac_free(root);
 	if(root->ac_lsigtable) {
 	    for(i = 0; i < root->ac_lsigs; i++) {
-		if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL)
+		if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
 		    mpool_free(engine->mempool, root->ac_lsigtable[i]->u.logic);
+		    mpool_free(engine->mempool, root->ac_lsigtable[i]->prog);
+		}
 		FREE_TDB(root->ac_lsigtable[i]->tdb);
 		mpool_free(engine->mempool, root->ac_lsigtable[i]);
 	    }
@@ -5106,6 +5127,10 @@ int cl_engine_compile(struct cl_engine *engine)
 	if((root = engine->root[i])) {
 	    if((ret = cli_ac_buildtrie(root)))
 		return ret;
+	    if((ret = cli_bm_build(root)))
+		return ret;
+	    if((ret = cli_roi_build(root)))
+		return ret;
 #if HAVE_PCRE
             if((ret = cli_pcre_build(root, engine->pcre_match_limit, engine->pcre_recmatch_limit, engine->dconf)))
                 return ret;
@@ -5143,8 +5168,10 @@ int cl_engine_compile(struct cl_engine *engine)
 	cli_ac_free(root);
 	if(root->ac_lsigtable) {
 	    for(i = 0; i < root->ac_lsigs; i++) {
-		if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL)
+		if (root->ac_lsigtable[i]->type == CLI_LSIG_NORMAL) {
 		    mpool_free(engine->mempool, root->ac_lsigtable[i]->u.logic);
+		    mpool_free(engine->mempool, root->ac_lsigtable[i]->prog);
+		}
 		FREE_TDB(root->ac_lsigtable[i]->tdb);
 		mpool_free(engine->mempool, root->ac_lsigtable[i]);
 	    }
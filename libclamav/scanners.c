@@ -43,6 +43,9 @@
 #ifdef HAVE_SYS_TIMES_H
 #include <sys/times.h>
 #endif
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
 
 #define DCONF_ARCH  ctx->dconf->archive
 #define DCONF_DOC   ctx->dconf->doc
@@ -109,6 +112,8 @@
 #include "tiff.h"
 #include "hwp.h"
 #include "msdoc.h"
+#include "arena.h"
+#include "trace.h"
 
 #ifdef HAVE_BZLIB_H
 #include <bzlib.h>
@@ -786,6 +791,11 @@ static int cli_scanxz(cli_ctx *ctx)
             ret = CL_EFORMAT;
             goto xz_exit;
 	}
+	/* a chunk may not fill the output buffer, don't wait for the flush */
+	if (cli_checkdeadline(ctx) != CL_SUCCESS) {
+	    ret = CL_ETIMEOUT;
+	    goto xz_exit;
+	}
         //cli_dbgmsg("cli_scanxz: xz decompressed %li of %li available bytes\n",
         //           avail - strm.avail_in, avail);
         
@@ -946,10 +956,10 @@ static int vba_scandata(const unsigned char *data, unsigned int len, cli_ctx *ct
 	int ret;
 	unsigned int viruses_found = 0;
 
-    if((ret = cli_ac_initdata(&tmdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN)))
+    if((ret = cli_ac_initdata_arena(&tmdata, troot->ac_partsigs, troot->ac_lsigs, troot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena)))
 	return ret;
 
-    if((ret = cli_ac_initdata(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
+    if((ret = cli_ac_initdata_arena(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena))) {
 	cli_ac_freedata(&tmdata);
 	return ret;
     }
@@ -1363,12 +1373,12 @@ static int cli_scanscript(cli_ctx *ctx)
 	ret = CL_CLEAN;
 
 
-	if ((ret = cli_ac_initdata(&tmdata, troot?troot->ac_partsigs:0, troot?troot->ac_lsigs:0, troot?troot->ac_reloff_num:0, CLI_DEFAULT_AC_TRACKLEN))) {
+	if ((ret = cli_ac_initdata_arena(&tmdata, troot?troot->ac_partsigs:0, troot?troot->ac_lsigs:0, troot?troot->ac_reloff_num:0, CLI_DEFAULT_AC_TRACKLEN, ctx->arena))) {
 		free(tmpname);
 		return ret;
 	}
 
-	if ((ret = cli_ac_initdata(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN))) {
+	if ((ret = cli_ac_initdata_arena(&gmdata, groot->ac_partsigs, groot->ac_lsigs, groot->ac_reloff_num, CLI_DEFAULT_AC_TRACKLEN, ctx->arena))) {
 		cli_ac_freedata(&tmdata);
 		free(tmpname);
 		return ret;
@@ -1601,29 +1611,10 @@ static int cli_scanole2(cli_ctx *ctx)
 
 static int cli_scantar(cli_ctx *ctx, unsigned int posix)
 {
-	char *dir;
-	int ret = CL_CLEAN;
-
-
     cli_dbgmsg("in cli_scantar()\n");
 
-    /* generate temporary directory */
-    if(!(dir = cli_gentemp(ctx->engine->tmpdir)))
-	return CL_EMEM;
-
-    if(mkdir(dir, 0700)) {
-	cli_errmsg("Tar: Can't create temporary directory %s\n", dir);
-	free(dir);
-	return CL_ETMPDIR;
-    }
-
-    ret = cli_untar(dir, posix, ctx);
-
-    if(!ctx->engine->keeptmp)
-	cli_rmdirs(dir);
-
-    free(dir);
-    return ret;
+    /* the members are scanned in place, nothing to extract */
+    return cli_untar(posix, ctx);
 }
 
 static int cli_scanmschm(cli_ctx *ctx)
@@ -2261,6 +2252,7 @@ static int cli_scanraw(cli_ctx *ctx, cli_file_t type, uint8_t typercg, cli_file_
 
     if(ret >= CL_TYPENO) {
 	perf_nested_start(ctx, PERFT_RAWTYPENO, PERFT_SCAN);
+	cli_trace_phase(ctx, CLI_TRACE_RAW);
 	ctx->recursion++;
         lastrar = 0xdeadbeef;
         fpt = ftoffset;
@@ -2500,6 +2492,7 @@ static int cli_scanraw(cli_ctx *ctx, cli_file_t type, uint8_t typercg, cli_file_
 		break;
 	}
 	perf_nested_stop(ctx, PERFT_RAWTYPENO, PERFT_SCAN);
+	cli_trace_phase(ctx, CLI_TRACE_NONE);
 	ctx->recursion--;
 	ret = nret;
     }
@@ -2550,6 +2543,13 @@ static int magic_scandesc_cleanup(cli_ctx *ctx, cli_file_t type, unsigned char *
 
     UNUSEDPARAM(type);
 
+    /* a partial scan is neither clean nor cacheable */
+    if (ctx->timed_out) {
+        cache_clean = 0;
+        if (retcode == CL_CLEAN)
+            retcode = CL_ETIMEOUT;
+    }
+
     if (retcode == CL_CLEAN && (ctx->found_possibly_unwanted || ctx->num_viruses != 0))
         cb_retcode = CL_VIRUS;
     else
@@ -2629,7 +2629,7 @@ static int dispatch_prescan(clcb_pre_scan cb, cli_ctx *ctx, const char *filetype
     return res;
 }
 
-static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
+static int magic_scandesc_object(cli_ctx *ctx, cli_file_t type)
 {
 	int ret = CL_CLEAN;
 	cli_file_t dettype = 0;
@@ -2663,7 +2663,9 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	early_ret_from_magicscan(CL_CLEAN);
     }
 
-    if(cli_updatelimits(ctx, (*ctx->fmap)->len)!=CL_CLEAN) {
+    if((res = cli_updatelimits(ctx, (*ctx->fmap)->len))!=CL_CLEAN) {
+	if(res == CL_ETIMEOUT)
+	    early_ret_from_magicscan(CL_ETIMEOUT);
 	emax_reached(ctx);
         early_ret_from_magicscan(CL_CLEAN);
     }
@@ -2682,6 +2684,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	early_ret_from_magicscan(CL_EREAD);
     }
     filetype = cli_ftname(type);
+    cli_trace_type(ctx, type);
 
 #if HAVE_JSON
     if (ctx->options & CL_SCAN_FILE_PROPERTIES) {
@@ -2853,6 +2856,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 
     ctx->recursion++;
     perf_nested_start(ctx, PERFT_CONTAINER, PERFT_SCAN);
+    cli_trace_phase(ctx, CLI_TRACE_CONTAINER);
     ctx->container_size = (*ctx->fmap)->len;
     switch(type) {
 	case CL_TYPE_IGNORED:
@@ -3186,6 +3190,7 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	    break;
     }
     perf_nested_stop(ctx, PERFT_CONTAINER, PERFT_SCAN);
+    cli_trace_phase(ctx, CLI_TRACE_NONE);
     ctx->recursion--;
     ctx->container_type = current_container_type;
     ctx->container_size = current_container_size;
@@ -3206,6 +3211,12 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	}
     }
 
+    if(cli_checktimelimit(ctx) != CL_SUCCESS) {
+	cli_bitset_free(ctx->hook_lsig_matches);
+	ctx->hook_lsig_matches = old_hook_lsig_matches;
+	return magic_scandesc_cleanup(ctx, type, hash, hashed_size, cache_clean, CL_ETIMEOUT, parent_property);
+    }
+
     /* CL_TYPE_HTML: raw HTML files are not scanned, unless safety measure activated via DCONF */
     if(type != CL_TYPE_IGNORED && (type != CL_TYPE_HTML || !(SCAN_HTML) || !(DCONF_DOC & DOC_CONF_HTML_SKIPRAW)) && !ctx->engine->sdb) {
 	res = cli_scanraw(ctx, type, typercg, &dettype, (ctx->engine->engine_options & ENGINE_OPTIONS_DISABLE_CACHE) ? NULL : hash);
@@ -3262,11 +3273,13 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	case CL_TYPE_TEXT_UTF16LE:
 	case CL_TYPE_TEXT_UTF8:
 	    perf_nested_start(ctx, PERFT_SCRIPT, PERFT_SCAN);
+	    cli_trace_phase(ctx, CLI_TRACE_SCRIPT);
 	    if((DCONF_DOC & DOC_CONF_SCRIPT) && dettype != CL_TYPE_HTML && ret != CL_VIRUS)
 	        ret = cli_scanscript(ctx);
 	    if(SCAN_MAIL && (DCONF_MAIL & MAIL_CONF_MBOX) && ret != CL_VIRUS && (ctx->container_type == CL_TYPE_MAIL || dettype == CL_TYPE_MAIL)) {
 		ret = cli_fmap_scandesc(ctx, CL_TYPE_MAIL, 0, NULL, AC_SCAN_VIR, NULL, NULL);
 	    }
+	    cli_trace_phase(ctx, CLI_TRACE_NONE);
 	    perf_nested_stop(ctx, PERFT_SCRIPT, PERFT_SCAN);
 	    break;
 	/* Due to performance reasons all executables were first scanned
@@ -3274,11 +3287,13 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
 	 */
 	case CL_TYPE_MSEXE:
 	    perf_nested_start(ctx, PERFT_PE, PERFT_SCAN);
+	    cli_trace_phase(ctx, CLI_TRACE_PE);
 	    if(SCAN_PE && ctx->dconf->pe) {
 		unsigned int corrupted_input = ctx->corrupted_input;
 		ret = cli_scanpe(ctx);
 		ctx->corrupted_input = corrupted_input;
 	    }
+	    cli_trace_phase(ctx, CLI_TRACE_NONE);
 	    perf_nested_stop(ctx, PERFT_PE, PERFT_SCAN);
 	    break;
 	case CL_TYPE_BINARY_DATA:
@@ -3319,6 +3334,20 @@ static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
     }
 }
 
+static int magic_scandesc(cli_ctx *ctx, cli_file_t type)
+{
+    struct cli_trace_node *node;
+    int ret;
+
+    if (!ctx->trace)
+	return magic_scandesc_object(ctx, type);
+
+    node = cli_trace_enter(ctx);
+    ret = magic_scandesc_object(ctx, type);
+    cli_trace_leave(ctx, node);
+    return ret;
+}
+
 static int cli_base_scandesc(int desc, cli_ctx *ctx, cli_file_t type)
 {
     STATBUF sb;
@@ -3332,6 +3361,9 @@ static int cli_base_scandesc(int desc, cli_ctx *ctx, cli_file_t type)
 	cli_errmsg("magic_scandesc: Can't fstat descriptor %d\n", desc);
 	early_ret_from_magicscan(CL_ESTAT);
     }
+    /* anything below the top level was written out by an unpacker */
+    if(ctx->recursion > 0)
+	cli_trace_tempfile(ctx, sb.st_size);
     if(sb.st_size <= 5) {
 	cli_dbgmsg("Small data (%u bytes)\n", (unsigned int) sb.st_size);
 	early_ret_from_magicscan(CL_CLEAN);
@@ -3345,6 +3377,12 @@ static int cli_base_scandesc(int desc, cli_ctx *ctx, cli_file_t type)
 	perf_stop(ctx, PERFT_MAP);
 	early_ret_from_magicscan(CL_EMEM);
     }
+    (*ctx->fmap)->readahead = ctx->engine->readahead;
+    if (ctx->top_md5 && !ctx->recursion) {
+        memcpy((*ctx->fmap)->maphash, ctx->top_md5, 16);
+        (*ctx->fmap)->have_maphash = 1;
+        ctx->top_md5 = NULL;
+    }
     perf_stop(ctx, PERFT_MAP);
 
     ret = magic_scandesc(ctx, type);
@@ -3516,58 +3554,173 @@ int cli_mem_scandesc(const void *buffer, size_t length, cli_ctx *ctx)
     return ret;
 }
 
-static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+/*
+ * When a scan is over its fmap stack, lsig hook bitset and arena go to a
+ * per-thread cache instead of back to the heap, and the next scan on the
+ * same thread takes them over after a reset. The arena keeps its first
+ * chunk across cli_arena_reset(), so a typical small scan allocates none
+ * of these. Nothing in the cache depends on the engine except the depth
+ * of the fmap stack, which is grown on reuse when it is too shallow.
+ */
+struct scan_ctx_cache {
+    fmap_t **fmap;
+    unsigned int fmap_depth;
+    bitset_t *hook_lsig_matches;
+    struct cli_arena *arena;
+};
+
+static void scan_ctx_cache_free(void *arg)
 {
-    cli_ctx ctx;
-    int rc;
-    STATBUF sb;
+    struct scan_ctx_cache *cache = (struct scan_ctx_cache *)arg;
 
-    /* We have a limit of around 2.17GB (INT_MAX - 2). Enforce it here. */
-    if (map != NULL) {
-        if ((size_t)(map->real_len) > (size_t)(INT_MAX - 2))
-            return CL_CLEAN;
-    } else {
-        if (FSTAT(desc, &sb))
-            return CL_ESTAT;
+    if (!cache)
+        return;
 
-        if ((size_t)(sb.st_size) > (size_t)(INT_MAX - 2))
-            return CL_CLEAN;
+    free(cache->fmap);
+    cli_bitset_free(cache->hook_lsig_matches);
+    cli_arena_destroy(cache->arena);
+    free(cache);
+}
+
+#ifdef CL_THREAD_SAFE
+static pthread_key_t scan_ctx_key;
+static pthread_once_t scan_ctx_once = PTHREAD_ONCE_INIT;
+static int scan_ctx_key_ok = 0;
+
+static void scan_ctx_key_init(void)
+{
+    if (!pthread_key_create(&scan_ctx_key, scan_ctx_cache_free))
+        scan_ctx_key_ok = 1;
+}
+
+static struct scan_ctx_cache *scan_ctx_cache_get(int create)
+{
+    struct scan_ctx_cache *cache;
+
+    pthread_once(&scan_ctx_once, scan_ctx_key_init);
+    if (!scan_ctx_key_ok)
+        return NULL;
+
+    cache = (struct scan_ctx_cache *)pthread_getspecific(scan_ctx_key);
+    if (!cache && create) {
+        cache = (struct scan_ctx_cache *)calloc(1, sizeof(*cache));
+        if (cache && pthread_setspecific(scan_ctx_key, cache)) {
+            free(cache);
+            cache = NULL;
+        }
     }
 
-    memset(&ctx, '\0', sizeof(cli_ctx));
-    ctx.engine = engine;
-    ctx.virname = virname;
-    ctx.scanned = scanned;
-    ctx.options = scanoptions;
-    ctx.found_possibly_unwanted = 0;
-    ctx.container_type = CL_TYPE_ANY;
-    ctx.container_size = 0;
-    ctx.dconf = (struct cli_dconf *) engine->dconf;
-    ctx.cb_ctx = context;
-    ctx.fmap = cli_calloc(sizeof(fmap_t *), ctx.engine->maxreclevel + 2);
-    if(!ctx.fmap)
+    return cache;
+}
+#else
+static struct scan_ctx_cache *scan_ctx_global = NULL;
+
+static struct scan_ctx_cache *scan_ctx_cache_get(int create)
+{
+    if (!scan_ctx_global && create)
+        scan_ctx_global = (struct scan_ctx_cache *)calloc(1, sizeof(*scan_ctx_global));
+
+    return scan_ctx_global;
+}
+#endif
+
+static void scan_teardown(cli_ctx *ctx)
+{
+    struct scan_ctx_cache *cache = scan_ctx_cache_get(1);
+
+    perf_done(ctx);
+    /* a scan started from a callback of another one finds the cache full */
+    if (cache && !cache->arena) {
+        cli_arena_reset(ctx->arena);
+        cache->fmap = ctx->fmap;
+        cache->fmap_depth = ctx->engine->maxreclevel + 2;
+        cache->hook_lsig_matches = ctx->hook_lsig_matches;
+        cache->arena = ctx->arena;
+        return;
+    }
+    cli_bitset_free(ctx->hook_lsig_matches);
+    cli_arena_destroy(ctx->arena);
+    free(ctx->fmap);
+}
+
+/* allocations that outlive a single object, see cl_scanmaps_batch() */
+static int scan_setup(cli_ctx *ctx, const struct cl_engine *engine, unsigned int scanoptions)
+{
+    struct scan_ctx_cache *cache = scan_ctx_cache_get(0);
+
+    memset(ctx, '\0', sizeof(cli_ctx));
+    ctx->engine = engine;
+    ctx->options = scanoptions;
+    ctx->dconf = (struct cli_dconf *) engine->dconf;
+
+    if (cache && cache->arena) {
+        /* MaxRecursion went up since, only the fmap stack has to grow */
+        if (cache->fmap_depth < engine->maxreclevel + 2) {
+            fmap_t **fmap = cli_realloc(cache->fmap, sizeof(fmap_t *) * (engine->maxreclevel + 2));
+
+            if (!fmap)
+                return CL_EMEM;
+            cache->fmap = fmap;
+            cache->fmap_depth = engine->maxreclevel + 2;
+        }
+        ctx->fmap = cache->fmap;
+        ctx->hook_lsig_matches = cache->hook_lsig_matches;
+        ctx->arena = cache->arena;
+        memset(cache, 0, sizeof(*cache));
+
+        memset(ctx->fmap, 0, sizeof(fmap_t *) * (engine->maxreclevel + 2));
+        if (ctx->hook_lsig_matches->bitset)
+            memset(ctx->hook_lsig_matches->bitset, 0, ctx->hook_lsig_matches->length);
+        perf_init(ctx);
+        return CL_SUCCESS;
+    }
+
+    ctx->fmap = cli_calloc(sizeof(fmap_t *), ctx->engine->maxreclevel + 2);
+    if(!ctx->fmap)
 	return CL_EMEM;
-    if (!(ctx.hook_lsig_matches = cli_bitset_init())) {
-	free(ctx.fmap);
+    if (!(ctx->hook_lsig_matches = cli_bitset_init())) {
+	free(ctx->fmap);
 	return CL_EMEM;
     }
-    perf_init(&ctx);
-
-    if (ctx.options & CL_SCAN_FILE_PROPERTIES && ctx.engine->time_limit != 0) {
-        if (gettimeofday(&ctx.time_limit, NULL) == 0) {
-            uint32_t secs = ctx.engine->time_limit / 1000;
-            uint32_t usecs = (ctx.engine->time_limit % 1000) * 1000;
-            ctx.time_limit.tv_sec += secs;
-            ctx.time_limit.tv_usec += usecs;
-            if (ctx.time_limit.tv_usec >= 1000000) {
-                ctx.time_limit.tv_usec -= 1000000;
-                ctx.time_limit.tv_sec++;
-            }
-        } else {
-            char buf[64];
-            cli_dbgmsg("scan_common; gettimeofday error: %s\n", cli_strerror(errno, buf, 64));
-        }
+    if (!(ctx->arena = cli_arena_create())) {
+	cli_bitset_free(ctx->hook_lsig_matches);
+	free(ctx->fmap);
+	return CL_EMEM;
     }
+    perf_init(ctx);
+    return CL_SUCCESS;
+}
+
+/* per object state, everything else is left alone */
+static int scan_object(cli_ctx *ctx, int desc, cl_fmap_t *map, off_t size, unsigned int scanoptions, unsigned int timeout)
+{
+    int rc;
+
+    ctx->num_viruses = 0;
+    ctx->scansize = 0;
+    ctx->scannedfiles = 0;
+    ctx->recursion = 0;
+    ctx->found_possibly_unwanted = 0;
+    ctx->corrupted_input = 0;
+    ctx->img_validate = 0;
+    ctx->options = scanoptions;
+    ctx->container_type = CL_TYPE_ANY;
+    ctx->container_size = 0;
+#if HAVE_JSON
+    ctx->properties = NULL;
+    ctx->wrkproperty = NULL;
+#endif
+    ctx->deadline = 0;
+    ctx->deadline_ticks = 0;
+    ctx->timed_out = 0;
+
+    if ((ctx->options & CL_SCAN_TRACE) && cli_trace_init(ctx) != CL_SUCCESS)
+	return CL_EMEM;
+
+    if (ctx->engine->time_limit && (!timeout || ctx->engine->time_limit < timeout))
+        timeout = ctx->engine->time_limit;
+    if (timeout)
+        ctx->deadline = cli_monotonic_usecs() + (uint64_t)timeout * 1000;
 
 #ifdef HAVE__INTERNAL__SHA_COLLECT
     if(scanoptions & CL_SCAN_INTERNAL_COLLECT_SHA) {
@@ -3577,36 +3730,36 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
 
 	snprintf(link, sizeof(link), "/proc/self/fd/%u", desc);
 	link[sizeof(link)-1]='\0';
-	if((linksz=readlink(link, ctx.entry_filename, sizeof(ctx.entry_filename)-1))==-1) {
+	if((linksz=readlink(link, ctx->entry_filename, sizeof(ctx->entry_filename)-1))==-1) {
 	    cli_errmsg("failed to resolve filename for descriptor %d (%s)\n", desc, link);
-	    strcpy(ctx.entry_filename, "NO_IDEA");
+	    strcpy(ctx->entry_filename, "NO_IDEA");
 	} else
-	    ctx.entry_filename[linksz]='\0';
+	    ctx->entry_filename[linksz]='\0';
     } while(0);
 #endif
 
-    cli_logg_setup(&ctx);
-    rc = map ? cli_map_scandesc(map, 0, map->len, &ctx, CL_TYPE_ANY) : cli_magic_scandesc(desc, &ctx);
+    cli_logg_setup(ctx);
+    rc = map ? cli_map_scandesc(map, 0, map->len, ctx, CL_TYPE_ANY) : cli_magic_scandesc(desc, ctx);
 
 #if HAVE_JSON
-    if (ctx.options & CL_SCAN_FILE_PROPERTIES && ctx.properties!=NULL) {
+    if (ctx->options & CL_SCAN_FILE_PROPERTIES && ctx->properties!=NULL) {
         json_object *jobj;
         const char *jstring;
 
         /* set value of unique root object tag */
-        if (json_object_object_get_ex(ctx.properties, "FileType", &jobj)) {
+        if (json_object_object_get_ex(ctx->properties, "FileType", &jobj)) {
             enum json_type type;
             const char *jstr;
 
             type = json_object_get_type(jobj);
             if (type == json_type_string) {
                 jstr = json_object_get_string(jobj);
-                cli_jsonstr(ctx.properties, "RootFileType", jstr);
+                cli_jsonstr(ctx->properties, "RootFileType", jstr);
             }
         }
 
         /* serialize json properties to string */
-        jstring = json_object_to_json_string(ctx.properties);
+        jstring = json_object_to_json_string(ctx->properties);
         if (NULL == jstring) {
             cli_errmsg("scan_common: no memory for json serialization.\n");
             rc = CL_EMEM;
@@ -3626,17 +3779,17 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
                     fmap_t *pc_map = map;
 
                     if (!pc_map) {
-                        perf_start(&ctx, PERFT_MAP);
-                        if(!(pc_map = fmap(desc, 0, sb.st_size))) {
-                            perf_stop(&ctx, PERFT_MAP);
+                        perf_start(ctx, PERFT_MAP);
+                        if(!(pc_map = fmap(desc, 0, size))) {
+                            perf_stop(ctx, PERFT_MAP);
                             rc = CL_EMEM;
                         }
-                        perf_stop(&ctx, PERFT_MAP);
+                        perf_stop(ctx, PERFT_MAP);
                     }
 
                     if (pc_map) {
-                        cli_bytecode_context_setctx(bc_ctx, &ctx);
-                        rc = cli_bytecode_runhook(&ctx, ctx.engine, bc_ctx, BC_PRECLASS, pc_map);
+                        cli_bytecode_context_setctx(bc_ctx, ctx);
+                        rc = cli_bytecode_runhook(ctx, ctx->engine, bc_ctx, BC_PRECLASS, pc_map);
                         cli_bytecode_context_destroy(bc_ctx);
 
                         if (!map)
@@ -3645,25 +3798,25 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
                 }
 
                 /* backwards compatibility: scan the json string unless a virus was detected */
-                if (rc != CL_VIRUS && ctx.engine->root[13]->ac_lsigs) {
+                if (rc != CL_VIRUS && ctx->engine->root[13]->ac_lsigs) {
                     cli_dbgmsg("scan_common: running deprecated preclass bytecodes for target type 13\n");
-                    ctx.options &= ~CL_SCAN_FILE_PROPERTIES;
-                    rc = cli_mem_scandesc(jstring, strlen(jstring), &ctx);
+                    ctx->options &= ~CL_SCAN_FILE_PROPERTIES;
+                    rc = cli_mem_scandesc(jstring, strlen(jstring), ctx);
                 }
             }
 
             /* Invoke file props callback */
-            if (ctx.engine->cb_file_props != NULL) {
-                ret = ctx.engine->cb_file_props(jstring, rc, ctx.cb_ctx);
+            if (ctx->engine->cb_file_props != NULL) {
+                ret = ctx->engine->cb_file_props(jstring, rc, ctx->cb_ctx);
                 if (ret != CL_SUCCESS)
                     rc = ret;
             }
 
             /* keeptmp file processing for file properties json string */
-            if (ctx.engine->keeptmp) {
+            if (ctx->engine->keeptmp) {
                 int fd = -1;
                 char * tmpname = NULL;
-                if ((ret = cli_gentempfd(ctx.engine->tmpdir, &tmpname, &fd)) != CL_SUCCESS) {
+                if ((ret = cli_gentempfd(ctx->engine->tmpdir, &tmpname, &fd)) != CL_SUCCESS) {
                     cli_dbgmsg("scan_common: Can't create json properties file, ret = %i.\n", ret);
                 } else {
                     if (cli_writen(fd, jstring, strlen(jstring)) < 0)
@@ -3677,10 +3830,10 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
                     free(tmpname);
             }
         }
-        json_object_put(ctx.properties); /* frees all json memory */
+        json_object_put(ctx->properties); /* frees all json memory */
 #if 0
         // test code  - to be deleted
-        if (cli_checktimelimit(&ctx) != CL_SUCCESS) {
+        if (cli_checktimelimit(ctx) != CL_SUCCESS) {
             cli_errmsg("scan_common: timeout!\n");
             rc = CL_ETIMEOUT;
         }
@@ -3688,26 +3841,110 @@ static int scan_common(int desc, cl_fmap_t *map, const char **virname, unsigned
     }
 #endif
 
-    cli_bitset_free(ctx.hook_lsig_matches);
-    free(ctx.fmap);
+    cli_trace_done(ctx);
+    /* whatever was found before the deadline is still reported */
+    if (rc == CL_ETIMEOUT && (ctx->num_viruses != 0 || ctx->found_possibly_unwanted))
+        rc = CL_CLEAN;
     if (rc == CL_CLEAN) {
-        if ((ctx.num_viruses != 0 && ctx.options & CL_SCAN_ALLMATCHES) ||
-            ctx.found_possibly_unwanted)
+        if ((ctx->num_viruses != 0 && ctx->options & CL_SCAN_ALLMATCHES) ||
+            ctx->found_possibly_unwanted)
                 rc = CL_VIRUS;
     }
     cli_logg_unsetup();
-    perf_done(&ctx);
+    return rc;
+}
+
+static int scan_common(int desc, cl_fmap_t *map, const unsigned char *md5, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context)
+{
+    cli_ctx ctx;
+    int rc;
+    STATBUF sb;
+
+    /* We have a limit of around 2.17GB (INT_MAX - 2). Enforce it here. */
+    if (map != NULL) {
+        if ((size_t)(map->real_len) > (size_t)(INT_MAX - 2))
+            return CL_CLEAN;
+        map->readahead = engine->readahead;
+    } else {
+        if (FSTAT(desc, &sb))
+            return CL_ESTAT;
+
+        if ((size_t)(sb.st_size) > (size_t)(INT_MAX - 2))
+            return CL_CLEAN;
+    }
+
+    if ((rc = scan_setup(&ctx, engine, scanoptions)) != CL_SUCCESS)
+        return rc;
+    ctx.virname = virname;
+    ctx.scanned = scanned;
+    ctx.cb_ctx = context;
+    ctx.top_md5 = md5;
+
+    rc = scan_object(&ctx, desc, map, map ? 0 : sb.st_size, scanoptions, timeout);
+    scan_teardown(&ctx);
     return rc;
 }
 
 int cl_scandesc_callback(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
 {
-    return scan_common(desc, NULL, virname, scanned, engine, scanoptions, context);
+    return scan_common(desc, NULL, NULL, virname, scanned, engine, scanoptions, 0, context);
+}
+
+int cl_scandesc_timeout(int desc, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context)
+{
+    return scan_common(desc, NULL, NULL, virname, scanned, engine, scanoptions, timeout, context);
+}
+
+int cl_scandesc_md5(int desc, const unsigned char *md5, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context)
+{
+    return scan_common(desc, NULL, md5, virname, scanned, engine, scanoptions, timeout, context);
 }
 
 int cl_scanmap_callback(cl_fmap_t *map, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
 {
-    return scan_common(-1, map, virname, scanned, engine, scanoptions, context);
+    return scan_common(-1, map, NULL, virname, scanned, engine, scanoptions, 0, context);
+}
+
+int cl_scanmaps_batch(cl_fmap_t **maps, unsigned int count, int *results, const char **virnames, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void **contexts)
+{
+    cli_ctx ctx;
+    unsigned int i;
+    int rc;
+
+    if (!maps || !results || !engine)
+        return CL_ENULLARG;
+
+    if ((rc = scan_setup(&ctx, engine, scanoptions)) != CL_SUCCESS)
+        return rc;
+    ctx.scanned = scanned;
+
+    for (i = 0; i < count; i++) {
+        cl_fmap_t *map = maps[i];
+
+        if (virnames)
+            virnames[i] = NULL;
+        if (!map) {
+            results[i] = CL_ENULLARG;
+            continue;
+        }
+        if ((size_t)(map->real_len) > (size_t)(INT_MAX - 2)) {
+            results[i] = CL_CLEAN;
+            continue;
+        }
+        map->readahead = engine->readahead;
+
+        ctx.virname = virnames ? &virnames[i] : NULL;
+        ctx.cb_ctx = contexts ? contexts[i] : NULL;
+        results[i] = scan_object(&ctx, -1, map, 0, scanoptions, 0);
+
+        /* hand the match data of this map back for the next one */
+        cli_arena_reset(ctx.arena);
+        if (ctx.hook_lsig_matches->bitset)
+            memset(ctx.hook_lsig_matches->bitset, 0, ctx.hook_lsig_matches->length);
+    }
+
+    scan_teardown(&ctx);
+    return CL_SUCCESS;
 }
 
 int cli_found_possibly_unwanted(cli_ctx* ctx)
@@ -3752,6 +3989,11 @@ int cl_scanfile(const char *filename, const char **virname, unsigned long int *s
 }
 
 int cl_scanfile_callback(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, void *context)
+{
+    return cl_scanfile_timeout(filename, virname, scanned, engine, scanoptions, 0, context);
+}
+
+int cl_scanfile_timeout(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, unsigned int scanoptions, unsigned int timeout, void *context)
 {
 	int fd, ret;
 	const char *fname = cli_to_utf8_maybe_alloc(filename);
@@ -3765,7 +4007,7 @@ int cl_scanfile_callback(const char *filename, const char **virname, unsigned lo
     if(fname != filename)
 	free((void*)fname);
 
-    ret = cl_scandesc_callback(fd, virname, scanned, engine, scanoptions, context);
+    ret = cl_scandesc_timeout(fd, virname, scanned, engine, scanoptions, timeout, context);
     close(fd);
 
     return ret;
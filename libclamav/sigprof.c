@@ -0,0 +1,477 @@
+/*
+ *  Per-signature runtime profiling
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#ifdef CL_THREAD_SAFE
+#include <pthread.h>
+#endif
+
+#include "clamav.h"
+#include "others.h"
+#include "sigprof.h"
+
+#define SIGPROF_INITIAL_SIZE 256
+
+static const char *sigprof_kind_names[CLI_SIGPROF_KINDS] = {
+    "ac", "pcre", "lsig", "bytecode"
+};
+
+struct sigprof_entry {
+    const char *key;    /* virname pointer as seen by the matcher; NULL if free */
+    char *name;         /* private copy, the engine may be freed before a report */
+    uint32_t kind;
+    uint64_t calls;
+    uint64_t matches;
+    uint64_t usecs;
+};
+
+/* Only the owning thread inserts into a table; it holds the table mutex
+ * while it looks an entry up and bumps its counters, so that reports and
+ * resets see consistent values. The list of tables is guarded by
+ * sigprof_mutex, which is taken before any table mutex. */
+struct sigprof_table {
+    struct sigprof_entry *entries;
+    uint32_t size;      /* power of two */
+    uint32_t used;
+#ifdef CL_THREAD_SAFE
+    pthread_mutex_t mutex;
+#endif
+    struct sigprof_table *next;
+};
+
+struct sigprof_elem {
+    char *name;
+    uint32_t kind;
+    uint64_t calls;
+    uint64_t matches;
+    uint64_t usecs;
+};
+
+static struct sigprof_table *sigprof_tables = NULL;
+/* samples of the threads that exited, merged by name */
+static struct sigprof_elem *sigprof_retired = NULL;
+static uint32_t sigprof_nretired = 0;
+
+static int sigprof_name_comp(const void *a, const void *b);
+static uint32_t sigprof_combine(struct sigprof_elem *el, uint32_t n);
+
+#ifdef CL_THREAD_SAFE
+static pthread_mutex_t sigprof_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t sigprof_key;
+static pthread_once_t sigprof_once = PTHREAD_ONCE_INIT;
+static int sigprof_key_ok = 0;
+
+static void sigprof_table_free(struct sigprof_table *t)
+{
+    uint32_t i;
+
+    for (i = 0; i < t->size; i++)
+        free(t->entries[i].name);
+    free(t->entries);
+    pthread_mutex_destroy(&t->mutex);
+    free(t);
+}
+
+static void sigprof_release(void *arg)
+{
+    struct sigprof_table *t = (struct sigprof_table *)arg, **pt;
+    struct sigprof_elem *el;
+    uint32_t i, n;
+
+    pthread_mutex_lock(&sigprof_mutex);
+    for (pt = &sigprof_tables; *pt && *pt != t; pt = &(*pt)->next);
+    if (*pt)
+        *pt = t->next;
+    /* keep the samples for the next report, the names move over */
+    n = sigprof_nretired;
+    el = t->used ? cli_realloc(sigprof_retired, (n + t->used) * sizeof(*el)) : NULL;
+    if (el) {
+        for (i = 0; i < t->size; i++) {
+            struct sigprof_entry *e = &t->entries[i];
+
+            if (!e->key || !e->calls)
+                continue;
+            el[n].name = e->name;
+            el[n].kind = e->kind;
+            el[n].calls = e->calls;
+            el[n].matches = e->matches;
+            el[n].usecs = e->usecs;
+            e->name = NULL;
+            n++;
+        }
+        sigprof_retired = el;
+        sigprof_nretired = sigprof_combine(el, n);
+    }
+    pthread_mutex_unlock(&sigprof_mutex);
+    sigprof_table_free(t);
+}
+
+static void sigprof_key_init(void)
+{
+    if (!pthread_key_create(&sigprof_key, sigprof_release))
+        sigprof_key_ok = 1;
+}
+
+#define sigprof_lock() pthread_mutex_lock(&sigprof_mutex)
+#define sigprof_unlock() pthread_mutex_unlock(&sigprof_mutex)
+#define sigprof_table_lock(t) pthread_mutex_lock(&(t)->mutex)
+#define sigprof_table_unlock(t) pthread_mutex_unlock(&(t)->mutex)
+#else
+static struct sigprof_table *sigprof_local = NULL;
+
+#define sigprof_lock()
+#define sigprof_unlock()
+#define sigprof_table_lock(t)
+#define sigprof_table_unlock(t)
+#endif
+
+static struct sigprof_table *sigprof_table_get(void)
+{
+    struct sigprof_table *t;
+
+#ifdef CL_THREAD_SAFE
+    pthread_once(&sigprof_once, sigprof_key_init);
+    if (!sigprof_key_ok)
+        return NULL;
+    if ((t = pthread_getspecific(sigprof_key)))
+        return t;
+#else
+    if (sigprof_local)
+        return sigprof_local;
+#endif
+
+    if (!(t = cli_calloc(1, sizeof(*t))))
+        return NULL;
+    if (!(t->entries = cli_calloc(SIGPROF_INITIAL_SIZE, sizeof(struct sigprof_entry)))) {
+        free(t);
+        return NULL;
+    }
+    t->size = SIGPROF_INITIAL_SIZE;
+#ifdef CL_THREAD_SAFE
+    if (pthread_mutex_init(&t->mutex, NULL)) {
+        free(t->entries);
+        free(t);
+        return NULL;
+    }
+#endif
+    sigprof_lock();
+    t->next = sigprof_tables;
+    sigprof_tables = t;
+    sigprof_unlock();
+
+#ifdef CL_THREAD_SAFE
+    pthread_setspecific(sigprof_key, t);
+#else
+    sigprof_local = t;
+#endif
+    return t;
+}
+
+static inline uint32_t sigprof_hash(const char *key, uint32_t kind)
+{
+    uint64_t h = (uint64_t)(size_t)key * 0x9e3779b97f4a7c15ULL;
+
+    return (uint32_t)(h >> 32) ^ kind;
+}
+
+static struct sigprof_entry *sigprof_find(struct sigprof_entry *entries, uint32_t size, const char *key, uint32_t kind)
+{
+    uint32_t i = sigprof_hash(key, kind) & (size - 1);
+
+    /* the same address may be reused for another name after a reload */
+    while (entries[i].key) {
+        if (entries[i].key == key && entries[i].kind == kind && !strcmp(entries[i].name, key))
+            return &entries[i];
+        i = (i + 1) & (size - 1);
+    }
+    return &entries[i];
+}
+
+static int sigprof_grow(struct sigprof_table *t)
+{
+    struct sigprof_entry *entries, *e;
+    uint32_t i, size = t->size * 2;
+
+    entries = cli_calloc(size, sizeof(struct sigprof_entry));
+    if (!entries)
+        return CL_EMEM;
+    for (i = 0; i < t->size; i++) {
+        if (!t->entries[i].key)
+            continue;
+        e = sigprof_find(entries, size, t->entries[i].key, t->entries[i].kind);
+        *e = t->entries[i];
+    }
+    free(t->entries);
+    t->entries = entries;
+    t->size = size;
+    return CL_SUCCESS;
+}
+
+/* Must be called with the table mutex held */
+static struct sigprof_entry *sigprof_insert(struct sigprof_table *t, const char *virname, uint32_t kind)
+{
+    struct sigprof_entry *e = NULL;
+    char *name;
+
+    if (!(name = cli_strdup(virname)))
+        return NULL;
+
+    if ((t->used + 1) * 4 > t->size * 3 && sigprof_grow(t) != CL_SUCCESS) {
+        free(name);
+        return NULL;
+    }
+    e = sigprof_find(t->entries, t->size, virname, kind);
+    e->name = name;
+    e->kind = kind;
+    e->key = virname;
+    t->used++;
+    return e;
+}
+
+void cli_sigprof_stop(const struct timeval *start, const char *virname, enum cli_sigprof_kind kind, int matched)
+{
+    struct sigprof_table *t;
+    struct sigprof_entry *e;
+    struct timeval tv;
+    int64_t usecs;
+
+    if (!virname || !(t = sigprof_table_get()))
+        return;
+    gettimeofday(&tv, NULL);
+    usecs = (int64_t)(tv.tv_sec - start->tv_sec) * 1000000 + (tv.tv_usec - start->tv_usec);
+
+    sigprof_table_lock(t);
+    e = sigprof_find(t->entries, t->size, virname, kind);
+    if (e->key || (e = sigprof_insert(t, virname, kind))) {
+        e->calls++;
+        if (matched)
+            e->matches++;
+        if (usecs > 0)
+            e->usecs += usecs;
+    }
+    sigprof_table_unlock(t);
+}
+
+static int sigprof_name_comp(const void *a, const void *b)
+{
+    const struct sigprof_elem *ela = (const struct sigprof_elem *)a;
+    const struct sigprof_elem *elb = (const struct sigprof_elem *)b;
+    int ret = strcmp(ela->name, elb->name);
+
+    if (ret)
+        return ret;
+    return (int)ela->kind - (int)elb->kind;
+}
+
+static int sigprof_usecs_comp(const void *a, const void *b)
+{
+    const struct sigprof_elem *ela = (const struct sigprof_elem *)a;
+    const struct sigprof_elem *elb = (const struct sigprof_elem *)b;
+
+    if (ela->usecs != elb->usecs)
+        return ela->usecs < elb->usecs ? 1 : -1;
+    return sigprof_name_comp(a, b);
+}
+
+/* Sorts by name and merges the entries of the same signature, the names
+ * of the merged entries are freed. Returns the new count. */
+static uint32_t sigprof_combine(struct sigprof_elem *el, uint32_t n)
+{
+    uint32_t i, j;
+
+    if (n < 2)
+        return n;
+    cli_qsort(el, n, sizeof(*el), sigprof_name_comp);
+    for (i = 0, j = 1; j < n; j++) {
+        if (!sigprof_name_comp(&el[i], &el[j])) {
+            el[i].calls += el[j].calls;
+            el[i].matches += el[j].matches;
+            el[i].usecs += el[j].usecs;
+            free(el[j].name);
+        } else {
+            el[++i] = el[j];
+        }
+    }
+    return i + 1;
+}
+
+static void sigprof_elems_free(struct sigprof_elem *el, uint32_t n)
+{
+    uint32_t i;
+
+    for (i = 0; i < n; i++)
+        free(el[i].name);
+    free(el);
+}
+
+static int sigprof_elem_copy(struct sigprof_elem *el, const char *name, uint32_t kind, uint64_t calls, uint64_t matches, uint64_t usecs)
+{
+    /* the owner of the name may exit before the report is done */
+    if (!(el->name = cli_strdup(name)))
+        return CL_EMEM;
+    el->kind = kind;
+    el->calls = calls;
+    el->matches = matches;
+    el->usecs = usecs;
+    return CL_SUCCESS;
+}
+
+/* Merges the samples of all threads (and of all engines that used the same
+ * name) and returns them sorted by total time, most expensive first. */
+static int sigprof_collect(struct sigprof_elem **elems, uint32_t *nelems)
+{
+    struct sigprof_table *t;
+    struct sigprof_elem *el;
+    uint32_t i, n = 0;
+    int ret = CL_SUCCESS;
+
+    *elems = NULL;
+    *nelems = 0;
+
+    sigprof_lock();
+    for (t = sigprof_tables; t; t = t->next)
+        n += t->used;
+    n += sigprof_nretired;
+    if (!n) {
+        sigprof_unlock();
+        return CL_SUCCESS;
+    }
+    if (!(el = cli_malloc(n * sizeof(*el)))) {
+        sigprof_unlock();
+        return CL_EMEM;
+    }
+    n = 0;
+    for (i = 0; ret == CL_SUCCESS && i < sigprof_nretired; i++) {
+        const struct sigprof_elem *r = &sigprof_retired[i];
+
+        if ((ret = sigprof_elem_copy(&el[n], r->name, r->kind, r->calls, r->matches, r->usecs)) == CL_SUCCESS)
+            n++;
+    }
+    for (t = sigprof_tables; ret == CL_SUCCESS && t; t = t->next) {
+        sigprof_table_lock(t);
+        for (i = 0; ret == CL_SUCCESS && i < t->size; i++) {
+            struct sigprof_entry *e = &t->entries[i];
+
+            if (!e->key || !e->calls)
+                continue;
+            if ((ret = sigprof_elem_copy(&el[n], e->name, e->kind, e->calls, e->matches, e->usecs)) == CL_SUCCESS)
+                n++;
+        }
+        sigprof_table_unlock(t);
+    }
+    sigprof_unlock();
+
+    if (ret != CL_SUCCESS) {
+        sigprof_elems_free(el, n);
+        return ret;
+    }
+    n = sigprof_combine(el, n);
+    if (n > 1)
+        cli_qsort(el, n, sizeof(*el), sigprof_usecs_comp);
+
+    *elems = el;
+    *nelems = n;
+    return CL_SUCCESS;
+}
+
+int cl_sigprof_report(unsigned int max, clcb_sigprof callback, void *context)
+{
+    struct sigprof_elem *el;
+    uint32_t i, n, n_all;
+    int ret;
+
+    if (!callback)
+        return CL_ENULLARG;
+    if ((ret = sigprof_collect(&el, &n_all)) != CL_SUCCESS)
+        return ret;
+    n = n_all;
+    if (max && n > max)
+        n = max;
+    for (i = 0; i < n; i++) {
+        if (callback(el[i].name, sigprof_kind_names[el[i].kind], el[i].calls, el[i].matches, el[i].usecs, context))
+            break;
+    }
+    sigprof_elems_free(el, n_all);
+    return CL_SUCCESS;
+}
+
+void cl_sigprof_reset(void)
+{
+    struct sigprof_table *t;
+    uint32_t i;
+
+    /* entries stay in place, only their owners insert */
+    sigprof_lock();
+    for (t = sigprof_tables; t; t = t->next) {
+        sigprof_table_lock(t);
+        for (i = 0; i < t->size; i++) {
+            t->entries[i].calls = 0;
+            t->entries[i].matches = 0;
+            t->entries[i].usecs = 0;
+        }
+        sigprof_table_unlock(t);
+    }
+    if (sigprof_retired) {
+        sigprof_elems_free(sigprof_retired, sigprof_nretired);
+        sigprof_retired = NULL;
+        sigprof_nretired = 0;
+    }
+    sigprof_unlock();
+}
+
+void cli_sigprof_print(void)
+{
+    struct sigprof_elem *el;
+    uint32_t i, n;
+    int name_len, max_name_len = strlen("Signature");
+
+    if (sigprof_collect(&el, &n) != CL_SUCCESS) {
+        cli_errmsg("cli_sigprof_print: no memory for the report\n");
+        return;
+    }
+    if (!n) {
+        cli_warnmsg("cli_sigprof_print: statistics requested but no signature was profiled!\n");
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        name_len = strlen(el[i].name);
+        if (name_len > max_name_len)
+            max_name_len = name_len;
+    }
+
+    /* name type runs matches microsecs avg */
+    cli_infomsg (NULL, "%-*s %-8s %*s %*s %*s %*s\n", max_name_len, "Signature", "Type",
+                 10, "#runs", 8, "#matches", 12, "usecs total", 9, "usecs avg");
+    cli_infomsg (NULL, "%-*s %-8s %*s %*s %*s %*s\n", max_name_len, "=========", "====",
+                 10, "=====", 8, "========", 12, "===========", 9, "=========");
+    for (i = 0; i < n; i++) {
+        cli_infomsg (NULL, "%-*s %-8s %*llu %*llu %*llu %*.2f\n", max_name_len, el[i].name,
+                     sigprof_kind_names[el[i].kind],
+                     10, (long long unsigned)el[i].calls, 8, (long long unsigned)el[i].matches,
+                     12, (long long unsigned)el[i].usecs, 9, (double)el[i].usecs/el[i].calls);
+    }
+    sigprof_elems_free(el, n);
+}
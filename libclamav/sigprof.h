@@ -0,0 +1,55 @@
+/*
+ *  Per-signature runtime profiling
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef SIGPROF_H
+#define SIGPROF_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "cltypes.h"
+
+/*
+ * Profiling is switched on per engine with CL_ENGINE_SIGPROFILE. Samples
+ * are recorded in a table private to the scanning thread, the hot path only
+ * takes the mutex of that table, which reports and resets contend for. The
+ * samples of a thread are merged into a shared list when it exits.
+ *
+ * Times are inclusive: an lsig sample contains the bytecode it triggered.
+ */
+enum cli_sigprof_kind {
+    CLI_SIGPROF_AC = 0,     /* ac_findmatch() verification of a pattern */
+    CLI_SIGPROF_PCRE,       /* one PCRE execution */
+    CLI_SIGPROF_LSIG,       /* evaluation of a logical signature */
+    CLI_SIGPROF_BYTECODE,   /* bytecode run triggered by an lsig */
+    CLI_SIGPROF_KINDS
+};
+
+#define cli_sigprof_start(tv) gettimeofday((tv), NULL)
+
+void cli_sigprof_stop(const struct timeval *start, const char *virname, enum cli_sigprof_kind kind, int matched);
+void cli_sigprof_print(void);
+
+#endif
@@ -238,6 +238,17 @@ static int scanzws(cli_ctx *ctx, struct swf_file_hdr *hdr)
             offset += ret;
         }
         lret = cli_LzmaDecode(&lz);
+        /* a round may not produce output, so the limits below don't run */
+        if (cli_checkdeadline(ctx) != CL_SUCCESS) {
+            cli_LzmaShutdown(&lz);
+            close(fd);
+            if (cli_unlink(tmpname)) {
+                free(tmpname);
+                return CL_EUNLINK;
+            }
+            free(tmpname);
+            return CL_ETIMEOUT;
+        }
         count = FILEBUFF - lz.avail_out;
         if (count) {
             if (cli_checklimits("SWF", ctx, outsize + count, 0, 0) != CL_SUCCESS)
@@ -0,0 +1,237 @@
+/*
+ *  Per-scan trace of the recursed object tree
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "clamav.h"
+#include "others.h"
+#include "arena.h"
+#include "trace.h"
+
+/* a zip bomb must not turn the trace into one */
+#define CLI_TRACE_MAX_NODES 10000
+
+static const char *trace_phase_names[CLI_TRACE_PHASES] = {
+    "other", "raw", "container", "script", "pe"
+};
+
+struct cli_trace_node {
+    cli_file_t type;
+    enum cli_trace_phase parser;    /* phase of the parent that produced us */
+    enum cli_trace_phase phase;     /* what we are doing right now */
+    unsigned int depth;
+    unsigned int matching;          /* nesting of matcher runs on this node */
+    uint64_t size;
+    uint64_t tempbytes;
+    uint64_t usecs;                 /* inclusive of the children */
+    uint64_t match_usecs;           /* exclusive of the children */
+    uint64_t child_usecs;
+    struct timeval start;
+    struct cli_trace_node *parent, *child, *last, *next;
+};
+
+struct cli_trace {
+    struct cli_trace_node *root, *last_root, *current;
+    unsigned int nodes;
+    unsigned int skip;              /* nesting of objects past the node limit */
+    unsigned int dropped;
+};
+
+static uint64_t trace_elapsed(const struct timeval *start)
+{
+    struct timeval tv;
+    int64_t usecs;
+
+    gettimeofday(&tv, NULL);
+    usecs = (int64_t)(tv.tv_sec - start->tv_sec) * 1000000 + (tv.tv_usec - start->tv_usec);
+    return usecs > 0 ? (uint64_t)usecs : 0;
+}
+
+int cli_trace_init(cli_ctx *ctx)
+{
+    ctx->trace = cli_arena_calloc(ctx->arena, 1, sizeof(struct cli_trace));
+    if (!ctx->trace) {
+        cli_errmsg("cli_trace_init: no memory for the scan trace\n");
+        return CL_EMEM;
+    }
+    return CL_SUCCESS;
+}
+
+struct cli_trace_node *cli_trace_enter(cli_ctx *ctx)
+{
+    struct cli_trace *trace = ctx->trace;
+    struct cli_trace_node *node, *parent;
+
+    if (!trace)
+        return NULL;
+    if (trace->skip || trace->nodes >= CLI_TRACE_MAX_NODES ||
+        !(node = cli_arena_calloc(ctx->arena, 1, sizeof(*node)))) {
+        /* accounted to the parent as unpack time */
+        trace->skip++;
+        trace->dropped++;
+        return NULL;
+    }
+    trace->nodes++;
+
+    parent = trace->current;
+    node->type = CL_TYPE_ANY;
+    node->size = (*ctx->fmap)->len;
+    node->parent = parent;
+    if (parent) {
+        node->parser = parent->phase;
+        node->depth = parent->depth + 1;
+        if (parent->last)
+            parent->last->next = node;
+        else
+            parent->child = node;
+        parent->last = node;
+    } else {
+        /* e.g. the file properties json scanned after the file itself */
+        if (trace->last_root)
+            trace->last_root->next = node;
+        else
+            trace->root = node;
+        trace->last_root = node;
+    }
+    trace->current = node;
+    gettimeofday(&node->start, NULL);
+    return node;
+}
+
+void cli_trace_leave(cli_ctx *ctx, struct cli_trace_node *node)
+{
+    struct cli_trace *trace = ctx->trace;
+
+    if (!trace)
+        return;
+    if (!node) {
+        if (trace->skip)
+            trace->skip--;
+        return;
+    }
+    node->usecs = trace_elapsed(&node->start);
+    if (node->parent)
+        node->parent->child_usecs += node->usecs;
+    trace->current = node->parent;
+}
+
+void cli_trace_type(cli_ctx *ctx, cli_file_t type)
+{
+    struct cli_trace *trace = ctx->trace;
+
+    if (trace && !trace->skip && trace->current)
+        trace->current->type = type;
+}
+
+void cli_trace_phase(cli_ctx *ctx, enum cli_trace_phase phase)
+{
+    struct cli_trace *trace = ctx->trace;
+
+    if (trace && !trace->skip && trace->current)
+        trace->current->phase = phase;
+}
+
+void cli_trace_tempfile(cli_ctx *ctx, uint64_t bytes)
+{
+    struct cli_trace *trace = ctx->trace;
+
+    if (trace && !trace->skip && trace->current)
+        trace->current->tempbytes += bytes;
+}
+
+void cli_trace_match_start(cli_ctx *ctx, struct cli_trace_mark *mark)
+{
+    struct cli_trace *trace = ctx->trace;
+    struct cli_trace_node *node;
+
+    mark->outer = 0;
+    if (!trace || trace->skip || !(node = trace->current))
+        return;
+    /* the matchers can call each other, only time the outermost run */
+    if (node->matching++)
+        return;
+    mark->outer = 1;
+    mark->child_usecs = node->child_usecs;
+    gettimeofday(&mark->tv, NULL);
+}
+
+void cli_trace_match_stop(cli_ctx *ctx, const struct cli_trace_mark *mark)
+{
+    struct cli_trace *trace = ctx->trace;
+    struct cli_trace_node *node;
+    uint64_t usecs, nested;
+
+    if (!trace || trace->skip || !(node = trace->current) || !node->matching)
+        return;
+    if (--node->matching || !mark->outer)
+        return;
+    /* objects extracted by bytecode triggered from the matcher are children */
+    usecs = trace_elapsed(&mark->tv);
+    nested = node->child_usecs - mark->child_usecs;
+    if (usecs > nested)
+        node->match_usecs += usecs - nested;
+}
+
+void cli_trace_done(cli_ctx *ctx)
+{
+    struct cli_trace *trace = ctx->trace;
+    struct cli_trace_node *node;
+    uint64_t own;
+
+    if (!trace)
+        return;
+
+    node = trace->root;
+    while (node) {
+        own = node->usecs > node->child_usecs ? node->usecs - node->child_usecs : 0;
+        own = own > node->match_usecs ? own - node->match_usecs : 0;
+        if (ctx->engine->cb_trace)
+            ctx->engine->cb_trace(node->depth, cli_ftname(node->type),
+                                  node->parent ? trace_phase_names[node->parser] : "file",
+                                  node->size, node->usecs, node->match_usecs, own,
+                                  node->tempbytes, ctx->cb_ctx);
+        else
+            cli_infomsg(ctx, "trace: %*s%s size: %llu parser: %s time: %llu match: %llu unpack: %llu temp: %llu\n",
+                        node->depth * 2, "", cli_ftname(node->type), (long long unsigned)node->size,
+                        node->parent ? trace_phase_names[node->parser] : "file",
+                        (long long unsigned)node->usecs, (long long unsigned)node->match_usecs,
+                        (long long unsigned)own, (long long unsigned)node->tempbytes);
+
+        /* depth first: children, then siblings, then the siblings of an ancestor */
+        if (node->child) {
+            node = node->child;
+            continue;
+        }
+        while (node && !node->next)
+            node = node->parent;
+        if (node)
+            node = node->next;
+    }
+    if (trace->dropped)
+        cli_dbgmsg("cli_trace_done: %u objects were not traced (limit %u)\n", trace->dropped, CLI_TRACE_MAX_NODES);
+
+    /* the nodes live in the scan arena */
+    ctx->trace = NULL;
+}
@@ -0,0 +1,74 @@
+/*
+ *  Per-scan trace of the recursed object tree
+ *
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#ifndef _WIN32
+#include <sys/time.h>
+#endif
+
+#include "cltypes.h"
+#include "others.h"
+#include "filetypes.h"
+
+/*
+ * With CL_SCAN_TRACE every object that goes through magic_scandesc() gets a
+ * node in a tree allocated from the scan arena. When the scan is over the
+ * tree is handed to the engine's clcb_trace callback in depth-first order.
+ * All calls are no-ops when ctx->trace is NULL.
+ */
+
+/* what the parent object was doing when a child was handed to us */
+enum cli_trace_phase {
+    CLI_TRACE_NONE = 0,
+    CLI_TRACE_RAW,          /* embedded type recognition (SFX, mail, ...) */
+    CLI_TRACE_CONTAINER,    /* the parser for the parent type */
+    CLI_TRACE_SCRIPT,       /* script normalisation */
+    CLI_TRACE_PE,           /* PE unpackers */
+    CLI_TRACE_PHASES
+};
+
+struct cli_trace_node;
+
+/* snapshot taken when a matcher run starts, see cli_trace_match_stop() */
+struct cli_trace_mark {
+    struct timeval tv;
+    uint64_t child_usecs;
+    int outer;
+};
+
+int cli_trace_init(cli_ctx *ctx);
+void cli_trace_done(cli_ctx *ctx);
+
+struct cli_trace_node *cli_trace_enter(cli_ctx *ctx);
+void cli_trace_leave(cli_ctx *ctx, struct cli_trace_node *node);
+void cli_trace_type(cli_ctx *ctx, cli_file_t type);
+void cli_trace_phase(cli_ctx *ctx, enum cli_trace_phase phase);
+void cli_trace_tempfile(cli_ctx *ctx, uint64_t bytes);
+
+void cli_trace_match_start(cli_ctx *ctx, struct cli_trace_mark *mark);
+void cli_trace_match_stop(cli_ctx *ctx, const struct cli_trace_mark *mark);
+
+#endif
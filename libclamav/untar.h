@@ -42,6 +42,6 @@
 
 #include "others.h"
 
-int cli_untar(const char *dir, unsigned int posix, cli_ctx *ctx);
+int cli_untar(unsigned int posix, cli_ctx *ctx);
 
 #endif
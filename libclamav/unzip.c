@@ -160,6 +160,11 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 	  res = Z_STREAM_END;
 	  break;
 	}
+	if(cli_checkdeadline(ctx) != CL_SUCCESS) {
+	  ret = CL_ETIMEOUT;
+	  res = 100;
+	  break;
+	}
 	if(cli_writen(of, obuf, sizeof(obuf)-(*avail_out)) != (int)(sizeof(obuf)-(*avail_out))) {
             cli_warnmsg("cli_unzip: falied to write %lu inflated bytes\n", (unsigned long int)sizeof(obuf)-(*avail_out));
 	  ret = CL_EWRITE;
@@ -204,6 +209,11 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 	  res = BZ_STREAM_END;
 	  break;
 	}
+	if(cli_checkdeadline(ctx) != CL_SUCCESS) {
+	  ret = CL_ETIMEOUT;
+	  res = 100;
+	  break;
+	}
 	if(cli_writen(of, obuf, sizeof(obuf)-strm.avail_out) != (int)(sizeof(obuf)-strm.avail_out)) {
             cli_warnmsg("cli_unzip: falied to write %lu bunzipped bytes\n", (long unsigned int)sizeof(obuf)-strm.avail_out);
 	  ret = CL_EWRITE;
@@ -241,6 +251,11 @@ static int unz(const uint8_t *src, uint32_t csize, uint32_t usize, uint16_t meth
 	  res = 0;
 	  break;
 	}
+	if(cli_checkdeadline(ctx) != CL_SUCCESS) {
+	  ret = CL_ETIMEOUT;
+	  res = 100;
+	  break;
+	}
 	if(cli_writen(of, obuf, sizeof(obuf)-strm.avail_out) != (int)(sizeof(obuf)-strm.avail_out)) {
             cli_warnmsg("cli_unzip: falied to write %lu exploded bytes\n", (unsigned long int) sizeof(obuf)-strm.avail_out);
 	  ret = CL_EWRITE;
@@ -587,6 +602,16 @@ static unsigned int lhdr(fmap_t *map, uint32_t loff,uint32_t zsize, unsigned int
       if(LH_flags & F_ENCR) {
 	  if(fmap_need_ptr_once(map, zip, csize))
 	      *ret = zdecrypt(zip, csize, usize, lh, fu, ctx, tmpd, zcb);
+      } else if(LH_method == ALG_STORED && csize == usize && zcb == zip_scan_cb) {
+	  /* a stored member is a slice of the archive, scan it in place */
+	  uint32_t len = usize;
+
+	  if(ctx->engine->maxfilesize && len > ctx->engine->maxfilesize) {
+	      cli_dbgmsg("cli_unzip: trimming output size to maxfilesize (%lu)\n", (long unsigned int) ctx->engine->maxfilesize);
+	      len = ctx->engine->maxfilesize;
+	  }
+	  (*fu)++;
+	  *ret = cli_map_scan(map, fmap_ptr2off(map, zip), len, ctx, CL_TYPE_ANY);
       } else {
 	  if(fmap_need_ptr_once(map, zip, csize))
 	      *ret = unz(zip, csize, usize, LH_method, LH_flags, fu, ctx, tmpd, zcb);
@@ -736,6 +761,8 @@ int cli_unzip(cli_ctx *ctx) {
 	      cli_dbgmsg("cli_unzip: Files limit reached (max: %u)\n", ctx->engine->maxfiles);
 	      ret=CL_EMAXFILES;
 	  }
+	  if (ret==CL_CLEAN && cli_checktimelimit(ctx) != CL_SUCCESS)
+	      ret=CL_ETIMEOUT;
 #if HAVE_JSON
           if (cli_json_timeout_cycle_check(ctx, &toval) != CL_SUCCESS) {
               ret=CL_ETIMEOUT;
@@ -757,6 +784,8 @@ int cli_unzip(cli_ctx *ctx) {
 	cli_dbgmsg("cli_unzip: Files limit reached (max: %u)\n", ctx->engine->maxfiles);
 	ret=CL_EMAXFILES;
       }
+      if (ret==CL_CLEAN && cli_checktimelimit(ctx) != CL_SUCCESS)
+	ret=CL_ETIMEOUT;
 #if HAVE_JSON
       if (cli_json_timeout_cycle_check(ctx, &toval) != CL_SUCCESS) {
           ret=CL_ETIMEOUT;
@@ -440,6 +440,8 @@ int yr_execute_code(
 #else
         {
             rule_matches++;
+            if (!acdata->yr_matches[aclsig->id])
+                acdata->lsig_yr[acdata->lsig_nyr++] = aclsig->id;
             acdata->yr_matches[aclsig->id] = 1;
         }
 #endif
@@ -42,6 +42,8 @@ const unsigned int TOP=1 << 24, BOT=1 << 15;
 static void sub_allocator_init(sub_allocator_t *sub_alloc)
 {
 	sub_alloc->sub_allocator_size = 0;
+	sub_alloc->heap_start = NULL;
+	sub_alloc->heap_alloc_size = 0;
 }
 
 static void sub_allocator_insert_node(sub_allocator_t *sub_alloc, void *p, int indx)
@@ -92,9 +94,11 @@ static long sub_allocator_get_allocated_memory(sub_allocator_t *sub_alloc)
 
 static void sub_allocator_stop_sub_allocator(sub_allocator_t *sub_alloc)
 {
-	if (sub_alloc->sub_allocator_size) {
-		sub_alloc->sub_allocator_size = 0;
+	sub_alloc->sub_allocator_size = 0;
+	if (sub_alloc->heap_start) {
 		free(sub_alloc->heap_start);
+		sub_alloc->heap_start = NULL;
+		sub_alloc->heap_alloc_size = 0;
 	}
 }
 
@@ -106,9 +110,9 @@ static int sub_allocator_start_sub_allocator(sub_allocator_t *sub_alloc, int sa_
 	if (sub_alloc->sub_allocator_size == t) {
 		return TRUE;
 	}
-	sub_allocator_stop_sub_allocator(sub_alloc);
 	if (t>138412020) {
 		rar_dbgmsg("too much memory needed for uncompressing this file\n");
+		sub_allocator_stop_sub_allocator(sub_alloc);
 		return FALSE;
 	}
 	alloc_size = t/FIXED_UNIT_SIZE*UNIT_SIZE+UNIT_SIZE;
@@ -116,9 +120,15 @@ static int sub_allocator_start_sub_allocator(sub_allocator_t *sub_alloc, int sa_
 	/* Allow for aligned access requirements */
 	alloc_size += UNIT_SIZE;
 #endif
-	if ((sub_alloc->heap_start = (uint8_t *) malloc(alloc_size)) == NULL) {
-		rar_dbgmsg("sub_alloc start failed\n");
-		return FALSE;
+	/* Model restarts within a solid stream keep the largest heap seen so
+	 * far; the model is rebuilt from scratch so the old contents are moot */
+	if (!sub_alloc->heap_start || alloc_size > sub_alloc->heap_alloc_size) {
+		sub_allocator_stop_sub_allocator(sub_alloc);
+		if ((sub_alloc->heap_start = (uint8_t *) malloc(alloc_size)) == NULL) {
+			rar_dbgmsg("sub_alloc start failed\n");
+			return FALSE;
+		}
+		sub_alloc->heap_alloc_size = alloc_size;
 	}
 	sub_alloc->heap_end = sub_alloc->heap_start + alloc_size - UNIT_SIZE;
 	sub_alloc->sub_allocator_size = t;
@@ -933,7 +943,6 @@ void ppm_destructor(ppm_data_t *ppm_data)
 
 void ppm_cleanup(ppm_data_t *ppm_data)
 {
-	sub_allocator_stop_sub_allocator(&ppm_data->sub_alloc);
 	sub_allocator_start_sub_allocator(&ppm_data->sub_alloc, 1);
 	start_model_rare(ppm_data, 2);
 }
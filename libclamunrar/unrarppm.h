@@ -41,6 +41,7 @@ typedef struct sub_allocator_tag
 	uint8_t *ptext, *units_start, *heap_end, *fake_units_start;
 	uint8_t *heap_start, *lo_unit, *hi_unit;
 	long sub_allocator_size;
+	unsigned int heap_alloc_size;
 	struct rar_node free_list[N_INDEXES];
 	int16_t indx2units[N_INDEXES], units2indx[128], glue_count;
 } sub_allocator_t;
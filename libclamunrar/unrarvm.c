@@ -359,6 +359,15 @@ static void execute_standard_filter(rarvm_data_t *rarvm_data, rarvm_standard_fil
 
 		cmp_byte2 = filter_type==VMSF_E8E9 ? 0xe9:0xe8;
 		for (cur_pos = 0 ; cur_pos < data_size-4 ; ) {
+			if (cmp_byte2 == 0xe8) {
+				/* skip straight to the next call opcode */
+				unsigned char *next = memchr(data, 0xe8, data_size-4-cur_pos);
+				if (!next) {
+					break;
+				}
+				cur_pos += next - data;
+				data = next;
+			}
 			cur_byte = *(data++);
 			cur_pos++;
 			if (cur_byte==0xe8 || cur_byte==cmp_byte2) {
@@ -902,7 +911,11 @@ int rarvm_execute(rarvm_data_t *rarvm_data, struct rarvm_prepared_program *prg)
 	    rar_dbgmsg("unrar: rarvm_execute: prepared_code == NULL\n");
 	    return FALSE;
 	}
-	if (!rarvm_execute_code(rarvm_data, prepared_code, prg->cmd_count)) {
+	if (prepared_code[0].op_code == VM_STANDARD) {
+		/* standard filters recognized by rarvm_prepare() run natively */
+		execute_standard_filter(rarvm_data,
+				(rarvm_standard_filters_t)prepared_code[0].op1.data);
+	} else if (!rarvm_execute_code(rarvm_data, prepared_code, prg->cmd_count)) {
 		prepared_code[0].op_code = VM_RET;
 	}
 	new_pos = GET_VALUE(FALSE, &rarvm_data->mem[VM_GLOBALMEMADDR+0x20])&RARVM_MEMMASK;
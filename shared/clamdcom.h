@@ -31,6 +31,7 @@
 #endif
 
 #include "shared/misc.h"
+#include "libclamav/cltypes.h"
 
 struct RCVLN {
     char buf[PATH_MAX+1024]; /* FIXME must match that in clamd - bb1349 */
@@ -44,4 +45,79 @@ int sendln(int sockd, const char *line, unsigned int len);
 void recvlninit(struct RCVLN *s, int sockd);
 int recvln(struct RCVLN *s, char **rbol, char **reol);
 
+/*
+ * MUXSESSION: INSTREAM style streams multiplexed on one connection.
+ * All numbers are in network byte order.
+ *
+ * Client frames are a stream id (4), a length (4) and then length bytes of
+ * data. A frame with length 0 ends the stream and queues its scan,
+ * MUX_ABORT drops the stream without a reply. Stream id 0 with length 0
+ * ends the session.
+ *
+ * Replies are sent as the scans finish: stream id (4), status (1), unused
+ * (1), text length (2), scan time in microseconds (8), bytes scanned (8)
+ * and then the text (the virus name or the error message, not terminated).
+ * Errors that don't belong to a stream use id 0.
+ *
+ * At most MUX_MAX_STREAMS streams may be open at once, clamd replies with
+ * an error to the streams beyond that and discards their data.
+ */
+#define MUX_MAX_STREAMS 64
+#define MUX_FRAME_HDRLEN 8
+#define MUX_REPLY_HDRLEN 24
+#define MUX_ABORT 0xffffffff
+
+#define MUX_STATUS_OK 0
+#define MUX_STATUS_FOUND 1
+#define MUX_STATUS_ERROR 2
+
+struct mux_reply {
+    uint32_t id;
+    unsigned int status;
+    unsigned int textlen;
+    uint64_t usecs;
+    uint64_t bytes;
+};
+
+static inline void mux_put32(unsigned char *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static inline uint32_t mux_get32(const unsigned char *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void mux_putframe(unsigned char *hdr, uint32_t id, uint32_t len)
+{
+    mux_put32(hdr, id);
+    mux_put32(hdr + 4, len);
+}
+
+static inline void mux_putreply(unsigned char *hdr, const struct mux_reply *r)
+{
+    mux_put32(hdr, r->id);
+    hdr[4] = r->status;
+    hdr[5] = 0;
+    hdr[6] = r->textlen >> 8;
+    hdr[7] = r->textlen;
+    mux_put32(hdr + 8, r->usecs >> 32);
+    mux_put32(hdr + 12, r->usecs);
+    mux_put32(hdr + 16, r->bytes >> 32);
+    mux_put32(hdr + 20, r->bytes);
+}
+
+static inline void mux_getreply(struct mux_reply *r, const unsigned char *hdr)
+{
+    r->id = mux_get32(hdr);
+    r->status = hdr[4];
+    r->textlen = (hdr[6] << 8) | hdr[7];
+    r->usecs = ((uint64_t)mux_get32(hdr + 8) << 32) | mux_get32(hdr + 12);
+    r->bytes = ((uint64_t)mux_get32(hdr + 16) << 32) | mux_get32(hdr + 20);
+}
+
 #endif
@@ -126,38 +126,11 @@ short int mprintf_disabled = 0, mprintf_verbose = 0, mprintf_quiet = 0,
     len += arglen;				    \
 }
 
-int mdprintf(int desc, const char *str, ...)
+/* Sends the bytes in buff to desc in one go with respect to the other
+ * threads, waiting up to mprintf_send_timeout whenever the socket is full */
+static int mdsend(int desc, const char *buff, int bytes)
 {
-	va_list args;
-	char buffer[512], *abuffer = NULL, *buff;
-	int bytes, todo, ret=0;
-	size_t len;
-
-    ARGLEN(args, str, len);
-    if(len <= sizeof(buffer)) {
-	len = sizeof(buffer);
-	buff = buffer;
-    } else {
-	abuffer = malloc(len);
-	if(!abuffer) {
-	    len = sizeof(buffer);
-	    buff = buffer;
-	} else {
-	    buff = abuffer;
-	}
-    }
-    va_start(args, str);
-    bytes = vsnprintf(buff, len, str, args);
-    va_end(args);
-    buff[len - 1] = 0;
-
-    if(bytes < 0) {
-	if(len > sizeof(buffer))
-	    free(abuffer);
-	return bytes;
-    }
-    if((size_t) bytes >= len)
-	bytes = len - 1;
+	int todo, ret=0;
 
     todo = bytes;
 #ifdef CL_THREAD_SAFE
@@ -166,14 +139,21 @@ int mdprintf(int desc, const char *str, ...)
     pthread_mutex_lock(&mdprintf_mutex);
 #endif
     while (todo > 0) {
-	ret = send(desc, buff, bytes, 0);
+	ret = send(desc, buff, todo, 0);
 	if (ret < 0) {
 	    struct timeval tv;
+#ifdef CL_THREAD_SAFE
+	    int unlocked = 0;
+#endif
 	    if (errno != EWOULDBLOCK)
 		break;
-	    /* didn't send anything yet */
 #ifdef CL_THREAD_SAFE
-	    pthread_mutex_unlock(&mdprintf_mutex);
+	    /* let other threads send while we wait, but only if none of buff
+	     * went out yet: a partly sent reply must not be interleaved */
+	    if (todo == bytes) {
+		pthread_mutex_unlock(&mdprintf_mutex);
+		unlocked = 1;
+	    }
 #endif
 	    tv.tv_sec = 0;
 	    tv.tv_usec = mprintf_send_timeout*1000;
@@ -184,7 +164,8 @@ int mdprintf(int desc, const char *str, ...)
 		ret = select(desc+1, NULL, &wfds, NULL, &tv);
 	    } while (ret < 0 && errno == EINTR);
 #ifdef CL_THREAD_SAFE
-	    pthread_mutex_lock(&mdprintf_mutex);
+	    if (unlocked)
+		pthread_mutex_lock(&mdprintf_mutex);
 #endif
 	    if (!ret) {
 		/* timed out */
@@ -200,10 +181,54 @@ int mdprintf(int desc, const char *str, ...)
     pthread_mutex_unlock(&mdprintf_mutex);
 #endif
 
+    return ret < 0 ? -1 : bytes;
+}
+
+/* mdprintf() for binary data */
+int mdwrite(int desc, const void *buff, size_t len)
+{
+    return mdsend(desc, (const char *)buff, (int)len);
+}
+
+int mdprintf(int desc, const char *str, ...)
+{
+	va_list args;
+	char buffer[512], *abuffer = NULL, *buff;
+	int bytes, ret;
+	size_t len;
+
+    ARGLEN(args, str, len);
+    if(len <= sizeof(buffer)) {
+	len = sizeof(buffer);
+	buff = buffer;
+    } else {
+	abuffer = malloc(len);
+	if(!abuffer) {
+	    len = sizeof(buffer);
+	    buff = buffer;
+	} else {
+	    buff = abuffer;
+	}
+    }
+    va_start(args, str);
+    bytes = vsnprintf(buff, len, str, args);
+    va_end(args);
+    buff[len - 1] = 0;
+
+    if(bytes < 0) {
+	if(len > sizeof(buffer))
+	    free(abuffer);
+	return bytes;
+    }
+    if((size_t) bytes >= len)
+	bytes = len - 1;
+
+    ret = mdsend(desc, buff, bytes);
+
     if(len > sizeof(buffer))
 	free(abuffer);
 
-    return ret < 0 ? -1 : bytes;
+    return ret;
 }
 
 static int rename_logg(STATBUF *sb)
@@ -38,6 +38,7 @@ int mdprintf(int desc, const char *str, ...) __attribute__((format(printf, 2,3))
 #else
 int mdprintf(int desc, const char *str, ...);
 #endif
+int mdwrite(int desc, const void *buff, size_t len);
 
 #ifdef __GNUC__
 int logg(const char *str, ...)      __attribute__((format(printf, 1, 2)));
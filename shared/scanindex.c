@@ -0,0 +1,235 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#if HAVE_CONFIG_H
+#include "clamav-config.h"
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#include <fcntl.h>
+
+#include "libclamav/clamav.h"
+#include "shared/output.h"
+#include "shared/scanindex.h"
+
+#ifndef _WIN32
+
+/* "1" is the layout version; the file is in host byte order */
+#define SCANINDEX_MAGIC "ClamIdx1"
+
+struct scanindex_header {
+    char magic[8];
+    uint32_t entries;
+    uint32_t entsize;
+};
+
+struct scanindex_entry {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime;	/* nanoseconds */
+    int64_t ctime;
+    uint64_t stamp;
+};
+
+struct scan_index {
+    int fd;
+    uint32_t entries;
+};
+
+static uint64_t mix64(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+static void fill_entry(struct scanindex_entry *e, const STATBUF *sb, uint64_t stamp)
+{
+    memset(e, 0, sizeof(*e));
+    e->dev = sb->st_dev;
+    e->ino = sb->st_ino;
+    e->size = sb->st_size;
+#if defined(C_LINUX)
+    e->mtime = (int64_t) sb->st_mtim.tv_sec * 1000000000 + sb->st_mtim.tv_nsec;
+    e->ctime = (int64_t) sb->st_ctim.tv_sec * 1000000000 + sb->st_ctim.tv_nsec;
+#elif defined(C_DARWIN)
+    e->mtime = (int64_t) sb->st_mtimespec.tv_sec * 1000000000 + sb->st_mtimespec.tv_nsec;
+    e->ctime = (int64_t) sb->st_ctimespec.tv_sec * 1000000000 + sb->st_ctimespec.tv_nsec;
+#else
+    e->mtime = (int64_t) sb->st_mtime * 1000000000;
+    e->ctime = (int64_t) sb->st_ctime * 1000000000;
+#endif
+    e->stamp = stamp;
+}
+
+static off_t slot_offset(const struct scan_index *idx, const STATBUF *sb)
+{
+    uint64_t slot = mix64((uint64_t) sb->st_dev ^ mix64((uint64_t) sb->st_ino)) % idx->entries;
+
+    return sizeof(struct scanindex_header) + (off_t) slot * sizeof(struct scanindex_entry);
+}
+
+struct scan_index *scanindex_open(const char *path, unsigned int entries)
+{
+    struct scan_index *idx;
+    struct scanindex_header hdr;
+    STATBUF sb;
+    off_t size;
+
+    if (!entries) {
+	logg("!scanindex: the index needs at least one entry\n");
+	return NULL;
+    }
+    if (!(idx = malloc(sizeof(*idx)))) {
+	logg("!scanindex: can't allocate memory\n");
+	return NULL;
+    }
+    if ((idx->fd = open(path, O_RDWR | O_CREAT, 0600)) == -1) {
+	logg("!scanindex: can't open %s: %s\n", path, strerror(errno));
+	free(idx);
+	return NULL;
+    }
+
+    /* an existing index keeps its own size */
+    if (read(idx->fd, &hdr, sizeof(hdr)) == sizeof(hdr) && !memcmp(hdr.magic, SCANINDEX_MAGIC, sizeof(hdr.magic)) &&
+	hdr.entries && hdr.entsize == sizeof(struct scanindex_entry) && FSTAT(idx->fd, &sb) == 0 &&
+	sb.st_size == (off_t) sizeof(hdr) + (off_t) hdr.entries * sizeof(struct scanindex_entry)) {
+	idx->entries = hdr.entries;
+	logg("*scanindex: using %s (%u entries)\n", path, idx->entries);
+	return idx;
+    }
+
+    /* missing, damaged or from another version: start over, the slots are left sparse */
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SCANINDEX_MAGIC, sizeof(hdr.magic));
+    hdr.entries = entries;
+    hdr.entsize = sizeof(struct scanindex_entry);
+    size = (off_t) sizeof(hdr) + (off_t) entries * sizeof(struct scanindex_entry);
+    if (ftruncate(idx->fd, 0) == -1 || ftruncate(idx->fd, size) == -1 ||
+	pwrite(idx->fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)) {
+	logg("!scanindex: can't initialize %s: %s\n", path, strerror(errno));
+	close(idx->fd);
+	free(idx);
+	return NULL;
+    }
+    idx->entries = entries;
+    logg("*scanindex: created %s (%u entries)\n", path, idx->entries);
+    return idx;
+}
+
+void scanindex_close(struct scan_index *idx)
+{
+    if (!idx)
+	return;
+    close(idx->fd);
+    free(idx);
+}
+
+uint64_t scanindex_stamp(const struct cl_engine *engine, unsigned int options)
+{
+    static const enum cl_engine_field fields[] = {
+	CL_ENGINE_DB_STAMP, CL_ENGINE_DB_VERSION, CL_ENGINE_DB_TIME, CL_ENGINE_DB_OPTIONS,
+	CL_ENGINE_MAX_SCANSIZE, CL_ENGINE_MAX_FILESIZE, CL_ENGINE_MAX_RECURSION, CL_ENGINE_MAX_FILES,
+	CL_ENGINE_MAX_EMBEDDEDPE, CL_ENGINE_MAX_HTMLNORMALIZE, CL_ENGINE_MAX_HTMLNOTAGS,
+	CL_ENGINE_MAX_SCRIPTNORMALIZE, CL_ENGINE_MAX_ZIPTYPERCG, CL_ENGINE_MAX_PARTITIONS,
+	CL_ENGINE_MAX_ICONSPE, CL_ENGINE_MAX_RECHWP3, CL_ENGINE_PCRE_MATCH_LIMIT,
+	CL_ENGINE_PCRE_RECMATCH_LIMIT, CL_ENGINE_PCRE_MAX_FILESIZE, CL_ENGINE_MIN_CC_COUNT,
+	CL_ENGINE_MIN_SSN_COUNT, CL_ENGINE_BYTECODE_SECURITY, CL_ENGINE_TIME_LIMIT
+    };
+    uint64_t h = mix64(options);
+    unsigned int i;
+
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
+	h = mix64(h ^ (uint64_t) cl_engine_get_num(engine, fields[i], NULL));
+    /* 0 is what an empty slot holds */
+    return h ? h : 1;
+}
+
+int scanindex_lookup(struct scan_index *idx, const STATBUF *sb, uint64_t stamp)
+{
+    struct scanindex_entry want, have;
+
+    if (!idx)
+	return 0;
+    fill_entry(&want, sb, stamp);
+    if (pread(idx->fd, &have, sizeof(have), slot_offset(idx, sb)) != sizeof(have))
+	return 0;
+    /* every field must match, so a slot torn by concurrent writers never does */
+    return !memcmp(&want, &have, sizeof(want));
+}
+
+void scanindex_update(struct scan_index *idx, const STATBUF *sb, uint64_t stamp)
+{
+    struct scanindex_entry e;
+
+    if (!idx)
+	return;
+    fill_entry(&e, sb, stamp);
+    if (pwrite(idx->fd, &e, sizeof(e), slot_offset(idx, sb)) != sizeof(e))
+	logg("^scanindex: can't update the index: %s\n", strerror(errno));
+}
+
+#else /* no pread()/pwrite() */
+
+struct scan_index *scanindex_open(const char *path, unsigned int entries)
+{
+    UNUSEDPARAM(entries);
+    logg("!scanindex: %s: the scan index is not supported on Windows\n", path);
+    return NULL;
+}
+
+void scanindex_close(struct scan_index *idx)
+{
+    UNUSEDPARAM(idx);
+}
+
+uint64_t scanindex_stamp(const struct cl_engine *engine, unsigned int options)
+{
+    UNUSEDPARAM(engine);
+    UNUSEDPARAM(options);
+    return 1;
+}
+
+int scanindex_lookup(struct scan_index *idx, const STATBUF *sb, uint64_t stamp)
+{
+    UNUSEDPARAM(idx);
+    UNUSEDPARAM(sb);
+    UNUSEDPARAM(stamp);
+    return 0;
+}
+
+void scanindex_update(struct scan_index *idx, const STATBUF *sb, uint64_t stamp)
+{
+    UNUSEDPARAM(idx);
+    UNUSEDPARAM(sb);
+    UNUSEDPARAM(stamp);
+}
+
+#endif
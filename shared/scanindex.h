@@ -0,0 +1,48 @@
+/*
+ *  Copyright (C) 2015 Cisco Systems, Inc. and/or its affiliates. All rights reserved.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License version 2 as
+ *  published by the Free Software Foundation.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ *  MA 02110-1301, USA.
+ */
+
+#ifndef __SCANINDEX_H
+#define __SCANINDEX_H
+
+#include "libclamav/clamav.h"
+#include "libclamav/cltypes.h"
+
+/*
+ * Persistent index of the files found clean, so that unchanged files can be
+ * skipped by the next scan. The index is a file with a fixed number of
+ * slots; a file's slot is picked by its device and inode, and a file landing
+ * on a taken slot replaces the entry there, which only costs a rescan.
+ * An entry matches while the size, mtime and ctime of the file are the same
+ * and the scan uses the same databases, options and limits (the stamp).
+ * Lookups and updates are single pread()/pwrite() calls, so they can be made
+ * from several threads without locking.
+ */
+struct scan_index;
+
+/* opens or creates the index, NULL on error (logged) */
+struct scan_index *scanindex_open(const char *path, unsigned int entries);
+void scanindex_close(struct scan_index *idx);
+
+uint64_t scanindex_stamp(const struct cl_engine *engine, unsigned int options);
+
+/* 1 if the file was found clean with this stamp and hasn't changed since */
+int scanindex_lookup(struct scan_index *idx, const STATBUF *sb, uint64_t stamp);
+/* record a clean result; sb must be taken before the scan */
+void scanindex_update(struct scan_index *idx, const STATBUF *sb, uint64_t stamp);
+
+#endif
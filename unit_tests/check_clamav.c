@@ -10,6 +10,7 @@
 #include <string.h>
 #include <check.h>
 #include <sys/types.h>
+#include <unistd.h>
 #include <dirent.h>
 #include <sys/mman.h>
 
@@ -23,6 +24,7 @@
 #include "../libclamav/version.h"
 #include "../libclamav/dsig.h"
 #include "../libclamav/fpu.h"
+#include "../libclamav/pdf.h"
 #include "checks.h"
 
 static int fpu_words  = FPU_ENDIAN_INITME;
@@ -204,6 +206,82 @@ START_TEST (test_cl_scandesc_allscan)
 }
 END_TEST
 
+START_TEST (test_cl_scandesc_md5)
+{
+    const char *virname = NULL;
+    char file[256], buf[8192];
+    unsigned char md5[16];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    void *hashctx;
+    int ret, n;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    /* what clamd does while receiving a stream */
+    hashctx = cl_hash_init("md5");
+    fail_unless(hashctx != NULL, "cl_hash_init failed");
+    while ((n = read(fd, buf, sizeof(buf))) > 0)
+        cl_update_hash(hashctx, buf, n);
+    cl_finish_hash(hashctx, md5);
+    lseek(fd, 0, SEEK_SET);
+
+    cli_dbgmsg("scanning (scandesc_md5) %s\n", file);
+    ret = cl_scandesc_md5(fd, md5, &virname, &scanned, g_engine, CL_SCAN_STDOPT, 0, NULL);
+    cli_dbgmsg("scan end (scandesc_md5) %s\n", file);
+
+    if (!FALSE_NEGATIVE) {
+      fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc_md5 failed for %s: %s", file, cl_strerror(ret));
+      fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s", virname);
+    }
+    close(fd);
+}
+END_TEST
+
+struct trace_data {
+    unsigned int nodes;
+    unsigned int last_depth;
+    int bad;
+};
+
+static void trace_cb(unsigned int depth, const char *type, const char *parser, unsigned long long size,
+                     unsigned long long usecs, unsigned long long match_usecs, unsigned long long unpack_usecs,
+                     unsigned long long tempbytes, void *context)
+{
+    struct trace_data *d = context;
+
+    (void)size; (void)tempbytes;
+    /* depth first order: the first node is the file, a child follows its parent */
+    if ((!d->nodes && (depth || strcmp(parser, "file"))) || (d->nodes && (!depth || depth > d->last_depth + 1)))
+        d->bad = 1;
+    if (!type || match_usecs + unpack_usecs > usecs)
+        d->bad = 1;
+    d->last_depth = depth;
+    d->nodes++;
+}
+
+START_TEST (test_cl_scandesc_trace)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    struct trace_data data;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    memset(&data, 0, sizeof(data));
+    cl_engine_set_clcb_trace(g_engine, trace_cb);
+    ret = cl_scandesc_callback(fd, &virname, &scanned, g_engine, CL_SCAN_STDOPT | CL_SCAN_TRACE, &data);
+    cl_engine_set_clcb_trace(g_engine, NULL);
+
+    if (!FALSE_NEGATIVE)
+      fail_unless_fmt(ret == CL_VIRUS, "cl_scandesc_trace failed for %s: %s", file, cl_strerror(ret));
+    fail_unless_fmt(data.nodes > 0, "no trace for %s", file);
+    fail_unless_fmt(!data.bad, "malformed trace for %s", file);
+    close(fd);
+}
+END_TEST
+
 //* int cl_scanfile(const char *filename, const char **virname, unsigned long int *scanned, const struct cl_engine *engine, const struct cl_limits *limits, unsigned int options) */
 START_TEST (test_cl_scanfile)
 {
@@ -272,6 +350,88 @@ START_TEST (test_cl_scanfile_callback)
 }
 END_TEST
 
+START_TEST (test_cl_scanfile_timeout)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    close(fd);
+
+    cli_dbgmsg("scanning (scanfile_timeout) %s\n", file);
+    /* plenty of time, must not change the result */
+    ret = cl_scanfile_timeout(file, &virname, &scanned, g_engine, CL_SCAN_STDOPT, 60000, NULL);
+    cli_dbgmsg("scan end (scanfile_timeout) %s\n", file);
+
+    if (!FALSE_NEGATIVE) {
+      fail_unless_fmt(ret == CL_VIRUS, "cl_scanfile_timeout failed for %s: %s", file, cl_strerror(ret));
+      fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s", virname);
+    }
+}
+END_TEST
+
+START_TEST (test_cl_scanfile_recursion_grown)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    long long maxrec;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    close(fd);
+
+    /* the next scan on this thread takes over a stack too shallow for it */
+    cl_scanfile(file, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    maxrec = cl_engine_get_num(g_engine, CL_ENGINE_MAX_RECURSION, NULL);
+    fail_unless(cl_engine_set_num(g_engine, CL_ENGINE_MAX_RECURSION, maxrec + 64) == CL_SUCCESS, "cl_engine_set_num");
+
+    cli_dbgmsg("scanning (scanfile_recursion_grown) %s\n", file);
+    virname = NULL;
+    ret = cl_scanfile(file, &virname, &scanned, g_engine, CL_SCAN_STDOPT);
+    cli_dbgmsg("scan end (scanfile_recursion_grown) %s\n", file);
+
+    if (!FALSE_NEGATIVE) {
+      fail_unless_fmt(ret == CL_VIRUS, "cl_scanfile failed for %s: %s", file, cl_strerror(ret));
+      fail_unless_fmt(virname && !strcmp(virname, "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s", virname);
+    }
+}
+END_TEST
+
+static cl_error_t slow_pre_scan(int fd, const char *type, void *context)
+{
+    UNUSEDPARAM(fd);
+    UNUSEDPARAM(type);
+    UNUSEDPARAM(context);
+    usleep(5000);
+    return CL_CLEAN;
+}
+
+START_TEST (test_cl_scanfile_timeout_expired)
+{
+    const char *virname = NULL;
+    char file[256];
+    unsigned long size;
+    unsigned long int scanned = 0;
+    int ret;
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+    close(fd);
+
+    /* the deadline passes before the first scanner gets to run */
+    cl_engine_set_clcb_pre_scan(g_engine, slow_pre_scan);
+    cli_dbgmsg("scanning (scanfile_timeout_expired) %s\n", file);
+    ret = cl_scanfile_timeout(file, &virname, &scanned, g_engine, CL_SCAN_STDOPT, 1, NULL);
+    cli_dbgmsg("scan end (scanfile_timeout_expired) %s\n", file);
+
+    fail_unless_fmt(ret == CL_ETIMEOUT, "cl_scanfile_timeout didn't time out for %s: %s", file, cl_strerror(ret));
+}
+END_TEST
+
 START_TEST (test_cl_scanfile_callback_allscan)
 {
     const char *virname = NULL;
@@ -367,6 +527,32 @@ END_TEST
 START_TEST (test_cl_strerror)
 END_TEST
 
+/* int cl_hash_data_batch(const char *alg, size_t count, const void * const *bufs, const size_t *lens, unsigned char **obufs) */
+START_TEST (test_cl_hash_data_batch)
+{
+    const char *data[3] = { "abc", "", "The quick brown fox jumps over the lazy dog" };
+    const void *bufs[3];
+    size_t lens[3];
+    unsigned char digests[3][SHA1_HASH_SIZE], expected[SHA1_HASH_SIZE];
+    unsigned char *obufs[3];
+    unsigned int i;
+
+    for (i = 0; i < 3; i++) {
+        bufs[i] = data[i];
+        lens[i] = strlen(data[i]);
+        obufs[i] = digests[i];
+    }
+
+    fail_unless(cl_hash_data_batch("sha1", 3, bufs, lens, obufs) == 0, "cl_hash_data_batch failed");
+    for (i = 0; i < 3; i++) {
+        fail_unless(cl_hash_data("sha1", data[i], lens[i], expected, NULL) != NULL, "cl_hash_data failed");
+        fail_unless(!memcmp(digests[i], expected, SHA1_HASH_SIZE), "digest mismatch for buffer %u", i);
+    }
+
+    fail_unless(cl_hash_data_batch("nosuchalg", 3, bufs, lens, obufs) == -1, "unknown algorithm accepted");
+}
+END_TEST
+
 static char **testfiles = NULL;
 static unsigned testfiles_n = 0;
 
@@ -567,6 +753,46 @@ START_TEST (test_cl_scanmap_callback_mem)
 }
 END_TEST
 
+START_TEST (test_cl_scanmaps_batch)
+{
+    const char *virnames[4];
+    unsigned long int scanned = 0;
+    cl_fmap_t *maps[4];
+    int results[4];
+    int ret, i;
+    void *mem;
+    unsigned long size;
+    char file[256];
+
+    int fd = get_test_file(_i, file, sizeof(file), &size);
+
+    mem = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    fail_unless(mem != MAP_FAILED, "mmap");
+
+    /* the same map three times: nothing may leak from one item to the next */
+    maps[0] = maps[1] = maps[2] = cl_fmap_open_memory(mem, size);
+    fail_unless(!!maps[0], "cl_fmap_open_mem");
+    maps[3] = NULL;
+
+    cli_dbgmsg("scanning (batch) %s\n", file);
+    ret = cl_scanmaps_batch(maps, 4, results, virnames, &scanned, g_engine, CL_SCAN_STDOPT, NULL);
+    cli_dbgmsg("scan end (batch) %s\n", file);
+    fail_unless_fmt(ret == CL_SUCCESS, "cl_scanmaps_batch failed: %s", cl_strerror(ret));
+    for (i = 0; i < 3; i++) {
+        if (!FALSE_NEGATIVE) {
+          fail_unless_fmt(results[i] == CL_VIRUS, "cl_scanmaps_batch item %d failed for %s: %s", i, file, cl_strerror(results[i]));
+          fail_unless_fmt(virnames[i] && !strcmp(virnames[i], "ClamAV-Test-File.UNOFFICIAL"), "virusname: %s for %s", virnames[i], file);
+        }
+    }
+    fail_unless_fmt(results[3] == CL_ENULLARG, "NULL map: %s", cl_strerror(results[3]));
+    fail_unless(virnames[3] == NULL, "virusname for a NULL map");
+    close(fd);
+    cl_fmap_close(maps[0]);
+
+    munmap(mem, size);
+}
+END_TEST
+
 START_TEST (test_cl_scanmap_callback_mem_allscan)
 {
     const char *virname = NULL;
@@ -625,6 +851,7 @@ static Suite *test_cl_suite(void)
     tcase_add_test(tc_cl, test_cl_statchkdir);
     tcase_add_test(tc_cl, test_cl_settempdir);
     tcase_add_test(tc_cl, test_cl_strerror);
+    tcase_add_test(tc_cl, test_cl_hash_data_batch);
 
     suite_add_tcase(s, tc_cl_scan);
     tcase_add_checked_fixture (tc_cl_scan, engine_setup, engine_teardown);
@@ -634,16 +861,22 @@ static Suite *test_cl_suite(void)
     expect -= skip_files();
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_allscan, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_trace, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_md5, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_allscan, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_callback, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scandesc_callback_allscan, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_callback, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_callback_allscan, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_timeout, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_timeout_expired, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scanfile_recursion_grown, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_handle, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_handle_allscan, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem, 0, expect);
     tcase_add_loop_test(tc_cl_scan, test_cl_scanmap_callback_mem_allscan, 0, expect);
+    tcase_add_loop_test(tc_cl_scan, test_cl_scanmaps_batch, 0, expect);
 
     user_timeout = getenv("T");
     if (user_timeout) {
@@ -832,22 +1065,268 @@ START_TEST (test_sha256)
 }
 END_TEST
 
+START_TEST (test_cli_checkdeadline)
+{
+    cli_ctx ctx;
+    unsigned int i;
+
+    memset(&ctx, 0, sizeof(ctx));
+    fail_unless(cli_checkdeadline(NULL) == CL_SUCCESS, "NULL ctx timed out");
+    for (i = 0; i < 2 * CLI_DEADLINE_STRIDE; i++)
+        fail_unless(cli_checkdeadline(&ctx) == CL_SUCCESS, "scan without a deadline timed out");
+
+    ctx.deadline = cli_monotonic_usecs() + 3600 * 1000000ULL;
+    for (i = 0; i < 2 * CLI_DEADLINE_STRIDE; i++)
+        fail_unless(cli_checkdeadline(&ctx) == CL_SUCCESS, "deadline reached an hour early");
+
+    /* long gone: must be noticed within one stride, and stay noticed */
+    ctx.deadline = 1;
+    for (i = 0; i < CLI_DEADLINE_STRIDE && cli_checkdeadline(&ctx) == CL_SUCCESS; i++)
+        ;
+    fail_unless_fmt(i < CLI_DEADLINE_STRIDE, "deadline not noticed after %u checks", i);
+    fail_unless(ctx.timed_out, "timed_out not set");
+    ctx.deadline = cli_monotonic_usecs() + 3600 * 1000000ULL;
+    fail_unless(cli_checktimelimit(&ctx) == CL_ETIMEOUT, "timeout is not sticky");
+}
+END_TEST
+
+#if defined(USE_MPOOL) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+/* Returns 1 if the mapping holding p is marked for huge pages, 0 if it is
+ * not and -1 if /proc/self/smaps can't tell */
+static int smaps_hugepage(const void *p)
+{
+    unsigned long start, end, addr = (unsigned long)p;
+    char line[512];
+    int inside = 0, ret = -1;
+    FILE *f;
+
+    if (!(f = fopen("/proc/self/smaps", "r")))
+        return -1;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "%lx-%lx ", &start, &end) == 2)
+            inside = addr >= start && addr < end;
+        else if (inside && !strncmp(line, "VmFlags:", 8)) {
+            /* hg: MADV_HUGEPAGE, ht: MAP_HUGETLB */
+            ret = strstr(line, " hg") || strstr(line, " ht");
+            break;
+        }
+    }
+    fclose(f);
+    return ret;
+}
+
+START_TEST (test_mpool_hugepages)
+{
+    mpool_t *mp;
+    void *p;
+    int ret;
+
+    if (access("/sys/kernel/mm/transparent_hugepage/enabled", F_OK))
+        return; /* no transparent huge pages in this kernel */
+
+    mp = mpool_create();
+    fail_unless(mp != NULL, "mpool_create");
+    mpool_set_hugepages(mp, CL_MPOOL_HUGEPAGES_TRANSPARENT);
+    /* doesn't fit the first chunk, so it gets a new MIN_FRAGSIZE one */
+    p = mpool_malloc(mp, 256 * 1024);
+    fail_unless(p != NULL, "mpool_malloc");
+    ret = smaps_hugepage(p);
+    mpool_free(mp, p);
+    mpool_destroy(mp);
+    if (ret != -1)
+        fail_unless(ret == 1, "mpool chunk is not on huge pages");
+}
+END_TEST
+#endif
+
+#define PDF_DUPIDS 200
+#define PDF_DUPOBJS (3 * PDF_DUPIDS)
+
+/* every object id shows up three times, and there are enough objects for
+ * the id index to be rebuilt twice while parsing */
+START_TEST (test_pdf_find_obj)
+{
+    struct pdf_struct pdf;
+    struct pdf_obj *obj, *linear;
+    uint32_t *objhash;
+    char *buf, *p;
+    unsigned i, id;
+    int rc;
+
+    buf = p = cli_malloc(PDF_DUPOBJS * 64);
+    fail_unless(buf != NULL, "cli_malloc");
+    p += sprintf(p, "%%PDF-1.4\n");
+    for (i = 0; i < PDF_DUPOBJS; i++)
+        p += sprintf(p, "%u 0 obj\n<< /N %u >>\nendobj\n", i % PDF_DUPIDS + 1, i);
+
+    memset(&pdf, 0, sizeof(pdf));
+    pdf.map = buf;
+    pdf.size = p - buf;
+    while ((rc = pdf_findobj(&pdf)) > 0)
+        ;
+    fail_unless(rc == 0, "pdf_findobj failed");
+    pdf.nobjs--;
+    fail_unless_fmt(pdf.nobjs == PDF_DUPOBJS, "found %u objects", pdf.nobjs);
+    fail_unless(pdf.objhash != NULL, "no object index");
+
+    /* id 5 is at 4, 204 and 404: the first one at or after the starting
+     * object wins, wrapping around to the start of the file */
+    id = 5 << 8;
+    fail_unless(find_obj(&pdf, &pdf.objs[0], id) == &pdf.objs[4], "lookup from the first object");
+    fail_unless(find_obj(&pdf, &pdf.objs[4], id) == &pdf.objs[4], "lookup from the object itself");
+    fail_unless(find_obj(&pdf, &pdf.objs[5], id) == &pdf.objs[204], "lookup past the first duplicate");
+    fail_unless(find_obj(&pdf, &pdf.objs[300], id) == &pdf.objs[404], "lookup past the second duplicate");
+    fail_unless(find_obj(&pdf, &pdf.objs[405], id) == &pdf.objs[4], "lookup didn't wrap around");
+    fail_unless(find_obj(&pdf, &pdf.objs[0], (PDF_DUPIDS + 1) << 8) == NULL, "found a missing object");
+
+    /* and the index agrees with the linear search everywhere */
+    objhash = pdf.objhash;
+    for (i = 0; i < pdf.nobjs; i++) {
+        for (id = 1; id <= PDF_DUPIDS + 1; id++) {
+            obj = find_obj(&pdf, &pdf.objs[i], id << 8);
+            pdf.objhash = NULL;
+            linear = find_obj(&pdf, &pdf.objs[i], id << 8);
+            pdf.objhash = objhash;
+            fail_unless_fmt(obj == linear, "object %u from %u: index %ld, linear %ld", id, i,
+                            obj ? (long)(obj - pdf.objs) : -1L, linear ? (long)(linear - pdf.objs) : -1L);
+        }
+    }
+
+    free(pdf.objs);
+    free(pdf.objhash);
+    free(pdf.objchain);
+    free(buf);
+}
+END_TEST
+
+#define PDF_DUMP_MARKER "ClamAV-PDF-dump-test-marker"
+
+static struct cl_engine *pdf_engine;
+
+static void pdf_engine_setup(void)
+{
+    char db[PATH_MAX], *tmp, *hex;
+    unsigned int sigs = 0;
+    FILE *f;
+
+    if (!inited)
+	fail_unless(cl_init(CL_INIT_DEFAULT) == 0, "cl_init");
+    inited = 1;
+    pdf_engine = cl_engine_new();
+    fail_unless(!!pdf_engine, "engine");
+
+    tmp = cli_gentemp(NULL);
+    fail_unless(tmp != NULL, "cli_gentemp");
+    snprintf(db, sizeof(db), "%s.ndb", tmp);
+    free(tmp);
+    hex = cli_str2hex(PDF_DUMP_MARKER, strlen(PDF_DUMP_MARKER));
+    fail_unless(hex != NULL, "cli_str2hex");
+    f = fopen(db, "w");
+    fail_unless_fmt(f != NULL, "fopen %s", db);
+    fprintf(f, "PDF-Dump-Test:0:*:%s\n", hex);
+    fclose(f);
+    free(hex);
+
+    fail_unless_fmt(cl_load(db, pdf_engine, &sigs, CL_DB_STDOPT) == 0, "cl_load %s", db);
+    unlink(db);
+    fail_unless(sigs == 1, "sigs");
+    fail_unless(cl_engine_compile(pdf_engine) == 0, "cl_engine_compile");
+}
+
+static void pdf_engine_teardown(void)
+{
+    cl_engine_free(pdf_engine);
+}
+
+static cl_error_t pdf_dump_pre_scan(int fd, const char *type, void *context)
+{
+    UNUSEDPARAM(type);
+    if (fd >= 0)
+        (*(unsigned int *)context)++;
+    return CL_CLEAN;
+}
+
+/* Scans a PDF with one ASCIIHexDecode stream of pad zero bytes and the
+ * marker, which only the decoded dump of the stream can match. */
+static void pdf_dump_check(size_t pad, int spilled)
+{
+    const char *virname = NULL;
+    unsigned long int scanned = 0;
+    unsigned int files = 0;
+    size_t hexlen = 2 * (pad + strlen(PDF_DUMP_MARKER));
+    char *buf, *p, *hex;
+    cl_fmap_t *map;
+    int ret;
+
+    buf = p = cli_malloc(hexlen + 256);
+    fail_unless(buf != NULL, "cli_malloc");
+    p += sprintf(p, "%%PDF-1.4\n1 0 obj\n<< /Length %lu /Filter /ASCIIHexDecode >>\nstream\n",
+                 (unsigned long)hexlen + 1);
+    memset(p, '0', 2 * pad);
+    p += 2 * pad;
+    hex = cli_str2hex(PDF_DUMP_MARKER, strlen(PDF_DUMP_MARKER));
+    fail_unless(hex != NULL, "cli_str2hex");
+    memcpy(p, hex, strlen(hex));
+    p += strlen(hex);
+    free(hex);
+    p += sprintf(p, ">\nendstream\nendobj\ntrailer\n<< /Root 1 0 R >>\n%%%%EOF\n");
+
+    map = cl_fmap_open_memory(buf, p - buf);
+    fail_unless(!!map, "cl_fmap_open_memory");
+    cl_engine_set_clcb_pre_scan(pdf_engine, pdf_dump_pre_scan);
+    ret = cl_scanmap_callback(map, &virname, &scanned, pdf_engine, CL_SCAN_STDOPT, &files);
+    cl_fmap_close(map);
+    free(buf);
+
+    fail_unless_fmt(ret == CL_VIRUS, "cl_scanmap_callback: %s", cl_strerror(ret));
+    fail_unless_fmt(virname && !strcmp(virname, "PDF-Dump-Test.UNOFFICIAL"), "virusname: %s", virname);
+    /* the PDF itself is in memory, so any fd is a dump that went to a file */
+    if (spilled)
+        fail_unless_fmt(files > 0, "%lu byte dump wasn't spilled to a file", (unsigned long)pad);
+    else
+        fail_unless_fmt(files == 0, "%lu byte dump went to a file", (unsigned long)pad);
+}
+
+START_TEST (test_pdf_dump_mem)
+{
+    pdf_dump_check(4096, 0);
+}
+END_TEST
+
+/* well past PDF_DUMP_MEMMAX (1 MiB) */
+START_TEST (test_pdf_dump_spill)
+{
+    pdf_dump_check(2 * 1024 * 1024, 1);
+}
+END_TEST
+
 static Suite *test_cli_suite(void)
 {
     Suite *s = suite_create("cli");
     TCase *tc_cli_others = tcase_create("byteorder_macros");
     TCase *tc_cli_dsig = tcase_create("digital signatures");
+    TCase *tc_cli_pdf = tcase_create("pdf");
 
     suite_add_tcase (s, tc_cli_others);
     tcase_add_checked_fixture (tc_cli_others, data_setup, data_teardown);
     tcase_add_loop_test(tc_cli_others, test_cli_readint32, 0, 16);
     tcase_add_loop_test(tc_cli_others, test_cli_readint16, 0, 16);
     tcase_add_loop_test(tc_cli_others, test_cli_writeint32, 0, 16);
+    tcase_add_test(tc_cli_others, test_cli_checkdeadline);
+#if defined(USE_MPOOL) && defined(HAVE_MADVISE) && defined(MADV_HUGEPAGE)
+    tcase_add_test(tc_cli_others, test_mpool_hugepages);
+#endif
 
     suite_add_tcase (s, tc_cli_dsig);
     tcase_add_loop_test(tc_cli_dsig, test_cli_dsig, 0, dsig_tests_cnt);
     tcase_add_test(tc_cli_dsig, test_sha256);
 
+    suite_add_tcase (s, tc_cli_pdf);
+    tcase_add_checked_fixture (tc_cli_pdf, pdf_engine_setup, pdf_engine_teardown);
+    tcase_add_test(tc_cli_pdf, test_pdf_find_obj);
+    tcase_add_test(tc_cli_pdf, test_pdf_dump_mem);
+    tcase_add_test(tc_cli_pdf, test_pdf_dump_spill);
+
     return s;
 }
 #endif /* CHECK_HAVE_LOOPS */
@@ -51,6 +51,7 @@
 #include "libclamav/clamav.h"
 #include "libclamav/version.h"
 #include "libclamav/cltypes.h"
+#include "shared/clamdcom.h"
 
 #ifdef CHECK_HAVE_LOOPS
 
@@ -153,7 +154,7 @@ static void commands_teardown(void)
 
 #define VERSION_REPLY "ClamAV "REPO_VERSION""VERSION_SUFFIX
 
-#define VCMDS_REPLY VERSION_REPLY"| COMMANDS: SCAN QUIT RELOAD PING CONTSCAN VERSIONCOMMANDS VERSION STREAM END SHUTDOWN MULTISCAN FILDES STATS IDSESSION INSTREAM DETSTATSCLEAR DETSTATS ALLMATCHSCAN"
+#define VCMDS_REPLY VERSION_REPLY"| COMMANDS: SCAN QUIT RELOAD PING CONTSCAN VERSIONCOMMANDS VERSION STREAM END SHUTDOWN MULTISCAN FILDES STATS IDSESSION INSTREAM DETSTATSCLEAR DETSTATS ALLMATCHSCAN SIGPROFILE METRICS TRACESCAN DEADLINE MUXSESSION"
 
 enum idsession_support {
     IDS_OK, /* accepted */
@@ -346,6 +347,56 @@ START_TEST (test_stats)
 }
 END_TEST
 
+#define SIGPROFILE_REPLY "SIGNATURES (top 100 by total time):\n"
+START_TEST (test_sigprofile)
+{
+    char *recvdata;
+    size_t len = strlen("zSIGPROFILE");
+    int rc;
+
+    /* test-clamd.conf enables SignatureProfiling */
+    conn_setup();
+    rc = send(sockd, "zSIGPROFILE", len + 1, 0);
+    fail_unless_fmt((size_t)rc == len + 1, "Unable to send(): %s\n", strerror(errno));
+
+    recvdata = recvfull(sockd, &len);
+
+    fail_unless_fmt(len >= strlen(SIGPROFILE_REPLY) + sizeof("END"), "Reply has wrong size: %lu, reply: %s\n",
+		    len, recvdata);
+    rc = strncmp(recvdata, SIGPROFILE_REPLY, strlen(SIGPROFILE_REPLY));
+    fail_unless_fmt(rc == 0, "Wrong reply: %s\n", recvdata);
+    rc = memcmp(recvdata + len - sizeof("END"), "END", sizeof("END"));
+    fail_unless_fmt(rc == 0, "Reply not terminated by END: %s\n", recvdata);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
+#define METRICS_REPLY "# HELP clamd_command_duration_seconds "
+START_TEST (test_metrics)
+{
+    char *recvdata;
+    size_t len = strlen("zMETRICS");
+    int rc;
+
+    conn_setup();
+    rc = send(sockd, "zMETRICS", len + 1, 0);
+    fail_unless_fmt((size_t)rc == len + 1, "Unable to send(): %s\n", strerror(errno));
+
+    recvdata = recvfull(sockd, &len);
+
+    fail_unless_fmt(len >= strlen(METRICS_REPLY) + sizeof("# EOF"), "Reply has wrong size: %lu, reply: %s\n",
+		    len, recvdata);
+    rc = strncmp(recvdata, METRICS_REPLY, strlen(METRICS_REPLY));
+    fail_unless_fmt(rc == 0, "Wrong reply: %s\n", recvdata);
+    fail_unless_fmt(strstr(recvdata, "\nclamd_scanned_files_total ") != NULL, "No file count in: %s\n", recvdata);
+    rc = memcmp(recvdata + len - sizeof("# EOF"), "# EOF", sizeof("# EOF"));
+    fail_unless_fmt(rc == 0, "Reply not terminated by # EOF: %s\n", recvdata);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
 static size_t prepare_instream(char *buf, size_t off, size_t buflen)
 {
     STATBUF stbuf;
@@ -397,6 +448,225 @@ START_TEST (test_instream)
 }
 END_TEST
 
+#define TRACE_INSTREAM_CMD "zTRACESCAN\0zINSTREAM"
+START_TEST (test_instream_trace)
+{
+    char *recvdata, *p, *end;
+    char buf[4096];
+    size_t len, off = sizeof(TRACE_INSTREAM_CMD);
+    unsigned int traces = 0, found = 0;
+
+    memcpy(buf, TRACE_INSTREAM_CMD, sizeof(TRACE_INSTREAM_CMD));
+    off = prepare_instream(buf, off, sizeof(buf));
+
+    conn_setup();
+    fail_unless((size_t)send(sockd, buf, off, 0) == off, "send() failed: %s\n", strerror(errno));
+    recvdata = recvfull(sockd, &len);
+
+    /* at least the top level object is traced before the result */
+    for (p = recvdata; p < recvdata + len; p = end + 1) {
+	end = memchr(p, '\0', recvdata + len - p);
+	fail_unless_fmt(end != NULL, "Unterminated reply: |%s|\n", p);
+	if (end + 1 == recvdata + len) {
+	    fail_unless_fmt(!strcmp(p, EXPECT_INSTREAM0), "Wrong result: |%s|, expected: |%s|\n", p, EXPECT_INSTREAM0);
+	    found = 1;
+	    break;
+	}
+	fail_unless_fmt(!strncmp(p, "stream: ", 8) && end - p > 6 && !strcmp(end - 6, " TRACE"),
+			"Wrong trace line: |%s|\n", p);
+	traces++;
+    }
+    fail_unless_fmt(found, "No result for the stream\n");
+    fail_unless_fmt(traces > 0, "No trace lines: |%s|\n", recvdata);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
+#define DEADLINE_SCAN_CMD "zDEADLINE 60000\0zSCAN "SCANFILE
+#define DEADLINE_INSTREAM_CMD "zDEADLINE 60000\0zINSTREAM"
+#define DEADLINE_BAD_CMD "zDEADLINE 60s"
+#define DEADLINE_BAD_REPLY "DEADLINE requires a number of milliseconds. ERROR"
+START_TEST (test_deadline)
+{
+    char buf[4096];
+    size_t off;
+
+    /* DEADLINE has no reply of its own, a generous one changes nothing */
+    conn_setup();
+    test_command(DEADLINE_SCAN_CMD, sizeof(DEADLINE_SCAN_CMD), NULL, FOUNDREPLY, sizeof(FOUNDREPLY));
+    conn_teardown();
+
+    memcpy(buf, DEADLINE_INSTREAM_CMD, sizeof(DEADLINE_INSTREAM_CMD));
+    off = prepare_instream(buf, sizeof(DEADLINE_INSTREAM_CMD), sizeof(buf));
+    conn_setup();
+    test_command(buf, off, NULL, EXPECT_INSTREAM0, sizeof(EXPECT_INSTREAM0));
+    conn_teardown();
+
+    conn_setup();
+    test_command(DEADLINE_BAD_CMD, sizeof(DEADLINE_BAD_CMD), NULL, DEADLINE_BAD_REPLY, sizeof(DEADLINE_BAD_REPLY));
+    conn_teardown();
+}
+END_TEST
+
+static size_t mux_frame(char *buf, size_t off, uint32_t id, const void *data, uint32_t len)
+{
+    mux_putframe((unsigned char *)buf + off, id, len);
+    off += MUX_FRAME_HDRLEN;
+    if (data && len != MUX_ABORT) {
+	memcpy(&buf[off], data, len);
+	off += len;
+    }
+    return off;
+}
+
+START_TEST (test_muxsession)
+{
+    char *recvdata, file[4096], buf[16384] = "zMUXSESSION";
+    size_t off = sizeof("zMUXSESSION"), len, pos;
+    unsigned int half, seen = 0;
+    struct mux_reply r;
+    STATBUF stbuf;
+    int fd, nread;
+
+    fail_unless_fmt(CLAMSTAT(SCANFILE, &stbuf) != -1, "stat failed for %s: %s", SCANFILE, strerror(errno));
+    fd = open(SCANFILE, O_RDONLY);
+    fail_unless_fmt(fd != -1, "open failed: %s\n", strerror(errno));
+    nread = read(fd, file, sizeof(file));
+    fail_unless_fmt(nread == stbuf.st_size, "read failed: %d != %d, %s\n", nread, stbuf.st_size, strerror(errno));
+    close(fd);
+    half = nread / 2;
+
+    /* two interleaved infected streams, a clean one, an aborted one */
+    off = mux_frame(buf, off, 1, file, half);
+    off = mux_frame(buf, off, 2, file, half);
+    off = mux_frame(buf, off, 3, "clean", 5);
+    off = mux_frame(buf, off, 2, file + half, nread - half);
+    off = mux_frame(buf, off, 1, file + half, nread - half);
+    off = mux_frame(buf, off, 4, "dropped", 7);
+    off = mux_frame(buf, off, 2, NULL, 0);
+    off = mux_frame(buf, off, 4, NULL, MUX_ABORT);
+    off = mux_frame(buf, off, 3, NULL, 0);
+    off = mux_frame(buf, off, 1, NULL, 0);
+    off = mux_frame(buf, off, 0, NULL, 0);
+
+    conn_setup();
+    fail_unless((size_t)send(sockd, buf, off, 0) == off, "send() failed: %s\n", strerror(errno));
+    recvdata = recvfull(sockd, &len);
+
+    for (pos = 0; pos < len; pos += MUX_REPLY_HDRLEN + r.textlen) {
+	fail_unless_fmt(len - pos >= MUX_REPLY_HDRLEN, "Truncated reply header at %lu\n", pos);
+	mux_getreply(&r, (unsigned char *)recvdata + pos);
+	fail_unless_fmt(len - pos - MUX_REPLY_HDRLEN >= r.textlen, "Truncated reply text at %lu\n", pos);
+	fail_unless_fmt(r.id >= 1 && r.id <= 3, "Reply for unexpected stream %u\n", r.id);
+	fail_unless_fmt(!(seen & (1 << r.id)), "Duplicate reply for stream %u\n", r.id);
+	seen |= 1 << r.id;
+	if (r.id == 3) {
+	    fail_unless_fmt(r.status == MUX_STATUS_OK, "Wrong status for the clean stream: %u\n", r.status);
+	    fail_unless_fmt(r.bytes == 5, "Wrong size for the clean stream: %lu\n", (unsigned long)r.bytes);
+	    continue;
+	}
+	fail_unless_fmt(r.status == MUX_STATUS_FOUND, "Wrong status for stream %u: %u\n", r.id, r.status);
+	fail_unless_fmt(r.bytes == (uint64_t)nread, "Wrong size for stream %u: %lu\n", r.id, (unsigned long)r.bytes);
+	fail_unless_fmt(r.textlen == strlen("ClamAV-Test-File.UNOFFICIAL") &&
+			!memcmp(recvdata + pos + MUX_REPLY_HDRLEN, "ClamAV-Test-File.UNOFFICIAL", r.textlen),
+			"Wrong virus name for stream %u\n", r.id);
+    }
+    fail_unless_fmt(seen == 0xe, "Missing replies: %x\n", seen);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
+START_TEST (test_muxsession_maxstreams)
+{
+    char *recvdata, buf[16384] = "zMUXSESSION";
+    size_t off = sizeof("zMUXSESSION"), len, pos;
+    unsigned int id, ok = 0, rejected = 0;
+    struct mux_reply r;
+
+    /* the stream beyond the limit is rejected, the session goes on */
+    for (id = 1; id <= MUX_MAX_STREAMS + 1; id++)
+	off = mux_frame(buf, off, id, "clean", 5);
+    for (id = 1; id <= MUX_MAX_STREAMS + 1; id++)
+	off = mux_frame(buf, off, id, NULL, 0);
+    off = mux_frame(buf, off, 0, NULL, 0);
+
+    conn_setup();
+    fail_unless((size_t)send(sockd, buf, off, 0) == off, "send() failed: %s\n", strerror(errno));
+    recvdata = recvfull(sockd, &len);
+
+    for (pos = 0; pos < len; pos += MUX_REPLY_HDRLEN + r.textlen) {
+	fail_unless_fmt(len - pos >= MUX_REPLY_HDRLEN, "Truncated reply header at %lu\n", pos);
+	mux_getreply(&r, (unsigned char *)recvdata + pos);
+	fail_unless_fmt(len - pos - MUX_REPLY_HDRLEN >= r.textlen, "Truncated reply text at %lu\n", pos);
+	if (r.id == MUX_MAX_STREAMS + 1) {
+	    fail_unless_fmt(r.status == MUX_STATUS_ERROR, "Wrong status for the rejected stream: %u\n", r.status);
+	    rejected++;
+	    continue;
+	}
+	fail_unless_fmt(r.id >= 1 && r.id <= MUX_MAX_STREAMS, "Reply for unexpected stream %u\n", r.id);
+	fail_unless_fmt(r.status == MUX_STATUS_OK, "Wrong status for stream %u: %u\n", r.id, r.status);
+	ok++;
+    }
+    fail_unless_fmt(ok == MUX_MAX_STREAMS, "Wrong number of clean replies: %u\n", ok);
+    fail_unless_fmt(rejected == 1, "Wrong number of rejections: %u\n", rejected);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
+/* StreamMaxLength in the test configuration */
+#define STREAM_MAX_LENGTH (1024*1024)
+
+START_TEST (test_muxsession_oversize)
+{
+    char *recvdata, hdr[MUX_REPLY_HDRLEN + 256], buf[16384] = "zMUXSESSION";
+    size_t off = sizeof("zMUXSESSION"), len, got, left;
+    struct mux_reply r;
+    int rc;
+
+    /* the reply comes as soon as clamd sees the size, before the data */
+    off = mux_frame(buf, off, 1, NULL, STREAM_MAX_LENGTH + 1);
+    conn_setup();
+    fail_unless((size_t)send(sockd, buf, off, 0) == off, "send() failed: %s\n", strerror(errno));
+    for (got = 0; got < MUX_REPLY_HDRLEN; got += rc) {
+	rc = recv(sockd, hdr + got, MUX_REPLY_HDRLEN - got, 0);
+	fail_unless_fmt(rc > 0, "recv() failed: %s\n", strerror(errno));
+    }
+    mux_getreply(&r, (unsigned char *)hdr);
+    fail_unless_fmt(r.id == 1 && r.status == MUX_STATUS_ERROR, "Wrong early reply: stream %u, status %u\n", r.id, r.status);
+    fail_unless_fmt(r.textlen < sizeof(hdr) - MUX_REPLY_HDRLEN, "Reply text too long: %u\n", r.textlen);
+    for (got = 0; got < r.textlen; got += rc) {
+	rc = recv(sockd, hdr + MUX_REPLY_HDRLEN + got, r.textlen - got, 0);
+	fail_unless_fmt(rc > 0, "recv() failed: %s\n", strerror(errno));
+    }
+    fail_unless_fmt(r.textlen == strlen("INSTREAM size limit exceeded.") &&
+		    !memcmp(hdr + MUX_REPLY_HDRLEN, "INSTREAM size limit exceeded.", r.textlen),
+		    "Wrong error: |%.*s|\n", (int)r.textlen, hdr + MUX_REPLY_HDRLEN);
+
+    /* the rest of the frame is discarded, the end frame gets no reply */
+    memset(buf, 0, sizeof(buf));
+    for (left = STREAM_MAX_LENGTH + 1; left; left -= len) {
+	len = left < sizeof(buf) ? left : sizeof(buf);
+	fail_unless((size_t)send(sockd, buf, len, 0) == len, "send() failed: %s\n", strerror(errno));
+    }
+    off = mux_frame(buf, 0, 1, NULL, 0);
+    off = mux_frame(buf, off, 2, "clean", 5);
+    off = mux_frame(buf, off, 2, NULL, 0);
+    off = mux_frame(buf, off, 0, NULL, 0);
+    fail_unless((size_t)send(sockd, buf, off, 0) == off, "send() failed: %s\n", strerror(errno));
+    recvdata = recvfull(sockd, &len);
+
+    fail_unless_fmt(len >= MUX_REPLY_HDRLEN, "Truncated reply: %lu\n", len);
+    mux_getreply(&r, (unsigned char *)recvdata);
+    fail_unless_fmt(r.id == 2 && r.status == MUX_STATUS_OK, "Wrong reply: stream %u, status %u\n", r.id, r.status);
+    fail_unless_fmt(len == MUX_REPLY_HDRLEN + r.textlen, "Unexpected data after the reply: %lu\n", len);
+    free(recvdata);
+    conn_teardown();
+}
+END_TEST
+
 static int sendmsg_fd(int sockd, const char *mesg, size_t msg_len, int fd, int singlemsg)
 {
     struct msghdr msg;
@@ -852,6 +1122,13 @@ static Suite *test_clamd_suite(void)
     tcase_add_test(tc_commands, test_instream);
     tcase_add_test(tc_commands, test_stream);
     tcase_add_test(tc_commands, test_idsession);
+    tcase_add_test(tc_commands, test_instream_trace);
+    tcase_add_test(tc_commands, test_deadline);
+    tcase_add_test(tc_commands, test_sigprofile);
+    tcase_add_test(tc_commands, test_metrics);
+    tcase_add_test(tc_commands, test_muxsession);
+    tcase_add_test(tc_commands, test_muxsession_maxstreams);
+    tcase_add_test(tc_commands, test_muxsession_oversize);
     tc_stress = tcase_create("clamd stress test");
     suite_add_tcase(s, tc_stress);
     tcase_set_timeout(tc_stress, 20);
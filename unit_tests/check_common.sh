@@ -86,6 +86,8 @@ ScanPDF yes
 CommandReadTimeout 1
 MaxQueue 800
 MaxConnectionQueueLength 1024
+SignatureProfiling yes
+StreamMaxLength 1M
 EOF
 }
 
@@ -163,6 +165,21 @@ test_clamscan() {
 	scan_failed clamscan.log "clamscan didn't detect all testfiles correctly"
     fi
 
+    # Test --scan-index: the second run skips the clean files and still finds the testfiles
+    rm -f scan.idx
+    if test_run 1 $CLAMSCAN --quiet -dtest-db/test.hdb -r $TOP/test --scan-index=scan.idx --log=clamscan-idx.log; then
+	scan_failed clamscan-idx.log "clamscan --scan-index didn't detect all testfiles correctly"
+    fi
+    if test_run 1 $CLAMSCAN --quiet -dtest-db/test.hdb -r $TOP/test --scan-index=scan.idx --log=clamscan-idx2.log; then
+	scan_failed clamscan-idx2.log "clamscan --scan-index didn't detect all testfiles correctly (second run)"
+    fi
+    NINFECTED=`grep "Infected files" clamscan-idx2.log | cut -f2 -d: | sed -e 's/ //g'`
+    NUNCHANGED=`grep "Unchanged files" clamscan-idx2.log | cut -f2 -d: | sed -e 's/ //g'`
+    if test "$NFILES" -ne "0$NINFECTED" || test "0$NUNCHANGED" -eq 0; then
+	scan_failed clamscan-idx2.log "clamscan --scan-index didn't skip the unchanged files"
+    fi
+    rm -f scan.idx
+
     cat <<EOF >test-db/test.pdb
 H:example.com
 EOF
@@ -384,6 +401,7 @@ test_clamd3() {
     test_start $1
     echo "VirusEvent $abs_srcdir/virusaction-test.sh `pwd` \"Virus found: %v\"" >>test-clamd.conf
     echo "HeuristicScanPrecedence yes" >>test-clamd.conf
+    echo "MultiscanWalkThreads 4" >>test-clamd.conf
     start_clamd
     # Test HeuristicScanPrecedence feature
     run_clamdscan ../clam-phish-exe
@@ -398,6 +416,13 @@ test_clamd3() {
 	echo "*** No file descriptor passing support, skipping test"
     fi
 
+    # Test MultiscanWalkThreads: every testfile is found when walking the directory
+    run_clamdscan_fileonly $TOP/test
+    NINFECTED_MULTI=`grep "Infected files" clamdscan-multiscan.log | cut -f2 -d:|sed -e 's/ //g'`
+    if test "$NFILES" -ne "0$NINFECTED_MULTI"; then
+	scan_failed clamdscan-multiscan.log "clamd did not detect all testfiles correctly with MultiscanWalkThreads!"
+    fi
+
     rm test-clamd.log
     # Test VirusEvent feature
     run_clamdscan_fileonly $TOP/test/clam.exe
@@ -32,6 +32,7 @@
 #include "../libclamav/matcher-ac.h"
 #include "../libclamav/matcher-bm.h"
 #include "../libclamav/matcher-pcre.h"
+#include "../libclamav/sigprof.h"
 #include "../libclamav/others.h"
 #include "../libclamav/default.h"
 #include "checks.h"
@@ -408,6 +409,157 @@ START_TEST (test_bm_scanbuff_allscan) {
 }
 END_TEST
 
+START_TEST (test_bm_build) {
+	struct cli_matcher *root;
+	const char *virname = NULL;
+	int ret;
+
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_bm_init(root);
+    fail_unless(ret == CL_SUCCESS, "cli_bm_init() failed");
+
+    ret = cli_parse_add(root, "Sig1", "deadbabe0102", 0, 0, 0, "*", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    ret = cli_parse_add(root, "Sig2", "deadbeef0304", 0, 0, 0, "*", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    ret = cli_parse_add(root, "Sig3", "babedead05060708", 0, 0, 0, "*", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+
+    ret = cli_bm_build(root);
+    fail_unless(ret == CL_SUCCESS, "cli_bm_build() failed");
+    fail_unless(root->bm_window > 3, "cli_bm_build() didn't widen the window");
+
+    ret = cli_bm_scanbuff((const unsigned char*)"blah\xde\xad\xbe\xef\x03\x04", 10, &virname, NULL, root, 0, NULL, NULL, NULL);
+    fail_unless(ret == CL_VIRUS, "cli_bm_scanbuff() failed");
+    fail_unless(!strncmp(virname, "Sig2", 4), "Incorrect signature matched in cli_bm_scanbuff()\n");
+
+    ret = cli_bm_scanbuff((const unsigned char*)"\xba\xbe\xde\xad\x05\x06\x07\x08", 8, &virname, NULL, root, 0, NULL, NULL, NULL);
+    fail_unless(ret == CL_VIRUS, "cli_bm_scanbuff() failed");
+    fail_unless(!strncmp(virname, "Sig3", 4), "Incorrect signature matched in cli_bm_scanbuff()\n");
+
+    ret = cli_bm_scanbuff((const unsigned char*)"\xde\xad\xbe\xef\x03", 5, &virname, NULL, root, 0, NULL, NULL, NULL);
+    fail_unless(ret == CL_CLEAN, "cli_bm_scanbuff() matched a truncated pattern");
+}
+END_TEST
+
+START_TEST (test_roi_build) {
+	struct cli_matcher *root;
+	int ret;
+
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+
+    ret = cli_bm_init(root);
+    fail_unless(ret == CL_SUCCESS, "cli_bm_init() failed");
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_init() failed");
+
+    ret = cli_parse_add(root, "Sig1", "deadbeef", 0, 0, 0, "0", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    ret = cli_parse_add(root, "Sig2", "dead??ef", 0, 0, 0, "EOF-10", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    ret = cli_parse_add(root, "Sig3", "babe??ef", 0, 0, 0, "EOF-10", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+
+    ret = cli_roi_build(root);
+    fail_unless(ret == CL_SUCCESS, "cli_roi_build() failed");
+    fail_unless(root->roi_on, "anchored signatures not recognised");
+    fail_unless_fmt(root->roi_num == 2, "expected 2 offsets, got %u", root->roi_num);
+
+    ret = cli_parse_add(root, "Sig4", "babebabe", 0, 0, 0, "*", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+
+    ret = cli_roi_build(root);
+    fail_unless(ret == CL_SUCCESS, "cli_roi_build() failed");
+    fail_unless(!root->roi_on && !root->roi, "unanchored signature not recognised");
+}
+END_TEST
+
+struct roi_handle {
+    const unsigned char *data;
+    size_t len;
+    off_t lowest;
+};
+
+/* pread callback for cl_fmap_open_handle() that remembers how far back the
+ * file has been read */
+static off_t roi_pread(void *handle, void *buf, size_t count, off_t offset)
+{
+    struct roi_handle *h = (struct roi_handle *) handle;
+
+    if ((size_t) offset >= h->len)
+	return 0;
+    if (count > h->len - offset)
+	count = h->len - offset;
+    if (offset < h->lowest)
+	h->lowest = offset;
+    memcpy(buf, h->data + offset, count);
+    return count;
+}
+
+START_TEST (test_roi_scan) {
+	struct cli_matcher *root;
+	struct roi_handle h;
+	unsigned char *data;
+	size_t len = 4 * SCANBUFF;
+	int ret;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+    root->ac_only = 1;
+
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_init() failed");
+    ret = cli_parse_add(root, "RoiSig", "deadbeef", 0, 0, 0, "EOF-100", 0, NULL, 0);
+    fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    ret = cli_ac_buildtrie(root);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_buildtrie() failed");
+    ret = cli_roi_build(root);
+    fail_unless(ret == CL_SUCCESS, "cli_roi_build() failed");
+    fail_unless(root->roi_on, "anchored signature not recognised");
+
+    /* the signature is only in the fourth block, away from the overlap
+     * with the short block at the end of the file */
+    data = cli_calloc(1, len);
+    fail_unless(data != NULL, "cli_calloc");
+    memcpy(data + len - 100, "\xde\xad\xbe\xef", 4);
+
+    h.data = data;
+    h.len = len;
+    h.lowest = len;
+    thefmap = cl_fmap_open_handle(&h, 0, len, roi_pread, 1);
+    fail_unless(thefmap != NULL, "cl_fmap_open_handle() failed");
+    ret = cli_fmap_scandesc(&ctx, CL_TYPE_ANY, 0, NULL, AC_SCAN_VIR, NULL, NULL);
+    fail_unless_fmt(ret == CL_VIRUS, "cli_fmap_scandesc() failed: %d", ret);
+    fail_unless(virname && !strncmp(virname, "RoiSig", 6), "Incorrect signature matched in cli_fmap_scandesc()");
+    fail_unless_fmt(h.lowest >= 2 * SCANBUFF, "blocks outside the region were read from %ld", (long) h.lowest);
+    cl_fmap_close(thefmap);
+    thefmap = NULL;
+
+    /* a copy a block earlier is neither matched nor read */
+    memset(data + len - 100, 0, 4);
+    memcpy(data + len - 100 - SCANBUFF, "\xde\xad\xbe\xef", 4);
+    virname = NULL;
+    h.lowest = len;
+    thefmap = cl_fmap_open_handle(&h, 0, len, roi_pread, 1);
+    fail_unless(thefmap != NULL, "cl_fmap_open_handle() failed");
+    ret = cli_fmap_scandesc(&ctx, CL_TYPE_ANY, 0, NULL, AC_SCAN_VIR, NULL, NULL);
+    fail_unless_fmt(ret == CL_CLEAN, "cli_fmap_scandesc() matched outside the region: %d", ret);
+    fail_unless_fmt(h.lowest >= 2 * SCANBUFF, "blocks outside the region were read from %ld", (long) h.lowest);
+    cl_fmap_close(thefmap);
+    thefmap = NULL;
+
+    free(data);
+}
+END_TEST
+
 #if HAVE_PCRE
 
 START_TEST (test_pcre_scanbuff) {
@@ -520,6 +672,106 @@ END_TEST
 
 #endif /* HAVE_PCRE */
 
+static const char *lsig_exprs[] = {
+    "0",
+    "0&1",
+    "0|1",
+    "0>2",
+    "0=0&1",
+    "(0|1|2)>1",
+    "(0|1|2)>1,2",
+    "(0|1)=0",
+    "((0|1)&2)<3",
+    "0&(1|2)&3>1",
+    "(0&1)|(2&3)|4=2",
+    "((0|1|2)>2,2|3)&(4|5)"
+};
+
+START_TEST (test_ac_evallsig) {
+    struct cli_lsig_prog *prog;
+    uint32_t lsigcnt[64];
+    unsigned int cnt, j, n;
+    uint64_t ids;
+    const char *expr = lsig_exprs[_i];
+
+    prog = cli_ac_compilelsig(ctx.engine->mempool, expr);
+    fail_unless_fmt(prog != NULL, "cli_ac_compilelsig() failed for %s", expr);
+
+    /* walk all small counter combinations of the first six subsigs */
+    memset(lsigcnt, 0, sizeof(lsigcnt));
+    for(n = 0; n < 729; n++) {
+        for(j = 0, cnt = n; j < 6; j++, cnt /= 3)
+            lsigcnt[j] = cnt % 3;
+        cnt = 0;
+        ids = 0;
+        fail_unless_fmt(cli_ac_evallsig(prog, lsigcnt) == cli_ac_chklsig(expr, expr + strlen(expr), lsigcnt, &cnt, &ids, 0),
+                        "cli_ac_evallsig() differs from cli_ac_chklsig() for %s (counters %u)", expr, n);
+    }
+    mpool_free(ctx.engine->mempool, prog);
+}
+END_TEST
+
+static int sigprof_count(const char *virname, const char *kind, unsigned long long calls, unsigned long long matches, unsigned long long usecs, void *context)
+{
+    unsigned int *found = (unsigned int *)context;
+
+    UNUSEDPARAM(usecs);
+    if (!strcmp(kind, "ac") && calls && matches)
+        (*found)++;
+    fail_unless_fmt(matches <= calls, "%s matched %llu times in %llu runs", virname, matches, calls);
+    return 0;
+}
+
+START_TEST (test_sigprof) {
+    struct cli_ac_data mdata;
+    struct cli_matcher *root;
+    unsigned int i, found = 0;
+    int ret;
+
+    root = ctx.engine->root[0];
+    fail_unless(root != NULL, "root == NULL");
+    root->ac_only = 1;
+
+#ifdef USE_MPOOL
+    root->mempool = mpool_create();
+#endif
+    ret = cli_ac_init(root, CLI_DEFAULT_AC_MINDEPTH, CLI_DEFAULT_AC_MAXDEPTH, 1);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_init() failed");
+
+    for(i = 0; ac_testdata[i].data; i++) {
+	ret = cli_parse_add(root, ac_testdata[i].virname, ac_testdata[i].hexsig, 0, 0, 0, "*", 0, NULL, 0);
+	fail_unless(ret == CL_SUCCESS, "cli_parse_add() failed");
+    }
+
+    ret = cli_ac_buildtrie(root);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_buildtrie() failed");
+
+    ret = cli_ac_initdata(&mdata, root->ac_partsigs, 0, 0, CLI_DEFAULT_AC_TRACKLEN);
+    fail_unless(ret == CL_SUCCESS, "cli_ac_initdata() failed");
+
+    ret = cl_engine_set_num((struct cl_engine *)ctx.engine, CL_ENGINE_SIGPROFILE, 1);
+    fail_unless(ret == CL_SUCCESS, "cl_engine_set_num(CL_ENGINE_SIGPROFILE) failed");
+    cl_sigprof_reset();
+
+    for(i = 0; ac_testdata[i].data; i++) {
+	ret = cli_ac_scanbuff((const unsigned char*)ac_testdata[i].data, strlen(ac_testdata[i].data), &virname, NULL, NULL, root, &mdata, 0, 0, NULL, AC_SCAN_VIR, &ctx);
+	fail_unless_fmt(ret == CL_VIRUS, "cli_ac_scanbuff() failed for %s", ac_testdata[i].virname);
+    }
+
+    ret = cl_sigprof_report(0, sigprof_count, &found);
+    fail_unless(ret == CL_SUCCESS, "cl_sigprof_report() failed");
+    fail_unless(found > 0, "no signature was profiled");
+
+    cl_sigprof_reset();
+    found = 0;
+    cl_sigprof_report(0, sigprof_count, &found);
+    fail_unless_fmt(found == 0, "%u signatures left after cl_sigprof_reset()", found);
+
+    cl_engine_set_num((struct cl_engine *)ctx.engine, CL_ENGINE_SIGPROFILE, 0);
+    cli_ac_freedata(&mdata);
+}
+END_TEST
+
 Suite *test_matchers_suite(void)
 {
     Suite *s = suite_create("matchers");
@@ -530,6 +782,9 @@ Suite *test_matchers_suite(void)
     tcase_add_test(tc_matchers, test_ac_scanbuff);
     tcase_add_test(tc_matchers, test_ac_scanbuff_ex);
     tcase_add_test(tc_matchers, test_bm_scanbuff);
+    tcase_add_test(tc_matchers, test_bm_build);
+    tcase_add_test(tc_matchers, test_roi_build);
+    tcase_add_test(tc_matchers, test_roi_scan);
 #if HAVE_PCRE
     tcase_add_test(tc_matchers, test_pcre_scanbuff);
 #endif
@@ -539,6 +794,8 @@ Suite *test_matchers_suite(void)
 #if HAVE_PCRE
     tcase_add_test(tc_matchers, test_pcre_scanbuff_allscan);
 #endif
+    tcase_add_loop_test(tc_matchers, test_ac_evallsig, 0, sizeof(lsig_exprs)/sizeof(lsig_exprs[0]));
+    tcase_add_test(tc_matchers, test_sigprof);
     return s;
 }
 